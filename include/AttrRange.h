@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include "logengine2/DynamicArrays.h"
+#include "NTFS.h"
+#include "Readers.h"
+
+/**
+* @brief Attributes of one MFT record selected by compile-time mask, e.g. TAttrRange<MakeAttrBitmask(ATTR_FILENAME)>(reader, mftRec).
+* @details Replacement of FillAttrCollection for callers that need one or two attribute types only. Range is walked lazily by range-based for:
+* attributes of the base record go first, then attributes located in extension records listed in ATTR_LIST.
+* Every ATTR_LIST entry is resolved into attribute with the same type and AttrID in extension record loaded by LoadExtRecord,
+* entries that refer to the base record are skipped, so every attribute is returned once and no visited records have to be remembered.
+* Nothing is allocated (except for non-resident ATTR_LIST of very fragmented files, its data is read into buffer owned by the range)
+* and nothing is loaded beyond the attribute returned last, so break out of the loop stops the walk.
+* Returned pointers stay valid while their records stay in records cache, the same as pointers collected by FillAttrCollection.
+* Walk stops at the first error, Result() returns it.
+**/
+template<uint32_t Mask>
+class TAttrRange
+{
+private:
+    TMFTBaseReader& FReader;
+    uint32_t FRecSize;                     // BytesPerMFTRec, attributes are checked against it by AttrInRecord
+    MFT_FILE_RECORD* FBase;
+    MFT_ATTR_HEADER* FAttr;                // next attribute of the base record, nullptr when base record is walked through
+    MFT_ATTR_HEADER* FListAttr{ nullptr }; // ATTR_LIST of the base record, entries are walked after the base record
+    uint8_t* FEntry{ nullptr };            // next ATTR_LIST entry
+    uint8_t* FListEnd{ nullptr };
+    THArray<uint8_t> FListBuf;             // data of non-resident ATTR_LIST
+    TErrorCode FResult{ TErrorCode::Success };
+
+    static bool Selected(ATTR_TYPE attrType) { return (attrType <= ATTR_LOGGED_UTILITY_STREAM) && ((MakeAttrBitmask(attrType) & Mask) != 0); }
+
+    MFT_ATTR_HEADER* Fail(TErrorCode error)
+    {
+        FResult = error;
+        FAttr = nullptr;
+        FListAttr = nullptr;
+        FEntry = nullptr;
+        return nullptr;
+    }
+
+    TErrorCode OpenList()
+    {
+        MFT_ATTR_HEADER* attr = FListAttr;
+        FListAttr = nullptr;
+
+        if (attr->NonResidentFlag == ATTR_FLAG_RESIDENT)
+        {
+            FEntry = Add2Ptr(attr, attr->res.DataOffset);
+            FListEnd = FEntry + attr->res.DataSize;
+            return TErrorCode::Success;
+        }
+
+        // all runs are read into one buffer, entries may cross boundaries of clusters and runs
+        TDataRuns runs;
+        CH_ERR(FReader.DecodeDataRuns(attr, runs)); // DecodeDataRuns writes a message into log file in case of an error
+
+        IRecordsLoader& loader = FReader.GetLoader();
+        uint32_t clusterSize = loader.GetVolumeData().BytesPerCluster;
+        uint64_t clusters = 0;
+        for (uint32_t i = 0; i < runs.Count(); i++) clusters += runs[i].len;
+        if (clusters == 0) return TErrorCode::Success; // empty list, FEntry stays nullptr
+
+        FListBuf.SetCount((uint32_t)(clusters * clusterSize));
+        TIOTagScope tagScope(loader, TIOTag::AttrList);
+
+        uint8_t* data = FListBuf.GetValuePointer(0);
+        for (uint32_t i = 0; i < runs.Count(); i++)
+        {
+            CH_ERR(loader.ReadClusters(runs[i].lcn, runs[i].len, data)); // ReadClusters writes a message into log file in case of an error
+            data += runs[i].len * clusterSize;
+        }
+
+        FEntry = FListBuf.GetValuePointer(0);
+        FListEnd = FEntry + std::min<uint64_t>(attr->nonres.RealSize, FListBuf.Count());
+        return TErrorCode::Success;
+    }
+
+    // attribute referred by ATTR_LIST entry, nullptr (and Success) when extension record does not have it
+    MFT_ATTR_HEADER* FindInExtension(ATTR_LIST_ENTRY* entry)
+    {
+        auto rec = FReader.LoadExtRecord(entry->RecRef);
+        if (!rec) return Fail(rec.error());
+
+        MFT_FILE_RECORD* extRec = (MFT_FILE_RECORD*)rec.value();
+        MFT_ATTR_HEADER* attr = (MFT_ATTR_HEADER*)Add2Ptr(extRec, extRec->FirstAttrOffset);
+        while (AttrInRecord(extRec, attr, FRecSize) && (attr->AttrType != ATTR_END))
+        {
+            if ((attr->AttrType == entry->AttrType) && (attr->AttrID == entry->AttrId)) return attr;
+            attr = (MFT_ATTR_HEADER*)Add2Ptr(attr, attr->AttrSize);
+        }
+
+        GET_LOGGER;
+        logger.WarnFmt("[TAttrRange] Attribute {} (id {}) listed in ATTR_LIST of MFT record {} is not found in MFT record {}.",
+            AttrName(entry->AttrType), entry->AttrId, FBase->IndexMFTRec, entry->RecRef.sId.low);
+        return nullptr;
+    }
+
+    MFT_ATTR_HEADER* Next()
+    {
+        while (FAttr != nullptr)
+        {
+            MFT_ATTR_HEADER* attr = FAttr;
+            if (!AttrInRecord(FBase, attr, FRecSize)) return Fail(TErrorCode::CorruptedData);
+            if (attr->AttrType == ATTR_END)
+            {
+                FAttr = nullptr;
+                break;
+            }
+
+            FAttr = (MFT_ATTR_HEADER*)Add2Ptr(attr, attr->AttrSize);
+            if (attr->AttrType == ATTR_LIST_ATTR)
+                FListAttr = attr;
+            else if (Selected(attr->AttrType))
+                return attr;
+        }
+
+        if (FListAttr != nullptr)
+        {
+            TErrorCode res = OpenList();
+            if (res != TErrorCode::Success) return Fail(res);
+        }
+
+        while ((FEntry != nullptr) && (FEntry + offsetof(ATTR_LIST_ENTRY, name) <= FListEnd))
+        {
+            ATTR_LIST_ENTRY* entry = (ATTR_LIST_ENTRY*)FEntry;
+            if (entry->AttrSize < offsetof(ATTR_LIST_ENTRY, name)) return Fail(TErrorCode::CorruptedData);
+            FEntry += entry->AttrSize;
+
+            // attributes of the base record have been returned already
+            if (!Selected(entry->AttrType) || (entry->RecRef.sId.low == FBase->IndexMFTRec)) continue;
+
+            MFT_ATTR_HEADER* attr = FindInExtension(entry);
+            if (attr != nullptr) return attr;
+            if (FResult != TErrorCode::Success) return nullptr;
+        }
+
+        FEntry = nullptr;
+        return nullptr;
+    }
+
+public:
+    class iterator
+    {
+    private:
+        TAttrRange* FRange;
+        MFT_ATTR_HEADER* FCurr;
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = MFT_ATTR_HEADER*;
+        using difference_type = std::ptrdiff_t;
+
+        iterator(TAttrRange* range, MFT_ATTR_HEADER* curr) : FRange(range), FCurr(curr) {}
+        MFT_ATTR_HEADER* operator*() const { return FCurr; }
+        iterator& operator++() { FCurr = FRange->Next(); return *this; }
+        bool operator==(const iterator& other) const { return FCurr == other.FCurr; }
+    };
+
+    TAttrRange(TMFTBaseReader& reader, MFT_FILE_RECORD* mftRec) : FReader(reader), FRecSize(reader.GetLoader().GetVolumeData().BytesPerMFTRec), FBase(mftRec),
+        FAttr((MFT_ATTR_HEADER*)Add2Ptr(mftRec, mftRec->FirstAttrOffset)) {}
+    TAttrRange(const TAttrRange&) = delete;
+
+    // range is walked once, begin() starts the walk
+    iterator begin() { return iterator(this, Next()); }
+    iterator end() { return iterator(this, nullptr); }
+
+    // first selected attribute, nullptr when there is no such attribute or error has occurred
+    MFT_ATTR_HEADER* First() { return Next(); }
+
+    TErrorCode Result() const { return FResult; }
+};
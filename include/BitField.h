@@ -2,6 +2,7 @@
 
 #include "Debug.h"
 #include <cassert>
+#include <bit>
 #include <cstdlib>
 #include <stdexcept>
 
@@ -87,7 +88,7 @@ public:
     }
 
     // true if bit=1, false if bit=0
-    bool Test(uint64_t bitIndex)
+    bool Test(uint64_t bitIndex) const
     {
         if (bitIndex >= FBitsCount) throw std::runtime_error("Index out of bounds");
 
@@ -106,6 +107,40 @@ public:
         FBits[wordIndex] |= (1ull << (bitIndex & DWORD_MASK));
     }
 
+    // index of the first bit set to 1 starting from bitIndex, -1 if there is no such bit. scans by whole words.
+    int64_t NextSetBit(uint64_t bitIndex) const
+    {
+        if (bitIndex >= FBitsCount) return -1;
+
+        uint64_t wordIndex = bitIndex >> DWORD_2POWER;
+        uint64_t word = FBits[wordIndex] & (~0ull << (bitIndex & DWORD_MASK)); // drop bits below bitIndex
+
+        while (word == 0)
+        {
+            if (++wordIndex >= FCount) return -1;
+            word = FBits[wordIndex];
+        }
+
+        return (int64_t)((wordIndex << DWORD_2POWER) + std::countr_zero(word));
+    }
+
+    // index of the first bit set to 0 starting from bitIndex, BitsCount() if there is no such bit. scans by whole words.
+    int64_t NextClearBit(uint64_t bitIndex) const
+    {
+        if (bitIndex >= FBitsCount) return (int64_t)FBitsCount;
+
+        uint64_t wordIndex = bitIndex >> DWORD_2POWER;
+        uint64_t word = ~FBits[wordIndex] & (~0ull << (bitIndex & DWORD_MASK));
+
+        while (word == 0)
+        {
+            if (++wordIndex >= FCount) return (int64_t)FBitsCount;
+            word = ~FBits[wordIndex];
+        }
+
+        return (int64_t)((wordIndex << DWORD_2POWER) + std::countr_zero(word));
+    }
+
     int64_t LastBit()
     {
         if (FBitsCount == 0) return -1;
@@ -2,25 +2,481 @@
 
 #include "Debug.h"
 #include <cstdint>
+#include <malloc.h>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <algorithm>
 #include "logengine2/DynamicArrays.h"
 #include "NTFS.h"
 #include "Functions.h" // for TErrorCode
+#include "BitField.h"
 
 
 
+constexpr uint64_t DEFAULT_REC_CACHE_BUDGET = 64ull * 1024 * 1024; // default memory limit for TMFTRecCache, 64Mb
+constexpr uint64_t DEFAULT_CLUSTER_CACHE_BUDGET = 16ull * 1024 * 1024; // default memory limit for TClusterCache, 16Mb
+
+/**
+* @brief Bounded cache of fixed size records (MFT records, clusters) with LRU eviction.
+* @details Cache is bounded by byte budget: when it is full, least recently used record is evicted and its memory is reused for the new one.
+* Records are spread over SHARDS_COUNT shards by key, each shard has its own lock, hash index and LRU list, 
+* lookup, insert and eviction are O(1). Memory for records of a shard is allocated by one piece on first insert into the shard.
+* Pointer returned by GetRec/AddRec stays valid until the record is evicted, that is at least until 
+* Capacity()/SHARDS_COUNT more records are added, so it must not be kept for long.
+* Use CopyRec when other threads may add records at the same time.
+* Budget 0 means that cache is disabled: Enabled() returns false and callers must not add records (one slot per shard is still set up).
+**/
+template <typename KeyType>
+class TLRUCache
+{
+private:
+    static constexpr uint32_t SHARDS_COUNT = 16; // must be power of 2
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    struct LRU_SLOT
+    {
+        KeyType Key;
+        uint32_t Prev; // towards most recently used
+        uint32_t Next; // towards least recently used
+    };
+
+    struct SHARD
+    {
+        std::mutex Lock;
+        std::unordered_map<KeyType, uint32_t> Index; // key -> slot
+        THArray<LRU_SLOT> Slots;
+        uint8_t* Data{ nullptr }; // FShardCapacity records
+        uint32_t Head{ NO_SLOT }; // most recently used
+        uint32_t Tail{ NO_SLOT }; // least recently used
+        uint64_t Hits{ 0 };
+        uint64_t Misses{ 0 };
+        uint64_t Evictions{ 0 };
+    };
+
+    SHARD FShards[SHARDS_COUNT];
+    uint32_t FRecordSize{ 0 };
+    uint32_t FShardCapacity{ 0 }; // in records
+    uint64_t FBudget;
+
+    SHARD& GetShard(KeyType key) { return FShards[(uint32_t)key & (SHARDS_COUNT - 1)]; }
+
+    static void Unlink(SHARD& shard, uint32_t slot)
+    {
+        LRU_SLOT& s = shard.Slots[slot];
+        if (s.Prev != NO_SLOT) shard.Slots[s.Prev].Next = s.Next; else shard.Head = s.Next;
+        if (s.Next != NO_SLOT) shard.Slots[s.Next].Prev = s.Prev; else shard.Tail = s.Prev;
+    }
+
+    static void LinkFront(SHARD& shard, uint32_t slot)
+    {
+        LRU_SLOT& s = shard.Slots[slot];
+        s.Prev = NO_SLOT;
+        s.Next = shard.Head;
+        if (shard.Head != NO_SLOT) shard.Slots[shard.Head].Prev = slot; else shard.Tail = slot;
+        shard.Head = slot;
+    }
+
+    void FreeShards()
+    {
+        for (auto& shard : FShards)
+        {
+            delete[] shard.Data;
+            shard.Data = nullptr;
+            shard.Index.clear();
+            shard.Slots.Clear();
+            shard.Head = shard.Tail = NO_SLOT;
+        }
+    }
+public:
+    TLRUCache(uint64_t budget) : FBudget(budget) {}
+    TLRUCache(const TLRUCache&) = delete;
+    ~TLRUCache() { FreeShards(); }
+
+    // must be called before first AddRec, clears the cache. 
+    // budget is rounded down to whole number of records per shard, but at least one record per shard is kept.
+    void Init(uint32_t recordSize, uint64_t budget)
+    {
+        assert(recordSize > 0);
+        Clear();
+        FRecordSize = recordSize;
+        FBudget = budget;
+        FShardCapacity = (uint32_t)std::max<uint64_t>(1, budget / recordSize / SHARDS_COUNT);
+    }
+
+    bool Enabled() const { return FBudget > 0; }
+    bool Initialized() const { return FRecordSize > 0; }
+    uint32_t RecordSize() const { return FRecordSize; }
+    uint64_t Budget() const { return FBudget; }
+    uint64_t Capacity() const { return (uint64_t)FShardCapacity * SHARDS_COUNT; } // in records
+
+    // returns nullptr if record is not in cache. found record becomes most recently used.
+    uint8_t* GetRec(KeyType key)
+    {
+        SHARD& shard = GetShard(key);
+        std::lock_guard lock(shard.Lock);
+
+        auto it = shard.Index.find(key);
+        if (it == shard.Index.end())
+        {
+            shard.Misses++;
+            return nullptr;
+        }
+
+        shard.Hits++;
+        uint32_t slot = it->second;
+        if (slot != shard.Head)
+        {
+            Unlink(shard, slot);
+            LinkFront(shard, slot);
+        }
+
+        return shard.Data + (uint64_t)slot * FRecordSize;
+    }
+
+    // copies record into dataBuf under the lock, returns false if record is not in cache. found record becomes most recently used.
+    bool CopyRec(KeyType key, uint8_t* dataBuf)
+    {
+        SHARD& shard = GetShard(key);
+        std::lock_guard lock(shard.Lock);
+
+        auto it = shard.Index.find(key);
+        if (it == shard.Index.end())
+        {
+            shard.Misses++;
+            return false;
+        }
+
+        shard.Hits++;
+        uint32_t slot = it->second;
+        if (slot != shard.Head)
+        {
+            Unlink(shard, slot);
+            LinkFront(shard, slot);
+        }
+
+        memcpy(dataBuf, shard.Data + (uint64_t)slot * FRecordSize, FRecordSize);
+        return true;
+    }
+
+    // does not change LRU order and counters
+    bool Contains(KeyType key)
+    {
+        SHARD& shard = GetShard(key);
+        std::lock_guard lock(shard.Lock);
+        return shard.Index.find(key) != shard.Index.end();
+    }
+
+    // copies record recData into the cache, evicts least recently used record of the shard if shard is full.
+    // returns pointer to the copy. if record is already in cache its data is not changed.
+    uint8_t* AddRec(KeyType key, const uint8_t* recData)
+    {
+        assert(Initialized());
+
+        SHARD& shard = GetShard(key);
+        std::lock_guard lock(shard.Lock);
+
+        auto it = shard.Index.find(key);
+        if (it != shard.Index.end()) // another thread has added the same record
+            return shard.Data + (uint64_t)it->second * FRecordSize;
+
+        if (shard.Data == nullptr)
+        {
+            shard.Data = DBG_NEW uint8_t[(uint64_t)FShardCapacity * FRecordSize];
+            shard.Slots.SetCapacity(FShardCapacity);
+            shard.Index.reserve(FShardCapacity);
+        }
+
+        uint32_t slot;
+        if (shard.Slots.Count() < FShardCapacity)
+        {
+            slot = shard.Slots.AddValue({ key, NO_SLOT, NO_SLOT });
+        }
+        else // shard is full, reuse the least recently used slot
+        {
+            slot = shard.Tail;
+            Unlink(shard, slot);
+            shard.Index.erase(shard.Slots[slot].Key);
+            shard.Slots[slot].Key = key;
+            shard.Evictions++;
+        }
+
+        LinkFront(shard, slot);
+        shard.Index.emplace(key, slot);
+
+        uint8_t* rec = shard.Data + (uint64_t)slot * FRecordSize;
+        memcpy(rec, recData, FRecordSize);
+        return rec;
+    }
+
+    // frees memory and resets counters, must be called when no other thread uses the cache
+    void Clear()
+    {
+        FreeShards();
+        for (auto& shard : FShards) shard.Hits = shard.Misses = shard.Evictions = 0;
+    }
+
+    uint32_t Count()
+    {
+        uint32_t cnt = 0;
+        for (auto& shard : FShards)
+        {
+            std::lock_guard lock(shard.Lock);
+            cnt += (uint32_t)shard.Index.size();
+        }
+        return cnt;
+    }
+
+    uint64_t Hits()      { uint64_t cnt = 0; for (auto& shard : FShards) { std::lock_guard lock(shard.Lock); cnt += shard.Hits; } return cnt; }
+    uint64_t Misses()    { uint64_t cnt = 0; for (auto& shard : FShards) { std::lock_guard lock(shard.Lock); cnt += shard.Misses; } return cnt; }
+    uint64_t Evictions() { uint64_t cnt = 0; for (auto& shard : FShards) { std::lock_guard lock(shard.Lock); cnt += shard.Evictions; } return cnt; }
+};
+
+// MFT records cache used by LoadMFTRecordCache, keyed by MFT record ID
+class TMFTRecCache : public TLRUCache<MFTRecIndex>
+{
+public:
+    TMFTRecCache() : TLRUCache(DEFAULT_REC_CACHE_BUDGET) {}
+};
+
+// clusters cache used by IRecordsLoader::ReadClusters, keyed by LCN
+class TClusterCache : public TLRUCache<uint64_t>
+{
+public:
+    TClusterCache() : TLRUCache(DEFAULT_CLUSTER_CACHE_BUDGET) {}
+};
+
+constexpr uint32_t DEFAULT_SLAB_PAGE_RECS = 256; // number of MFT records in one page of TMFTRecSlab, 256Kb pages for 1Kb records
+
+/**
+* @brief Direct-indexed storage of MFT records.
+* @details MFT record IDs are dense integers, so record is found by its ID without any hash or search: 
+* page index is ID / RecsPerPage, position in page is ID % RecsPerPage. Page is a contiguous block of RecsPerPage records,
+* neighbouring records share cache lines and the whole page can be filled by one read. Pages are allocated on first use.
+* Bit in presence bitmap is set for each record that holds valid data. Records are never evicted, 
+* pointers returned by GetRec/AddRec/AcquirePage stay valid until Clear() or Init().
+* Not thread-safe for writing, concurrent GetRec calls are safe once all records are added.
+**/
+class TMFTRecSlab
+{
+private:
+    THArray<uint8_t*> FPages; // nullptr for pages that have not been allocated yet
+    TBitField FPresent;       // bit is set when record contains valid data
+    uint32_t FRecordSize{ 0 };
+    uint32_t FRecsPerPage{ 0 };
+    uint64_t FRecordsCount{ 0 };
+    uint64_t FPresentCount{ 0 };
+
+    void FreePages()
+    {
+        for (auto page : FPages) delete[] page;
+        FPages.Clear();
+    }
+public:
+    TMFTRecSlab() {}
+    TMFTRecSlab(const TMFTRecSlab&) = delete;
+    ~TMFTRecSlab() { FreePages(); }
+
+    // prepares storage for recordsCount records, no memory for records is allocated here
+    void Init(uint32_t recordSize, uint64_t recordsCount, uint32_t recsPerPage = DEFAULT_SLAB_PAGE_RECS)
+    {
+        assert(recordSize > 0);
+        assert(recsPerPage > 0);
+
+        FreePages();
+        FRecordSize = recordSize;
+        FRecsPerPage = recsPerPage;
+        FRecordsCount = recordsCount;
+        FPresentCount = 0;
+
+        FPages.AddFillValues((uint32_t)PagesCount()); // filled by nullptr
+        FPresent.SetData((uint32_t)((recordsCount + TBitField::DWORD_MASK) >> TBitField::DWORD_2POWER), false);
+    }
+
+    void Clear() { FreePages(); FPresent.SetData(0u, false); FRecordsCount = 0; FPresentCount = 0; }
+
+    uint32_t RecordSize() const { return FRecordSize; }
+    uint32_t RecsPerPage() const { return FRecsPerPage; }
+    uint64_t RecordsCount() const { return FRecordsCount; }
+    uint64_t PresentCount() const { return FPresentCount; } // number of records with valid data
+    uint64_t PagesCount() const { return (FRecsPerPage == 0) ? 0 : (FRecordsCount + FRecsPerPage - 1) / FRecsPerPage; }
+    uint64_t PageSize() const { return (uint64_t)FRecsPerPage * FRecordSize; }
+    uint64_t MemSize() const { uint64_t cnt = 0; for (auto page : FPages) if (page) cnt++; return cnt * PageSize(); }
+
+    bool Test(MFTRecIndex mftRecID) { return (mftRecID < FRecordsCount) && FPresent.Test(mftRecID); }
+
+    // returns nullptr if record is not present
+    uint8_t* GetRec(MFTRecIndex mftRecID)
+    {
+        if (!Test(mftRecID)) return nullptr;
+        return FPages[mftRecID / FRecsPerPage] + (uint64_t)(mftRecID % FRecsPerPage) * FRecordSize;
+    }
+
+    // returns memory of page pageIndex, allocates the page if needed. Used for filling the whole page by one read,
+    // after that SetPresent must be called for each valid record of the page.
+    uint8_t* AcquirePage(uint32_t pageIndex)
+    {
+        assert(pageIndex < FPages.Count());
+        uint8_t*& page = FPages[pageIndex];
+        if (page == nullptr) page = DBG_NEW uint8_t[PageSize()];
+        return page;
+    }
+
+    void SetPresent(MFTRecIndex mftRecID)
+    {
+        assert(mftRecID < FRecordsCount);
+        assert(FPages[mftRecID / FRecsPerPage] != nullptr);
+        if (!FPresent.Test(mftRecID)) FPresentCount++;
+        FPresent.SetTrue(mftRecID);
+    }
+
+    // copies mftRecData into the slab and marks record as present. returns pointer to the copy.
+    uint8_t* AddRec(MFTRecIndex mftRecID, const uint8_t* mftRecData)
+    {
+        assert(mftRecID < FRecordsCount);
+        uint8_t* rec = AcquirePage(mftRecID / FRecsPerPage) + (uint64_t)(mftRecID % FRecsPerPage) * FRecordSize;
+        memcpy(rec, mftRecData, FRecordSize);
+        SetPresent(mftRecID);
+        return rec;
+    }
+};
+
+constexpr uint32_t DEFAULT_IO_ALIGNMENT = 4096; // alignment for unbuffered I/O, multiple of any sector size in use
+constexpr uint32_t DEFAULT_ALIGNED_BUF_SIZE = 1024 * 1024; // size of buffers in TAlignedBufferPool
+
+/**
+* @brief Pool of equally sized memory buffers aligned to Alignment bytes.
+* @details Unbuffered reads (FILE_FLAG_NO_BUFFERING) need buffer address aligned to device sector size.
+* Buffers are allocated on first Acquire() and are reused after Release(), so long scans make no allocations.
+* Acquire() and Release() are thread-safe. All buffers must be released before Clear() or Init().
+**/
+class TAlignedBufferPool
+{
+private:
+    THArray<uint8_t*> FFree;
+    std::mutex FLock;
+    uint32_t FBufSize{ 0 };
+    uint32_t FAlignment{ DEFAULT_IO_ALIGNMENT };
+    uint32_t FAllocated{ 0 }; // number of buffers allocated by the pool, free and acquired
+public:
+    TAlignedBufferPool() {}
+    TAlignedBufferPool(const TAlignedBufferPool&) = delete;
+    ~TAlignedBufferPool() { Clear(); }
+
+    // bufSize is rounded up to alignment, alignment must be power of 2
+    void Init(uint32_t bufSize, uint32_t alignment)
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+        Clear();
+        FAlignment = alignment;
+        FBufSize = (bufSize + alignment - 1) & ~(alignment - 1);
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(FLock);
+        assert(FFree.Count() == FAllocated); // acquired buffers would leak
+        for (auto buf : FFree) _aligned_free(buf);
+        FFree.Clear();
+        FAllocated = 0;
+    }
+
+    uint32_t BufSize() const { return FBufSize; }
+    uint32_t Alignment() const { return FAlignment; }
+    uint32_t Allocated() const { return FAllocated; }
+
+    // returns nullptr when memory cannot be allocated
+    uint8_t* Acquire()
+    {
+        assert(FBufSize > 0);
+
+        std::lock_guard<std::mutex> lock(FLock);
+        if (FFree.Count() > 0) return FFree.Pop();
+
+        uint8_t* buf = (uint8_t*)_aligned_malloc(FBufSize, FAlignment);
+        if (buf != nullptr) FAllocated++;
+        return buf;
+    }
+
+    void Release(uint8_t* buf)
+    {
+        assert(buf != nullptr);
+
+        std::lock_guard<std::mutex> lock(FLock);
+        FFree.AddValue(buf);
+    }
+};
+
 /**
-* @brief This class stores MFT records in memory and gets them by MFT Rec ID
-* @details It is used by LoadMFTRecordCache to prevent loading the same record from disk several times.
-* The difference from standard THash is that TMFTRecCache frees MFT records memory in its destructor.
-* MFT record is defined as uint8_t* type 
-* MFT rec ID is defined as MFTRecIndex type which is equivalent to uint32_t
+* @brief Unbounded thread-safe cache of MFT records.
+* @details Unlike TMFTRecCache it never evicts records, so pointers to records can be kept by several threads for long time.
+* Records are spread over SHARDS_COUNT shards by MFT Rec ID, every shard has its own hash and reader-writer lock, 
+* so threads that look up different records almost never wait for each other. Records are never removed till Clear(), 
+* so pointers returned by GetRec/AddRec stay valid without holding a lock.
 **/
-class TMFTRecCache : public THash<MFTRecIndex, uint8_t*>
+class TConcurrentMFTRecCache
 {
+private:
+    static constexpr uint32_t SHARDS_COUNT = 64; // must be power of 2
+
+    struct SHARD
+    {
+        std::shared_mutex Lock;
+        THash<MFTRecIndex, uint8_t*> Recs;
+    };
+
+    SHARD FShards[SHARDS_COUNT];
+
+    SHARD& GetShard(MFTRecIndex mftRecID) { return FShards[mftRecID & (SHARDS_COUNT - 1)]; }
 public:
-    ~TMFTRecCache() override
+    ~TConcurrentMFTRecCache() { Clear(); }
+
+    // returns nullptr if record is not in cache
+    uint8_t* GetRec(MFTRecIndex mftRecID)
+    {
+        SHARD& shard = GetShard(mftRecID);
+        std::shared_lock lock(shard.Lock);
+        uint8_t** rec = shard.Recs.GetValuePointer(mftRecID);
+        return (rec == nullptr) ? nullptr : *rec;
+    }
+
+    // takes ownership of mftRecData (allocated by new[]). if another thread has already added the same record 
+    // mftRecData is freed and record from cache is returned
+    uint8_t* AddRec(MFTRecIndex mftRecID, uint8_t* mftRecData)
+    {
+        SHARD& shard = GetShard(mftRecID);
+        std::unique_lock lock(shard.Lock);
+        uint8_t** rec = shard.Recs.GetValuePointer(mftRecID);
+        if (rec != nullptr)
+        {
+            delete[] mftRecData;
+            return *rec;
+        }
+
+        shard.Recs.SetValue(mftRecID, mftRecData);
+        return mftRecData;
+    }
+
+    uint32_t Count()
+    {
+        uint32_t cnt = 0;
+        for (auto& shard : FShards)
+        {
+            std::shared_lock lock(shard.Lock);
+            cnt += shard.Recs.Count();
+        }
+        return cnt;
+    }
+
+    // not thread-safe, must be called when no other thread uses the cache
+    void Clear()
     {
-        for (uint32_t i = 0; i < FAValues.Count(); i++) delete[] FAValues[i];
+        for (auto& shard : FShards)
+        {
+            for (auto rec : shard.Recs.GetValues()) delete[] rec;
+            shard.Recs.Clear();
+        }
     }
 };
 
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include "logengine2/DynamicArrays.h"
+#include "Functions.h" // for TErrorCode
+
+constexpr uint32_t VHD_SECTOR_SIZE = 512;
+constexpr uint32_t VHD_FOOTER_SIZE = 512;
+constexpr uint64_t VHDX_HEADER1_OFFSET = 64 * 1024;
+constexpr uint64_t VHDX_HEADER2_OFFSET = 128 * 1024;
+constexpr uint64_t VHDX_REGION_TABLE1_OFFSET = 192 * 1024;
+constexpr uint64_t VHDX_REGION_TABLE2_OFFSET = 256 * 1024;
+constexpr uint32_t VHDX_HEADER_SIZE = 4 * 1024;
+constexpr uint32_t VHDX_REGION_TABLE_SIZE = 64 * 1024;
+constexpr uint64_t VHDX_MB = 1024 * 1024;
+
+enum class TDiskFormat
+{
+    Raw,        // plain disk or partition image
+    FixedVHD,   // raw image followed by VHD footer
+    DynamicVHD, // VHD with dynamic header and block allocation table
+    VHDX
+};
+
+const char_t* DiskFormatName(TDiskFormat format);
+
+#pragma pack(push, 1)
+// all fields are big-endian
+struct VHD_FOOTER
+{
+    char Cookie[8]; // "conectix"
+    uint32_t Features;
+    uint32_t FileFormatVersion;
+    uint64_t DataOffset; // offset of dynamic header, UINT64_MAX for fixed disks
+    uint32_t TimeStamp;
+    uint32_t CreatorApp;
+    uint32_t CreatorVersion;
+    uint32_t CreatorHostOS;
+    uint64_t OriginalSize;
+    uint64_t CurrentSize; // size of virtual disk in bytes
+    uint32_t DiskGeometry;
+    uint32_t DiskType;    // 2 - fixed, 3 - dynamic, 4 - differencing
+    uint32_t Checksum;
+    uint8_t UniqueId[16];
+    uint8_t SavedState;
+    uint8_t Reserved[427];
+};
+
+// all fields are big-endian
+struct VHD_DYNAMIC_HEADER
+{
+    char Cookie[8]; // "cxsparse"
+    uint64_t DataOffset;
+    uint64_t TableOffset;  // offset of block allocation table
+    uint32_t HeaderVersion;
+    uint32_t MaxTableEntries;
+    uint32_t BlockSize;    // data bytes in block, sector bitmap of the block is stored before the data
+    uint32_t Checksum;
+    uint8_t ParentUniqueId[16];
+    uint32_t ParentTimeStamp;
+    uint32_t Reserved1;
+    uint8_t ParentUnicodeName[512];
+    uint8_t ParentLocators[8 * 24];
+    uint8_t Reserved2[256];
+};
+
+struct VHDX_HEADER
+{
+    uint32_t Signature; // "head"
+    uint32_t Checksum;  // CRC-32C of VHDX_HEADER_SIZE bytes with this field set to 0
+    uint64_t SequenceNumber; // header with larger sequence number is the current one
+    GUID FileWriteGuid;
+    GUID DataWriteGuid;
+    GUID LogGuid; // not zero when log has entries that must be replayed
+    uint16_t LogVersion;
+    uint16_t Version;
+    uint32_t LogLength;
+    uint64_t LogOffset;
+};
+
+struct VHDX_REGION_TABLE_HEADER
+{
+    uint32_t Signature; // "regi"
+    uint32_t Checksum;  // CRC-32C of VHDX_REGION_TABLE_SIZE bytes with this field set to 0
+    uint32_t EntryCount;
+    uint32_t Reserved;
+};
+
+struct VHDX_REGION_TABLE_ENTRY
+{
+    GUID Guid;
+    uint64_t FileOffset;
+    uint32_t Length;
+    uint32_t Required;
+};
+
+struct VHDX_METADATA_TABLE_HEADER
+{
+    char Signature[8]; // "metadata"
+    uint16_t Reserved;
+    uint16_t EntryCount;
+    uint32_t Reserved2[5];
+};
+
+struct VHDX_METADATA_TABLE_ENTRY
+{
+    GUID ItemId;
+    uint32_t Offset; // from the beginning of metadata region
+    uint32_t Length;
+    uint32_t Flags;
+    uint32_t Reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VHD_FOOTER) == VHD_FOOTER_SIZE);
+static_assert(sizeof(VHD_DYNAMIC_HEADER) == 1024);
+static_assert(sizeof(VHDX_METADATA_TABLE_ENTRY) == 32);
+
+/**
+* @brief Maps offsets of virtual disk into offsets of the image file for raw, VHD and VHDX disk images.
+* @details Format is detected by Open(). Block allocation table of dynamic VHD and VHDX is read once and kept in memory
+* as file offsets of blocks, so every read is a table lookup plus positional read of the image file.
+* Blocks that are not allocated in the image (and VHDX blocks in ZERO and UNMAPPED states) are served as zeros without any I/O.
+* Reads are positional (offset is passed with every read), so they can be made from several threads at the same time.
+* Differencing disks and VHDX files with not replayed log are not supported, Open() throws std::runtime_error for them.
+**/
+class TDiskContainer
+{
+private:
+    static constexpr uint64_t ZERO_BLOCK = UINT64_MAX;
+
+    HANDLE FHFile{ INVALID_HANDLE_VALUE }; // not owned
+    TDiskFormat FFormat{ TDiskFormat::Raw };
+    uint64_t FDiskSize{ 0 };
+    uint32_t FBlockSize{ 0 };
+    uint32_t FSectorSize{ 0 }; // logical sector size of virtual disk, 0 when format does not store it (raw images)
+    THArray<uint64_t> FBlocks; // file offset of data of every block, ZERO_BLOCK when block is not allocated
+    uint64_t FAllocatedBlocks{ 0 };
+    std::atomic<uint64_t> FZeroBytes{ 0 }; // bytes served as zeros from not allocated blocks
+
+    TErrorCode ReadAt(uint64_t fileOffset, uint8_t* dataBuf, uint64_t size);
+    void ReadMeta(uint64_t fileOffset, void* dataBuf, uint32_t size); // throws when read fails
+    bool CheckRange(uint64_t offset, uint64_t size) const; // logs reads outside of virtual disk
+    bool TryOpenVHDX(uint64_t fileSize);
+    bool TryOpenVHD(uint64_t fileSize);
+    void ReadVHDXMetadata(const VHDX_REGION_TABLE_ENTRY& region, uint32_t& logicalSectorSize, bool& hasParent);
+public:
+    TDiskContainer() {}
+    TDiskContainer(const TDiskContainer&) = delete;
+
+    // detects format of image file opened as hFile and reads block allocation table. hFile must stay open till Close()
+    void Open(HANDLE hFile);
+    void Close();
+
+    bool IsOpened() const { return FHFile != INVALID_HANDLE_VALUE; }
+    TDiskFormat GetFormat() const { return FFormat; }
+    // true when offsets of virtual disk are offsets of the image file: raw images and fixed VHD
+    bool IsFlat() const { return (FFormat == TDiskFormat::Raw) || (FFormat == TDiskFormat::FixedVHD); }
+    uint64_t GetDiskSize() const { return FDiskSize; }
+    uint32_t GetBlockSize() const { return FBlockSize; }
+    // logical sector size of virtual disk (512 for VHD, from metadata for VHDX), 0 when it is not known (raw images)
+    uint32_t GetSectorSize() const { return FSectorSize; }
+    uint64_t GetBlocksCount() const { return FBlocks.Count(); }
+    uint64_t GetAllocatedBlocks() const { return FAllocatedBlocks; }
+    uint64_t GetZeroBytes() const { return FZeroBytes.load(std::memory_order_relaxed); }
+
+    // reads size bytes of virtual disk starting from offset. IOError when read goes beyond the end of virtual disk or image file
+    TErrorCode Read(uint64_t offset, uint8_t* dataBuf, uint64_t size);
+
+    // the same as Read but allocated data is read by readAt(fileOffset, dataBuf, size), so loaders that have their own I/O
+    // (overlapped handle, unbuffered reads, file mapping) keep it for VHD and VHDX images
+    template<class TReadAt>
+    TErrorCode ReadVia(uint64_t offset, uint8_t* dataBuf, uint64_t size, TReadAt&& readAt);
+};
+
+template<class TReadAt>
+TErrorCode TDiskContainer::ReadVia(uint64_t offset, uint8_t* dataBuf, uint64_t size, TReadAt&& readAt)
+{
+    if (!CheckRange(offset, size)) return TErrorCode::IOError;
+
+    if (IsFlat()) return readAt(offset, dataBuf, size);
+
+    // read is split by blocks, adjacent blocks are usually not adjacent in the image file
+    while (size > 0)
+    {
+        uint64_t block = offset / FBlockSize;
+        uint64_t inBlock = offset % FBlockSize;
+        uint64_t len = std::min<uint64_t>(size, FBlockSize - inBlock);
+
+        uint64_t blockOffset = FBlocks[(uint32_t)block];
+        if (blockOffset == ZERO_BLOCK)
+        {
+            memset(dataBuf, 0, len);
+            FZeroBytes.fetch_add(len, std::memory_order_relaxed);
+        }
+        else
+        {
+            CH_ERR(readAt(blockOffset + inBlock, dataBuf, len));
+        }
+
+        offset += len;
+        dataBuf += len;
+        size -= len;
+    }
+
+    return TErrorCode::Success;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include "logengine2/DynamicArrays.h"
+#include "NTFS.h"
+#include "Functions.h" // for TDataRuns
+
+// one contiguous piece of $MFT file on disk
+struct MFT_EXTENT
+{
+    uint64_t FirstRecID; // ID of the first MFT record located in this extent
+    uint64_t Lcn;        // first LCN of the extent
+};
+
+/**
+* @brief Maps MFT record IDs into offsets on disk for fragmented $MFT file.
+* @details Built once from $MFT Data Runs. Keeps prefix sums of MFT records count over all extents,
+* so lookup is a binary search, O(log extents). Index of the extent found by previous lookup is remembered,
+* sequential access to MFT records (in the same or in the next extent) is O(1).
+* Data Runs are taken into account till the first run which length is not divisible by MFT record size,
+* all MFT records starting from that run are considered as out of MFT bounds.
+* Can be shared by any loader that needs to calculate MFT records offsets. Lookups are safe to make from several threads.
+**/
+class TMFTExtentMap
+{
+private:
+    THArray<MFT_EXTENT> FExtents; // sorted by FirstRecID, last item is a sentinel where FirstRecID is total number of MFT records
+    uint32_t FBytesPerCluster{ 0 };
+    uint32_t FBytesPerMFTRec{ 0 };
+    mutable std::atomic<uint32_t> FLastHit{ 0 }; // index of extent found by previous lookup, only a hint, so relaxed access is enough for concurrent lookups
+public:
+    TMFTExtentMap() {}
+    TMFTExtentMap(const TDataRuns& runs, uint32_t BytesPerCluster, uint32_t BytesPerMFTRec) { Build(runs, BytesPerCluster, BytesPerMFTRec); }
+
+    void Build(const TDataRuns& runs, uint32_t BytesPerCluster, uint32_t BytesPerMFTRec)
+    {
+        assert(BytesPerCluster > 0);
+        assert(BytesPerMFTRec > 0);
+
+        Clear();
+        FBytesPerCluster = BytesPerCluster;
+        FBytesPerMFTRec = BytesPerMFTRec;
+        FExtents.SetCapacity(runs.Count() + 1);
+
+        uint64_t recID = 0;
+        for (uint i = 0; i < runs.Count(); i++)
+        {
+            DATA_RUN_ITEM& rli = runs[i];
+            assert(rli.len > 0ul);
+
+            uint64_t runBytes = rli.len * BytesPerCluster;
+            if ((runBytes % BytesPerMFTRec) != 0) break; // we've met len that is not divisible by BytesPerMFTRec
+
+            FExtents.AddValue({ recID, rli.lcn });
+            recID += runBytes / BytesPerMFTRec;
+        }
+
+        if (FExtents.Count() > 0)
+            FExtents.AddValue({ recID, 0 }); // sentinel
+    }
+
+    void Clear() { FExtents.Clear(); FLastHit.store(0, std::memory_order_relaxed); }
+
+    // number of extents
+    uint32_t Count() const { return FExtents.Count() == 0 ? 0 : FExtents.Count() - 1; }
+
+    // total number of MFT records in all extents
+    uint64_t RecordsCount() const { return FExtents.Count() == 0 ? 0 : FExtents.Last().FirstRecID; }
+
+    const MFT_EXTENT& GetExtent(uint32_t index) const { assert(index < Count()); return FExtents[index]; }
+    uint64_t ExtentRecsCount(uint32_t index) const { assert(index < Count()); return FExtents[index + 1].FirstRecID - FExtents[index].FirstRecID; }
+    uint64_t ExtentClustersCount(uint32_t index) const { return ExtentRecsCount(index) * FBytesPerMFTRec / FBytesPerCluster; }
+
+    // returns index of the extent that contains MFT record MFTRecID, or -1 if MFTRecID is out of MFT bounds
+    int64_t FindExtent(MFTRecIndex MFTRecID) const
+    {
+        if (MFTRecID >= RecordsCount()) return -1;
+
+        uint32_t cnt = Count();
+        const MFT_EXTENT* ext = FExtents.GetValuePointer(0);
+
+        // fast path for sequential access: the same extent or the next one
+        uint32_t hit = FLastHit.load(std::memory_order_relaxed);
+        if ((hit < cnt) && (MFTRecID >= ext[hit].FirstRecID))
+        {
+            if (MFTRecID < ext[hit + 1].FirstRecID) return hit;
+            if ((hit + 1 < cnt) && (MFTRecID < ext[hit + 2].FirstRecID))
+            {
+                FLastHit.store(hit + 1, std::memory_order_relaxed);
+                return hit + 1;
+            }
+        }
+
+        // first extent which FirstRecID is greater than MFTRecID, sentinel is included into the search range
+        auto it = std::upper_bound(ext, ext + cnt + 1, (uint64_t)MFTRecID, [](uint64_t id, const MFT_EXTENT& e) { return id < e.FirstRecID; });
+        assert(it != ext);
+        hit = (uint32_t)(it - ext) - 1;
+        assert(hit < cnt);
+
+        FLastHit.store(hit, std::memory_order_relaxed);
+        return hit;
+    }
+
+    // offset of MFT record from the beginning of NTFS partition, -1 if MFTRecID is out of MFT bounds
+    int64_t RecIdToOffset(MFTRecIndex MFTRecID) const
+    {
+        int64_t index = FindExtent(MFTRecID);
+        if (index == -1) return -1;
+
+        const MFT_EXTENT& ext = FExtents[(uint)index];
+        return ext.Lcn * FBytesPerCluster + (MFTRecID - ext.FirstRecID) * FBytesPerMFTRec;
+    }
+};
@@ -2,6 +2,8 @@
 
 #include <functional>
 #include <optional>
+#include <memory>
+#include <vector>
 #include <windows.h>
 #include <winioctl.h>
 
@@ -27,6 +29,7 @@ const size_t ATTR_LINE_LEN = MFT_LINE_LEN - 6;
 //#define MFT_LOGGER_NAME_LIST "mftlist"
 
 constexpr uint32_t DEFAULT_BYTES_PER_MFT_REC = 1024;
+constexpr uint32_t DEFAULT_BYTES_PER_CLUSTER = 4096;
 
 #define GET_LOGGER auto& logger = LogEngine::GetLogger(MFT_LOGGER_NAME)
 #define GET_LOGGER_FUNC auto& logger = GetLoggerFunc()
@@ -199,6 +202,14 @@ typedef THArray<ITEM_INFO> TItemInfoList;
 typedef std::function<void(const ATTR_FILE_NAME*, const MFT_REF&)> AddFileAttrPred;
 typedef std::function<TErrorCode(const MFT_REF&)> AttrListPred;
 typedef std::function<void(uint8_t* dataBuf, uint64_t VCN, uint64_t LCN)> ProcessiBlocksPred;
+// called for every fixed up MFT record with 'FILE' signature during MFT scan, any result except Success stops scanning
+typedef std::function<TErrorCode(MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)> ScanMFTRecordsPred;
+// called for every MFT record requested by LoadMFTRecords, index is position of mftRecRef in the requested list.
+// mftRecData is valid only during the call and it is nullptr when res != Success. Any result except Success stops loading.
+typedef std::function<TErrorCode(uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)> LoadMFTRecordsPred;
+// called by ReadClustersAsync when reading of run runIndex is completed. dataBuf is valid only during the call 
+// and it is nullptr when res != Success. Any result except Success stops reading.
+typedef std::function<TErrorCode(uint32_t runIndex, uint8_t* dataBuf, TErrorCode res)> ReadClustersPred;
 
 typedef int32_t (__stdcall *ProgressCallbackPtr)(int32_t progress);
 
@@ -223,6 +234,9 @@ class TAttrCollection
 {
 private:
     THArray<TAttrHeaderList> FAttrList;
+    std::vector<std::unique_ptr<uint8_t[]>> FRecCopies; // chunks of records owned by the collection, see KeepRecord
+    uint32_t FChunkFree{ 0 };                             // records that still fit into the last chunk of FRecCopies
+    static constexpr uint32_t KEEP_CHUNK_RECS = 4;        // records per chunk, files rarely have more extension records
 public:
     TAttrCollection()
     {
@@ -250,8 +264,87 @@ public:
         return FAttrList[MATI(attrType)];
     }
 
+    // copy of the record that lives as long as the collection, attributes of extension records are collected from such copies
+    // because records cache may evict an extension record while attributes of the next ones are being collected
+    // copies are placed into chunks of KEEP_CHUNK_RECS records, recSize is the same for all records of the volume
+    MFT_FILE_RECORD* KeepRecord(const uint8_t* recData, uint32_t recSize)
+    {
+        if (FChunkFree == 0)
+        {
+            FRecCopies.push_back(std::make_unique_for_overwrite<uint8_t[]>((size_t)KEEP_CHUNK_RECS * recSize));
+            FChunkFree = KEEP_CHUNK_RECS;
+        }
+
+        uint8_t* rec = FRecCopies.back().get() + (size_t)(KEEP_CHUNK_RECS - FChunkFree) * recSize;
+        FChunkFree--;
+        memcpy(rec, recData, recSize);
+        return (MFT_FILE_RECORD*)rec;
+    }
+
+};
+
+// Set of MFT record numbers already parsed while ATTR_LIST entries are walked. Files usually have one or two extension records,
+// so first VISITED_INLINE_CNT numbers are kept in place without allocation, the rest are kept sorted and found by binary search.
+class TVisitedRecs
+{
+private:
+    static constexpr uint32_t VISITED_INLINE_CNT = 8;
+    MFTRecIndex FInline[VISITED_INLINE_CNT];
+    uint32_t FInlineCount{ 0 };
+    THArray<MFTRecIndex> FMore; // sorted
+
+    uint32_t LowerBound(MFTRecIndex mftRecID) const
+    {
+        uint32_t lo = 0, hi = FMore.Count();
+        while (lo < hi)
+        {
+            uint32_t mid = (lo + hi) / 2;
+            if (FMore[mid] < mftRecID) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+public:
+    TVisitedRecs() {}
+    explicit TVisitedRecs(MFTRecIndex mftRecID) { Add(mftRecID); }
+    TVisitedRecs(const TVisitedRecs&) = delete;
+
+    bool Contains(MFTRecIndex mftRecID) const
+    {
+        for (uint32_t i = 0; i < FInlineCount; i++)
+            if (FInline[i] == mftRecID) return true;
+
+        uint32_t pos = LowerBound(mftRecID);
+        return (pos < FMore.Count()) && (FMore[pos] == mftRecID);
+    }
+
+    // returns false when mftRecID is in the set already
+    bool Add(MFTRecIndex mftRecID)
+    {
+        if (Contains(mftRecID)) return false;
+
+        if (FInlineCount < VISITED_INLINE_CNT)
+            FInline[FInlineCount++] = mftRecID;
+        else
+            FMore.InsertValue(LowerBound(mftRecID), mftRecID);
+        return true;
+    }
+
+    uint32_t Count() const { return FInlineCount + FMore.Count(); }
 };
 
+// attribute must fit into used part of the record, ATTR_END needs its type field only. recSize is the size of record buffer
+// (BytesPerMFTRec), FileRecSize of a corrupted header is not trusted beyond it. attribute size must cover the common header
+// and keep the next attribute 8-byte aligned
+inline bool AttrInRecord(const MFT_FILE_RECORD* mftRec, const MFT_ATTR_HEADER* attr, uint32_t recSize)
+{
+    uint64_t usedSize = std::min<uint32_t>(std::min<uint32_t>(mftRec->FileRecSize, mftRec->AllocFileRecSize), recSize);
+    uint64_t offset = Diff2Ptr(mftRec, attr);
+    if (offset + sizeof(uint32_t) > usedSize) return false;
+    if (attr->AttrType == ATTR_END) return true;
+    if (offset + offsetof(MFT_ATTR_HEADER, res) > usedSize) return false;
+    return (attr->AttrSize >= offsetof(MFT_ATTR_HEADER, res)) && (attr->AttrSize % 8 == 0) && (offset + attr->AttrSize <= usedSize);
+}
+
 LogEngine::Logger& GetLoggerFunc();
 string_t FileDateToString(uint64_t dateTime);
 std::string FormatFileAttributes(uint32_t a);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include "Functions.h" // for TErrorCode
+#include "LoaderStats.h"
+
+// which part of the parser has issued a read, recorded into I/O trace together with every device read
+enum class TIOTag : uint8_t { Clusters, MFTRecord, IndexBlock, Bitmap, AttrList, Count };
+
+constexpr uint32_t IO_TRACE_VERSION = 1;
+constexpr uint64_t IO_TRACE_NO_OFFSET = UINT64_MAX; // offset of the read is not known (WinAPI loaders), replay skips such reads
+constexpr uint32_t IO_TRACE_BUF_RECS = 64 * 1024;   // records are written to trace file by that many
+
+#pragma pack(push, 1)
+struct IO_TRACE_HEADER
+{
+    uint8_t Magic[4]{ 'M', 'F', 'T', 'T' };
+    uint32_t Version{ IO_TRACE_VERSION };
+    uint32_t BytesPerCluster{ 0 };
+    uint32_t BytesPerMFTRec{ 0 };
+    uint64_t VolumeSize{ 0 }; // bytes, reads of a trace fit into that size
+};
+
+// one device read, 24 bytes
+struct IO_TRACE_RECORD
+{
+    uint64_t Offset;   // from the beginning of the volume, IO_TRACE_NO_OFFSET when not known
+    uint64_t Time;     // nanoseconds since start of the trace, moment when read has been issued
+    uint32_t Length;
+    uint8_t Tag;       // TIOTag
+    uint8_t Reserved[3];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(IO_TRACE_RECORD) == 24);
+
+const char_t* IOTagName(TIOTag tag);
+
+/**
+* @brief Writes device reads of a loader into binary trace file.
+* @details Trace file is IO_TRACE_HEADER followed by IO_TRACE_RECORD items in order of issue.
+* Records are collected in memory and written to the file by IO_TRACE_BUF_RECS, remaining ones are written by destructor.
+* AddRead may be called from several threads.
+**/
+class TIOTraceWriter
+{
+private:
+    HANDLE FHFile{ INVALID_HANDLE_VALUE };
+    THArray<IO_TRACE_RECORD> FBuf;
+    std::mutex FLock;
+    TLoaderStats::TTimePoint FStart;
+    uint64_t FCount{ 0 };
+    bool FFailed{ false }; // write error has occurred, records are not collected anymore
+
+    void Flush(); // FLock must be held
+public:
+    // creates (overwrites) trace file, throws std::system_error when file cannot be created
+    TIOTraceWriter(const string_t& fileName, const IO_TRACE_HEADER& header);
+    ~TIOTraceWriter();
+
+    void AddRead(uint64_t offset, uint64_t length, TIOTag tag);
+    uint64_t Count() const { return FCount; }
+};
+
+// reads whole trace file into memory
+TErrorCode LoadIOTrace(const string_t& fileName, IO_TRACE_HEADER& header, THArray<IO_TRACE_RECORD>& records);
+
+// I/O backends a trace may be replayed with
+enum class TReplayBackend { File, Mapped, Direct, Async };
+
+bool StringToReplayBackend(const string_t& str, TReplayBackend& backend);
+
+struct IO_REPLAY_RESULT
+{
+    uint64_t Reads{ 0 };
+    uint64_t Bytes{ 0 };
+    uint64_t Skipped{ 0 };  // reads without known offset
+    uint64_t Failed{ 0 };
+    uint64_t Nanosecs{ 0 }; // wall time of the whole replay
+    uint64_t TagReads[(uint32_t)TIOTag::Count]{ 0 };
+};
+
+/**
+* @brief Replays reads of a trace against target file (disk image or volume device) as fast as backend allows.
+* @details Timestamps of the trace are ignored, reads are issued in trace order, each read is made at baseOffset + Offset.
+* Device reads are counted in stats (latencies, seeks), so results can be compared with statistics of the original run.
+* Async backend keeps up to queueDepth reads in flight, other backends are synchronous.
+**/
+TErrorCode ReplayIOTrace(const THArray<IO_TRACE_RECORD>& records, const string_t& targetFile, uint64_t baseOffset, TReplayBackend backend,
+    uint32_t queueDepth, TLoaderStats& stats, IO_REPLAY_RESULT& result);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include "LoaderStats.h"
+
+constexpr uint64_t LATENCY_SPIN_NS = 2'000'000; // last 2 ms of a delay are spun, sleep granularity of the system is too coarse for them
+
+// parameters of a simulated device, all times are in nanoseconds
+struct LATENCY_MODEL
+{
+    uint64_t ReadNs{ 0 };      // fixed cost of every read: command overhead or network round trip
+    uint64_t SeekMinNs{ 0 };   // track-to-track seek, paid when read does not start where previous one has ended
+    uint64_t SeekMaxNs{ 0 };   // full stroke seek, seek time grows as square root of seek distance
+    uint64_t RotationNs{ 0 };  // average rotational delay, paid with every seek
+    uint64_t StrokeBytes{ 0 }; // seek distance of full stroke seek
+    uint64_t BytesPerSec{ 0 }; // bandwidth cap, 0 - unlimited
+    bool Serial{ false };      // device serves one read at a time (single head), otherwise fixed costs of concurrent reads overlap
+
+    // 7200 rpm desktop hard disk
+    static LATENCY_MODEL HDD()
+    {
+        return { 100'000, 1'000'000, 16'000'000, 4'170'000, 1024ull * 1024 * 1024 * 1024, 150ull * 1024 * 1024, true };
+    }
+
+    // SMB share over 1 Gbit LAN: every read is a round trip, reads of several threads or async reads are pipelined
+    static LATENCY_MODEL SMB()
+    {
+        return { 1'000'000, 0, 0, 0, 0, 110ull * 1024 * 1024, false };
+    }
+
+    // fixed per-read latency plus bandwidth cap
+    static LATENCY_MODEL Fixed(uint64_t readNs, uint64_t bytesPerSec)
+    {
+        return { readNs, 0, 0, 0, 0, bytesPerSec, false };
+    }
+};
+
+/**
+* @brief Simulated slow device: calculates when a read made at given moment completes.
+* @details Device time is reserved by Reserve(), caller waits for returned moment by WaitUntil(). Reserved transfers
+* share one link, so bandwidth cap holds for any number of threads and reads in flight. Serial devices (HDD) also serve
+* seeks and fixed costs one at a time, non-serial ones (network shares) overlap them. Head position is the end of the
+* previously reserved read, reads with unknown offset do not seek.
+* Results are deterministic for single threaded access: they depend on offsets and sizes of reads only.
+**/
+class TLatencyModel
+{
+private:
+    LATENCY_MODEL FModel;
+    std::mutex FLock;
+    TLoaderStats::TTimePoint FLinkFree{}; // moment when all reserved transfers are finished
+    uint64_t FHeadPos{ 0 };
+public:
+    TLatencyModel(const LATENCY_MODEL& model) : FModel(model) {}
+
+    const LATENCY_MODEL& Model() const { return FModel; }
+
+    // seek time to offset from the current head position, 0 for sequential reads and reads with unknown offset
+    uint64_t SeekNs(int64_t offset) const
+    {
+        if ((offset < 0) || ((uint64_t)offset == FHeadPos) || ((FModel.SeekMaxNs == 0) && (FModel.RotationNs == 0))) return 0;
+
+        uint64_t distance = ((uint64_t)offset > FHeadPos) ? (uint64_t)offset - FHeadPos : FHeadPos - (uint64_t)offset;
+        double part = (FModel.StrokeBytes == 0) ? 1.0 : std::min<double>(1.0, (double)distance / (double)FModel.StrokeBytes);
+        return FModel.SeekMinNs + (uint64_t)((FModel.SeekMaxNs - FModel.SeekMinNs) * std::sqrt(part)) + FModel.RotationNs;
+    }
+
+    uint64_t TransferNs(uint64_t bytes) const
+    {
+        return (FModel.BytesPerSec == 0) ? 0 : (uint64_t)((double)bytes * 1e9 / (double)FModel.BytesPerSec);
+    }
+
+    // reserves device time for the read of bytes at offset (-1 when unknown) issued at issueTime, returns moment when the read completes
+    TLoaderStats::TTimePoint Reserve(int64_t offset, uint64_t bytes, TLoaderStats::TTimePoint issueTime)
+    {
+        std::lock_guard<std::mutex> lk(FLock);
+
+        auto fixed = std::chrono::nanoseconds(FModel.ReadNs + SeekNs(offset));
+        auto transfer = std::chrono::nanoseconds(TransferNs(bytes));
+        if (offset >= 0) FHeadPos = (uint64_t)offset + bytes;
+
+        TLoaderStats::TTimePoint done;
+        if (FModel.Serial)
+            done = std::max<TLoaderStats::TTimePoint>(issueTime, FLinkFree) + fixed + transfer;
+        else
+            done = std::max<TLoaderStats::TTimePoint>(issueTime + fixed, FLinkFree) + transfer;
+
+        FLinkFree = done;
+        return done;
+    }
+
+    static void WaitUntil(TLoaderStats::TTimePoint moment)
+    {
+        auto now = TLoaderStats::Now();
+        if (moment <= now) return;
+
+        if (moment - now > std::chrono::nanoseconds(LATENCY_SPIN_NS))
+            std::this_thread::sleep_until(moment - std::chrono::nanoseconds(LATENCY_SPIN_NS));
+
+        while (TLoaderStats::Now() < moment) std::this_thread::yield();
+    }
+
+    // synchronous read: reserves device time and waits for it
+    void Delay(int64_t offset, uint64_t bytes)
+    {
+        WaitUntil(Reserve(offset, bytes, TLoaderStats::Now()));
+    }
+};
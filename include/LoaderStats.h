@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <bit>
+
+// public loader calls counted by TLoaderStats
+enum class TIOCall : uint32_t { LoadMFTRecord, LoadMFTRecordCache, ReadClusters, Count };
+
+constexpr uint32_t IO_CALLS_COUNT = (uint32_t)TIOCall::Count;
+constexpr uint32_t SEEK_HIST_BUCKETS = 65;     // bucket 0 - sequential read, bucket i - seek distance in [2^(i-1), 2^i) bytes
+constexpr uint32_t LATENCY_SUB_BUCKETS = 8;    // latency histogram has 8 buckets per power of 2, percentiles are precise to 1/8
+constexpr uint32_t LATENCY_HIST_BUCKETS = LATENCY_SUB_BUCKETS + 61 * LATENCY_SUB_BUCKETS;
+
+struct IO_CALL_STATS
+{
+    uint64_t Calls{ 0 };
+    uint64_t Bytes{ 0 };
+    uint64_t Nanosecs{ 0 };
+};
+
+// copy of loader I/O counters at some moment, returned by IRecordsLoader::GetIOStats()
+struct LOADER_IO_STATS
+{
+    IO_CALL_STATS Calls[IO_CALLS_COUNT]; // public loader calls, Bytes are bytes returned to caller
+    IO_CALL_STATS Reads;  // reads made by loader read primitives: MFT records and clusters missed by caches, bulk reads of scans and batches.
+                          // memory-mapped and slab loaders count their memory copies here
+    IO_CALL_STATS Fixups; // Calls is number of USA fixed up records (MFT records and Index Blocks)
+    uint64_t UnknownOffsetReads{ 0 }; // reads which offset on disk is not known (WinAPI loaders), they are not in seek histogram
+    uint64_t BackwardSeeks{ 0 };
+    uint64_t SeekHist[SEEK_HIST_BUCKETS]{ 0 };
+    uint64_t LatencyHist[LATENCY_HIST_BUCKETS]{ 0 };
+
+    uint64_t RecCacheHits{ 0 };
+    uint64_t RecCacheMisses{ 0 };
+    uint64_t ClusterCacheHits{ 0 };
+    uint64_t ClusterCacheMisses{ 0 };
+
+    // bucket of the latency histogram for value ns. values below 8 have their own buckets,
+    // larger values are split by power of 2 and then by 3 bits that follow the highest bit
+    static uint32_t LatencyBucket(uint64_t ns)
+    {
+        if (ns < LATENCY_SUB_BUCKETS) return (uint32_t)ns;
+
+        uint32_t exp = (uint32_t)std::bit_width(ns) - 1; // >= 3
+        uint32_t mantissa = (uint32_t)(ns >> (exp - 3)) & (LATENCY_SUB_BUCKETS - 1);
+        return LATENCY_SUB_BUCKETS + (exp - 3) * LATENCY_SUB_BUCKETS + mantissa;
+    }
+
+    // smallest value that falls into bucket
+    static uint64_t LatencyBucketLow(uint32_t bucket)
+    {
+        if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+
+        uint32_t exp = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS + 3;
+        uint64_t mantissa = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS;
+        return (LATENCY_SUB_BUCKETS + mantissa) << (exp - 3);
+    }
+
+    // read latency (in nanoseconds) that percent% of device reads do not exceed, upper bound of histogram bucket. 0 when there were no reads
+    uint64_t LatencyPercentile(double percent) const
+    {
+        uint64_t total = 0;
+        for (auto cnt : LatencyHist) total += cnt;
+        if (total == 0) return 0;
+
+        uint64_t rank = (uint64_t)(percent * total / 100.0 + 0.5);
+        if (rank == 0) rank = 1;
+
+        uint64_t cnt = 0;
+        for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+        {
+            cnt += LatencyHist[b];
+            if (cnt >= rank) return (b + 1 < LATENCY_HIST_BUCKETS) ? LatencyBucketLow(b + 1) - 1 : UINT64_MAX;
+        }
+
+        return UINT64_MAX;
+    }
+
+    static uint32_t SeekBucket(uint64_t distance) { return (uint32_t)std::bit_width(distance); }
+};
+
+/**
+* @brief I/O counters of a records loader.
+* @details Counts public loader calls, reads that go to the device (with seek distances and latencies) and time spent in USA fixups.
+* All counters are atomic with relaxed ordering, so concurrent loaders update them from several threads without locks.
+* Seek distance is measured from the end of previous device read, it is meaningful for single threaded access only.
+* Counting can be switched off by SetEnabled(false), then only one branch per call is left.
+**/
+class TLoaderStats
+{
+private:
+    struct ATOMIC_CALL_STATS
+    {
+        std::atomic<uint64_t> Calls{ 0 };
+        std::atomic<uint64_t> Bytes{ 0 };
+        std::atomic<uint64_t> Nanosecs{ 0 };
+
+        void Add(uint64_t calls, uint64_t bytes, uint64_t ns)
+        {
+            Calls.fetch_add(calls, std::memory_order_relaxed);
+            Bytes.fetch_add(bytes, std::memory_order_relaxed);
+            Nanosecs.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        void CopyTo(IO_CALL_STATS& stats) const
+        {
+            stats.Calls = Calls.load(std::memory_order_relaxed);
+            stats.Bytes = Bytes.load(std::memory_order_relaxed);
+            stats.Nanosecs = Nanosecs.load(std::memory_order_relaxed);
+        }
+
+        void Clear() { Calls = 0; Bytes = 0; Nanosecs = 0; }
+    };
+
+    bool FEnabled{ true };
+    ATOMIC_CALL_STATS FCalls[IO_CALLS_COUNT];
+    ATOMIC_CALL_STATS FReads;
+    ATOMIC_CALL_STATS FFixups;
+    std::atomic<uint64_t> FUnknownOffsetReads{ 0 };
+    std::atomic<uint64_t> FBackwardSeeks{ 0 };
+    std::atomic<uint64_t> FSeekHist[SEEK_HIST_BUCKETS]{};
+    std::atomic<uint64_t> FLatencyHist[LATENCY_HIST_BUCKETS]{};
+    std::atomic<uint64_t> FLastReadEnd{ 0 };
+public:
+    typedef std::chrono::steady_clock::time_point TTimePoint;
+
+    static TTimePoint Now() { return std::chrono::steady_clock::now(); }
+    static uint64_t NanosecsSince(TTimePoint start) { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Now() - start).count(); }
+
+    bool Enabled() const { return FEnabled; }
+    void SetEnabled(bool enabled) { FEnabled = enabled; }
+
+    void AddCall(TIOCall call, uint64_t bytes, uint64_t ns)
+    {
+        if (FEnabled) FCalls[(uint32_t)call].Add(1, bytes, ns);
+    }
+
+    // offset is offset of the read from the beginning of the volume, -1 when it is not known
+    void AddRead(int64_t offset, uint64_t bytes, uint64_t ns)
+    {
+        if (!FEnabled) return;
+
+        FReads.Add(1, bytes, ns);
+        FLatencyHist[LOADER_IO_STATS::LatencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+        if (offset < 0)
+        {
+            FUnknownOffsetReads.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        uint64_t lastEnd = FLastReadEnd.exchange((uint64_t)offset + bytes, std::memory_order_relaxed);
+        uint64_t distance = ((uint64_t)offset >= lastEnd) ? (uint64_t)offset - lastEnd : lastEnd - (uint64_t)offset;
+        if ((uint64_t)offset < lastEnd) FBackwardSeeks.fetch_add(1, std::memory_order_relaxed);
+        FSeekHist[LOADER_IO_STATS::SeekBucket(distance)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void AddFixups(uint64_t records, uint64_t bytes, uint64_t ns)
+    {
+        if (FEnabled) FFixups.Add(records, bytes, ns);
+    }
+
+    void Snapshot(LOADER_IO_STATS& stats) const
+    {
+        for (uint32_t i = 0; i < IO_CALLS_COUNT; i++) FCalls[i].CopyTo(stats.Calls[i]);
+        FReads.CopyTo(stats.Reads);
+        FFixups.CopyTo(stats.Fixups);
+        stats.UnknownOffsetReads = FUnknownOffsetReads.load(std::memory_order_relaxed);
+        stats.BackwardSeeks = FBackwardSeeks.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < SEEK_HIST_BUCKETS; i++) stats.SeekHist[i] = FSeekHist[i].load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < LATENCY_HIST_BUCKETS; i++) stats.LatencyHist[i] = FLatencyHist[i].load(std::memory_order_relaxed);
+    }
+
+    void Clear()
+    {
+        for (auto& call : FCalls) call.Clear();
+        FReads.Clear();
+        FFixups.Clear();
+        FUnknownOffsetReads = 0;
+        FBackwardSeeks = 0;
+        for (auto& cnt : FSeekHist) cnt = 0;
+        for (auto& cnt : FLatencyHist) cnt = 0;
+        FLastReadEnd = 0;
+    }
+};
+
+// measures time of USA fixups made in a scope and adds it to stats
+class TFixupTimer
+{
+private:
+    TLoaderStats& FStats;
+    TLoaderStats::TTimePoint FStart;
+    uint64_t FRecords;
+    uint64_t FBytes;
+public:
+    TFixupTimer(TLoaderStats& stats, uint64_t records, uint64_t bytes) : FStats(stats), FRecords(records), FBytes(bytes)
+    {
+        if (FStats.Enabled()) FStart = TLoaderStats::Now();
+    }
+    ~TFixupTimer() { if (FStats.Enabled()) FStats.AddFixups(FRecords, FBytes, TLoaderStats::NanosecsSince(FStart)); }
+};
+
+// measures time spent in a scope and counts it as one call
+class TCallTimer
+{
+private:
+    TLoaderStats& FStats;
+    TLoaderStats::TTimePoint FStart;
+    TIOCall FCall;
+    uint64_t FBytes;
+public:
+    TCallTimer(TLoaderStats& stats, TIOCall call, uint64_t bytes) : FStats(stats), FCall(call), FBytes(bytes)
+    {
+        if (FStats.Enabled()) FStart = TLoaderStats::Now();
+    }
+    ~TCallTimer() { if (FStats.Enabled()) FStats.AddCall(FCall, FBytes, TLoaderStats::NanosecsSince(FStart)); }
+};
@@ -1,7 +1,15 @@
 #pragma once
 
 #include <expected>
+#include <span>
+#include <type_traits>
 #include "Functions.h" //for TErrorCode
+#include "ExtentMap.h"
+#include "LoaderStats.h"
+#include "IOTrace.h"
+#include "LatencyModel.h"
+#include "MFTSnapshot.h"
+#include "DiskContainer.h"
 //#include "Caches.h"
 //#include "FileCache.h"
 
@@ -10,8 +18,36 @@ typedef uint8_t* puint8_t;
 typedef std::expected<puint8_t, TErrorCode> expected_uintptr;
 typedef std::expected<uint32_t, TErrorCode> expected_uint32;
 
+constexpr uint32_t DEFAULT_SCAN_CHUNK_SIZE = 4 * 1024 * 1024; // size of one read during sequential MFT scan
+constexpr uint32_t DEFAULT_COALESCE_GAP = 64 * 1024; // LoadMFTRecords reads records separated by smaller gap in one read call
+constexpr uint32_t MAX_COALESCED_READ = 1024 * 1024; // max size of one read call made by LoadMFTRecords
+constexpr uint32_t DEFAULT_QUEUE_DEPTH = 32; // max number of reads in flight for asynchronous loaders
+constexpr uint32_t SCAN_CHUNKS_PER_THREAD = 2; // parallel MFT scan: max number of read ahead chunks per reader thread
+
 class TMFTBaseReader;
 
+// record (MFT record or Index Block) and sector sizes USA kernels are specialized for, see FixupUSA.cpp
+enum class TRecordGeometry : uint32_t
+{
+	Generic,      // any other sizes, kernels take sizes at run time
+	Rec1K_Sec512, // 1K MFT records on 512 byte sectors
+	Rec4K_Sec512, // 4K MFT records (and Index Blocks) on 512 byte sectors
+	Rec4K_Sec4K   // 4K MFT records on 4K native disks
+};
+
+TRecordGeometry RecordGeometryOf(uint32_t BytesPerBlock, uint32_t BytesPerSector);
+const char_t* RecordGeometryName(TRecordGeometry geometry);
+
+// USA fixup kernels compiled for one geometry, arguments are the same as of IRecordsLoader::FixupUSA1 and FixupUSABatch
+struct USA_KERNELS
+{
+	TRecordGeometry Geometry;
+	TErrorCode(*Fixup)(NTFS_RECORD_HEADER* record, uint32_t BytesPerBlock, uint32_t BytesPerSector);
+	uint32_t(*FixupBatch)(uint8_t* records, uint32_t count, uint32_t BytesPerBlock, uint32_t BytesPerSector, NTFS_SIGNATURE signature, TBitField& fixedUp);
+};
+
+const USA_KERNELS& GetUSAKernels(TRecordGeometry geometry);
+
 class IRecordsLoader
 {
 protected:
@@ -20,11 +56,38 @@ protected:
 	uint32_t FMetaFilesCount{ 0 }; // number of first "system" hidden meta files till first non-system file met
 	VOLUME_DATA FVolumeData;
 	TMFTRecCache FMFTRecCache;
+	TClusterCache FClusterCache;
+	// record returned by LoadMFTRecordCache when records cache is disabled. kept per thread, so concurrent readers do not overwrite records of each other
+	inline static thread_local THArray<uint8_t> FUncachedRec;
+	TBitField FMFTBitmap; // $BITMAP attribute of $MFT, bit is set for MFT records in use. empty when bitmap has not been read
+	TLoaderStats FStats;
+	TIOTraceWriter* FIOTrace{ nullptr }; // not null while device reads are recorded into trace file
+	// recorded into trace together with cluster reads, set by TIOTagScope. tag is kept per thread (and shared by all loaders
+	// used by the thread), so reads made at the same time by prefetcher or scan threads do not change tags of each other
+	inline static thread_local TIOTag FIOTag{ TIOTag::Clusters };
+	const USA_KERNELS* FMFTKernels{ &GetUSAKernels(TRecordGeometry::Generic) }; // chosen by SelectRecordKernels() at Open
 
 	virtual TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) = 0;
+	virtual TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) = 0;
+	virtual expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef);
+	// offset of MFT record from the beginning of the volume, used for seek statistics. -1 when loader does not know it
+	virtual int64_t MFTRecVolumeOffset(MFTRecIndex mftRecID) { UNREFERENCED_PARAMETER(mftRecID); return -1; }
+	// InternalLoadMFTRecord and InternalReadClusters that count the read in FStats. all reads made by loaders go through them
+	TErrorCode DeviceLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall);
+	TErrorCode DeviceReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf);
+	// records device read into I/O trace, offset is from the beginning of the volume. loaders that bypass Device* functions call it directly
+	void TraceRead(uint64_t offset, uint64_t length, TIOTag tag) { if (FIOTrace != nullptr) FIOTrace->AddRead(offset, length, tag); }
+	bool ClustersCached(uint64_t lcnStart, uint64_t lcnCnt);
+	void CacheClusters(uint64_t lcnStart, uint64_t lcnCnt, const uint8_t* dataBuf);
 	virtual expected_uint32 ReadMetaFilesCount(TMFTBaseReader& parser);
+	TErrorCode ReadMFTBitmap(TMFTBaseReader& parser);
+	// picks USA kernels for FVolumeData record and sector sizes, called by Open once volume data is known
+	void SelectRecordKernels();
+	// sizes records and clusters caches for FVolumeData, called by Open once volume data is known. caches are not
+	// initialized lazily by readers, so concurrent readers and prefetch threads never race on Init
+	void InitCaches();
 public:
-	virtual ~IRecordsLoader() { Close(); }
+	virtual ~IRecordsLoader() { Close(); StopIOTrace(); }
 	static string_t NormalizeVolume(const string_t& vol);
 	static string_t PreNormalize(const string_t& str);
 	static string_t AbsPath(const string_t& str);
@@ -36,14 +99,96 @@ public:
 	virtual bool IsOpened() { return FOpened; };
 	virtual void SetOpened(bool opened) { FOpened = opened; }
 	virtual uint32_t GetMetaFilesCount() { return FMetaFilesCount; }
+	uint64_t GetRecordsCount() const { return FRecordsCount; }
 	virtual bool IsMetaFile(MFTRecIndex mftRecID) { assert(FMetaFilesCount > 0); return mftRecID < FMetaFilesCount; }
 
 	virtual TErrorCode LoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData);
-	virtual TErrorCode ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) = 0;
+	// reads clusters through FClusterCache, only clusters missing in the cache are read from disk.
+	// reads larger than quarter of the cache capacity are passed to InternalReadClusters as is.
+	TErrorCode ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf);
 	static TErrorCode FixupUSA1(NTFS_RECORD_HEADER* record, uint32_t BytesPerBlock, uint32_t BytesPerSector);
-	virtual expected_uintptr LoadMFTRecordCache(MFT_REF mftRecRef); // returns NULL if error occurred during loading MFT record
+	// validates and fixes up count consecutive records, bit i of fixedUp is set when record i has been fixed up. returns number of fixed up records.
+	static uint32_t FixupUSABatch(uint8_t* records, uint32_t count, uint32_t BytesPerBlock, uint32_t BytesPerSector, NTFS_SIGNATURE signature, TBitField& fixedUp);
+	// the same for MFT records of the opened volume by kernels specialized for its record and sector sizes
+	TErrorCode FixupMFTRecord(NTFS_RECORD_HEADER* mftRec) { return FMFTKernels->Fixup(mftRec, FVolumeData.BytesPerMFTRec, FVolumeData.BytesPerSector); }
+	uint32_t FixupMFTRecords(uint8_t* records, uint32_t count, TBitField& fixedUp)
+	{
+		return FMFTKernels->FixupBatch(records, count, FVolumeData.BytesPerMFTRec, FVolumeData.BytesPerSector, NTFS_SIGNATURE::magic_FILE, fixedUp);
+	}
+	TRecordGeometry GetRecordGeometry() const { return FMFTKernels->Geometry; }
+	// returns pointer to fixed up MFT record or error if error occurred during loading MFT record. Pointer is valid till Close() when
+	// RecordPointersStable() is true. Otherwise record may be evicted from bounded records cache by following calls, and when the cache
+	// is disabled (budget 0) record is returned in per thread buffer that is valid till the next LoadMFTRecordCache call of the same thread
+	expected_uintptr LoadMFTRecordCache(MFT_REF mftRecRef);
+	// true when records returned by LoadMFTRecordCache are never evicted (unbounded cache or records kept in memory by the loader)
+	virtual bool RecordPointersStable() const { return false; }
+
+	// records cache used by LoadMFTRecordCache is bounded by budget bytes (DEFAULT_REC_CACHE_BUDGET by default), budget 0 disables it.
+	// clears the cache, must not be called while other threads use the loader
+	void SetRecCacheBudget(uint64_t budget);
+	TMFTRecCache& GetRecCache() { return FMFTRecCache; }
+	// allocation map of MFT records read from $MFT $BITMAP attribute at Open(). Bulk scans and batch loaders skip free records by it.
+	const TBitField& GetMFTBitmap() const { return FMFTBitmap; }
+	// false when record is marked as free in $MFT bitmap. records beyond the bitmap (or all records when there is no bitmap) are considered allocated
+	bool IsRecordAllocated(MFTRecIndex mftRecID) const { return (mftRecID >= FMFTBitmap.BitsCount()) || FMFTBitmap.Test(mftRecID); }
+	// first allocated MFT record starting from mftRecID, records count when there are no allocated records till the end of MFT
+	MFTRecIndex NextAllocatedRecord(MFTRecIndex mftRecID) const;
+	// first free MFT record starting from mftRecID, records count when there are no free records till the end of MFT
+	MFTRecIndex NextFreeRecord(MFTRecIndex mftRecID) const;
+
+	// clusters cache used by ReadClusters is bounded by budget bytes (DEFAULT_CLUSTER_CACHE_BUDGET by default), 0 disables it.
+	// clears the cache, must not be called while other threads use the loader
+	void SetClusterCacheBudget(uint64_t budget);
+	TClusterCache& GetClusterCache() { return FClusterCache; }
+
+	// I/O counters: calls of LoadMFTRecord, LoadMFTRecordCache and ReadClusters, reads with seek distances and latencies, USA fixups.
+	// counters are kept across Open/Close, GetStats().Clear() resets them
+	TLoaderStats& GetStats() { return FStats; }
+	// copy of I/O counters together with hits and misses of records and clusters caches
+	LOADER_IO_STATS GetIOStats();
+
+	// records every device read (offset, length, time, tag) into binary trace file till StopIOTrace() or Close().
+	// loader must be opened. throws std::system_error when trace file cannot be created
+	void StartIOTrace(const string_t& traceFileName);
+	// writes remaining records to trace file and closes it, returns number of recorded reads
+	uint64_t StopIOTrace();
+	bool IsIOTracing() const { return FIOTrace != nullptr; }
+	// tag recorded with following cluster reads made by the calling thread, returns previous tag of the thread
+	TIOTag SetIOTag(TIOTag tag) { TIOTag prev = FIOTag; FIOTag = tag; return prev; }
+	TIOTag GetIOTag() const { return FIOTag; }
 	virtual void Close();
 
+	// Walks through all MFT records from #0 to the last one and calls pred for each record that contains 'FILE' signature.
+	// Records are fixed up before passing to pred. Records without 'FILE' signature and records marked as free in $MFT bitmap are skipped.
+	// Default implementation loads records one by one, loaders that know $MFT layout read whole extents by chunkSize bytes.
+	virtual TErrorCode ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize = DEFAULT_SCAN_CHUNK_SIZE);
+
+	// Loads batch of MFT records and calls pred for each of them (also for records that failed to load).
+	// Order of pred calls is not defined, loaders that know physical layout of $MFT sort records by offset and 
+	// coalesce adjacent records into large reads. Default implementation loads records one by one in requested order.
+	// Records marked as free in $MFT bitmap are not read, pred gets MFTRecordNotInUse for them.
+	virtual TErrorCode LoadMFTRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred);
+
+	// Reads several independent runs of clusters (lcn, len items, vcn is not used) and calls pred for each run once it is read.
+	// Order of pred calls is not defined, asynchronous loaders call pred in order of I/O completions.
+	// Default implementation reads runs one by one in requested order by ReadClusters.
+	// useCache=false bypasses FClusterCache, it is used for $MFT data that is cached by records.
+	virtual TErrorCode ReadClustersAsync(std::span<const DATA_RUN_ITEM> runs, ReadClustersPred pred, bool useCache = true);
+
+	// true when LoadMFTRecord, LoadMFTRecords and ReadClustersAsync may be called by several threads at the same time
+	virtual bool SupportsConcurrentReads() const { return false; }
+};
+
+// sets tag of cluster reads recorded into loader I/O trace for a scope. Tag is set for the calling thread only,
+// so scope must be created and destroyed by the same thread, threads that read for the caller set their own scope.
+class TIOTagScope
+{
+private:
+	IRecordsLoader& FLoader;
+	TIOTag FPrevTag;
+public:
+	TIOTagScope(IRecordsLoader& loader, TIOTag tag) : FLoader(loader), FPrevTag(loader.SetIOTag(tag)) {}
+	~TIOTagScope() { FLoader.SetIOTag(FPrevTag); }
 };
 
 class TWinAPIRecordsLoader : public IRecordsLoader
@@ -56,15 +201,14 @@ public:
 	TWinAPIRecordsLoader(const string_t& vol) { Open(vol); }
 	void Open(const string_t& vol) override;
 	void Close() override;
-	TErrorCode ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
 	//TErrorCode LoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData) override;
 };
 
 class TWinAPICacheRecordsLoader : public TWinAPIRecordsLoader
 {
 protected:
-	THArrayRaw FRecs;
-	TBitField FBitmap;
+	TMFTRecSlab FSlab; // all MFT records of the volume, read once by ReadAllMftRecords
 
 	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
 	TErrorCode ReadAllMftRecords();
@@ -72,32 +216,55 @@ public:
 	TWinAPICacheRecordsLoader() {}
 	TWinAPICacheRecordsLoader(const string_t& vol) { Open(vol); }
 	void Open(const string_t& vol) override;
+	void Close() override;
 	//TErrorCode LoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData) override;
-	expected_uintptr LoadMFTRecordCache(MFT_REF mftRecRef) override
-	{
-		UNREFERENCED_PARAMETER(mftRecRef);
-		throw std::exception("LoadMFTRecordCache methhod is not supported.");
-	}
+
+	// zero-copy: returns pointer straight into the slab. returned pointers are valid until Close()
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override;
+	bool RecordPointersStable() const override { return FSlab.RecordsCount() > 0; }
 };
 
 
 class TFileImageRecordsLoader : public IRecordsLoader
 {
-private:
+protected:
+	// one read of MFT scan: records [FirstRecID, EndRecID) located in clusters [LcnStart, LcnStart + LcnCnt)
+	struct MFT_SCAN_CHUNK
+	{
+		MFTRecIndex FirstRecID;
+		MFTRecIndex EndRecID;
+		uint64_t LcnStart;
+		uint64_t LcnCnt;
+		uint32_t Skip; // bytes from the beginning of the read to the first record
+	};
+
 	HANDLE FHFile = INVALID_HANDLE_VALUE;
+	TDiskContainer FContainer; // raw image, VHD or VHDX opened as FHFile. offsets below are offsets of the virtual disk
 	uint64_t FPartitionOffset{ 0 }; // offset from beginning of the file where NTFS partition starts 
-	TDataRuns FMFTDataRuns; // Data Runs of $MFT file, used to properly calc offsets for MFT records
+	TDataRuns FMFTDataRuns; // Data Runs of $MFT file
+	TMFTExtentMap FMFTExtents; // built from FMFTDataRuns, used to properly calc offsets for MFT records
+
+	int64_t MFTRecVolumeOffset(MFTRecIndex mftRecID) override { return FMFTExtents.RecIdToOffset(mftRecID); }
+
+	// splits allocated records of every $MFT extent into reads of up to chunkSize bytes, short free gaps are read through.
+	// returns size (in clusters) of the largest read
+	uint64_t PlanMFTScan(uint32_t chunkSize, THArray<MFT_SCAN_CHUNK>& chunks);
+	// calls pred for allocated and fixed up records of the chunk read into recs, counts records that failed USA check
+	TErrorCode DeliverScanChunk(const MFT_SCAN_CHUNK& chunk, uint8_t* recs, TBitField& fixedUp, ScanMFTRecordsPred& pred, uint32_t& corruptedCnt);
 public:
 	TFileImageRecordsLoader() {}
 	TFileImageRecordsLoader(const string_t& imgFileName) { Open(imgFileName); }
 
 	bool Eof(MFTRecIndex id) const { return id >= FRecordsCount; }
+	uint64_t GetPartitionOffset() const { return FPartitionOffset; }
+	const TDiskContainer& GetContainer() const { return FContainer; }
 
 	int64_t MFTRecIdToOffset(MFTRecIndex MFTRecID);
 
 	// MFT table may be fragmented. Fragments can be found in Data Runs in the first MFT record (file with name '$MFT', MFT rec #0)
 	// This function calculates offset of MFT record MFTRecID taking into account MFT table fragmentation. 
 	// This offset starts from first byte of NTFS partition. 
+	// Builds temporary TMFTExtentMap on every call, use TMFTExtentMap directly for repeated lookups.
 	static int64_t MFTRecIdToOffset(MFTRecIndex MFTRecID, TDataRuns& runs, uint32_t BytesPerCluster, uint32_t BytesPerMFTRec);
 
 	// finds first NTFS partition in the file, then finds first MFT record in this partition.
@@ -117,9 +284,339 @@ public:
 	//   - FixupUSA call failed
 	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
 
-	TErrorCode ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
 
 	// Applies Update Sequence Array (USA) to MFT record refered by dataBuf
 	TErrorCode FixupUsaMFTRec(NTFS_RECORD_HEADER* mftRec);
+
+	// reads $MFT extent by extent (according to FMFTExtents) with large sequential reads of chunkSize bytes
+	TErrorCode ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize = DEFAULT_SCAN_CHUNK_SIZE) override;
+
+	// sorts requested records by their offsets on disk and reads records located closer than DEFAULT_COALESCE_GAP
+	// to each other by one read call (up to MAX_COALESCED_READ bytes). Read calls are made via ReadClustersAsync.
+	TErrorCode LoadMFTRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred) override;
 };
 
+
+// Maps the whole disk image file into memory and serves MFT records and clusters right from the mapping.
+// No seek+read syscalls are made per record, page cache does the readahead.
+// USA fixups made by LoadMFTRecordCache go into second copy-on-write view (private overlay), 
+// so the image file itself and raw data returned by ReadClusters are never modified.
+// For dynamic VHD and VHDX records and clusters are copied from the view block by block, overlay is not used then.
+class TMappedImageRecordsLoader : public TFileImageRecordsLoader
+{
+private:
+	uint8_t* FView{ nullptr };    // read-only view of the whole image file, raw data
+	uint8_t* FOverlay{ nullptr }; // copy-on-write view of the same file, MFT records are fixed up here
+	uint64_t FViewSize{ 0 };
+	TBitField FFixedUp; // bit is set when MFT record in FOverlay has already been fixed up
+
+	void MapImage(const string_t& imgFileName);
+	void UnmapImage();
+	std::expected<uint64_t, TErrorCode> MFTRecFileOffset(MFTRecIndex mftRecID); // offset of MFT record from the beginning of the image file
+	TErrorCode ReadView(uint64_t diskOffset, uint8_t* dataBuf, uint64_t size);
+public:
+	// clusters are copied straight from the view, clusters cache would only add one more copy
+	TMappedImageRecordsLoader() { SetClusterCacheBudget(0); }
+	TMappedImageRecordsLoader(const string_t& imgFileName) { SetClusterCacheBudget(0); Open(imgFileName); }
+	~TMappedImageRecordsLoader() override { Close(); }
+
+	void Open(const string_t& imgFileName) override;
+	void Close() override;
+
+	// copies MFT record from the view into mftRecData and fixes up the copy. No syscalls are made.
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
+
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+
+	// zero-copy: returns pointer straight into the overlay view, MFT record is fixed up there once.
+	// returned pointers are valid until Close()
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override;
+	// records are in the overlay view for raw images, VHD and VHDX records go through records cache
+	bool RecordPointersStable() const override { return FFixedUp.BitsCount() > 0; }
+	// true when InternalLoadMFTRecordCache takes the record straight from the view and the record has not been accessed there yet
+	bool FirstViewAccess(MFTRecIndex mftRecID) const { return (FFixedUp.BitsCount() > 0) && (mftRecID < FFixedUp.BitsCount()) && !FFixedUp.Test(mftRecID); }
+};
+
+// Disk image loader that reads clusters asynchronously. Second handle to the image file is opened with FILE_FLAG_OVERLAPPED 
+// and bound to I/O completion port, ReadClustersAsync keeps up to FQueueDepth reads in flight and passes read data to caller 
+// in order of completions. Single MFT records and ReadClusters calls are still read synchronously by TFileImageRecordsLoader.
+// When overlapped handle or completion port cannot be created (or queue depth is 1) loader falls back to synchronous reads.
+class TOverlappedImageRecordsLoader : public TFileImageRecordsLoader
+{
+private:
+	HANDLE FHAsyncFile{ INVALID_HANDLE_VALUE }; // image file opened for overlapped I/O
+	HANDLE FIOPort{ nullptr }; // completion port bound to FHAsyncFile
+	uint32_t FQueueDepth{ DEFAULT_QUEUE_DEPTH };
+
+	void OpenAsync(const string_t& imgFileName);
+	void CloseAsync();
+public:
+	TOverlappedImageRecordsLoader(uint32_t queueDepth = DEFAULT_QUEUE_DEPTH) : FQueueDepth(queueDepth) {}
+	TOverlappedImageRecordsLoader(const string_t& imgFileName, uint32_t queueDepth = DEFAULT_QUEUE_DEPTH) : FQueueDepth(queueDepth) { Open(imgFileName); }
+	~TOverlappedImageRecordsLoader() override { Close(); }
+
+	void Open(const string_t& imgFileName) override;
+	void Close() override;
+
+	uint32_t GetQueueDepth() const { return FQueueDepth; }
+	void SetQueueDepth(uint32_t queueDepth) { FQueueDepth = queueDepth; }
+
+	// true when asynchronous reads are available, false when loader has fallen back to synchronous reads
+	bool IsAsync() const { return FIOPort != nullptr; }
+
+	TErrorCode ReadClustersAsync(std::span<const DATA_RUN_ITEM> runs, ReadClustersPred pred, bool useCache = true) override;
+};
+
+// Disk image loader that can be shared by several threads. 
+// All reads are positional (offset is passed with every read, like pread), image file is opened for overlapped I/O 
+// and each thread waits for its own reads on its own event, so there is no shared file pointer and no lock around reads.
+// LoadMFTRecordCache uses TConcurrentMFTRecCache instead of FMFTRecCache. Open() and Close() must not be called concurrently with reads.
+class TConcurrentImageRecordsLoader : public TFileImageRecordsLoader
+{
+private:
+	HANDLE FHPosFile{ INVALID_HANDLE_VALUE }; // image file opened with FILE_FLAG_OVERLAPPED for positional reads
+	TConcurrentMFTRecCache FConcurrentCache;
+
+	TErrorCode ReadAt(uint64_t fileOffset, uint8_t* dataBuf, DWORD bytesToRead);
+	TErrorCode ReadDisk(uint64_t diskOffset, uint8_t* dataBuf, DWORD bytesToRead);
+public:
+	TConcurrentImageRecordsLoader() {}
+	TConcurrentImageRecordsLoader(const string_t& imgFileName) { Open(imgFileName); }
+	~TConcurrentImageRecordsLoader() override { Close(); }
+
+	void Open(const string_t& imgFileName) override;
+	void Close() override;
+
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+
+	// returned pointers are valid until Close()
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override;
+	bool RecordPointersStable() const override { return true; }
+	bool SupportsConcurrentReads() const override { return true; }
+
+	// Parallel version of ScanMFTRecords: one sequential stream does not saturate RAID arrays and NVMe drives.
+	// Chunks planned over $MFT extents are read and fixed up by threadsCount reader threads (0 means number of CPUs),
+	// every thread makes its own large positional reads into its own buffers. pred is called from the calling thread only,
+	// in MFT record number order when ordered is true, or in order of read completions otherwise.
+	// Readers run ahead of pred by at most SCAN_CHUNKS_PER_THREAD chunks per thread.
+	TErrorCode ScanMFTRecordsParallel(ScanMFTRecordsPred pred, uint32_t threadsCount = 0, bool ordered = true, uint32_t chunkSize = DEFAULT_SCAN_CHUNK_SIZE);
+};
+
+// Disk image loader for one-pass scans of huge images. Image file is opened with FILE_FLAG_NO_BUFFERING (Windows analogue of O_DIRECT),
+// data goes from the device straight into our buffers: system file cache is not polluted by the scan and data is not copied twice.
+// Unbuffered reads need offset, size and buffer address aligned to device sector size. Aligned requests are read straight into
+// caller's buffer, other ones are widened to aligned bounds and read through aligned buffers of FBufPool.
+// Boot sector is read by TFileImageRecordsLoader::Open through ordinary buffered handle.
+class TDirectImageRecordsLoader : public TFileImageRecordsLoader
+{
+private:
+	HANDLE FHDirectFile{ INVALID_HANDLE_VALUE }; // image file opened with FILE_FLAG_NO_BUFFERING
+	uint32_t FAlignment{ DEFAULT_IO_ALIGNMENT };
+	TAlignedBufferPool FBufPool;
+
+	TErrorCode ReadDirect(uint64_t fileOffset, uint8_t* dataBuf, DWORD bytesToRead, DWORD& bytesRead);
+	TErrorCode ReadAligned(uint64_t fileOffset, uint8_t* dataBuf, uint64_t bytesToRead);
+	TErrorCode ReadDisk(uint64_t diskOffset, uint8_t* dataBuf, uint64_t bytesToRead);
+public:
+	TDirectImageRecordsLoader() {}
+	TDirectImageRecordsLoader(const string_t& imgFileName) { Open(imgFileName); }
+	~TDirectImageRecordsLoader() override { Close(); }
+
+	void Open(const string_t& imgFileName) override;
+	void Close() override;
+
+	// alignment of offsets, sizes and buffers required by the device where image file is located
+	uint32_t GetAlignment() const { return FAlignment; }
+
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+};
+
+// Disk image loader that loads the whole $MFT into RAM at Open(). Records are stored in TMFTRecSlab page by page,
+// each page (or piece of a page when page crosses $MFT extent boundary) is filled by one read call and fixed up in place.
+// After Open() no disk reads are made for MFT records, LoadMFTRecordCache returns pointers straight into the slab.
+class TSlabImageRecordsLoader : public TFileImageRecordsLoader
+{
+private:
+	TMFTRecSlab FSlab;
+
+	TErrorCode LoadPage(uint32_t pageIndex, uint8_t*& bounceBuf, uint64_t& bounceBufSize);
+	TErrorCode LoadAllMFTRecords();
+public:
+	TSlabImageRecordsLoader() {}
+	TSlabImageRecordsLoader(const string_t& imgFileName) { Open(imgFileName); }
+	~TSlabImageRecordsLoader() override { Close(); }
+
+	void Open(const string_t& imgFileName) override;
+	void Close() override;
+
+	TMFTRecSlab& GetSlab() { return FSlab; }
+
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
+
+	// zero-copy: returns pointer straight into the slab. returned pointers are valid until Close()
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override;
+};
+
+// Loader that opens MFT snapshot file written by WriteMFTSnapshot. Records are already fixed up there, so they are copied
+// from the file mapping (or from decompressed blocks) as is, no reads of the source volume are made for MFT records.
+// Snapshot does not keep clusters, index blocks and other non-resident data are read from the source volume or image
+// named in snapshot when it is available, ReadClusters returns IOError otherwise.
+// Decompressed blocks of compressed snapshots are kept in LRU cache bounded by DEFAULT_SNAPSHOT_CACHE_BUDGET.
+class TSnapshotRecordsLoader : public IRecordsLoader
+{
+private:
+	uint8_t* FView{ nullptr }; // copy-on-write view of the whole snapshot file
+	uint64_t FViewSize{ 0 };
+	const MFT_SNAPSHOT_HEADER* FHeader{ nullptr };
+	const uint64_t* FStored{ nullptr };      // stored records bitmap inside of the view
+	const SNAPSHOT_BLOCK* FBlocks{ nullptr }; // block index inside of the view
+	HANDLE FHSource{ INVALID_HANDLE_VALUE }; // source volume or image, used for cluster reads
+	TDiskContainer FSourceContainer; // opened when source is an image file
+	uint64_t FPartitionOffset{ 0 };
+	TDataRuns FMFTDataRuns;
+	TMFTExtentMap FMFTExtents;
+	DECOMPRESSOR_HANDLE FDecompressor{ nullptr };
+	TLRUCache<uint32_t> FBlockCache{ DEFAULT_SNAPSHOT_CACHE_BUDGET }; // decompressed blocks, key is block index
+	uint8_t* FBlockBuf{ nullptr }; // block is decompressed here and then copied into FBlockCache
+
+	void MapSnapshot(const string_t& snapshotFile);
+	void LoadTables();
+	void OpenSource();
+	// pointer to the data of decompressed (or stored as is) block, valid till block is evicted from FBlockCache
+	expected_uintptr GetBlock(uint32_t blockIndex);
+	// pointer to the fixed up record in the block, MFTRecordNotInUse when record is not stored in snapshot
+	expected_uintptr GetRecord(MFTRecIndex mftRecID);
+protected:
+	int64_t MFTRecVolumeOffset(MFTRecIndex mftRecID) override { return FMFTExtents.RecIdToOffset(mftRecID); }
+public:
+	TSnapshotRecordsLoader() {}
+	TSnapshotRecordsLoader(const string_t& snapshotFile) { Open(snapshotFile); }
+	~TSnapshotRecordsLoader() override { Close(); }
+
+	void Open(const string_t& snapshotFile) override;
+	void Close() override;
+
+	const MFT_SNAPSHOT_HEADER& GetHeader() const { assert(FHeader != nullptr); return *FHeader; }
+	bool IsCompressed() const { return (FHeader != nullptr) && (FHeader->Flags & SNAPSHOT_FLAG_COMPRESSED); }
+	bool HasSource() const { return FHSource != INVALID_HANDLE_VALUE; }
+
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override;
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override;
+
+	// zero-copy for blocks stored as is: returns pointer straight into the view, valid until Close()
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override;
+
+	// walks through stored records block by block, every block is decompressed once
+	TErrorCode ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize = DEFAULT_SCAN_CHUNK_SIZE) override;
+};
+
+/**
+* @brief Decorator that makes any disk image loader behave as if the image was on a slow device (HDD, network share).
+* @details Every device read of TLoader (single MFT records, clusters, chunks of bulk scans and batches) is delayed till
+* the moment calculated by TLatencyModel. Delays of reads made by several threads overlap as the model allows.
+* Overlapped reads of TOverlappedImageRecordsLoader are delayed at completion, up to queue depth of them overlap.
+* Zero-copy records of TMappedImageRecordsLoader are delayed on the first access to every record (page-in of the view).
+* Reads served from memory (slab of TSlabImageRecordsLoader, records and clusters caches, records already accessed in the view) are not delayed.
+* Delays are counted in read latencies of loader statistics.
+* Usage: TLatencyLoader<TFileImageRecordsLoader> ldr(LATENCY_MODEL::SMB(), imgFileName);
+**/
+template<class TLoader>
+class TLatencyLoader : public TLoader
+{
+	static_assert(std::is_base_of_v<TFileImageRecordsLoader, TLoader>, "TLatencyLoader works with disk image loaders only");
+private:
+	TLatencyModel FLatency;
+protected:
+	TErrorCode InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall) override
+	{
+		auto start = TLoaderStats::Now();
+		TErrorCode res = TLoader::InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+
+		if constexpr (!std::is_base_of_v<TSlabImageRecordsLoader, TLoader>) // slab loader reads records from RAM after Open()
+		{
+			int64_t offset = (mftRecRef.sId.low < this->FRecordsCount) ? this->MFTRecVolumeOffset(mftRecRef.sId.low) : -1;
+			TLatencyModel::WaitUntil(FLatency.Reserve(offset, this->FVolumeData.BytesPerMFTRec, start));
+		}
+
+		return res;
+	}
+
+	// mapped loader returns records from its view without InternalLoadMFTRecord, other loaders read cache misses by InternalLoadMFTRecord
+	expected_uintptr InternalLoadMFTRecordCache(MFT_REF mftRecRef) override
+	{
+		if constexpr (std::is_base_of_v<TMappedImageRecordsLoader, TLoader>)
+		{
+			if (this->FirstViewAccess(mftRecRef.sId.low))
+			{
+				auto start = TLoaderStats::Now();
+				auto res = TLoader::InternalLoadMFTRecordCache(mftRecRef);
+				int64_t offset = (mftRecRef.sId.low < this->FRecordsCount) ? this->MFTRecVolumeOffset(mftRecRef.sId.low) : -1;
+				TLatencyModel::WaitUntil(FLatency.Reserve(offset, this->FVolumeData.BytesPerMFTRec, start));
+				return res;
+			}
+		}
+
+		return TLoader::InternalLoadMFTRecordCache(mftRecRef);
+	}
+
+	TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override
+	{
+		auto start = TLoaderStats::Now();
+		TErrorCode res = TLoader::InternalReadClusters(lcnStart, lcnCnt, dataBuf);
+
+		uint32_t clusterSize = this->FVolumeData.BytesPerCluster;
+		TLatencyModel::WaitUntil(FLatency.Reserve(lcnStart * clusterSize, lcnCnt * clusterSize, start));
+
+		return res;
+	}
+public:
+	// image is opened by this constructor, not by TLoader one, so reads made by Open() are delayed too
+	template<class... Args>
+	TLatencyLoader(const LATENCY_MODEL& model, const string_t& imgFileName, Args... args) : TLoader(args...), FLatency(model)
+	{
+		this->Open(imgFileName);
+	}
+	~TLatencyLoader() override { this->Close(); }
+
+	TLatencyModel& GetLatencyModel() { return FLatency; }
+
+	TErrorCode ReadClustersAsync(std::span<const DATA_RUN_ITEM> runs, ReadClustersPred pred, bool useCache = true) override
+	{
+		if constexpr (std::is_base_of_v<TOverlappedImageRecordsLoader, TLoader>)
+		{
+			if (this->IsAsync() && (runs.size() > 1))
+			{
+				// reads are made by overlapped I/O and do not go through InternalReadClusters.
+				// every completion waits for its simulated completion moment, the read that took the same queue slot
+				// QueueDepth completions ago defines when this one could have been issued
+				uint32_t clusterSize = this->FVolumeData.BytesPerCluster;
+				uint32_t queueDepth = std::max<uint32_t>(1, this->GetQueueDepth());
+				THArray<TLoaderStats::TTimePoint> slotFree;
+				for (uint32_t i = 0; i < queueDepth; i++) slotFree.AddValue(TLoaderStats::Now());
+				uint32_t completed = 0;
+
+				TBitField cached; // runs served from clusters cache are not delayed
+				cached.SetData((uint32_t)((runs.size() + TBitField::DWORD_MASK) >> TBitField::DWORD_2POWER), false);
+				for (uint32_t i = 0; i < runs.size(); i++)
+					if (useCache && this->ClustersCached(runs[i].lcn, runs[i].len)) cached.SetTrue(i);
+
+				return TLoader::ReadClustersAsync(runs, [&](uint32_t runIndex, uint8_t* dataBuf, TErrorCode res)
+					{
+						if (!cached.Test(runIndex))
+						{
+							auto& slot = slotFree[completed++ % queueDepth];
+							slot = FLatency.Reserve(runs[runIndex].lcn * clusterSize, runs[runIndex].len * clusterSize, slot);
+							TLatencyModel::WaitUntil(slot);
+						}
+
+						return pred(runIndex, dataBuf, res);
+					}, useCache);
+			}
+		}
+
+		return TLoader::ReadClustersAsync(runs, pred, useCache);
+	}
+};
@@ -5,6 +5,15 @@
 #define OPT_P _T("p")   // "by Path"
 #define OPT_S _T("s")   // "collect Statistic"
 #define OPT_C _T("c")   // "build Cache for file search"
+#define OPT_M _T("m")   // "Memory-mapped" disk image access
+#define OPT_A _T("a")   // "Asynchronous" (overlapped) disk image reads
+#define OPT_L _T("l")   // "Load" whole $MFT of disk image into RAM
+#define OPT_U _T("u")   // "Unbuffered" disk image reads, system file cache is bypassed
+#define OPT_D _T("d")   // "Delay" disk image reads as a slow device would do
+#define OPT_W _T("w")   // "Write" trace of device reads into a file
+#define OPT_Y _T("y")   // "replaY" trace of device reads
+#define OPT_F _T("f")   // "Fetch" child records ahead of the parser
+#define OPT_N _T("n")   // "sNapshot" of MFT records into a file
 #define OPT_T _T("t")   // "Testing" - for testing purposes
 
 #define MFT_LOG_CFG_FILENAME "MFTReader.lfg"
@@ -12,4 +21,12 @@
 
 void PrintUsage(COptionsList& options);
 void DefineOptions(COptionsList& options);
+bool NumericOptionsValid(CCommandLine& cmd);
 void InitLogger();
+IRecordsLoader* CreateRecordsLoader(const string_t& absPath, CCommandLine& cmd);
+void PrintLoaderStats(IRecordsLoader& ldr);
+void FinishIOTrace(IRecordsLoader& ldr);
+void StartPrefetch(TMFTBaseReader& rdr, CCommandLine& cmd);
+void FinishPrefetch(TMFTBaseReader& rdr);
+void RunIOTraceReplay(CCommandLine& cmd);
+void RunMFTSnapshot(CCommandLine& cmd);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include "Functions.h" // for TErrorCode, VOLUME_DATA
+#include <compressapi.h>
+
+class IRecordsLoader;
+
+constexpr uint32_t MFT_SNAPSHOT_VERSION = 1;
+constexpr uint32_t SNAPSHOT_RECS_PER_BLOCK = 64; // records of one block are covered by one 64-bit word of stored records bitmap
+constexpr uint32_t SNAPSHOT_FLAG_COMPRESSED = 1; // blocks were compressed by XPRESS, blocks that do not shrink are stored as is
+constexpr uint64_t DEFAULT_SNAPSHOT_CACHE_BUDGET = 16ull * 1024 * 1024; // memory limit for decompressed blocks of snapshot loader, 16Mb
+
+#pragma pack(push, 1)
+/**
+* Snapshot file layout:
+*   MFT_SNAPSHOT_HEADER
+*   blocks of records, in block index order
+*   tables starting at TablesOffset (aligned to 8 bytes), one after another:
+*     stored records bitmap, BlocksCount uint64_t, bit is set for records present in snapshot
+*     $MFT bitmap, BitmapWords uint64_t
+*     block index, BlocksCount SNAPSHOT_BLOCK items
+*     $MFT Data Runs, RunsCount SNAPSHOT_RUN items
+*     volume name, VolumeNameLen wchar_t
+* Block i keeps records [i * SNAPSHOT_RECS_PER_BLOCK, (i + 1) * SNAPSHOT_RECS_PER_BLOCK) that are present in snapshot, one after another.
+**/
+struct MFT_SNAPSHOT_HEADER
+{
+    uint8_t Magic[4]{ 'M', 'F', 'T', 'S' };
+    uint32_t Version{ MFT_SNAPSHOT_VERSION };
+    uint32_t Flags{ 0 };
+    uint32_t MetaFilesCount{ 0 };
+    NTFS_VOLUME_DATA_BUFFER VolumeData{ 0 }; // geometry of the source volume
+    uint64_t PartitionOffset{ 0 };  // offset of NTFS partition in the source disk image, 0 for volumes
+    uint64_t RecordsCount{ 0 };     // MFT records count of the source volume
+    uint64_t StoredCount{ 0 };      // records present in snapshot
+    uint64_t TablesOffset{ 0 };     // end of blocks area
+    uint32_t VolumeNameLen{ 0 };
+    uint32_t RunsCount{ 0 };
+    uint32_t BitmapWords{ 0 };
+    uint32_t BlocksCount{ 0 };
+};
+
+struct SNAPSHOT_RUN
+{
+    uint64_t Lcn;
+    uint64_t Len; // in clusters
+};
+
+struct SNAPSHOT_BLOCK
+{
+    uint64_t Offset;  // from the beginning of snapshot file
+    uint32_t Size;    // bytes in snapshot file, less than RawSize when block is compressed
+    uint32_t RawSize; // number of records in block * BytesPerMFTRec, 0 for empty blocks
+};
+#pragma pack(pop)
+
+static_assert(sizeof(SNAPSHOT_BLOCK) == 16);
+
+struct MFT_SNAPSHOT_INFO
+{
+    uint64_t Records{ 0 };
+    uint64_t RawBytes{ 0 };  // size of stored records
+    uint64_t FileBytes{ 0 }; // size of snapshot file
+    uint32_t Blocks{ 0 };    // non empty blocks
+};
+
+// true when file starts with MFT snapshot signature
+bool IsMFTSnapshotFile(const string_t& fileName);
+
+/**
+* @brief Writes all in-use MFT records of the loader into snapshot file that is opened by TSnapshotRecordsLoader.
+* @details Records are taken by loader.ScanMFTRecords, so they are already fixed up. Together with records snapshot keeps
+* volume geometry, $MFT Data Runs, $MFT bitmap and number of meta files, so snapshot loader does not read the source at Open().
+* When compress is true every block is compressed by XPRESS with Huffman (Windows Compression API), blocks that do not shrink are stored as is.
+* Partially written file is deleted on error.
+**/
+TErrorCode WriteMFTSnapshot(IRecordsLoader& loader, const string_t& snapshotFile, bool compress, MFT_SNAPSHOT_INFO& info);
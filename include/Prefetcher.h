@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include "Functions.h" // for TErrorCode, MFT_REF
+
+class IRecordsLoader;
+
+constexpr uint32_t PREFETCH_MIN_DEPTH = 32;       // window of the prefetcher never shrinks below that many records
+constexpr uint32_t DEFAULT_PREFETCH_DEPTH = 1024; // max window of the prefetcher, in records
+constexpr uint32_t PREFETCH_BATCH_SIZE = 64;      // max number of records loaded by one LoadMFTRecords call of the prefetch thread
+constexpr uint32_t PREFETCH_ADAPT_PERIOD = 256;   // window depth is reconsidered after that many Take calls
+
+// counters of TRecordsPrefetcher, returned by GetStats()
+struct PREFETCH_STATS
+{
+    uint64_t Pushed{ 0 };   // records queued for prefetch
+    uint64_t Issued{ 0 };   // records passed to loader by prefetch thread
+    uint64_t Hits{ 0 };     // Take found record already loaded
+    uint64_t LateHits{ 0 }; // Take has waited for record being loaded
+    uint64_t Misses{ 0 };   // Take did not find record, caller loads it by itself
+    uint64_t Wasted{ 0 };   // loaded records that have never been taken
+    uint32_t Depth{ 0 };    // current window depth
+    uint32_t MaxDepth{ 0 }; // largest window depth reached
+};
+
+/**
+* @brief Reads child MFT records of directories ahead of the parser.
+* @details Parser pushes MFT refs of child items while it is still going through index of the current directory (from AddFileAttrPred),
+* prefetch thread loads them by batches via IRecordsLoader::LoadMFTRecords, so reads of child records overlap with parsing of Index Blocks.
+* When parser gets to the children it takes loaded records by Take(), records that are not there are loaded by the parser as before,
+* so results of the parser do not depend on prefetching.
+* Refs are pushed into groups, one group per directory being parsed. Groups form a stack that follows depth-first walk of the parser,
+* prefetch thread serves the innermost group first because its records are needed first.
+* Number of records being loaded or waiting for Take is bounded by window depth. Depth starts at PREFETCH_MIN_DEPTH and adapts to hit rate:
+* it doubles when Take often finds records not loaded yet and halves when loaded records are often thrown away unused.
+* Loader must support concurrent reads (IRecordsLoader::SupportsConcurrentReads), it is used by prefetch thread and parser at the same time.
+* Push, Take and group functions must be called from one (parser) thread.
+**/
+class TRecordsPrefetcher
+{
+private:
+    enum class TState : uint8_t { Queued, InFlight, Ready, Discarded };
+
+    struct ENTRY
+    {
+        TState State;
+        uint32_t Group;  // index of the group in FGroups
+        uint8_t* Data;   // loaded record, Ready entries only
+    };
+
+    IRecordsLoader& FLoader;
+    uint32_t FRecSize;
+    uint32_t FMaxDepth;
+    uint32_t FDepth;
+    uint32_t FInWindow{ 0 }; // InFlight and Ready entries
+
+    std::mutex FLock;
+    std::condition_variable FWorkCond;  // prefetch thread waits for refs to load and free room in the window
+    std::condition_variable FReadyCond; // Take waits for InFlight record
+    std::unordered_map<MFTRecIndex, ENTRY> FEntries;
+    std::vector<std::deque<MFT_REF>> FGroups; // refs not issued yet, taken or discarded refs are dropped lazily
+    THArray<uint8_t*> FFreeBufs;
+    PREFETCH_STATS FStats;
+    uint32_t FPeriodTakes{ 0 };
+    uint32_t FPeriodBehind{ 0 }; // late hits and misses of the current adapt period
+    uint32_t FPeriodWasted{ 0 };
+    bool FStop{ false };
+    std::thread FThread;
+
+    void PrefetchThread();
+    bool HasWork(); // FLock must be held
+    void ReleaseEntry(ENTRY& entry); // FLock must be held
+    void Adapt(); // FLock must be held
+public:
+    // starts prefetch thread. loader must be opened and must stay opened till prefetcher is destroyed
+    TRecordsPrefetcher(IRecordsLoader& loader, uint32_t maxDepth = DEFAULT_PREFETCH_DEPTH);
+    TRecordsPrefetcher(const TRecordsPrefetcher&) = delete;
+    ~TRecordsPrefetcher();
+
+    // opens group for children of a directory, pushed refs go to the innermost group
+    void BeginGroup();
+    // closes innermost group, its records that have not been taken are thrown away
+    void EndGroup();
+    // queues record for prefetch, ignored when there is no open group or record is already queued
+    void Push(const MFT_REF& mftRecRef);
+    // copies prefetched record into mftRecData and returns true, returns false when record has not been prefetched.
+    // waits when record is being loaded at the moment
+    bool Take(const MFT_REF& mftRecRef, uint8_t* mftRecData);
+
+    PREFETCH_STATS GetStats();
+};
+
+// opens prefetch group for a scope, does nothing when prefetcher is null
+class TPrefetchGroup
+{
+private:
+    TRecordsPrefetcher* FPrefetcher;
+public:
+    TPrefetchGroup(TRecordsPrefetcher* prefetcher) : FPrefetcher(prefetcher) { if (FPrefetcher != nullptr) FPrefetcher->BeginGroup(); }
+    ~TPrefetchGroup() { if (FPrefetcher != nullptr) FPrefetcher->EndGroup(); }
+};
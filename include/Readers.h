@@ -1,10 +1,14 @@
 #pragma once
 
 #include <expected>
+#include <vector>
 #include "Functions.h" //for TErrorCode
 #include "Caches.h"
 #include "FileCache.h"
 #include "Loaders.h"
+#include "Prefetcher.h"
+
+class TExtRecordIndex;
 
 #define STREAM_NONAME "<noname>"
 #define STREAM_NONAME_W L"<noname>"
@@ -17,9 +21,31 @@ protected:
 	IRecordsLoader& FLoader;
 	const VOLUME_DATA& getVolData() const { return FLoader.GetVolumeData(); }
 	ostream_t& FOut;
+	TRecordsPrefetcher* FPrefetcher{ nullptr }; // not null while child records are prefetched
+	TExtRecordIndex* FExtIndex{ nullptr };       // not owned
+	std::vector<std::vector<uint8_t>> FBatchBufs; // child records of directory walks, one buffer per directory level
+
+	// buffer for recsCount (up to READ_ITEMS_BATCH_SIZE) child records of a directory at dirLevel. buffer is reused by all directories
+	// of the level, so walk allocates it once per level, it is valid till the next call for the same level
+	uint8_t* BatchBuffer(size_t dirLevel, uint32_t recsCount);
 
 public:
 	TMFTBaseReader(IRecordsLoader& loader) : FOut(cout_t), FAttrCurrIndex(0), FLoader(loader) {};
+	~TMFTBaseReader() { SetPrefetch(false); }
+
+	// starts (stops) reading of child records ahead of ReadDirectoryV1 and ReadMftItems by TRecordsPrefetcher.
+	// loader must be opened. returns false when loader does not support concurrent reads, prefetching stays off then
+	bool SetPrefetch(bool enable, uint32_t maxDepth = DEFAULT_PREFETCH_DEPTH);
+	TRecordsPrefetcher* GetPrefetcher() { return FPrefetcher; }
+	IRecordsLoader& GetLoader() { return FLoader; }
+	// extension records referred by ATTR_LIST are taken from extIndex (filled by TMFTRecordTable::Build or TExtRecordIndex::Build)
+	// instead of loading them from disk. extIndex must outlive the reader or be reset by SetExtIndex(nullptr)
+	void SetExtIndex(TExtRecordIndex* extIndex) { FExtIndex = extIndex; }
+	TExtRecordIndex* GetExtIndex() { return FExtIndex; }
+	// extension record referred by ATTR_LIST entry, from FExtIndex when it has the record otherwise from records cache
+	expected_uintptr LoadExtRecord(const MFT_REF& extRecRef);
+	// the same as FLoader.LoadMFTRecords, records already read by prefetcher are taken from it, remaining ones are loaded by FLoader
+	TErrorCode LoadChildRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred);
 
 	ostream_t& Out();
 
@@ -41,15 +67,16 @@ public:
 	void ParseIndexRoot(MFT_ATTR_HEADER* attr, TLCNRecs& lcns, TFileList& fileList);
 	//bool ParseAlloc(MFT_ATTR_HEADER* attr, TDataRuns& dataRuns);
 	TErrorCode ParseAttrList(MFTRecIndex indexMFTRec, uint32_t attrFilter, ATTR_LIST_ENTRY* startListItem, uint8_t* attrListEnd, uint64_t realSize, 
-		                     uint64_t& processedAttrSize, THArray<MFTRecIndex> visitedMFTRec, AttrListPred processChildMFTRecPred);
+		                     uint64_t& processedAttrSize, TVisitedRecs& visitedMFTRec, AttrListPred processChildMFTRecPred);
 	TErrorCode ParseAttrList(MFTRecIndex indexMFTRec, ATTR_LIST_ENTRY* startListItem, uint8_t* attrListEnd, uint64_t realSize, 
-		                     uint64_t& processedAttrSize, THArray<MFTRecIndex> visitedMFTRec, AttrListPred processChildMFTRecPred);
+		                     uint64_t& processedAttrSize, TVisitedRecs& visitedMFTRec, AttrListPred processChildMFTRecPred);
 	TErrorCode ProcessAllocDataRuns(DIR_NODE& node, ProcessiBlocksPred processIndexBlockPred);
+	// appends runs decoded from mapping pairs of non-resident attr to runs
 	TErrorCode DecodeDataRuns(MFT_ATTR_HEADER* attr, TDataRuns& runs);
 	
 	ATTR_FILE_NAME* GetDirNameAttr(MFT_FILE_RECORD* mftRec);
 	std::wstring GetPathByAttrFileName(ATTR_FILE_NAME* attrFileName);
-	TErrorCode GetFileNameAttrPointers(MFT_FILE_RECORD* mftRec, THArray<ATTR_FILE_NAME*>& attrFileNames);
+	TErrorCode GetFileNameAttrPointers(MFT_FILE_RECORD* mftRec, THArray<ATTR_FILE_NAME*>& attrFileNames, std::vector<std::unique_ptr<uint8_t[]>>& nameCopies);
 	
 	TErrorCode GetFileListFromMFTRec(MFT_FILE_RECORD* mftRec, TFileList& fileList);
 	TErrorCode GetFileListFromMFTRec(TAttrCollection& collection, TFileList& fileList);
@@ -78,6 +105,8 @@ public:
 
 typedef int32_t(*ReadMftItemsCallback)(const string_t& data);
 
+constexpr uint32_t READ_ITEMS_BATCH_SIZE = 1024; // max number of child MFT records loaded by one LoadMFTRecords call
+
 class TMFTStatCollector : public TMFTBaseReader
 {
 private:
@@ -86,18 +115,22 @@ private:
 	bool FProcessNonResAttr; // whether to process non-resident attrs. for some tests it is not needed to process non-res attrs
 
 	int64_t CountFileNamesWithNameType(uint8_t nameType, uint32_t count);
+	TErrorCode ReadMftChildItems(ITEM_INFO& itemInfo, uint32_t dirLevel, ReadMftItemsCallback callback);
 public:
 	TMFTStatCollector(IRecordsLoader& loader, bool processNonRes = true) : TMFTBaseReader(loader), FProcessNonResAttr(processNonRes) {};
 	
 	TItemInfoList& GetItemsList() { return FItemsList; }
 
 	TErrorCode ReadMftItems(MFT_REF mftRecRef, IFILE_NAME* iFileItem, uint32_t dirLevel, ReadMftItemsCallback callback);
+	TErrorCode ReadMftItemsBuf(MFT_FILE_RECORD* mftRec, IFILE_NAME* iFileItem, uint32_t dirLevel, ReadMftItemsCallback callback);
 	//TErrorCode ReadMftItems(MFT_REF mftRecRef, uint32_t dirLevel, ReadMftItemsCallback callback);
 	TErrorCode ReadMftItemInfo(MFT_REF mftRecRef, IFILE_NAME* iFileItem, ITEM_INFO& itemInfo);
 	//TErrorCode ReadMftItemInfo(MFT_REF mftRecRef, ITEM_INFO& itemInfo);
 	TErrorCode ReadMftItemInfoBuf(MFT_FILE_RECORD* mftRec, IFILE_NAME* iFileItem, ITEM_INFO& itemInfo);
 	//TErrorCode ReadMftItemInfoBuf(MFT_FILE_RECORD* mftRec, ITEM_INFO& itemInfo);
 	TErrorCode CollectVolumeStat();
+	// statistics from one sequential pass over $MFT (see TMFTRecordTable), directory indexes are not read
+	TErrorCode CollectVolumeStatLinear();
 	void ShowVolumeStat();
 	void SaveToFile(string_t fileName);
 
@@ -112,6 +145,7 @@ public:
 	TErrorCode ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node, AddFileAttrPred addToFileListPred /*uint32_t parentIdx, TFileCache::TLevel* level*/);
 
 	TErrorCode ReadDirectoryV1(uint32_t parentIdx, CACHE_ITEM* parentItem, uint64_t& dirSize, ProgressCallbackPtr callback);
+	TErrorCode ReadDirectoryV1Buf(uint32_t parentIdx, CACHE_ITEM* parentItem, uint8_t* mftRecBuf, uint64_t& dirSize, ProgressCallbackPtr callback);
 	void ReadDirsV1();
 	void SaveToFile(string_t fileName);
 };
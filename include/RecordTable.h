@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <span>
+#include "logengine2/DynamicArrays.h"
+#include "NTFS.h"
+#include "Functions.h" // for TErrorCode, MFT_REF
+
+class IRecordsLoader;
+
+constexpr uint32_t TABLE_NO_ROW = UINT32_MAX;  // RowOf() result for records that are not in the table
+constexpr uint32_t TABLE_NO_NAME = UINT32_MAX; // MainName of rows without ATTR_FILENAME attributes
+
+/**
+* @brief Copies of all in-use extension MFT records with base -> extensions index, filled during sequential pass over $MFT.
+* @details Extension records are a small part of $MFT, so they are kept in memory as whole records (slots).
+* Attributes referred by ATTR_LIST entries are then taken from these copies (see TMFTBaseReader::SetExtIndex)
+* instead of random loads of extension records. Copies stay valid while the index exists.
+* Index is a snapshot of $MFT: records with sequence number different from the requested one are not returned.
+**/
+class TExtRecordIndex
+{
+private:
+    uint32_t FRecSize{ 0 };
+    THArray<uint8_t> FRecs;        // record images, one slot of FRecSize bytes per extension record
+    THArray<MFTRecIndex> FExtIDs;  // record number of every slot, increasing
+    THArray<MFTRecIndex> FBaseIDs; // base record number of every slot
+    THArray<uint32_t> FByBase;     // slots sorted by base record number, built by Finish()
+    uint64_t FHits{ 0 };
+    uint64_t FMisses{ 0 };
+public:
+    TExtRecordIndex() {}
+    TExtRecordIndex(const TExtRecordIndex&) = delete;
+
+    // fills the index by its own pass over $MFT, use TMFTRecordTable::Build(loader, &extIndex) when the table is needed too
+    TErrorCode Build(IRecordsLoader& loader);
+    void Clear();
+    // records must be added in increasing order of record numbers, Finish() must be called after the last one
+    void Reset(uint32_t recSize);
+    void Add(MFT_FILE_RECORD* extRec, MFTRecIndex extRecID);
+    void Finish();
+
+    uint32_t Count() const { return FExtIDs.Count(); }
+    MFT_FILE_RECORD* Record(uint32_t slot) const { return (MFT_FILE_RECORD*)FRecs.GetValuePointer(slot * FRecSize); }
+    // extension record referred by extRecRef, nullptr when the index does not have it
+    MFT_FILE_RECORD* Find(const MFT_REF& extRecRef);
+    // slots of extension records of base record baseRecID
+    std::span<const uint32_t> ExtensionsOf(MFTRecIndex baseRecID) const;
+
+    uint64_t GetHits() const { return FHits; }
+    uint64_t GetMisses() const { return FMisses; }
+    uint64_t MemorySize() const { return (uint64_t)FRecs.Count() + (uint64_t)Count() * (2 * sizeof(MFTRecIndex) + sizeof(uint32_t)); }
+};
+
+/**
+* @brief Columnar (structure of arrays) table of all in-use base MFT records, built by one sequential pass over $MFT.
+* @details Build() walks records by loader.ScanMFTRecords in MFT record number order, no directory indexes are read and no records
+* are loaded at random (except for extension records that precede their base records, they are loaded after the scan).
+* Row i of every row column describes the same base record, attributes of extension records are added to the row of their base record.
+* Every ATTR_FILENAME attribute is a row of names columns, names characters are kept in one shared name pool,
+* so there is no per-record or per-name allocation. Columns are public for analyses that run over one or two of them.
+**/
+class TMFTRecordTable
+{
+private:
+    THArray<uint32_t> FRowOfRec; // row index for every MFT record number, TABLE_NO_ROW for records that are not in the table
+    uint32_t FRecSize{ 0 };      // BytesPerMFTRec of the volume the table is built for
+
+    uint32_t AddRow(MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID);
+    void AddAttrs(uint32_t row, MFT_FILE_RECORD* mftRec);
+    void AddName(uint32_t row, ATTR_FILE_NAME* fileName);
+    // row of the base record extension record belongs to. TABLE_NO_ROW when base record has no row or when the extension record
+    // is stale: base record number has been reused and sequence numbers differ (zero sequence number is not checked, as in TExtRecordIndex::Find)
+    uint32_t BaseRowOf(const MFT_FILE_RECORD* extRec) const;
+public:
+    // row columns, one item per base record
+    THArray<MFTRecIndex> RecID;
+    THArray<uint16_t> SeqNum;
+    THArray<uint16_t> Flags;          // MFT_RECORD_FLAGS of the record header
+    THArray<uint16_t> HardLinks;
+    THArray<uint32_t> FileAttrib;     // from STD_INFO
+    THArray<uint64_t> CreateTime;     // STD_INFO timestamps
+    THArray<uint64_t> ModifyTime;
+    THArray<uint64_t> ModifyAttrTime;
+    THArray<uint64_t> AccessTime;
+    THArray<uint64_t> DataSize;       // real size of unnamed DATA stream, 0 when there is no such stream
+    THArray<uint64_t> AllocSize;      // allocated size of unnamed DATA stream
+    THArray<uint16_t> AttrsCount;     // attributes in base and extension records
+    THArray<uint16_t> AttrCounters[ATTR_TYPE_CNT]; // the same by attribute types, indexed by MATI()
+    THArray<uint32_t> NonResidentAttrs; // bit MakeAttrBitmask(type) is set when record has non-resident attribute of that type
+    THArray<uint32_t> MainName;       // first non-DOS name of the record in names columns, TABLE_NO_NAME when record has no names
+    THArray<uint16_t> NamesCount;
+
+    // names columns, one item per ATTR_FILENAME attribute
+    THArray<uint32_t> NameRow;        // row of the record the name belongs to
+    THArray<MFT_REF> NameParent;
+    THArray<uint32_t> NameOffset;     // offset of the first character in NamePool
+    THArray<uint8_t> NameLen;         // in characters
+    THArray<uint8_t> NameType;        // FILE_NAME_POSIX, FILE_NAME_UNICODE, FILE_NAME_DOS or FILE_NAME_UNICODE_AND_DOS
+
+    THArray<wchar_t> NamePool;
+
+    TMFTRecordTable() {}
+    TMFTRecordTable(const TMFTRecordTable&) = delete;
+
+    // extIndex (when not null) gets copies of extension records met during the same pass
+    TErrorCode Build(IRecordsLoader& loader, TExtRecordIndex* extIndex = nullptr);
+    void Clear();
+
+    uint32_t RowsCount() const { return RecID.Count(); }
+    uint32_t NamesTotal() const { return NameRow.Count(); }
+    uint32_t RowOf(MFTRecIndex mftRecID) const { return (mftRecID < FRowOfRec.Count()) ? FRowOfRec[mftRecID] : TABLE_NO_ROW; }
+    bool IsDir(uint32_t row) const { return (Flags[row] & MFT_FLAG_IS_DIRECTORY) != 0; }
+    std::wstring_view Name(uint32_t nameIdx) const { return std::wstring_view(NamePool.GetValuePointer(NameOffset[nameIdx]), NameLen[nameIdx]); }
+    // bytes taken by all columns
+    uint64_t MemorySize() const;
+};
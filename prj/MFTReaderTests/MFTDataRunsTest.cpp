@@ -1,4 +1,5 @@
 
+#include <chrono>
 #include "gtest/gtest.h"
 #include "Readers.h"
 #include "TestUtils.h"
@@ -102,6 +103,144 @@ TEST_P(MFTDataRunDecodeTest, DecodeDataRuns_1)
     file.close();
 };
 
+// byte by byte decoder the table driven DecodeDataRuns has replaced, used as etalon and as baseline of the benchmark
+static void ReferenceDecodeDataRuns(MFT_ATTR_HEADER* attr, TDataRuns& runs)
+{
+    uint8_t* datarun = Add2Ptr(attr, attr->nonres.DataRunsOffset);
+    uint8_t* attrEnd = Add2Ptr(attr, attr->AttrSize);
+    uint64_t currVCN = attr->nonres.StartVCN;
+    uint64_t currLCN = 0;
+
+    while ((datarun < attrEnd) && *datarun)
+    {
+        uint8_t lenBytes = *datarun & 0x0F;
+        uint8_t offBytes = (*datarun >> 4) & 0x0F;
+
+        uint64_t len = 0;
+        for (uint8_t b = lenBytes; b > 0; b--) len = (len << 8) + datarun[b];
+
+        int64_t delta = 0;
+        if (offBytes > 0)
+        {
+            delta = (datarun[lenBytes + offBytes] & 0x80) ? -1 : 0;
+            for (uint8_t b = lenBytes + offBytes; b > lenBytes; b--) delta = (delta << 8) + datarun[b];
+        }
+
+        currLCN += delta;
+        runs.AddValue({ len, currVCN, (delta == 0) ? 0 : currLCN });
+        currVCN += len;
+        datarun += 1 + lenBytes + offBytes;
+    }
+}
+
+// every line of data runs fixture is placed into fake MFT record as mapping pairs of non-resident DATA attribute
+static bool LoadFakeDataRunsRecords(const string_t& fileName, std::vector<std::vector<uint8_t>>& records)
+{
+    constexpr uint32_t ATTR_OFFSET = 0x38;
+
+    std::ifstream file(fileName);
+    if (!file) return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream iss(line);
+        std::vector<uint8_t> pairs;
+        uint32_t num;
+        while (iss >> std::hex >> num) pairs.push_back((uint8_t)num);
+
+        std::getline(file, line); // etalon runs are checked by DecodeDataRuns_1
+
+        uint32_t attrSize = (uint32_t)(sizeof(MFT_ATTR_HEADER) + pairs.size() + 7) & ~7u;
+        uint32_t recSize = std::max<uint32_t>(1024, ATTR_OFFSET + attrSize + 8);
+        std::vector<uint8_t>& rec = records.emplace_back(recSize, 0);
+
+        MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)rec.data();
+        mftRec->SeqNum = 1;
+        mftRec->FirstAttrOffset = ATTR_OFFSET;
+        mftRec->FileRecSize = ATTR_OFFSET + attrSize + 8;
+        mftRec->AllocFileRecSize = recSize;
+        mftRec->IndexMFTRec = (MFTRecIndex)records.size() + 24;
+
+        MFT_ATTR_HEADER* attr = (MFT_ATTR_HEADER*)Add2Ptr(mftRec, ATTR_OFFSET);
+        attr->AttrType = ATTR_DATA;
+        attr->AttrSize = attrSize;
+        attr->NonResidentFlag = ATTR_FLAG_NONRESIDENT;
+        attr->AttrID = 1;
+        attr->nonres.DataRunsOffset = sizeof(MFT_ATTR_HEADER);
+        memcpy(Add2Ptr(attr, sizeof(MFT_ATTR_HEADER)), pairs.data(), pairs.size());
+        *(uint32_t*)Add2Ptr(attr, attrSize) = ATTR_END;
+    }
+
+    return true;
+}
+
+static MFT_ATTR_HEADER* FakeRecordAttr(std::vector<uint8_t>& rec)
+{
+    MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)rec.data();
+    return (MFT_ATTR_HEADER*)Add2Ptr(mftRec, mftRec->FirstAttrOffset);
+}
+
+// reference decoder and DecodeDataRuns give the same runs
+TEST_P(MFTDataRunDecodeTest, DecodeDataRunsSameAsReference)
+{
+    TWinAPIRecordsLoader ldr;
+    TMFTBaseReader parser(ldr);
+
+    std::vector<std::vector<uint8_t>> records;
+    if (!LoadFakeDataRunsRecords(GetParam(), records)) FAIL() << "Error opening file '" << GetParam() << "'";
+    ASSERT_FALSE(records.empty());
+
+    for (auto& rec : records)
+    {
+        TDataRuns etalon, runs;
+        ReferenceDecodeDataRuns(FakeRecordAttr(rec), etalon);
+        ASSERT_EQ(TErrorCode::Success, parser.DecodeDataRuns(FakeRecordAttr(rec), runs));
+        ASSERT_EQ(etalon.Count(), runs.Count());
+        for (uint32_t i = 0; i < etalon.Count(); i++)
+            ASSERT_EQ(etalon[i], runs[i]);
+    }
+}
+
+// the same attributes are decoded many times by reference decoder and by DecodeDataRuns.
+// disabled by default, run with --gtest_also_run_disabled_tests
+TEST_P(MFTDataRunDecodeTest, DISABLED_DecodeDataRunsBenchmark)
+{
+    constexpr uint32_t ITERATIONS = 2000;
+
+    TWinAPIRecordsLoader ldr;
+    TMFTBaseReader parser(ldr);
+
+    std::vector<std::vector<uint8_t>> records;
+    if (!LoadFakeDataRunsRecords(GetParam(), records)) FAIL() << "Error opening file '" << GetParam() << "'";
+    ASSERT_FALSE(records.empty());
+
+    TDataRuns runs;
+    uint64_t totalRuns = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+        for (auto& rec : records)
+        {
+            runs.Clear();
+            ReferenceDecodeDataRuns(FakeRecordAttr(rec), runs);
+            totalRuns += runs.Count();
+        }
+    auto refTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+        for (auto& rec : records)
+        {
+            runs.Clear();
+            ASSERT_EQ(TErrorCode::Success, parser.DecodeDataRuns(FakeRecordAttr(rec), runs));
+        }
+    auto tableTime = std::chrono::steady_clock::now() - start;
+
+    auto ns = [totalRuns](auto time) { return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / std::max<uint64_t>(totalRuns, 1); };
+    std::cout << "[ BENCHMARK] " << totalRuns << " runs decoded, ns per run: reference " << ns(refTime) << ", table " << ns(tableTime) << std::endl;
+}
+
 INSTANTIATE_TEST_CASE_P(DecodeDataRuns1, MFTDataRunDecodeTest, testing::Values(_T(TEST_DATA_DIR "DataRuns1.txt"), _T(TEST_DATA_DIR "DataRuns2.txt")));
 //INSTANTIATE_TEST_CASE_P(DecodeDataRuns2, MFTDataRunDecodeTest, testing::Values(_T(TEST_DATA_DIR "DataRuns2.txt")));
 
@@ -286,3 +286,381 @@ TEST_F(MFTParserBaseTests, BitField_1)
         else
             ASSERT_EQ(false, bmp.Test(i));
 }
+
+TEST_F(MFTParserBaseTests, BitField_2)
+{
+    const uint32_t DWORDS = 10;
+    const uint64_t BITS = DWORDS * 64;
+
+    TBitField bmp;
+    bmp.SetData(DWORDS, false);
+
+    ASSERT_EQ(-1, bmp.NextSetBit(0));
+    ASSERT_EQ(0, bmp.NextClearBit(0));
+
+    uint arr[] = { 4,6,100,55,639,199,9, 0,1,2,3, 512, 127,128,129, 600,599,601,602,603 };
+    for (uint val : arr)
+        bmp.SetTrue(val);
+
+    // NextSetBit/NextClearBit agree with Test for every starting position
+    for (uint64_t i = 0; i < BITS; i++)
+    {
+        int64_t set = -1;
+        for (uint64_t j = i; j < BITS; j++)
+            if (bmp.Test(j)) { set = (int64_t)j; break; }
+
+        int64_t clear = (int64_t)BITS;
+        for (uint64_t j = i; j < BITS; j++)
+            if (!bmp.Test(j)) { clear = (int64_t)j; break; }
+
+        ASSERT_EQ(set, bmp.NextSetBit(i)) << "from " << i;
+        ASSERT_EQ(clear, bmp.NextClearBit(i)) << "from " << i;
+    }
+
+    ASSERT_EQ(-1, bmp.NextSetBit(BITS));
+    ASSERT_EQ((int64_t)BITS, bmp.NextClearBit(BITS));
+
+    bmp.SetData(DWORDS, true);
+    ASSERT_EQ((int64_t)BITS, bmp.NextClearBit(0));
+    ASSERT_EQ(70, bmp.NextSetBit(70));
+}
+
+TEST_F(MFTParserBaseTests, MFTRecCache_1)
+{
+    const uint32_t REC_SIZE = 64;
+    const uint32_t SHARD_RECS = 4; // cache has 16 shards
+
+    TMFTRecCache cache;
+    cache.Init(REC_SIZE, 16 * SHARD_RECS * REC_SIZE);
+    ASSERT_EQ(16 * SHARD_RECS, cache.Capacity());
+
+    uint8_t rec[REC_SIZE];
+    auto fillRec = [&rec](MFTRecIndex id) { memset(rec, (uint8_t)id, REC_SIZE); };
+
+    // ids 0, 16, 32, ... go into the same shard
+    for (MFTRecIndex i = 0; i < SHARD_RECS; i++)
+    {
+        fillRec(i * 16);
+        uint8_t* p = cache.AddRec(i * 16, rec);
+        ASSERT_EQ(0, memcmp(p, rec, REC_SIZE));
+    }
+
+    ASSERT_EQ(SHARD_RECS, cache.Count());
+    ASSERT_EQ(0u, cache.Evictions());
+
+    // touch record 0, so record 16 becomes least recently used
+    uint8_t* p = cache.GetRec(0);
+    ASSERT_NE(nullptr, p);
+    ASSERT_EQ(0, p[0]);
+
+    fillRec(SHARD_RECS * 16);
+    cache.AddRec(SHARD_RECS * 16, rec);
+    ASSERT_EQ(1u, cache.Evictions());
+    ASSERT_EQ(SHARD_RECS, cache.Count());
+
+    ASSERT_EQ(nullptr, cache.GetRec(16)); // evicted
+    ASSERT_NE(nullptr, cache.GetRec(0));
+    p = cache.GetRec(SHARD_RECS * 16);
+    ASSERT_NE(nullptr, p);
+    ASSERT_EQ((uint8_t)(SHARD_RECS * 16), p[REC_SIZE - 1]);
+
+    // records of other shards are not affected
+    fillRec(1);
+    cache.AddRec(1, rec);
+    ASSERT_EQ(1u, cache.Evictions());
+    ASSERT_EQ(SHARD_RECS + 1, cache.Count());
+
+    // adding existing record does not change it
+    fillRec(200);
+    p = cache.AddRec(1, rec);
+    ASSERT_EQ(1, p[0]);
+
+    ASSERT_EQ(3u, cache.Hits());
+    ASSERT_EQ(1u, cache.Misses());
+
+    cache.Clear();
+    ASSERT_EQ(0u, cache.Count());
+    ASSERT_EQ(0u, cache.Hits());
+    ASSERT_EQ(nullptr, cache.GetRec(0));
+}
+
+TEST_F(MFTParserBaseTests, ClusterCache_1)
+{
+    const uint32_t CLUSTER_SIZE = 512;
+
+    TClusterCache cache;
+    ASSERT_TRUE(cache.Enabled());
+    cache.Init(CLUSTER_SIZE, 16 * 2 * CLUSTER_SIZE);
+    ASSERT_EQ(32u, cache.Capacity());
+
+    uint8_t cluster[CLUSTER_SIZE];
+    uint8_t buf[CLUSTER_SIZE];
+
+    // LCNs larger than 32 bits must not collide with small ones
+    const uint64_t bigLcn = 0x100000000ull + 5;
+    memset(cluster, 5, CLUSTER_SIZE);
+    cache.AddRec(5, cluster);
+    memset(cluster, 7, CLUSTER_SIZE);
+    cache.AddRec(bigLcn, cluster);
+
+    ASSERT_TRUE(cache.Contains(5));
+    ASSERT_TRUE(cache.Contains(bigLcn));
+    ASSERT_FALSE(cache.Contains(6));
+    ASSERT_EQ(0u, cache.Hits()); // Contains does not change counters
+    ASSERT_EQ(0u, cache.Misses());
+
+    ASSERT_TRUE(cache.CopyRec(5, buf));
+    ASSERT_EQ(5, buf[0]);
+    ASSERT_EQ(5, buf[CLUSTER_SIZE - 1]);
+    ASSERT_TRUE(cache.CopyRec(bigLcn, buf));
+    ASSERT_EQ(7, buf[0]);
+    ASSERT_FALSE(cache.CopyRec(6, buf));
+    ASSERT_EQ(7, buf[0]); // buffer is not touched on miss
+
+    ASSERT_EQ(2u, cache.Hits());
+    ASSERT_EQ(1u, cache.Misses());
+
+    // budget 0 disables the cache
+    cache.Init(CLUSTER_SIZE, 0);
+    ASSERT_FALSE(cache.Enabled());
+    ASSERT_EQ(0u, cache.Count());
+}
+
+TEST_F(MFTParserBaseTests, FixupUSABatch_1)
+{
+    const uint32_t REC_SIZE = 1024;
+    const uint32_t SECTOR_SIZE = 512;
+    const uint32_t RECS = 21; // not multiple of 8, tail is processed by one record path
+    const uint16_t USA_OFFSET = 0x30;
+    const uint16_t USN = 0x1234;
+
+    auto recsBuf = std::make_unique<uint8_t[]>(RECS * REC_SIZE);
+    auto expectedBuf = std::make_unique<uint8_t[]>(RECS * REC_SIZE);
+    uint8_t* recs = recsBuf.get();
+    uint8_t* expected = expectedBuf.get();
+
+    for (uint32_t i = 0; i < RECS; i++)
+    {
+        uint8_t* rec = recs + i * REC_SIZE;
+        memset(rec, (uint8_t)i, REC_SIZE);
+
+        NTFS_RECORD_HEADER* hdr = (NTFS_RECORD_HEADER*)rec;
+        memcpy(hdr->Signature, "FILE", 4);
+        hdr->FixupOffset = USA_OFFSET;
+        hdr->FixupCnt = REC_SIZE / SECTOR_SIZE + 1;
+
+        uint16_t* usa = (uint16_t*)(rec + USA_OFFSET);
+        usa[0] = USN;
+        for (uint32_t s = 0; s < REC_SIZE / SECTOR_SIZE; s++)
+        {
+            uint16_t* trailer = (uint16_t*)(rec + (s + 1) * SECTOR_SIZE - 2);
+            usa[s + 1] = (uint16_t)(0xA000 + i * 16 + s); // original data of the sector end
+            *trailer = USN;
+        }
+    }
+
+    memcpy(recs + 3 * REC_SIZE, "INDX", 4);                    // wrong signature
+    *(uint16_t*)(recs + 9 * REC_SIZE + REC_SIZE - 2) = 0x4321; // second sector trailer does not match USN
+    ((NTFS_RECORD_HEADER*)(recs + 17 * REC_SIZE))->FixupCnt = 9; // wrong USA size
+    ((NTFS_RECORD_HEADER*)(recs + 20 * REC_SIZE))->FixupOffset = 0xFFF0; // USA outside of the record
+
+    // expected result is made by FixupUSA1 record by record
+    memcpy(expected, recs, RECS * REC_SIZE);
+    for (uint32_t i = 0; i < RECS; i++)
+        if (i != 3 && i != 9 && i != 17 && i != 20)
+            ASSERT_EQ(TErrorCode::Success, IRecordsLoader::FixupUSA1((NTFS_RECORD_HEADER*)(expected + i * REC_SIZE), REC_SIZE, SECTOR_SIZE));
+
+    TBitField fixedUp;
+    uint32_t cnt = IRecordsLoader::FixupUSABatch(recs, RECS, REC_SIZE, SECTOR_SIZE, NTFS_SIGNATURE::magic_FILE, fixedUp);
+    ASSERT_EQ(RECS - 4, cnt);
+
+    for (uint32_t i = 0; i < RECS; i++)
+    {
+        bool bad = (i == 3 || i == 9 || i == 17 || i == 20);
+        ASSERT_EQ(!bad, fixedUp.Test(i)) << "record " << i;
+        ASSERT_EQ(0, memcmp(expected + i * REC_SIZE, recs + i * REC_SIZE, REC_SIZE)) << "record " << i; // bad records are not modified
+    }
+
+    // only record 3 has 'INDX' signature, its USA has not been applied yet
+    cnt = IRecordsLoader::FixupUSABatch(recs, RECS, REC_SIZE, SECTOR_SIZE, NTFS_SIGNATURE::magic_INDX, fixedUp);
+    ASSERT_EQ(1u, cnt);
+    ASSERT_TRUE(fixedUp.Test(3));
+    ASSERT_EQ(0xA000 + 3 * 16 + 1, *(uint16_t*)(recs + 3 * REC_SIZE + REC_SIZE - 2));
+}
+
+TEST_F(MFTParserBaseTests, FixupUSAGeometries_1)
+{
+    struct GEOMETRY_CASE { uint32_t RecSize; uint32_t SectorSize; TRecordGeometry Geometry; };
+    const GEOMETRY_CASE cases[] = {
+        { 1024, 512, TRecordGeometry::Rec1K_Sec512 },
+        { 4096, 512, TRecordGeometry::Rec4K_Sec512 },
+        { 4096, 4096, TRecordGeometry::Rec4K_Sec4K },
+        { 2048, 512, TRecordGeometry::Generic },
+        { 8192, 4096, TRecordGeometry::Generic } };
+
+    const uint32_t RECS = 11; // one AVX2 batch and scalar tail
+    const uint16_t USA_OFFSET = 0x30;
+    const uint16_t USN = 0x0707;
+
+    for (const GEOMETRY_CASE& gc : cases)
+    {
+        ASSERT_EQ(gc.Geometry, RecordGeometryOf(gc.RecSize, gc.SectorSize));
+        ASSERT_EQ(gc.Geometry, GetUSAKernels(gc.Geometry).Geometry);
+
+        uint32_t sectors = gc.RecSize / gc.SectorSize;
+        std::vector<uint8_t> recs(RECS * gc.RecSize);
+        for (uint32_t i = 0; i < RECS; i++)
+        {
+            uint8_t* rec = recs.data() + i * gc.RecSize;
+            memset(rec, (uint8_t)(i + 1), gc.RecSize);
+
+            NTFS_RECORD_HEADER* hdr = (NTFS_RECORD_HEADER*)rec;
+            memcpy(hdr->Signature, "FILE", 4);
+            hdr->FixupOffset = USA_OFFSET;
+            hdr->FixupCnt = (uint16_t)(sectors + 1);
+
+            uint16_t* usa = (uint16_t*)(rec + USA_OFFSET);
+            usa[0] = USN;
+            for (uint32_t s = 0; s < sectors; s++)
+            {
+                usa[s + 1] = (uint16_t)(0xB000 + i * 16 + s);
+                *(uint16_t*)(rec + (s + 1) * gc.SectorSize - 2) = USN;
+            }
+        }
+
+        // trailer of the last sector of record 5 does not match USN
+        *(uint16_t*)(recs.data() + 6 * gc.RecSize - 2) = 0x1111;
+
+        // record by record fixup leaves corrupted record untouched
+        std::vector<uint8_t> expected = recs;
+        for (uint32_t i = 0; i < RECS; i++)
+        {
+            uint8_t* rec = expected.data() + i * gc.RecSize;
+            std::vector<uint8_t> before(rec, rec + gc.RecSize);
+            TErrorCode res = IRecordsLoader::FixupUSA1((NTFS_RECORD_HEADER*)rec, gc.RecSize, gc.SectorSize);
+            ASSERT_EQ((i == 5) ? TErrorCode::CorruptedData : TErrorCode::Success, res) << "record " << i << ", record size " << gc.RecSize;
+            if (i == 5) ASSERT_EQ(0, memcmp(before.data(), rec, gc.RecSize));
+            else ASSERT_EQ(0xB000 + i * 16 + sectors - 1, *(uint16_t*)(rec + gc.RecSize - 2));
+        }
+
+        TBitField fixedUp;
+        uint32_t cnt = IRecordsLoader::FixupUSABatch(recs.data(), RECS, gc.RecSize, gc.SectorSize, NTFS_SIGNATURE::magic_FILE, fixedUp);
+        ASSERT_EQ(RECS - 1, cnt) << "record size " << gc.RecSize;
+        ASSERT_FALSE(fixedUp.Test(5));
+        ASSERT_TRUE(expected == recs) << "record size " << gc.RecSize << ", sector size " << gc.SectorSize;
+    }
+}
+
+TEST_F(MFTParserBaseTests, AlignedBufferPool_1)
+{
+    TAlignedBufferPool pool;
+    pool.Init(5000, 4096); // size is rounded up to alignment
+    ASSERT_EQ(8192u, pool.BufSize());
+    ASSERT_EQ(4096u, pool.Alignment());
+    ASSERT_EQ(0u, pool.Allocated());
+
+    uint8_t* buf1 = pool.Acquire();
+    uint8_t* buf2 = pool.Acquire();
+    ASSERT_NE(nullptr, buf1);
+    ASSERT_NE(nullptr, buf2);
+    ASSERT_NE(buf1, buf2);
+    ASSERT_EQ(0u, (uintptr_t)buf1 % 4096);
+    ASSERT_EQ(0u, (uintptr_t)buf2 % 4096);
+    ASSERT_EQ(2u, pool.Allocated());
+
+    memset(buf1, 1, pool.BufSize()); // whole buffer is usable
+
+    // released buffer is reused, no new allocation
+    pool.Release(buf1);
+    ASSERT_EQ(buf1, pool.Acquire());
+    ASSERT_EQ(2u, pool.Allocated());
+
+    pool.Release(buf1);
+    pool.Release(buf2);
+    pool.Clear();
+    ASSERT_EQ(0u, pool.Allocated());
+}
+
+TEST_F(MFTParserBaseTests, LoaderStats_1)
+{
+    // every value falls into the bucket which bounds contain it
+    for (uint64_t ns : { 0ull, 1ull, 7ull, 8ull, 9ull, 17ull, 1000ull, 123456789ull, (unsigned long long)UINT64_MAX })
+    {
+        uint32_t bucket = LOADER_IO_STATS::LatencyBucket(ns);
+        ASSERT_LT(bucket, LATENCY_HIST_BUCKETS);
+        ASSERT_LE(LOADER_IO_STATS::LatencyBucketLow(bucket), ns);
+        if (bucket + 1 < LATENCY_HIST_BUCKETS) ASSERT_GT(LOADER_IO_STATS::LatencyBucketLow(bucket + 1), ns);
+    }
+
+    TLoaderStats stats;
+    for (uint64_t i = 1; i <= 100; i++)
+        stats.AddRead(i * 4096, 4096, i * 1000); // sequential reads, the first one is 4096 bytes away from offset 0
+    stats.AddRead(0, 4096, 5);   // backward seek
+    stats.AddRead(-1, 1024, 5);  // offset is unknown
+    stats.AddCall(TIOCall::LoadMFTRecord, 1024, 10);
+    stats.AddFixups(8, 8192, 100);
+
+    LOADER_IO_STATS snapshot;
+    stats.Snapshot(snapshot);
+    ASSERT_EQ(102u, snapshot.Reads.Calls);
+    ASSERT_EQ(100u * 4096 + 4096 + 1024, snapshot.Reads.Bytes);
+    ASSERT_EQ(99u, snapshot.SeekHist[0]);
+    ASSERT_EQ(1u, snapshot.SeekHist[LOADER_IO_STATS::SeekBucket(4096)]);
+    ASSERT_EQ(1u, snapshot.BackwardSeeks);
+    ASSERT_EQ(1u, snapshot.UnknownOffsetReads);
+    ASSERT_EQ(1u, snapshot.Calls[(uint32_t)TIOCall::LoadMFTRecord].Calls);
+    ASSERT_EQ(0u, snapshot.Calls[(uint32_t)TIOCall::ReadClusters].Calls);
+    ASSERT_EQ(8u, snapshot.Fixups.Calls);
+
+    // percentiles are upper bounds of buckets, precise to 1/8. 51st of 102 latencies is 49000
+    uint64_t p50 = snapshot.LatencyPercentile(50);
+    ASSERT_GE(p50, 49'000u);
+    ASSERT_LE(p50, 49'000u * 9 / 8);
+    ASSERT_GE(snapshot.LatencyPercentile(100), 100'000u);
+    ASSERT_LE(snapshot.LatencyPercentile(0), 7u);
+
+    stats.SetEnabled(false);
+    stats.AddRead(0, 4096, 5);
+    stats.Clear();
+    stats.Snapshot(snapshot);
+    ASSERT_EQ(0u, snapshot.Reads.Calls);
+    ASSERT_EQ(0u, snapshot.LatencyPercentile(50));
+}
+
+TEST_F(MFTParserBaseTests, LatencyModel_1)
+{
+    auto t0 = TLoaderStats::Now();
+    auto ns = [&](TLoaderStats::TTimePoint t) { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t - t0).count(); };
+
+    // HDD: sequential read does not seek, far read pays seek and rotation, reads are served one after another
+    LATENCY_MODEL hdd = LATENCY_MODEL::HDD();
+    TLatencyModel disk(hdd);
+    uint64_t xfer = disk.TransferNs(4096);
+    uint64_t d1 = ns(disk.Reserve(0, 4096, t0));
+    uint64_t d2 = ns(disk.Reserve(4096, 4096, t0));
+    uint64_t d3 = ns(disk.Reserve(hdd.StrokeBytes, 4096, t0));
+    ASSERT_EQ(hdd.ReadNs + xfer, d1);
+    ASSERT_EQ(d1 + hdd.ReadNs + xfer, d2);
+    ASSERT_GE(d3, d2 + hdd.SeekMaxNs + hdd.RotationNs);
+    ASSERT_LE(d3, d2 + hdd.ReadNs + hdd.SeekMaxNs + hdd.RotationNs + xfer);
+    ASSERT_EQ(0u, disk.SeekNs(-1)); // unknown offset
+
+    // SMB: round trips of concurrent reads overlap, transfers share bandwidth
+    LATENCY_MODEL smb = LATENCY_MODEL::SMB();
+    TLatencyModel share(smb);
+    uint64_t mbXfer = share.TransferNs(1024 * 1024);
+    uint64_t s1 = ns(share.Reserve(0, 1024 * 1024, t0));
+    uint64_t s2 = ns(share.Reserve(1024 * 1024, 1024 * 1024, t0));
+    ASSERT_EQ(smb.ReadNs + mbXfer, s1);
+    ASSERT_EQ(s1 + mbXfer, s2);
+
+    // fixed latency without bandwidth cap: reads issued at the same moment complete together
+    TLatencyModel fixed(LATENCY_MODEL::Fixed(1000, 0));
+    ASSERT_EQ(1000u, ns(fixed.Reserve(0, 4096, t0)));
+    ASSERT_EQ(1000u, ns(fixed.Reserve(1 << 20, 4096, t0)));
+
+    auto start = TLoaderStats::Now();
+    fixed.Delay(-1, 0);
+    ASSERT_GE(TLoaderStats::NanosecsSince(start), 1000u);
+}
+
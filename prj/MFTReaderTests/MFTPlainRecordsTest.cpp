@@ -36,6 +36,7 @@ public:
         FVolumeData.MftZoneStart.QuadPart = 0;
         FVolumeData.MftZoneEnd.QuadPart = 1000;
         FVolumeData.Name = convert_string<wchar_t>(GetVolumeName(fileName));
+        InitCaches();
 
         SetOpened(true); // needed for LoadMFTRecord
 
@@ -125,7 +126,7 @@ public:
         */
     }
 
-    TErrorCode ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override
+    TErrorCode InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf) override
     {
         EXPECT_TRUE(IsOpened());
 
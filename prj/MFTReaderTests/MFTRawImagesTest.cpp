@@ -1,6 +1,13 @@
 
+#include <thread>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <bit>
 #include "gtest/gtest.h"
 #include "Readers.h"
+#include "AttrRange.h"
+#include "RecordTable.h"
 #include "TestUtils.h"
 #include "MFTBaseParamTest.h"
 
@@ -171,6 +178,1190 @@ TEST_P(MFTImgFileParserTest, ReadDiskImageRootAndGoSubDirs_1)
     EXPECT_EQ(ImgFileFigures[imgFileName].DirsCount, DirsCount);
 }
 
+TEST_P(MFTImgFileParserTest, MappedImageLoaderMatchesFileLoader)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader fldr(imgFileName);
+    TMappedImageRecordsLoader mldr(imgFileName);
+
+    ASSERT_EQ(fldr.GetMetaFilesCount(), mldr.GetMetaFilesCount());
+
+    uint32_t recSize = fldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* fRecBuf = (uint8_t*)alloca(recSize);
+    uint8_t* mRecBuf = (uint8_t*)alloca(recSize);
+    MFT_REF mftRef{ 0 };
+
+    while (!fldr.Eof(mftRef.sId.low))
+    {
+        auto fres = fldr.LoadMFTRecord(mftRef, fRecBuf);
+        auto mres = mldr.LoadMFTRecord(mftRef, mRecBuf);
+        ASSERT_EQ(fres, mres) << "MFT record " << mftRef.sId.low;
+
+        if (fres == TErrorCode::Success)
+        {
+            ASSERT_EQ(0, memcmp(fRecBuf, mRecBuf, recSize)) << "MFT record " << mftRef.sId.low;
+
+            // zero-copy record is fixed up once, second call must return the same fixed up data
+            for (int i = 0; i < 2; i++)
+            {
+                auto mrec = mldr.LoadMFTRecordCache(mftRef);
+                ASSERT_TRUE(mrec.has_value()) << "MFT record " << mftRef.sId.low;
+                ASSERT_EQ(0, memcmp(fRecBuf, mrec.value(), recSize)) << "MFT record " << mftRef.sId.low;
+            }
+
+            // copy is served from the overlay after fixup
+            ASSERT_EQ(TErrorCode::Success, mldr.LoadMFTRecord(mftRef, mRecBuf));
+            ASSERT_EQ(0, memcmp(fRecBuf, mRecBuf, recSize)) << "MFT record " << mftRef.sId.low;
+        }
+
+        mftRef.sId.low++;
+    }
+
+    // raw clusters are not affected by fixups made in the overlay
+    uint32_t clusterSize = fldr.GetVolumeData().BytesPerCluster;
+    uint8_t* fClusterBuf = (uint8_t*)alloca(clusterSize);
+    uint8_t* mClusterBuf = (uint8_t*)alloca(clusterSize);
+    uint64_t mftLcn = fldr.GetVolumeData().MftStartLcn.QuadPart;
+
+    ASSERT_EQ(TErrorCode::Success, fldr.ReadClusters(mftLcn, 1, fClusterBuf));
+    ASSERT_EQ(TErrorCode::Success, mldr.ReadClusters(mftLcn, 1, mClusterBuf));
+    EXPECT_EQ(0, memcmp(fClusterBuf, mClusterBuf, clusterSize));
+}
+
+TEST_P(MFTImgFileParserTest, ScanMFTRecordsMatchesOneByOne)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* mftRecBuf = (uint8_t*)alloca(recSize);
+
+    // default chunk size, minimal chunk size (one MFT record) and chunk size that is not multiple of cluster size
+    for (uint32_t chunkSize : { DEFAULT_SCAN_CHUNK_SIZE, 0u, (uint32_t)(3 * tldr.GetVolumeData().BytesPerCluster + 100) })
+    {
+        MFTRecIndex expectedID = 0;
+        uint32_t scannedCount = 0;
+
+        auto res = tldr.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+            {
+                // records that are skipped by scan must be Not In Use or marked as free in $MFT bitmap
+                for (MFT_REF ref{ expectedID }; ref.sId.low < mftRecID; ref.sId.low++)
+                    if (tldr.IsRecordAllocated(ref.sId.low))
+                        EXPECT_EQ(TErrorCode::MFTRecordNotInUse, tldr.LoadMFTRecord(ref, mftRecBuf)) << "MFT record " << ref.sId.low;
+
+                MFT_REF ref{ mftRecID };
+                EXPECT_EQ(TErrorCode::Success, tldr.LoadMFTRecord(ref, mftRecBuf)) << "MFT record " << mftRecID;
+                EXPECT_EQ(0, memcmp(mftRecBuf, mftRec, recSize)) << "MFT record " << mftRecID;
+
+                expectedID = mftRecID + 1;
+                scannedCount++;
+                return TErrorCode::Success;
+            }, chunkSize);
+
+        ASSERT_EQ(TErrorCode::Success, res);
+        EXPECT_GT(scannedCount, 0u);
+
+        for (MFT_REF ref{ expectedID }; !tldr.Eof(ref.sId.low); ref.sId.low++)
+            if (tldr.IsRecordAllocated(ref.sId.low))
+                EXPECT_EQ(TErrorCode::MFTRecordNotInUse, tldr.LoadMFTRecord(ref, mftRecBuf)) << "MFT record " << ref.sId.low;
+    }
+
+    // scan stops when predicate returns an error
+    uint32_t calls = 0;
+    auto res = tldr.ScanMFTRecords([&calls](MFT_FILE_RECORD*, MFTRecIndex) { calls++; return TErrorCode::NotFound; });
+    EXPECT_EQ(TErrorCode::NotFound, res);
+    EXPECT_EQ(1u, calls);
+}
+
+TEST_P(MFTImgFileParserTest, LoadMFTRecordsMatchesOneByOne)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* mftRecBuf = (uint8_t*)alloca(recSize);
+
+    MFTRecIndex recsCount = 0;
+    while (!tldr.Eof(recsCount)) recsCount++;
+
+    // records in backward order, duplicates, record far from others and record out of MFT bounds
+    THArray<MFT_REF> refs;
+    for (MFTRecIndex id = 40; id > 0; id--) refs.AddValue(MFT_REF{ id - 1 });
+    refs.AddValue(MFT_REF{ 5 });
+    refs.AddValue(MFT_REF{ 5 });
+    refs.AddValue(MFT_REF{ recsCount - 1 });
+    refs.AddValue(MFT_REF{ recsCount + 10 });
+
+    THArray<uint32_t> calls;
+    calls.AddFillValues(refs.Count());
+    for (uint32_t i = 0; i < calls.Count(); i++) calls[i] = 0;
+
+    auto res = tldr.LoadMFTRecords(std::span<const MFT_REF>(refs.GetValuePointer(0), refs.Count()),
+        [&](uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)
+        {
+            EXPECT_LT(index, refs.Count());
+            EXPECT_EQ(refs[index].Id, mftRecRef.Id);
+            calls[index]++;
+
+            TErrorCode expected = tldr.LoadMFTRecord(mftRecRef, mftRecBuf);
+            if ((expected == TErrorCode::Success) && !tldr.IsRecordAllocated(mftRecRef.sId.low))
+                expected = TErrorCode::MFTRecordNotInUse; // free records are not read by batch loader
+            EXPECT_EQ(expected, res) << "MFT record " << mftRecRef.sId.low;
+            if (res == TErrorCode::Success)
+                EXPECT_EQ(0, memcmp(mftRecBuf, mftRecData, recSize)) << "MFT record " << mftRecRef.sId.low;
+            else
+                EXPECT_EQ(nullptr, mftRecData);
+
+            return TErrorCode::Success;
+        });
+
+    ASSERT_EQ(TErrorCode::Success, res);
+
+    for (uint32_t i = 0; i < calls.Count(); i++)
+        EXPECT_EQ(1u, calls[i]) << "index " << i;
+
+    // loading stops when predicate returns an error
+    uint32_t cnt = 0;
+    res = tldr.LoadMFTRecords(std::span<const MFT_REF>(refs.GetValuePointer(0), refs.Count()),
+        [&cnt](uint32_t, const MFT_REF&, uint8_t*, TErrorCode) { cnt++; return TErrorCode::NotFound; });
+    EXPECT_EQ(TErrorCode::NotFound, res);
+    EXPECT_EQ(1u, cnt);
+}
+
+TEST_P(MFTImgFileParserTest, OverlappedLoaderMatchesFileLoader)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+
+    uint32_t clusterSize = tldr.GetVolumeData().BytesPerCluster;
+    uint64_t mftLcn = tldr.GetVolumeData().MftStartLcn.QuadPart;
+
+    // runs of different length, overlapping and repeated runs
+    THArray<DATA_RUN_ITEM> runs;
+    for (uint64_t i = 0; i < 20; i++) runs.AddValue({ 1 + i % 4, 0, mftLcn + (i * 7) % 32 });
+    runs.AddValue({ 1, 0, 0 });
+
+    uint8_t* expected = (uint8_t*)alloca(4 * clusterSize);
+
+    // queue depth 1 means synchronous fallback
+    for (uint32_t queueDepth : { 1u, 4u, DEFAULT_QUEUE_DEPTH })
+    {
+        TOverlappedImageRecordsLoader oldr(imgFileName, queueDepth);
+        EXPECT_EQ(queueDepth > 1, oldr.IsAsync());
+
+        THArray<uint32_t> calls;
+        calls.AddFillValues(runs.Count());
+        for (uint32_t i = 0; i < calls.Count(); i++) calls[i] = 0;
+
+        auto res = oldr.ReadClustersAsync(std::span<const DATA_RUN_ITEM>(runs.GetValuePointer(0), runs.Count()),
+            [&](uint32_t runIndex, uint8_t* dataBuf, TErrorCode res)
+            {
+                EXPECT_LT(runIndex, runs.Count());
+                EXPECT_EQ(TErrorCode::Success, res);
+                calls[runIndex]++;
+
+                EXPECT_EQ(TErrorCode::Success, tldr.ReadClusters(runs[runIndex].lcn, runs[runIndex].len, expected));
+                EXPECT_EQ(0, memcmp(expected, dataBuf, runs[runIndex].len * clusterSize)) << "run " << runIndex;
+                return TErrorCode::Success;
+            });
+
+        ASSERT_EQ(TErrorCode::Success, res);
+        for (uint32_t i = 0; i < calls.Count(); i++)
+            EXPECT_EQ(1u, calls[i]) << "run " << i;
+
+        // reading stops when predicate returns an error
+        uint32_t cnt = 0;
+        res = oldr.ReadClustersAsync(std::span<const DATA_RUN_ITEM>(runs.GetValuePointer(0), runs.Count()),
+            [&cnt](uint32_t, uint8_t*, TErrorCode) { cnt++; return TErrorCode::NotFound; });
+        EXPECT_EQ(TErrorCode::NotFound, res);
+        EXPECT_EQ(1u, cnt);
+
+        // reading of directories gives the same results as synchronous loader
+        TMFTStatCollector stat1(tldr, true);
+        TMFTStatCollector stat2(oldr, true);
+        MFT_REF root{ 0 };
+        root.Id = MFT_ROOT_REC_ID;
+        ASSERT_EQ(TErrorCode::Success, stat1.ReadMftItems(root, nullptr, 0, nullptr));
+        ASSERT_EQ(TErrorCode::Success, stat2.ReadMftItems(root, nullptr, 0, nullptr));
+        EXPECT_EQ(stat1.GetItemsList().Count(), stat2.GetItemsList().Count());
+    }
+}
+
+TEST_P(MFTImgFileParserTest, ConcurrentLoaderSharedByThreads)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    TConcurrentImageRecordsLoader cldr(imgFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+
+    MFTRecIndex recsCount = 0;
+    while (!tldr.Eof(recsCount)) recsCount++;
+
+    // load all records one by one in the main thread, they are reference data
+    THArray<TErrorCode> expectedRes;
+    auto expectedBuf = std::make_unique<uint8_t[]>((uint64_t)recsCount * recSize);
+    uint8_t* expected = expectedBuf.get();
+    for (MFT_REF ref{ 0 }; ref.sId.low < recsCount; ref.sId.low++)
+        expectedRes.AddValue(tldr.LoadMFTRecord(ref, expected + (uint64_t)ref.sId.low * recSize));
+
+    const uint32_t threadsCount = 4;
+    std::atomic<uint32_t> mismatches{ 0 };
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < threadsCount; t++)
+    {
+        threads.emplace_back([&, t]()
+            {
+                uint8_t* mftRecBuf = (uint8_t*)alloca(recSize);
+
+                // every thread goes through all records starting from different position, so threads request the same records at different times
+                for (MFTRecIndex i = 0; i < recsCount; i++)
+                {
+                    MFT_REF ref{ (i + t * recsCount / threadsCount) % recsCount };
+                    uint8_t* expectedRec = expected + (uint64_t)ref.sId.low * recSize;
+
+                    TErrorCode res = cldr.LoadMFTRecord(ref, mftRecBuf);
+                    if ((res != expectedRes[ref.sId.low]) || ((res == TErrorCode::Success) && (memcmp(mftRecBuf, expectedRec, recSize) != 0)))
+                        mismatches++;
+
+                    auto cached = cldr.LoadMFTRecordCache(ref);
+                    if (cached.has_value() != (expectedRes[ref.sId.low] == TErrorCode::Success))
+                        mismatches++;
+                    else if (cached && (memcmp(*cached, expectedRec, recSize) != 0))
+                        mismatches++;
+                }
+            });
+    }
+
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_EQ(0u, mismatches.load());
+
+    // cache contains one copy of each record successfully loaded
+    MFT_REF ref{ 0 };
+    auto rec1 = cldr.LoadMFTRecordCache(ref);
+    auto rec2 = cldr.LoadMFTRecordCache(ref);
+    ASSERT_TRUE(rec1 && rec2);
+    EXPECT_EQ(*rec1, *rec2);
+}
+
+TEST_P(MFTImgFileParserTest, ParallelScanMatchesScan)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    TConcurrentImageRecordsLoader cldr(imgFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint32_t smallChunk = 3 * tldr.GetVolumeData().BytesPerCluster + 100; // many chunks even on small images
+
+    // sequential scan gives reference data
+    THArray<MFTRecIndex> expectedIDs;
+    std::vector<uint8_t> expected;
+    auto res = tldr.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            expectedIDs.AddValue(mftRecID);
+            expected.insert(expected.end(), (uint8_t*)mftRec, (uint8_t*)mftRec + recSize);
+            return TErrorCode::Success;
+        });
+    ASSERT_EQ(TErrorCode::Success, res);
+    ASSERT_GT(expectedIDs.Count(), 0u);
+
+    for (uint32_t threadsCount : { 1u, 4u, 0u })
+    {
+        for (bool ordered : { true, false })
+        {
+            THArray<MFTRecIndex> ids;
+            uint32_t mismatches = 0;
+
+            res = cldr.ScanMFTRecordsParallel([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+                {
+                    ids.AddValue(mftRecID);
+
+                    MFTRecIndex* found = std::lower_bound(expectedIDs.GetValuePointer(0), expectedIDs.GetValuePointer(0) + expectedIDs.Count(), mftRecID);
+                    uint32_t index = (uint32_t)(found - expectedIDs.GetValuePointer(0));
+                    if ((index == expectedIDs.Count()) || (*found != mftRecID) || (memcmp(mftRec, expected.data() + (uint64_t)index * recSize, recSize) != 0))
+                        mismatches++;
+
+                    return TErrorCode::Success;
+                }, threadsCount, ordered, smallChunk);
+
+            ASSERT_EQ(TErrorCode::Success, res);
+            EXPECT_EQ(0u, mismatches) << "threads " << threadsCount << " ordered " << ordered;
+            ASSERT_EQ(expectedIDs.Count(), ids.Count()) << "threads " << threadsCount << " ordered " << ordered;
+
+            if (!ordered) std::sort(ids.GetValuePointer(0), ids.GetValuePointer(0) + ids.Count());
+            for (uint32_t i = 0; i < ids.Count(); i++)
+                EXPECT_EQ(expectedIDs[i], ids[i]) << "threads " << threadsCount << " ordered " << ordered;
+        }
+    }
+
+    // scan stops when predicate returns an error, reader threads are stopped too
+    uint32_t calls = 0;
+    res = cldr.ScanMFTRecordsParallel([&calls](MFT_FILE_RECORD*, MFTRecIndex) { calls++; return TErrorCode::NotFound; }, 4, false, smallChunk);
+    EXPECT_EQ(TErrorCode::NotFound, res);
+    EXPECT_EQ(1u, calls);
+}
+
+TEST_P(MFTImgFileParserTest, DirectLoaderMatchesFileLoader)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader fldr(imgFileName);
+    TDirectImageRecordsLoader dldr(imgFileName);
+
+    uint32_t recSize = fldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* fRecBuf = (uint8_t*)alloca(recSize);
+    uint8_t* dRecBuf = (uint8_t*)alloca(recSize);
+
+    ASSERT_GE(dldr.GetAlignment(), DEFAULT_IO_ALIGNMENT);
+
+    // single records are smaller than alignment, they are read through pool buffer
+    for (MFT_REF mftRef{ 0 }; !fldr.Eof(mftRef.sId.low); mftRef.sId.low++)
+    {
+        auto fres = fldr.LoadMFTRecord(mftRef, fRecBuf);
+        auto dres = dldr.LoadMFTRecord(mftRef, dRecBuf);
+        ASSERT_EQ(fres, dres) << "MFT record " << mftRef.sId.low;
+
+        if (fres == TErrorCode::Success)
+            ASSERT_EQ(0, memcmp(fRecBuf, dRecBuf, recSize)) << "MFT record " << mftRef.sId.low;
+    }
+
+    // read bigger than pool buffer: straight into aligned buffer and split into pieces for unaligned one
+    fldr.SetClusterCacheBudget(0);
+    dldr.SetClusterCacheBudget(0);
+
+    uint32_t clusterSize = fldr.GetVolumeData().BytesPerCluster;
+    uint64_t clustersCnt = DEFAULT_ALIGNED_BUF_SIZE / clusterSize + 3;
+    uint64_t bytesCnt = clustersCnt * clusterSize;
+
+    // buffers are freed when ASSERT_* below returns from the test
+    auto fClusterBufPtr = std::make_unique<uint8_t[]>(bytesCnt);
+    std::unique_ptr<uint8_t, decltype(&_aligned_free)> dClusterBufPtr((uint8_t*)_aligned_malloc(bytesCnt + 8, dldr.GetAlignment()), &_aligned_free);
+    ASSERT_NE(nullptr, dClusterBufPtr);
+    uint8_t* fClusterBuf = fClusterBufPtr.get();
+    uint8_t* dClusterBuf = dClusterBufPtr.get();
+
+    ASSERT_EQ(TErrorCode::Success, fldr.ReadClusters(0, clustersCnt, fClusterBuf));
+    ASSERT_EQ(TErrorCode::Success, dldr.ReadClusters(0, clustersCnt, dClusterBuf));
+    EXPECT_EQ(0, memcmp(fClusterBuf, dClusterBuf, bytesCnt));
+
+    memset(dClusterBuf, 0, bytesCnt + 8);
+    ASSERT_EQ(TErrorCode::Success, dldr.ReadClusters(0, clustersCnt, dClusterBuf + 8));
+    EXPECT_EQ(0, memcmp(fClusterBuf, dClusterBuf + 8, bytesCnt));
+
+    // sequential scan reads into aligned buffer
+    uint32_t fCount = 0, dCount = 0;
+    ASSERT_EQ(TErrorCode::Success, fldr.ScanMFTRecords([&fCount](MFT_FILE_RECORD*, MFTRecIndex) { fCount++; return TErrorCode::Success; }));
+    ASSERT_EQ(TErrorCode::Success, dldr.ScanMFTRecords([&dCount](MFT_FILE_RECORD*, MFTRecIndex) { dCount++; return TErrorCode::Success; }));
+    EXPECT_EQ(fCount, dCount);
+}
+
+TEST_P(MFTImgFileParserTest, SlabLoaderMatchesFileLoader)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    TSlabImageRecordsLoader sldr(imgFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* mftRecBuf1 = (uint8_t*)alloca(recSize);
+    uint8_t* mftRecBuf2 = (uint8_t*)alloca(recSize);
+
+    TMFTRecSlab& slab = sldr.GetSlab();
+    EXPECT_GT(slab.PresentCount(), 0u);
+    EXPECT_EQ(slab.PagesCount() * slab.PageSize(), slab.MemSize()); // all pages are loaded
+
+    MFT_REF ref{ 0 };
+    for (; !tldr.Eof(ref.sId.low); ref.sId.low++)
+    {
+        auto res1 = tldr.LoadMFTRecord(ref, mftRecBuf1);
+        auto res2 = sldr.LoadMFTRecord(ref, mftRecBuf2);
+        ASSERT_EQ(res1, res2) << "MFT record " << ref.sId.low;
+        EXPECT_EQ(res1 == TErrorCode::Success, slab.Test(ref.sId.low)) << "MFT record " << ref.sId.low;
+
+        if (res1 != TErrorCode::Success) continue;
+
+        EXPECT_EQ(0, memcmp(mftRecBuf1, mftRecBuf2, recSize)) << "MFT record " << ref.sId.low;
+
+        // zero-copy pointer into the slab, the same on every call
+        auto cached = sldr.LoadMFTRecordCache(ref);
+        ASSERT_TRUE(cached);
+        EXPECT_EQ(slab.GetRec(ref.sId.low), *cached);
+        EXPECT_EQ(0, memcmp(mftRecBuf1, *cached, recSize)) << "MFT record " << ref.sId.low;
+    }
+
+    EXPECT_EQ(TErrorCode::WrongMFTRecID, sldr.LoadMFTRecord(ref, mftRecBuf2));
+}
+
+TEST_P(MFTImgFileParserTest, ClusterCacheServesRepeatedReads)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader nocache;
+    nocache.SetClusterCacheBudget(0);
+    nocache.Open(imgFileName);
+    TFileImageRecordsLoader tldr(imgFileName);
+
+    uint32_t clusterSize = tldr.GetVolumeData().BytesPerCluster;
+    uint64_t mftLcn = tldr.GetVolumeData().MftStartLcn.QuadPart;
+
+    uint8_t* expected = (uint8_t*)alloca(8 * clusterSize);
+    uint8_t* actual = (uint8_t*)alloca(8 * clusterSize);
+
+    // overlapping ranges: second and third passes are partially and then completely served from the cache
+    for (uint32_t pass = 0; pass < 3; pass++)
+    {
+        for (uint64_t i = 0; i < 16; i++)
+        {
+            uint64_t lcn = mftLcn + (i * 3 + pass) % 24;
+            uint64_t cnt = 1 + (i + pass) % 8;
+
+            ASSERT_EQ(TErrorCode::Success, nocache.ReadClusters(lcn, cnt, expected));
+            ASSERT_EQ(TErrorCode::Success, tldr.ReadClusters(lcn, cnt, actual));
+            ASSERT_EQ(0, memcmp(expected, actual, cnt * clusterSize)) << "pass " << pass << " lcn " << lcn;
+        }
+    }
+
+    ASSERT_EQ(0u, nocache.GetClusterCache().Count());
+    ASSERT_GT(tldr.GetClusterCache().Hits(), 0u);
+    ASSERT_GT(tldr.GetClusterCache().Count(), 0u);
+
+    // directory listings that go through ProcessAllocDataRuns give the same results when served from the cache
+    TMFTBaseReader reader(tldr);
+    uint8_t* rootRec = (uint8_t*)alloca(tldr.GetVolumeData().BytesPerMFTRec);
+    ASSERT_EQ(TErrorCode::Success, tldr.LoadMFTRecord(MFT_REF{ MFT_ROOT_REC_ID }, rootRec));
+
+    TFileList list1, list2;
+    ASSERT_EQ(TErrorCode::Success, reader.GetFileListFromMFTRec((MFT_FILE_RECORD*)rootRec, list1));
+    ASSERT_EQ(TErrorCode::Success, reader.GetFileListFromMFTRec((MFT_FILE_RECORD*)rootRec, list2));
+    ASSERT_EQ(list1.Count(), list2.Count());
+    for (uint32_t i = 0; i < list1.Count(); i++)
+        EXPECT_EQ(list1[i].MFTRecID.sId.low, list2[i].MFTRecID.sId.low) << "item " << i;
+
+    tldr.Close();
+    ASSERT_EQ(0u, tldr.GetClusterCache().Count());
+}
+
+TEST_P(MFTImgFileParserTest, MFTBitmapMatchesInUseRecords)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    ASSERT_GT(tldr.GetMFTBitmap().BitsCount(), 0u);
+
+    uint8_t* mftRecBuf = (uint8_t*)alloca(tldr.GetVolumeData().BytesPerMFTRec);
+    MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)mftRecBuf;
+
+    MFTRecIndex recsCount = 0;
+    while (!tldr.Eof(recsCount)) recsCount++;
+
+    uint32_t allocated = 0;
+    for (MFT_REF ref{ 0 }; ref.sId.low < recsCount; ref.sId.low++)
+    {
+        bool inUse = (tldr.LoadMFTRecord(ref, mftRecBuf) == TErrorCode::Success) && (mftRec->Flags & MFT_FLAG_IN_USE);
+        // records in use are never marked as free, scans may skip free records safely
+        if (inUse) EXPECT_TRUE(tldr.IsRecordAllocated(ref.sId.low)) << "MFT record " << ref.sId.low;
+
+        if (tldr.IsRecordAllocated(ref.sId.low)) allocated++;
+
+        // NextAllocatedRecord/NextFreeRecord agree with IsRecordAllocated
+        MFTRecIndex next = tldr.NextAllocatedRecord(ref.sId.low);
+        EXPECT_EQ(tldr.IsRecordAllocated(ref.sId.low), next == ref.sId.low);
+        next = tldr.NextFreeRecord(ref.sId.low);
+        EXPECT_EQ(!tldr.IsRecordAllocated(ref.sId.low), next == ref.sId.low);
+    }
+
+    EXPECT_GT(allocated, 0u);
+    EXPECT_EQ(recsCount, tldr.NextAllocatedRecord(recsCount));
+}
+
+TEST_P(MFTImgFileParserTest, LoaderStatsCountCalls)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    tldr.GetStats().Clear(); // reads made by Open() are not counted below
+    tldr.SetRecCacheBudget(DEFAULT_REC_CACHE_BUDGET); // caches are emptied
+    tldr.SetClusterCacheBudget(DEFAULT_CLUSTER_CACHE_BUDGET);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint32_t clusterSize = tldr.GetVolumeData().BytesPerCluster;
+    uint8_t* mftRecBuf = (uint8_t*)alloca(recSize);
+    uint8_t* clusterBuf = (uint8_t*)alloca(clusterSize);
+
+    const uint32_t RECS_COUNT = 10;
+    for (MFT_REF ref{ 0 }; ref.sId.low < RECS_COUNT; ref.sId.low++)
+        ASSERT_EQ(TErrorCode::Success, tldr.LoadMFTRecord(ref, mftRecBuf));
+
+    // second call for the same record is served by records cache
+    ASSERT_TRUE(tldr.LoadMFTRecordCache(MFT_REF{ 0 }).has_value());
+    ASSERT_TRUE(tldr.LoadMFTRecordCache(MFT_REF{ 0 }).has_value());
+
+    // second read of the same cluster is served by clusters cache
+    uint64_t mftLcn = tldr.GetVolumeData().MftStartLcn.QuadPart;
+    ASSERT_EQ(TErrorCode::Success, tldr.ReadClusters(mftLcn, 1, clusterBuf));
+    ASSERT_EQ(TErrorCode::Success, tldr.ReadClusters(mftLcn, 1, clusterBuf));
+
+    LOADER_IO_STATS stats = tldr.GetIOStats();
+    const IO_CALL_STATS& loadRec = stats.Calls[(uint32_t)TIOCall::LoadMFTRecord];
+    const IO_CALL_STATS& loadRecCache = stats.Calls[(uint32_t)TIOCall::LoadMFTRecordCache];
+    const IO_CALL_STATS& readClusters = stats.Calls[(uint32_t)TIOCall::ReadClusters];
+
+    EXPECT_EQ(RECS_COUNT + 1, loadRec.Calls); // LoadMFTRecordCache miss loads the record by LoadMFTRecord
+    EXPECT_EQ((RECS_COUNT + 1) * recSize, loadRec.Bytes);
+    EXPECT_EQ(2u, loadRecCache.Calls);
+    EXPECT_EQ(2u * recSize, loadRecCache.Bytes);
+    EXPECT_EQ(2u, readClusters.Calls);
+    EXPECT_EQ(2u * clusterSize, readClusters.Bytes);
+
+    EXPECT_EQ(RECS_COUNT + 2, stats.Reads.Calls); // 11 records and one cluster went to disk
+    EXPECT_EQ(RECS_COUNT + 1, stats.Fixups.Calls);
+    EXPECT_EQ(0u, stats.UnknownOffsetReads);
+    EXPECT_GE(stats.SeekHist[0], RECS_COUNT - 2); // records #1..#9 follow each other on disk (unless $MFT is fragmented there)
+    EXPECT_GE(stats.RecCacheHits, 1u);
+    EXPECT_GE(stats.ClusterCacheHits, 1u);
+    EXPECT_GT(stats.LatencyPercentile(100), 0u);
+
+    // nothing is counted when stats are disabled
+    tldr.GetStats().SetEnabled(false);
+    ASSERT_EQ(TErrorCode::Success, tldr.LoadMFTRecord(MFT_REF{ 0 }, mftRecBuf));
+    EXPECT_EQ(RECS_COUNT + 1, tldr.GetIOStats().Calls[(uint32_t)TIOCall::LoadMFTRecord].Calls);
+}
+
+TEST_P(MFTImgFileParserTest, IOTraceRecordAndReplay)
+{
+    string_t imgFileName = GetParam();
+    string_t traceFileName = convert_string<char_t>(std::filesystem::temp_directory_path() / "MFTReaderTests.trace");
+
+    TFileImageRecordsLoader tldr(imgFileName);
+    tldr.GetStats().Clear();
+    tldr.SetRecCacheBudget(DEFAULT_REC_CACHE_BUDGET); // caches are emptied, every record below goes to disk
+    tldr.SetClusterCacheBudget(DEFAULT_CLUSTER_CACHE_BUDGET);
+    tldr.StartIOTrace(traceFileName);
+
+    uint32_t recSize = tldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* mftRecBuf = (uint8_t*)alloca(recSize);
+    const uint32_t RECS_COUNT = 10;
+    for (MFT_REF ref{ 0 }; ref.sId.low < RECS_COUNT; ref.sId.low++)
+        ASSERT_EQ(TErrorCode::Success, tldr.LoadMFTRecord(ref, mftRecBuf));
+
+    {
+        TIOTagScope tagScope(tldr, TIOTag::IndexBlock);
+        uint8_t* clusterBuf = (uint8_t*)alloca(tldr.GetVolumeData().BytesPerCluster);
+        ASSERT_EQ(TErrorCode::Success, tldr.ReadClusters(tldr.GetVolumeData().MftStartLcn.QuadPart, 1, clusterBuf));
+    }
+    ASSERT_EQ(TIOTag::Clusters, tldr.GetIOTag()); // scope restores previous tag
+
+    {
+        // tags are per thread, scope of another thread does not change tag of this one
+        TIOTagScope tagScope(tldr, TIOTag::AttrList);
+        TIOTag otherTag = TIOTag::Count;
+        std::thread([&]() { otherTag = tldr.GetIOTag(); TIOTagScope otherScope(tldr, TIOTag::Bitmap); }).join();
+        ASSERT_EQ(TIOTag::Clusters, otherTag);
+        ASSERT_EQ(TIOTag::AttrList, tldr.GetIOTag());
+    }
+    ASSERT_EQ(TIOTag::Clusters, tldr.GetIOTag());
+
+    uint32_t scanned = 0;
+    ASSERT_EQ(TErrorCode::Success, tldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { scanned++; return TErrorCode::Success; }));
+    ASSERT_GT(scanned, 0u);
+
+    uint64_t deviceReads = tldr.GetIOStats().Reads.Calls;
+    ASSERT_EQ(deviceReads, tldr.StopIOTrace()); // every device read is in the trace
+    ASSERT_FALSE(tldr.IsIOTracing());
+
+    IO_TRACE_HEADER header;
+    THArray<IO_TRACE_RECORD> records;
+    ASSERT_EQ(TErrorCode::Success, LoadIOTrace(traceFileName, header, records));
+    ASSERT_EQ(deviceReads, records.Count());
+    ASSERT_EQ(tldr.GetVolumeData().BytesPerCluster, header.BytesPerCluster);
+    ASSERT_EQ(recSize, header.BytesPerMFTRec);
+
+    for (uint32_t i = 0; i < RECS_COUNT; i++)
+    {
+        ASSERT_EQ((uint8_t)TIOTag::MFTRecord, records[i].Tag);
+        ASSERT_EQ(recSize, records[i].Length);
+        ASSERT_EQ((uint64_t)tldr.MFTRecIdToOffset(i), records[i].Offset);
+        if (i > 0) ASSERT_GE(records[i].Time, records[i - 1].Time);
+    }
+    ASSERT_EQ((uint8_t)TIOTag::IndexBlock, records[RECS_COUNT].Tag);
+    ASSERT_EQ(tldr.GetVolumeData().MftStartLcn.QuadPart * tldr.GetVolumeData().BytesPerCluster, records[RECS_COUNT].Offset);
+    for (uint32_t i = RECS_COUNT + 1; i < records.Count(); i++)
+        ASSERT_EQ((uint8_t)TIOTag::MFTRecord, records[i].Tag); // scan reads $MFT by chunks
+
+    // replay makes the same reads at the same offsets of the image
+    for (TReplayBackend backend : { TReplayBackend::File, TReplayBackend::Mapped, TReplayBackend::Direct, TReplayBackend::Async })
+    {
+        TLoaderStats stats;
+        IO_REPLAY_RESULT result;
+        ASSERT_EQ(TErrorCode::Success, ReplayIOTrace(records, imgFileName, tldr.GetPartitionOffset(), backend, DEFAULT_QUEUE_DEPTH, stats, result));
+        ASSERT_EQ(0u, result.Failed);
+        ASSERT_EQ(0u, result.Skipped);
+        ASSERT_EQ(records.Count(), result.Reads);
+        ASSERT_EQ(records.Count() - 1, result.TagReads[(uint32_t)TIOTag::MFTRecord]);
+        ASSERT_EQ(1u, result.TagReads[(uint32_t)TIOTag::IndexBlock]);
+
+        LOADER_IO_STATS ioStats;
+        stats.Snapshot(ioStats);
+        ASSERT_EQ(records.Count(), ioStats.Reads.Calls);
+    }
+
+    std::filesystem::remove(traceFileName);
+}
+
+TEST_P(MFTImgFileParserTest, LatencyLoaderDelaysReads)
+{
+    string_t imgFileName = GetParam();
+
+    const uint64_t READ_NS = 2'000'000;
+    TFileImageRecordsLoader fldr(imgFileName);
+    TLatencyLoader<TFileImageRecordsLoader> sldr(LATENCY_MODEL::Fixed(READ_NS, 0), imgFileName);
+    sldr.GetStats().Clear();
+
+    uint32_t recSize = fldr.GetVolumeData().BytesPerMFTRec;
+    uint8_t* fileRec = (uint8_t*)alloca(recSize);
+    uint8_t* slowRec = (uint8_t*)alloca(recSize);
+
+    const uint32_t RECS_COUNT = 5;
+    auto start = TLoaderStats::Now();
+    for (MFT_REF ref{ 0 }; ref.sId.low < RECS_COUNT; ref.sId.low++)
+    {
+        ASSERT_EQ(fldr.LoadMFTRecord(ref, fileRec), sldr.LoadMFTRecord(ref, slowRec));
+        ASSERT_EQ(0, memcmp(fileRec, slowRec, recSize));
+    }
+    ASSERT_GE(TLoaderStats::NanosecsSince(start), RECS_COUNT * READ_NS);
+
+    LOADER_IO_STATS stats = sldr.GetIOStats();
+    ASSERT_EQ(RECS_COUNT, stats.Reads.Calls);
+    ASSERT_GE(stats.LatencyPercentile(0), READ_NS * 7 / 8); // delays are in read latencies, percentiles are precise to 1/8
+
+    // delayed loader returns the same records
+    uint32_t fileCnt = 0, slowCnt = 0;
+    ASSERT_EQ(TErrorCode::Success, fldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { fileCnt++; return TErrorCode::Success; }));
+    ASSERT_EQ(TErrorCode::Success, sldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { slowCnt++; return TErrorCode::Success; }));
+    ASSERT_EQ(fileCnt, slowCnt);
+
+    // zero-copy records of mapped loader are delayed on the first access only
+    TLatencyLoader<TMappedImageRecordsLoader> mldr(LATENCY_MODEL::Fixed(READ_NS, 0), imgFileName);
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+        start = TLoaderStats::Now();
+        for (MFT_REF ref{ 0 }; ref.sId.low < RECS_COUNT; ref.sId.low++)
+        {
+            ASSERT_EQ(TErrorCode::Success, fldr.LoadMFTRecord(ref, fileRec));
+            auto mappedRec = mldr.LoadMFTRecordCache(ref);
+            ASSERT_TRUE(mappedRec);
+            ASSERT_EQ(0, memcmp(fileRec, mappedRec.value(), recSize));
+        }
+
+        if (pass == 0)
+            ASSERT_GE(TLoaderStats::NanosecsSince(start), RECS_COUNT * READ_NS);
+        else
+            ASSERT_LT(TLoaderStats::NanosecsSince(start), RECS_COUNT * READ_NS);
+    }
+}
+
+TEST_P(MFTImgFileParserTest, PrefetchKeepsReadersOutput)
+{
+    string_t imgFileName = GetParam();
+
+    TFileImageRecordsLoader fldr(imgFileName);
+    TLatencyLoader<TConcurrentImageRecordsLoader> sldr(LATENCY_MODEL::Fixed(200'000, 0), imgFileName);
+
+    // prefetch is not available when loader cannot be shared by threads
+    TMFTSearchReader noPrefetch(fldr);
+    ASSERT_FALSE(noPrefetch.SetPrefetch(true));
+    ASSERT_EQ(nullptr, noPrefetch.GetPrefetcher());
+
+    // ReadDirectoryV1
+    TMFTSearchReader fileRdr(fldr);
+    TMFTSearchReader prefRdr(sldr);
+    ASSERT_TRUE(prefRdr.SetPrefetch(true, 64));
+
+    uint64_t fileDirSize{ 0 }, prefDirSize{ 0 };
+    ASSERT_EQ(TErrorCode::Success, fileRdr.ReadDirectoryV1(0, nullptr, fileDirSize, nullptr));
+    ASSERT_EQ(TErrorCode::Success, prefRdr.ReadDirectoryV1(0, nullptr, prefDirSize, nullptr));
+    EXPECT_EQ(fileDirSize, prefDirSize);
+
+    ASSERT_EQ(fileRdr.FFileList.LevelsCount(), prefRdr.FFileList.LevelsCount());
+    for (uint32_t lv = 0; lv < fileRdr.FFileList.LevelsCount(); lv++)
+    {
+        auto fileLevel = fileRdr.FFileList.GetLevel(lv);
+        auto prefLevel = prefRdr.FFileList.GetLevel(lv);
+        ASSERT_EQ(fileLevel->Count(), prefLevel->Count());
+
+        CACHE_ITEM* fileItem = (fileLevel->Count() > 0) ? fileLevel->GetValue(0) : nullptr;
+        CACHE_ITEM* prefItem = (prefLevel->Count() > 0) ? prefLevel->GetValue(0) : nullptr;
+        for (uint32_t i = 0; i < fileLevel->Count(); i++)
+        {
+            ASSERT_EQ(fileItem->FMFTRecID.Id, prefItem->FMFTRecID.Id);
+            ASSERT_EQ(fileItem->FParent, prefItem->FParent);
+            ASSERT_EQ(fileItem->FFilesCount, prefItem->FFilesCount);
+            fileItem = fileLevel->Next(fileItem);
+            prefItem = prefLevel->Next(prefItem);
+        }
+    }
+
+    PREFETCH_STATS stats = prefRdr.GetPrefetcher()->GetStats();
+    EXPECT_GT(stats.Pushed, 0u);
+    EXPECT_GT(stats.Hits + stats.LateHits, 0u);
+    EXPECT_LE(stats.MaxDepth, 64u);
+    prefRdr.SetPrefetch(false);
+
+    // ReadMftItems
+    TMFTStatCollector fileStat(fldr);
+    TMFTStatCollector prefStat(sldr);
+    ASSERT_TRUE(prefStat.SetPrefetch(true));
+
+    MFT_REF startId{ 0 };
+    startId.Id = MFT_ROOT_REC_ID;
+    ASSERT_EQ(TErrorCode::Success, fileStat.ReadMftItems(startId, nullptr, 0, nullptr));
+    ASSERT_EQ(TErrorCode::Success, prefStat.ReadMftItems(startId, nullptr, 0, nullptr));
+
+    auto& fileItems = fileStat.GetItemsList();
+    auto& prefItems = prefStat.GetItemsList();
+    ASSERT_EQ(fileItems.Count(), prefItems.Count());
+    for (uint32_t i = 0; i < fileItems.Count(); i++)
+    {
+        ASSERT_EQ(fileItems[i].MFTRecID.Id, prefItems[i].MFTRecID.Id);
+        ASSERT_EQ(fileItems[i].FilesCount, prefItems[i].FilesCount);
+    }
+
+    stats = prefStat.GetPrefetcher()->GetStats();
+    EXPECT_GT(stats.Hits + stats.LateHits, 0u);
+    EXPECT_GE(stats.Issued, stats.Hits + stats.LateHits);
+}
+
+TEST_P(MFTImgFileParserTest, SnapshotLoaderMatchesImage)
+{
+    string_t imgFileName = GetParam();
+    string_t snapshotFileName = convert_string<char_t>(std::filesystem::temp_directory_path() / "MFTReaderTests.mfts");
+
+    TFileImageRecordsLoader fldr(imgFileName);
+    uint32_t recSize = fldr.GetVolumeData().BytesPerMFTRec;
+
+    uint64_t scanned = 0;
+    ASSERT_EQ(TErrorCode::Success, fldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { scanned++; return TErrorCode::Success; }));
+
+    for (bool compress : { false, true })
+    {
+        MFT_SNAPSHOT_INFO info;
+        ASSERT_EQ(TErrorCode::Success, WriteMFTSnapshot(fldr, snapshotFileName, compress, info));
+        ASSERT_TRUE(IsMFTSnapshotFile(snapshotFileName));
+        ASSERT_FALSE(IsMFTSnapshotFile(imgFileName));
+        EXPECT_EQ(scanned, info.Records);
+        EXPECT_EQ(scanned * recSize, info.RawBytes);
+        EXPECT_EQ(std::filesystem::file_size(snapshotFileName), info.FileBytes);
+        if (compress) EXPECT_LT(info.FileBytes, info.RawBytes);
+
+        {
+            TSnapshotRecordsLoader sldr(snapshotFileName);
+            ASSERT_EQ(compress, sldr.IsCompressed());
+            ASSERT_TRUE(sldr.HasSource()); // snapshot keeps path to the image, index blocks are read from there
+            ASSERT_EQ(fldr.GetRecordsCount(), sldr.GetRecordsCount());
+            ASSERT_EQ(fldr.GetMetaFilesCount(), sldr.GetMetaFilesCount());
+            ASSERT_EQ(fldr.GetVolumeData().BytesPerCluster, sldr.GetVolumeData().BytesPerCluster);
+            ASSERT_EQ(fldr.GetVolumeData().Name, sldr.GetVolumeData().Name);
+            ASSERT_EQ(fldr.GetMFTBitmap().Count(), sldr.GetMFTBitmap().Count());
+
+            // every record scanned from the image is in snapshot byte to byte, other ones are not in use
+            uint8_t* fileRec = (uint8_t*)alloca(recSize);
+            uint8_t* snapRec = (uint8_t*)alloca(recSize);
+            for (MFTRecIndex id = 0; id < fldr.GetRecordsCount(); id++)
+            {
+                MFT_REF ref{ id };
+                TErrorCode fres = fldr.LoadMFTRecord(ref, fileRec);
+                TErrorCode sres = sldr.LoadMFTRecord(ref, snapRec);
+                if (fres == TErrorCode::Success && fldr.IsRecordAllocated(id))
+                {
+                    ASSERT_EQ(TErrorCode::Success, sres) << "MFT record " << id;
+                    ASSERT_EQ(0, memcmp(fileRec, snapRec, recSize)) << "MFT record " << id;
+                }
+                else
+                {
+                    ASSERT_EQ(TErrorCode::MFTRecordNotInUse, sres) << "MFT record " << id;
+                }
+            }
+
+            MFT_REF outOfRange{ (MFTRecIndex)fldr.GetRecordsCount() };
+            EXPECT_EQ(TErrorCode::WrongMFTRecID, sldr.LoadMFTRecord(outOfRange, snapRec));
+
+            uint64_t snapScanned = 0;
+            MFTRecIndex prevId = 0;
+            ASSERT_EQ(TErrorCode::Success, sldr.ScanMFTRecords([&](MFT_FILE_RECORD* rec, MFTRecIndex id)
+                {
+                    EXPECT_TRUE((snapScanned == 0) || (id > prevId));
+                    EXPECT_TRUE(ntfs_is_file_recp(rec->RecHeader.Signature));
+                    prevId = id;
+                    snapScanned++;
+                    return TErrorCode::Success;
+                }));
+            EXPECT_EQ(scanned, snapScanned);
+
+            // readers work on snapshot as on the image itself
+            TMFTStatCollector fileStat(fldr);
+            TMFTStatCollector snapStat(sldr);
+            MFT_REF startId{ 0 };
+            startId.Id = MFT_ROOT_REC_ID;
+            ASSERT_EQ(TErrorCode::Success, fileStat.ReadMftItems(startId, nullptr, 0, nullptr));
+            ASSERT_EQ(TErrorCode::Success, snapStat.ReadMftItems(startId, nullptr, 0, nullptr));
+
+            auto& fileItems = fileStat.GetItemsList();
+            auto& snapItems = snapStat.GetItemsList();
+            ASSERT_EQ(fileItems.Count(), snapItems.Count());
+            for (uint32_t i = 0; i < fileItems.Count(); i++)
+            {
+                ASSERT_EQ(fileItems[i].MFTRecID.Id, snapItems[i].MFTRecID.Id);
+                ASSERT_EQ(fileItems[i].FilesCount, snapItems[i].FilesCount);
+            }
+        }
+
+        std::filesystem::remove(snapshotFileName);
+    }
+}
+
+// attribute range must return the same attributes as FillAttrCollection, order of attributes from extension records may differ
+template<uint32_t Mask>
+static void CheckAttrRange(TMFTBaseReader& reader, MFT_FILE_RECORD* mftRec)
+{
+    TAttrCollection collection;
+    ASSERT_EQ(TErrorCode::Success, reader.FillAttrCollection(mftRec, Mask, collection)) << "MFT record " << mftRec->IndexMFTRec;
+
+    THArray<MFT_ATTR_HEADER*> expected;
+    for (uint32_t t = 0; t < ATTR_TYPE_CNT; t++)
+        for (auto attr : collection.Get((ATTR_TYPE)(t << 4)))
+            expected.AddValue(attr);
+
+    TAttrRange<Mask> range(reader, mftRec);
+    uint32_t count = 0;
+    for (auto attr : range)
+    {
+        ASSERT_NE(ATTR_LIST_ATTR, attr->AttrType);
+        ASSERT_TRUE((MakeAttrBitmask(attr->AttrType) & Mask) != 0);
+        ASSERT_NE(-1, expected.IndexOf(attr)) << "MFT record " << mftRec->IndexMFTRec << ", attribute " << AttrName(attr->AttrType);
+        count++;
+    }
+
+    ASSERT_EQ(TErrorCode::Success, range.Result());
+    ASSERT_EQ(expected.Count(), count) << "MFT record " << mftRec->IndexMFTRec;
+}
+
+TEST_P(MFTImgFileParserTest, AttrRangeMatchesAttrCollection)
+{
+    string_t imgFileName = GetParam();
+    TFileImageRecordsLoader ldr(imgFileName);
+    TMFTBaseReader reader(ldr);
+
+    ASSERT_EQ(TErrorCode::Success, ldr.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex)
+        {
+            if ((mftRec->Flags & MFT_FLAG_IN_USE) == 0) return TErrorCode::Success;
+
+            // extension records are checked as part of their base records
+            if (mftRec->ParentFileRec.Id != 0) return TErrorCode::Success;
+
+            CheckAttrRange<ALL_ATTRS_FILTER>(reader, mftRec);
+            CheckAttrRange<MakeAttrBitmask(ATTR_FILENAME)>(reader, mftRec);
+            CheckAttrRange<MakeAttrBitmask(ATTR_DATA) | MakeAttrBitmask(ATTR_ALLOC)>(reader, mftRec);
+            return HasFatalFailure() ? TErrorCode::CorruptedData : TErrorCode::Success;
+        }));
+}
+
+TEST_P(MFTImgFileParserTest, RecordTableMatchesAttrCollection)
+{
+    string_t imgFileName = GetParam();
+    TFileImageRecordsLoader ldr(imgFileName);
+    TMFTBaseReader reader(ldr);
+
+    TMFTRecordTable table;
+    ASSERT_EQ(TErrorCode::Success, table.Build(ldr));
+    ASSERT_GT(table.RowsCount(), 0u);
+    ASSERT_EQ(table.NameOffset.Count(), table.NamesTotal());
+
+    for (uint32_t row = 1; row < table.RowsCount(); row++)
+        ASSERT_LT(table.RecID[row - 1], table.RecID[row]); // rows go in order of MFT record numbers
+
+    uint32_t baseRecords = 0;
+    ASSERT_EQ(TErrorCode::Success, ldr.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            if ((mftRec->Flags & MFT_FLAG_IN_USE) == 0) return TErrorCode::Success;
+            if (mftRec->ParentFileRec.Id != 0) return TErrorCode::Success;
+            baseRecords++;
+
+            uint32_t row = table.RowOf(mftRecID);
+            EXPECT_NE(TABLE_NO_ROW, row) << "MFT record " << mftRecID;
+            if (row == TABLE_NO_ROW) return TErrorCode::CorruptedData;
+
+            EXPECT_EQ(mftRecID, table.RecID[row]);
+            EXPECT_EQ(mftRec->SeqNum, table.SeqNum[row]);
+            EXPECT_EQ(mftRec->HardLinksCnt, table.HardLinks[row]);
+            EXPECT_EQ((mftRec->Flags & MFT_FLAG_IS_DIRECTORY) != 0, table.IsDir(row));
+
+            TAttrCollection collection;
+            EXPECT_EQ(TErrorCode::Success, reader.FillAttrCollection(mftRec, ALL_ATTRS_FILTER, collection));
+
+            // ATTR_LIST itself is not put into collection
+            for (uint32_t t = 0; t < ATTR_TYPE_CNT; t++)
+                if ((t << 4) != ATTR_LIST_ATTR)
+                    EXPECT_EQ(collection.Get((ATTR_TYPE)(t << 4)).Count(), table.AttrCounters[t][row]) << "MFT record " << mftRecID << ", attribute " << AttrTypeNames[t];
+
+            auto& fileNames = collection.Get(ATTR_FILENAME);
+            EXPECT_EQ(fileNames.Count(), table.NamesCount[row]) << "MFT record " << mftRecID;
+            for (auto attr : fileNames)
+            {
+                ATTR_FILE_NAME* fileName = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
+                std::wstring_view name(GetFName(fileName), fileName->FileNameLen);
+
+                bool found = false;
+                for (uint32_t i = 0; (i < table.NamesTotal()) && !found; i++)
+                    found = (table.NameRow[i] == row) && (table.NameParent[i].Id == fileName->ParentDir.Id) &&
+                        (table.NameType[i] == fileName->NameType) && (table.Name(i) == name);
+                EXPECT_TRUE(found) << "MFT record " << mftRecID << ", name type " << (uint32_t)fileName->NameType;
+            }
+
+            if (table.MainName[row] != TABLE_NO_NAME)
+            {
+                EXPECT_EQ(row, table.NameRow[table.MainName[row]]);
+                EXPECT_NE(FILE_NAME_DOS, table.NameType[table.MainName[row]]);
+            }
+
+            return HasFailure() ? TErrorCode::CorruptedData : TErrorCode::Success;
+        }));
+
+    ASSERT_EQ(baseRecords, table.RowsCount());
+}
+
+// attributes of the same records collected with and without extension index must be equal byte by byte
+static void CompareAttrCollections(TAttrCollection& expected, TAttrCollection& actual, MFTRecIndex mftRecID)
+{
+    for (uint32_t t = 0; t < ATTR_TYPE_CNT; t++)
+    {
+        auto& exp = expected.Get((ATTR_TYPE)(t << 4));
+        auto& act = actual.Get((ATTR_TYPE)(t << 4));
+        ASSERT_EQ(exp.Count(), act.Count()) << "MFT record " << mftRecID << ", attribute " << AttrTypeNames[t];
+
+        for (uint32_t i = 0; i < exp.Count(); i++)
+        {
+            ASSERT_EQ(exp[i]->AttrSize, act[i]->AttrSize);
+            ASSERT_EQ(0, memcmp(exp[i], act[i], exp[i]->AttrSize)) << "MFT record " << mftRecID << ", attribute " << AttrTypeNames[t];
+        }
+    }
+}
+
+TEST_P(MFTImgFileParserTest, ExtIndexResolvesAttrListWithoutLoads)
+{
+    string_t imgFileName = GetParam();
+    TFileImageRecordsLoader ldr(imgFileName);
+    TMFTBaseReader reader(ldr);
+    uint32_t recSize = ldr.GetVolumeData().BytesPerMFTRec;
+
+    TMFTRecordTable table;
+    TExtRecordIndex extIndex;
+    ASSERT_EQ(TErrorCode::Success, table.Build(ldr, &extIndex));
+
+    // index built by its own pass must be the same
+    TExtRecordIndex extIndex2;
+    ASSERT_EQ(TErrorCode::Success, extIndex2.Build(ldr));
+    ASSERT_EQ(extIndex.Count(), extIndex2.Count());
+
+    uint32_t extRecords = 0;
+    THArray<uint8_t> baseRecs; // base records that have ATTR_LIST
+    ASSERT_EQ(TErrorCode::Success, ldr.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            if ((mftRec->Flags & MFT_FLAG_IN_USE) == 0) return TErrorCode::Success;
+
+            if (mftRec->ParentFileRec.Id != 0)
+            {
+                extRecords++;
+                MFT_REF ref{ mftRecID };
+                MFT_FILE_RECORD* extRec = extIndex.Find(ref);
+                EXPECT_NE(nullptr, extRec) << "MFT record " << mftRecID;
+                if (extRec != nullptr) EXPECT_EQ(0, memcmp(mftRec, extRec, recSize)) << "MFT record " << mftRecID;
+
+                bool listed = false;
+                for (uint32_t slot : extIndex.ExtensionsOf(mftRec->ParentFileRec.sId.low))
+                    listed = listed || (extIndex.Record(slot)->IndexMFTRec == mftRecID);
+                EXPECT_TRUE(listed) << "MFT record " << mftRecID;
+            }
+            else
+            {
+                uint32_t row = table.RowOf(mftRecID);
+                if ((row != TABLE_NO_ROW) && (table.AttrCounters[MATI(ATTR_LIST_ATTR)][row] > 0))
+                {
+                    uint32_t offset = baseRecs.Count();
+                    baseRecs.SetCount(offset + recSize);
+                    memcpy(baseRecs.GetValuePointer(offset), mftRec, recSize);
+                }
+            }
+
+            return HasFailure() ? TErrorCode::CorruptedData : TErrorCode::Success;
+        }));
+
+    ASSERT_EQ(extRecords, extIndex.Count());
+    MFT_REF missing{ (MFTRecIndex)ldr.GetRecordsCount() };
+    ASSERT_EQ(nullptr, extIndex.Find(missing));
+
+    uint32_t baseCount = baseRecs.Count() / recSize;
+    std::vector<std::unique_ptr<TAttrCollection>> indexed;
+
+    // ATTR_LIST entries are resolved by the index, no extension record is loaded
+    reader.SetExtIndex(&extIndex);
+    ldr.GetStats().Clear();
+    for (uint32_t i = 0; i < baseCount; i++)
+    {
+        MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)baseRecs.GetValuePointer(i * recSize);
+        indexed.push_back(std::make_unique<TAttrCollection>());
+        ASSERT_EQ(TErrorCode::Success, reader.FillAttrCollection(mftRec, ALL_ATTRS_FILTER, *indexed[i]));
+    }
+    LOADER_IO_STATS stats = ldr.GetIOStats();
+    EXPECT_EQ(0u, stats.Calls[(uint32_t)TIOCall::LoadMFTRecordCache].Calls);
+    EXPECT_EQ(0u, stats.Calls[(uint32_t)TIOCall::LoadMFTRecord].Calls);
+
+    reader.SetExtIndex(nullptr);
+    for (uint32_t i = 0; i < baseCount; i++)
+    {
+        MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)baseRecs.GetValuePointer(i * recSize);
+        TAttrCollection loaded;
+        ASSERT_EQ(TErrorCode::Success, reader.FillAttrCollection(mftRec, ALL_ATTRS_FILTER, loaded));
+        CompareAttrCollections(loaded, *indexed[i], mftRec->IndexMFTRec);
+    }
+}
+
+// converts raw image into dynamic VHD, blocks that contain only zeros are left unallocated. Returns number of allocated blocks.
+static uint32_t WriteDynamicVHD(const string_t& rawFileName, const string_t& vhdFileName, uint32_t blockSize)
+{
+    std::ifstream raw(std::filesystem::path(rawFileName), std::ios::binary);
+    std::ofstream vhd(std::filesystem::path(vhdFileName), std::ios::binary | std::ios::trunc);
+
+    uint64_t diskSize = std::filesystem::file_size(rawFileName);
+    uint32_t entries = (uint32_t)((diskSize + blockSize - 1) / blockSize);
+    uint32_t batSize = (entries * sizeof(uint32_t) + VHD_SECTOR_SIZE - 1) / VHD_SECTOR_SIZE * VHD_SECTOR_SIZE;
+    uint32_t bitmapSize = (blockSize / VHD_SECTOR_SIZE / 8 + VHD_SECTOR_SIZE - 1) / VHD_SECTOR_SIZE * VHD_SECTOR_SIZE;
+    uint64_t tableOffset = VHD_FOOTER_SIZE + sizeof(VHD_DYNAMIC_HEADER);
+
+    VHD_FOOTER footer{ 0 };
+    memcpy(footer.Cookie, "conectix", sizeof(footer.Cookie));
+    footer.Features = std::byteswap(2u);
+    footer.FileFormatVersion = std::byteswap(0x00010000u);
+    footer.DataOffset = std::byteswap((uint64_t)VHD_FOOTER_SIZE);
+    footer.OriginalSize = footer.CurrentSize = std::byteswap(diskSize);
+    footer.DiskType = std::byteswap(3u); // dynamic
+    uint32_t checksum = 0;
+    for (uint32_t i = 0; i < sizeof(footer); i++) checksum += ((uint8_t*)&footer)[i];
+    footer.Checksum = std::byteswap(~checksum);
+
+    VHD_DYNAMIC_HEADER header{ 0 };
+    memcpy(header.Cookie, "cxsparse", sizeof(header.Cookie));
+    header.DataOffset = UINT64_MAX;
+    header.TableOffset = std::byteswap(tableOffset);
+    header.HeaderVersion = std::byteswap(0x00010000u);
+    header.MaxTableEntries = std::byteswap(entries);
+    header.BlockSize = std::byteswap(blockSize);
+
+    std::vector<uint32_t> bat(batSize / sizeof(uint32_t), UINT32_MAX);
+    std::vector<uint8_t> block(blockSize);
+    std::vector<uint8_t> bitmap(bitmapSize, 0xFF);
+    uint64_t nextOffset = tableOffset + batSize;
+    uint32_t allocated = 0;
+
+    // blocks go right after BAT, BAT itself is written when all of them are in place
+    vhd.seekp(nextOffset);
+    for (uint32_t i = 0; i < entries; i++)
+    {
+        std::fill(block.begin(), block.end(), (uint8_t)0);
+        raw.read((char*)block.data(), blockSize);
+        raw.clear(); // last block may be partial
+
+        if (std::all_of(block.begin(), block.end(), [](uint8_t b) { return b == 0; })) continue;
+
+        bat[i] = std::byteswap((uint32_t)(nextOffset / VHD_SECTOR_SIZE));
+        vhd.write((const char*)bitmap.data(), bitmapSize);
+        vhd.write((const char*)block.data(), blockSize);
+        nextOffset += bitmapSize + blockSize;
+        allocated++;
+    }
+
+    vhd.write((const char*)&footer, sizeof(footer));
+    vhd.seekp(0);
+    vhd.write((const char*)&footer, sizeof(footer));
+    vhd.write((const char*)&header, sizeof(header));
+    vhd.write((const char*)bat.data(), batSize);
+
+    return allocated;
+}
+
+TEST_P(MFTImgFileParserTest, DynamicVHDMatchesRawImage)
+{
+    string_t imgFileName = GetParam();
+    string_t vhdFileName = convert_string<char_t>(std::filesystem::temp_directory_path() / "MFTReaderTests.vhd");
+    constexpr uint32_t blockSize = 64 * 1024;
+    uint32_t allocated = WriteDynamicVHD(imgFileName, vhdFileName, blockSize);
+
+    {
+        TFileImageRecordsLoader fldr(imgFileName);
+        TFileImageRecordsLoader vldr(vhdFileName);
+        TMappedImageRecordsLoader mldr(vhdFileName);
+        uint32_t recSize = fldr.GetVolumeData().BytesPerMFTRec;
+        uint32_t clusterSize = fldr.GetVolumeData().BytesPerCluster;
+
+        const TDiskContainer& container = vldr.GetContainer();
+        ASSERT_EQ(TDiskFormat::Raw, fldr.GetContainer().GetFormat());
+        ASSERT_EQ(TDiskFormat::DynamicVHD, container.GetFormat());
+        ASSERT_FALSE(container.IsFlat());
+        ASSERT_EQ(std::filesystem::file_size(imgFileName), container.GetDiskSize());
+        ASSERT_EQ(blockSize, container.GetBlockSize());
+        ASSERT_EQ(allocated, container.GetAllocatedBlocks());
+        ASSERT_EQ(fldr.GetPartitionOffset(), vldr.GetPartitionOffset());
+        ASSERT_EQ(fldr.GetRecordsCount(), vldr.GetRecordsCount());
+        ASSERT_EQ(fldr.GetRecordsCount(), mldr.GetRecordsCount());
+
+        uint8_t* fileRec = (uint8_t*)alloca(recSize);
+        uint8_t* vhdRec = (uint8_t*)alloca(recSize);
+        for (MFTRecIndex id = 0; id < fldr.GetRecordsCount(); id++)
+        {
+            MFT_REF ref{ id };
+            TErrorCode fres = fldr.LoadMFTRecord(ref, fileRec);
+            ASSERT_EQ(fres, vldr.LoadMFTRecord(ref, vhdRec)) << "MFT record " << id;
+            if (fres == TErrorCode::Success) ASSERT_EQ(0, memcmp(fileRec, vhdRec, recSize)) << "MFT record " << id;
+
+            ASSERT_EQ(fres, mldr.LoadMFTRecord(ref, vhdRec)) << "MFT record " << id;
+            if (fres == TErrorCode::Success) ASSERT_EQ(0, memcmp(fileRec, vhdRec, recSize)) << "MFT record " << id;
+
+            auto cached = mldr.LoadMFTRecordCache(ref);
+            ASSERT_EQ(fres == TErrorCode::Success, cached.has_value()) << "MFT record " << id;
+            if (cached) ASSERT_EQ(0, memcmp(fileRec, (uint8_t*)cached.value(), recSize)) << "MFT record " << id;
+        }
+
+        uint64_t scanned = 0, vhdScanned = 0;
+        ASSERT_EQ(TErrorCode::Success, fldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { scanned++; return TErrorCode::Success; }));
+        ASSERT_EQ(TErrorCode::Success, vldr.ScanMFTRecords([&](MFT_FILE_RECORD*, MFTRecIndex) { vhdScanned++; return TErrorCode::Success; }));
+        EXPECT_EQ(scanned, vhdScanned);
+
+        // clusters of the whole volume, reads cross block boundaries and go through unallocated blocks
+        constexpr uint64_t chunk = 48;
+        std::vector<uint8_t> fileBuf(chunk * clusterSize), vhdBuf(chunk * clusterSize);
+        uint64_t totalClusters = fldr.GetVolumeData().TotalClusters.QuadPart;
+        for (uint64_t lcn = 0; lcn < totalClusters; lcn += chunk)
+        {
+            uint64_t cnt = std::min<uint64_t>(chunk, totalClusters - lcn);
+            TErrorCode fres = fldr.ReadClusters(lcn, cnt, fileBuf.data());
+            ASSERT_EQ(fres, vldr.ReadClusters(lcn, cnt, vhdBuf.data())) << "LCN " << lcn;
+            if (fres == TErrorCode::Success) ASSERT_EQ(0, memcmp(fileBuf.data(), vhdBuf.data(), cnt * clusterSize)) << "LCN " << lcn;
+        }
+
+        if (allocated < container.GetBlocksCount()) EXPECT_GT(container.GetZeroBytes(), 0u);
+        EXPECT_EQ(TErrorCode::IOError, vldr.ReadClusters(container.GetDiskSize() / clusterSize + 1, 1, vhdBuf.data()));
+    }
+
+    std::filesystem::remove(vhdFileName);
+}
+
 TEST_P(MFTImgFileParserTest, DISABLED_ReadDiskImageRootAndGoSubDirs_WINAPI)
 {
     //string_t imgFileName = GetParam();
@@ -581,3 +1772,53 @@ TEST_P(MFTImgFileParserTest, MFTRecIdToOffset_1024)
     EXPECT_EQ(-1, TFileImageRecordsLoader::MFTRecIdToOffset(16, runs, CLUSTER_SIZE, DEFAULT_BYTES_PER_MFT_REC));
     EXPECT_EQ(-1, TFileImageRecordsLoader::MFTRecIdToOffset(100'000, runs, CLUSTER_SIZE, DEFAULT_BYTES_PER_MFT_REC));
 }
+
+TEST_P(MFTImgFileParserTest, MFTExtentMapLookups)
+{
+    const uint32_t CLUSTER_SIZE = 4096;
+    const uint32_t RECS_PER_CLUSTER = CLUSTER_SIZE / DEFAULT_BYTES_PER_MFT_REC;
+
+    TDataRuns runs;
+    runs.AddValue({ 8, 0, 5 });
+    runs.AddValue({ 1, 8, 999 });
+    runs.AddValue({ 3, 9, 44 });
+    runs.AddValue({ 2, 12, 7 });
+
+    TMFTExtentMap extents(runs, CLUSTER_SIZE, DEFAULT_BYTES_PER_MFT_REC);
+    ASSERT_EQ(4u, extents.Count());
+    ASSERT_EQ(14ull * RECS_PER_CLUSTER, extents.RecordsCount());
+    EXPECT_EQ(3ull * RECS_PER_CLUSTER, extents.ExtentRecsCount(2));
+    EXPECT_EQ(3ull, extents.ExtentClustersCount(2));
+
+    // brute force offsets calculation
+    THArray<int64_t> expected;
+    for (auto& rli : runs)
+        for (uint64_t i = 0; i < rli.len * RECS_PER_CLUSTER; i++)
+            expected.AddValue(rli.lcn * CLUSTER_SIZE + i * DEFAULT_BYTES_PER_MFT_REC);
+
+    // sequential access forward and backward
+    for (MFTRecIndex id = 0; id < expected.Count(); id++)
+        EXPECT_EQ(expected[id], extents.RecIdToOffset(id)) << "MFT record " << id;
+    for (MFTRecIndex id = expected.Count(); id > 0; id--)
+        EXPECT_EQ(expected[id - 1], extents.RecIdToOffset(id - 1)) << "MFT record " << id - 1;
+
+    // random access
+    for (MFTRecIndex id : { 40u, 0u, 33u, 8u, 55u, 31u, 32u, 36u, 1u, 47u })
+    {
+        EXPECT_EQ(expected[id], extents.RecIdToOffset(id)) << "MFT record " << id;
+        EXPECT_EQ(expected[id], TFileImageRecordsLoader::MFTRecIdToOffset(id, runs, CLUSTER_SIZE, DEFAULT_BYTES_PER_MFT_REC));
+    }
+
+    EXPECT_EQ(-1, extents.RecIdToOffset(expected.Count()));
+    EXPECT_EQ(-1, extents.RecIdToOffset(100'000));
+
+    // extents are truncated at the first run which length is not divisible by MFT record size
+    TMFTExtentMap truncated(runs, 512, DEFAULT_BYTES_PER_MFT_REC);
+    EXPECT_EQ(1u, truncated.Count());
+    EXPECT_EQ(4ull, truncated.RecordsCount());
+    EXPECT_EQ(-1, truncated.RecIdToOffset(4));
+
+    TMFTExtentMap empty;
+    EXPECT_EQ(0u, empty.Count());
+    EXPECT_EQ(-1, empty.RecIdToOffset(0));
+}
@@ -0,0 +1,325 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+// every thread waits for completion of its reads on its own event
+struct TThreadReadEvent
+{
+    HANDLE Event{ CreateEvent(nullptr, TRUE, FALSE, nullptr) };
+    ~TThreadReadEvent() { if (Event != nullptr) CloseHandle(Event); }
+};
+
+static thread_local TThreadReadEvent ThreadReadEvent;
+
+// handle for positional reads is opened first because TFileImageRecordsLoader::Open loads MFT record #0 via our InternalLoadMFTRecord
+void TConcurrentImageRecordsLoader::Open(const string_t& imgFileName)
+{
+    assert(!IsOpened());
+    assert(INVALID_HANDLE_VALUE == FHPosFile);
+
+    FHPosFile = CreateFile(imgFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    if (FHPosFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("TConcurrentImageRecordsLoader.CreateFile");
+
+    try
+    {
+        TFileImageRecordsLoader::Open(imgFileName);
+    }
+    catch (...)
+    {
+        CloseHandle(FHPosFile);
+        FHPosFile = INVALID_HANDLE_VALUE;
+        throw;
+    }
+
+    // ReadClusters initializes clusters cache on first use, it must not happen concurrently
+    SetClusterCacheBudget(FClusterCache.Budget());
+}
+
+void TConcurrentImageRecordsLoader::Close()
+{
+    // records returned by LoadMFTRecordCache become invalid here
+    TFileImageRecordsLoader::Close();
+    FConcurrentCache.Clear();
+
+    if (FHPosFile != INVALID_HANDLE_VALUE) CloseHandle(FHPosFile);
+    FHPosFile = INVALID_HANDLE_VALUE;
+}
+
+// pread-like read: offset is passed in OVERLAPPED, file pointer is not used
+TErrorCode TConcurrentImageRecordsLoader::ReadAt(uint64_t fileOffset, uint8_t* dataBuf, DWORD bytesToRead)
+{
+    if (ThreadReadEvent.Event == nullptr)
+    {
+        GET_LOGGER;
+        logger.Error("[ReadAt] Read completion event has not been created.");
+        return TErrorCode::IOError;
+    }
+
+    LARGE_INTEGER offset{ 0 };
+    offset.QuadPart = fileOffset;
+
+    OVERLAPPED overlapped{ 0 };
+    overlapped.Offset = offset.LowPart;
+    overlapped.OffsetHigh = offset.HighPart;
+    overlapped.hEvent = ThreadReadEvent.Event;
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(FHPosFile, dataBuf, bytesToRead, nullptr, &overlapped) && (GetLastError() != ERROR_IO_PENDING))
+        return TErrorCode::IOError;
+
+    if (!GetOverlappedResult(FHPosFile, &overlapped, &bytesRead, TRUE) || (bytesRead != bytesToRead))
+        return TErrorCode::IOError;
+
+    return TErrorCode::Success;
+}
+
+// offsets of virtual disk are translated by the container, allocated data of VHD/VHDX is still read by positional reads
+TErrorCode TConcurrentImageRecordsLoader::ReadDisk(uint64_t diskOffset, uint8_t* dataBuf, DWORD bytesToRead)
+{
+    return FContainer.ReadVia(diskOffset, dataBuf, bytesToRead,
+        [this](uint64_t fileOffset, uint8_t* buf, uint64_t size) { return ReadAt(fileOffset, buf, (DWORD)size); });
+}
+
+TErrorCode TConcurrentImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    assert(IsOpened());
+    assert(FRecordsCount > 0);
+
+    // check that MFT Rec ID is less than MFT table size
+    if (mftRecRef.sId.low >= FRecordsCount)
+        return TErrorCode::WrongMFTRecID;
+
+    auto offset = MFTRecIdToOffset(mftRecRef.sId.low);
+    if (offset == -1) return TErrorCode::WrongMFTRecID; // MFT rec ID is out of MFT bounds
+
+    assert(offset > 0); // offset>=0 must be
+
+    if (TErrorCode::Success != ReadDisk(FPartitionOffset + offset, mftRecData, FVolumeData.BytesPerMFTRec))
+        return TErrorCode::IOError;
+
+    // check that we've read record with proper signature
+    NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)mftRecData;
+    if (!ntfs_is_file_recp(mftRec->Signature)) // MFT rec must contain 'FILE' signature
+    {
+        if (!internalCall)
+        {
+            GET_LOGGER;
+            uint8_t* sign = mftRec->Signature;
+            logger.WarnFmt("[LoadMFTRecord] Signature 'FILE' has not been found in MFT record {}. Signature found: {}{}{}{}",
+                mftRecRef.sId.low, sign[0], sign[1], sign[2], sign[3]);
+        }
+        //record is inside MFT table but it does not contain 'FILE' signature - consider it as Not In Use
+        return TErrorCode::MFTRecordNotInUse;
+    }
+
+    return FixupUsaMFTRec(mftRec);
+}
+
+TErrorCode TConcurrentImageRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    assert(IsOpened());
+
+    uint64_t bytesToRead = lcnCnt * FVolumeData.BytesPerCluster;
+    assert(bytesToRead <= MAXDWORD);
+
+    TErrorCode res = ReadDisk(FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster, dataBuf, (DWORD)bytesToRead);
+    if (res != TErrorCode::Success)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("ReadClusters.ReadAt() has failed with error: {}", GetLastError());
+    }
+
+    return res;
+}
+
+// the same as IRecordsLoader::LoadMFTRecordCache but cache is safe for concurrent access.
+// two threads may load the same record at the same time, then only one copy goes to cache.
+expected_uintptr TConcurrentImageRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    assert(IsOpened());
+
+    uint8_t* result = FConcurrentCache.GetRec(mftRecRef.sId.low);
+    if (result != nullptr) return result;
+
+    uint8_t* mftRecBuf = DBG_NEW uint8_t[FVolumeData.BytesPerMFTRec];
+    TErrorCode res = LoadMFTRecord(mftRecRef, mftRecBuf);
+    if (res != TErrorCode::Success)
+    {
+        delete[] mftRecBuf;
+        return std::unexpected(res); // error loading MFT record
+    }
+
+    //we use mftRecRef.sId.low here because high part of mftRecRef.Id may change when MFT record is modified
+    return FConcurrentCache.AddRec(mftRecRef.sId.low, mftRecBuf);
+}
+
+// buffer for one chunk of parallel MFT scan. Filled by a reader thread, passed to pred by the calling thread.
+struct TScanSlot
+{
+    uint8_t* Data{ nullptr };
+    TBitField FixedUp; // status of records of the chunk after FixupMFTRecords
+    uint32_t Chunk{ 0 }; // index of the chunk that has been read into Data
+    TErrorCode Result{ TErrorCode::Success };
+
+    ~TScanSlot() { delete[] Data; }
+};
+
+// reader threads of ScanMFTRecordsParallel. destructor stops and joins them, also when pred throws,
+// so joinable threads are never destroyed and they do not outlive slots and chunks they use
+struct TScanReaders
+{
+    std::mutex& Lock;
+    std::condition_variable& SlotFreed;
+    bool& Stop;
+    std::vector<std::thread> Threads;
+
+    ~TScanReaders() { StopAndJoin(); }
+
+    // readers finish their current reads and exit
+    void StopAndJoin()
+    {
+        {
+            std::lock_guard<std::mutex> lk(Lock);
+            Stop = true;
+        }
+        SlotFreed.notify_all();
+
+        for (auto& thr : Threads)
+            if (thr.joinable()) thr.join();
+    }
+};
+
+TErrorCode TConcurrentImageRecordsLoader::ScanMFTRecordsParallel(ScanMFTRecordsPred pred, uint32_t threadsCount, bool ordered, uint32_t chunkSize)
+{
+    assert(IsOpened());
+
+    THArray<MFT_SCAN_CHUNK> chunks;
+    uint64_t bufClusters = PlanMFTScan(chunkSize, chunks);
+    if (chunks.Count() == 0) return TErrorCode::Success;
+
+    if (threadsCount == 0) threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    threadsCount = std::min(threadsCount, chunks.Count());
+
+    uint32_t slotsCount = threadsCount * SCAN_CHUNKS_PER_THREAD;
+    std::unique_ptr<TScanSlot[]> slots(DBG_NEW TScanSlot[slotsCount]);
+    THArray<uint32_t> freeSlots;  // slots that can be taken by readers
+    THArray<uint32_t> readySlots; // slots with read and fixed up chunks waiting for pred
+    for (uint32_t s = 0; s < slotsCount; s++)
+    {
+        slots[s].Data = DBG_NEW uint8_t[bufClusters * FVolumeData.BytesPerCluster];
+        freeSlots.AddValue(s);
+    }
+
+    std::mutex lock;
+    std::condition_variable slotFreed; // readers wait for a free slot
+    std::condition_variable slotReady; // calling thread waits for read chunks
+    uint32_t nextChunk = 0;
+    bool stop = false;
+
+    auto reader = [&]()
+        {
+            TIOTagScope tagScope(*this, TIOTag::MFTRecord); // tags are per thread
+
+            while (true)
+            {
+                uint32_t s;
+                {
+                    std::unique_lock<std::mutex> lk(lock);
+                    slotFreed.wait(lk, [&]() { return stop || (nextChunk >= chunks.Count()) || (freeSlots.Count() > 0); });
+                    if (stop || (nextChunk >= chunks.Count())) return;
+
+                    // chunks are taken in order and only together with a slot, 
+                    // so the chunk awaited by ordered delivery is always either being read or ready
+                    s = freeSlots.Pop();
+                    slots[s].Chunk = nextChunk++;
+                }
+
+                TScanSlot& slot = slots[s];
+                const MFT_SCAN_CHUNK& chunk = chunks[slot.Chunk];
+
+                slot.Result = DeviceReadClusters(chunk.LcnStart, chunk.LcnCnt, slot.Data); // ReadClusters writes error message to log file
+                if (slot.Result == TErrorCode::Success)
+                {
+                    uint32_t count = chunk.EndRecID - chunk.FirstRecID;
+                    TFixupTimer timer(FStats, count, (uint64_t)count * FVolumeData.BytesPerMFTRec);
+                    FixupMFTRecords(slot.Data + chunk.Skip, count, slot.FixedUp);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lk(lock);
+                    readySlots.AddValue(s);
+                }
+                slotReady.notify_one();
+            }
+        };
+
+    TScanReaders readers{ lock, slotFreed, stop };
+    try
+    {
+        for (uint32_t t = 0; t < threadsCount; t++)
+            readers.Threads.emplace_back(reader);
+    }
+    catch (const std::system_error& e)
+    {
+        GET_LOGGER;
+        logger.WarnFmt("[ScanMFTRecordsParallel] Only {} reader threads out of {} have been started: {}", readers.Threads.size(), threadsCount, e.what());
+    }
+
+    uint32_t corruptedCnt = 0;
+    TErrorCode result = readers.Threads.empty() ? TErrorCode::IOError : TErrorCode::Success;
+
+    for (uint32_t delivered = 0; (delivered < chunks.Count()) && (result == TErrorCode::Success); delivered++)
+    {
+        uint32_t s = 0;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            uint32_t pos = 0;
+            slotReady.wait(lk, [&]()
+                {
+                    for (pos = 0; pos < readySlots.Count(); pos++)
+                        if (!ordered || (slots[readySlots[pos]].Chunk == delivered)) return true;
+                    return false;
+                });
+
+            s = readySlots[pos];
+            readySlots.DeleteValue(pos);
+        }
+
+        TScanSlot& slot = slots[s];
+        const MFT_SCAN_CHUNK& chunk = chunks[slot.Chunk];
+
+        result = slot.Result;
+        if (result == TErrorCode::Success)
+            result = DeliverScanChunk(chunk, slot.Data + chunk.Skip, slot.FixedUp, pred, corruptedCnt);
+
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            freeSlots.AddValue(s);
+        }
+        slotFreed.notify_one();
+    }
+
+    // on error or when pred has stopped the scan readers finish their current reads and exit
+    readers.StopAndJoin();
+
+    if (corruptedCnt > 0)
+    {
+        GET_LOGGER;
+        logger.WarnFmt("[ScanMFTRecordsParallel] USA check failed for {} MFT records, they have been skipped.", corruptedCnt);
+    }
+
+    return result;
+}
@@ -0,0 +1,201 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+// alignment required for unbuffered reads from hFile: sector size of the device and alignment of buffer address.
+// DEFAULT_IO_ALIGNMENT is used when device reports smaller values or when they cannot be queried.
+static uint32_t QueryIOAlignment(HANDLE hFile)
+{
+    uint32_t alignment = DEFAULT_IO_ALIGNMENT;
+
+    FILE_STORAGE_INFO storageInfo{ 0 };
+    if (GetFileInformationByHandleEx(hFile, FileStorageInfo, &storageInfo, sizeof(storageInfo)))
+        alignment = std::max(alignment, (uint32_t)storageInfo.LogicalBytesPerSector);
+
+    FILE_ALIGNMENT_INFO alignmentInfo{ 0 };
+    if (GetFileInformationByHandleEx(hFile, FileAlignmentInfo, &alignmentInfo, sizeof(alignmentInfo)))
+        alignment = std::max(alignment, (uint32_t)alignmentInfo.AlignmentRequirement + 1); // AlignmentRequirement is a mask
+
+    assert((alignment & (alignment - 1)) == 0);
+    return alignment;
+}
+
+// unbuffered handle is opened first because TFileImageRecordsLoader::Open loads MFT record #0 via our InternalLoadMFTRecord
+void TDirectImageRecordsLoader::Open(const string_t& imgFileName)
+{
+    assert(!IsOpened());
+    assert(INVALID_HANDLE_VALUE == FHDirectFile);
+
+    FHDirectFile = CreateFile(imgFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+    if (FHDirectFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("TDirectImageRecordsLoader.CreateFile");
+
+    FAlignment = QueryIOAlignment(FHDirectFile);
+    FBufPool.Init(std::max(DEFAULT_ALIGNED_BUF_SIZE, FAlignment), FAlignment);
+
+    try
+    {
+        TFileImageRecordsLoader::Open(imgFileName);
+    }
+    catch (...)
+    {
+        CloseHandle(FHDirectFile);
+        FHDirectFile = INVALID_HANDLE_VALUE;
+        FBufPool.Clear();
+        throw;
+    }
+}
+
+void TDirectImageRecordsLoader::Close()
+{
+    TFileImageRecordsLoader::Close();
+    FBufPool.Clear();
+
+    if (FHDirectFile != INVALID_HANDLE_VALUE) CloseHandle(FHDirectFile);
+    FHDirectFile = INVALID_HANDLE_VALUE;
+}
+
+// offset, size and buffer must be aligned. Offset is passed in OVERLAPPED, for synchronous handle this is a positional read.
+// bytesRead may be less than bytesToRead at the end of the file.
+TErrorCode TDirectImageRecordsLoader::ReadDirect(uint64_t fileOffset, uint8_t* dataBuf, DWORD bytesToRead, DWORD& bytesRead)
+{
+    assert((((uint64_t)dataBuf | fileOffset | bytesToRead) & (FAlignment - 1)) == 0);
+
+    LARGE_INTEGER offset{ 0 };
+    offset.QuadPart = fileOffset;
+
+    OVERLAPPED overlapped{ 0 };
+    overlapped.Offset = offset.LowPart;
+    overlapped.OffsetHigh = offset.HighPart;
+
+    bytesRead = 0;
+    if (!ReadFile(FHDirectFile, dataBuf, bytesToRead, &bytesRead, &overlapped))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[ReadDirect] ReadFile() has failed with error: {}, offset {}, size {}", GetLastError(), fileOffset, bytesToRead);
+        return TErrorCode::IOError;
+    }
+
+    return TErrorCode::Success;
+}
+
+// reads any range of the image file into any buffer.
+// aligned requests go straight into dataBuf, unaligned ones are read by aligned pieces into pool buffer and copied from there.
+TErrorCode TDirectImageRecordsLoader::ReadAligned(uint64_t fileOffset, uint8_t* dataBuf, uint64_t bytesToRead)
+{
+    uint64_t mask = FAlignment - 1;
+    DWORD bytesRead = 0;
+
+    if ((((uint64_t)dataBuf | fileOffset | bytesToRead) & mask) == 0)
+    {
+        while (bytesToRead > 0)
+        {
+            DWORD piece = (DWORD)std::min<uint64_t>(bytesToRead, MAXDWORD & ~mask);
+            CH_ERR(ReadDirect(fileOffset, dataBuf, piece, bytesRead));
+            if (bytesRead != piece) return TErrorCode::IOError; // attempt to read outside of a file
+
+            dataBuf += piece;
+            fileOffset += piece;
+            bytesToRead -= piece;
+        }
+
+        return TErrorCode::Success;
+    }
+
+    uint8_t* bounceBuf = FBufPool.Acquire();
+    if (bounceBuf == nullptr)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[ReadAligned] Cannot allocate aligned buffer of {} bytes.", FBufPool.BufSize());
+        return TErrorCode::IOError;
+    }
+
+    TErrorCode res = TErrorCode::Success;
+    while (bytesToRead > 0)
+    {
+        uint64_t alignedOffset = fileOffset & ~mask;
+        uint32_t head = (uint32_t)(fileOffset - alignedOffset);
+        uint32_t piece = (uint32_t)std::min<uint64_t>(bytesToRead, FBufPool.BufSize() - head);
+        DWORD alignedSize = (DWORD)((head + piece + mask) & ~mask); // not bigger than BufSize() because it is multiple of alignment
+
+        res = ReadDirect(alignedOffset, bounceBuf, alignedSize, bytesRead);
+        if (res != TErrorCode::Success) break;
+        if (bytesRead < head + piece) // tail of the last sector may be beyond the end of file, needed bytes may not
+        {
+            res = TErrorCode::IOError;
+            break;
+        }
+
+        memcpy(dataBuf, bounceBuf + head, piece);
+        dataBuf += piece;
+        fileOffset += piece;
+        bytesToRead -= piece;
+    }
+
+    FBufPool.Release(bounceBuf);
+    return res;
+}
+
+// offsets of virtual disk are translated by the container, data blocks of VHD/VHDX are read unbuffered as well
+TErrorCode TDirectImageRecordsLoader::ReadDisk(uint64_t diskOffset, uint8_t* dataBuf, uint64_t bytesToRead)
+{
+    return FContainer.ReadVia(diskOffset, dataBuf, bytesToRead,
+        [this](uint64_t fileOffset, uint8_t* buf, uint64_t size) { return ReadAligned(fileOffset, buf, size); });
+}
+
+TErrorCode TDirectImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    assert(IsOpened());
+    assert(FRecordsCount > 0);
+
+    // check that MFT Rec ID is less than MFT table size
+    if (mftRecRef.sId.low >= FRecordsCount)
+        return TErrorCode::WrongMFTRecID;
+
+    auto offset = MFTRecIdToOffset(mftRecRef.sId.low);
+    if (offset == -1) return TErrorCode::WrongMFTRecID; // MFT rec ID is out of MFT bounds
+
+    assert(offset > 0); // offset>=0 must be
+
+    if (TErrorCode::Success != ReadDisk(FPartitionOffset + offset, mftRecData, FVolumeData.BytesPerMFTRec))
+        return TErrorCode::IOError;
+
+    // check that we've read record with proper signature
+    NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)mftRecData;
+    if (!ntfs_is_file_recp(mftRec->Signature)) // MFT rec must contain 'FILE' signature
+    {
+        if (!internalCall)
+        {
+            GET_LOGGER;
+            uint8_t* sign = mftRec->Signature;
+            logger.WarnFmt("[LoadMFTRecord] Signature 'FILE' has not been found in MFT record {}. Signature found: {}{}{}{}",
+                mftRecRef.sId.low, sign[0], sign[1], sign[2], sign[3]);
+        }
+        //record is inside MFT table but it does not contain 'FILE' signature - consider it as Not In Use
+        return TErrorCode::MFTRecordNotInUse;
+    }
+
+    return FixupUsaMFTRec(mftRec);
+}
+
+TErrorCode TDirectImageRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    assert(IsOpened());
+
+    TErrorCode res = ReadDisk(FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster, dataBuf, lcnCnt * FVolumeData.BytesPerCluster);
+    if (res != TErrorCode::Success)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("ReadClusters.ReadDisk() has failed, lcn {}, count {}", lcnStart, lcnCnt);
+    }
+
+    return res;
+}
@@ -0,0 +1,349 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include <bit>
+#include <array>
+#include "DiskContainer.h"
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+#define throw_format_exception(_what_) throw std::runtime_error(std::string("Virtual disk format is incorrect: ") + (_what_))
+
+// VHD_DISK_TYPE values of VHD footer
+constexpr uint32_t VHD_TYPE_FIXED = 2;
+constexpr uint32_t VHD_TYPE_DYNAMIC = 3;
+constexpr uint32_t VHD_TYPE_DIFFERENCING = 4;
+constexpr uint32_t VHD_UNUSED_BLOCK = UINT32_MAX;
+
+// VHDX BAT entry: state in bits 0-2, file offset in megabytes in bits 20-63
+constexpr uint64_t VHDX_BAT_STATE_MASK = 7;
+constexpr uint64_t VHDX_BAT_FULLY_PRESENT = 6;
+constexpr uint32_t VHDX_BAT_OFFSET_SHIFT = 20;
+constexpr uint32_t VHDX_HAS_PARENT = 2; // flag of file parameters metadata item
+
+static const GUID VHDX_BAT_REGION = { 0x2DC27766, 0xF623, 0x4200, { 0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08 } };
+static const GUID VHDX_METADATA_REGION = { 0x8B7CA206, 0x4790, 0x4B9A, { 0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E } };
+static const GUID VHDX_FILE_PARAMETERS = { 0xCAA16737, 0xFA36, 0x4D43, { 0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B } };
+static const GUID VHDX_VIRTUAL_DISK_SIZE = { 0x2FA54224, 0xCD1B, 0x4876, { 0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8 } };
+static const GUID VHDX_LOGICAL_SECTOR_SIZE = { 0x8141BF1D, 0xA96F, 0x4709, { 0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F } };
+
+const char_t* DiskFormatName(TDiskFormat format)
+{
+    switch (format)
+    {
+    case TDiskFormat::Raw: return _T("raw");
+    case TDiskFormat::FixedVHD: return _T("fixed VHD");
+    case TDiskFormat::DynamicVHD: return _T("dynamic VHD");
+    case TDiskFormat::VHDX: return _T("VHDX");
+    }
+    return _T("unknown");
+}
+
+// CRC-32C (Castagnoli) used by VHDX headers and region tables
+static constexpr auto CRC32C_TABLE = []
+    {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (uint32_t b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+static uint32_t Crc32c(const uint8_t* data, uint32_t size)
+{
+    uint32_t crc = UINT32_MAX;
+    for (uint32_t i = 0; i < size; i++) crc = CRC32C_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// checksum field of VHDX structures is at offset 4 and it is zero while checksum is calculated
+static bool CheckVHDXChecksum(uint8_t* data, uint32_t size)
+{
+    uint32_t checksum = *(uint32_t*)(data + 4);
+    *(uint32_t*)(data + 4) = 0;
+    bool res = (Crc32c(data, size) == checksum);
+    *(uint32_t*)(data + 4) = checksum;
+    return res;
+}
+
+TErrorCode TDiskContainer::ReadAt(uint64_t fileOffset, uint8_t* dataBuf, uint64_t size)
+{
+    while (size > 0)
+    {
+        // handle is synchronous, offset in OVERLAPPED makes the read positional, file pointer is not used
+        OVERLAPPED overlapped{ 0 };
+        overlapped.Offset = (DWORD)fileOffset;
+        overlapped.OffsetHigh = (DWORD)(fileOffset >> 32);
+
+        DWORD bytesToRead = (DWORD)std::min<uint64_t>(size, 1u << 30);
+        DWORD bytesRead = 0;
+        if (!ReadFile(FHFile, dataBuf, bytesToRead, &bytesRead, &overlapped) || (bytesRead != bytesToRead))
+        {
+            GET_LOGGER;
+            logger.ErrorFmt("[TDiskContainer] ReadFile() has failed with error: {}, offset {}, size {}", GetLastError(), fileOffset, bytesToRead);
+            return TErrorCode::IOError;
+        }
+
+        fileOffset += bytesRead;
+        dataBuf += bytesRead;
+        size -= bytesRead;
+    }
+
+    return TErrorCode::Success;
+}
+
+void TDiskContainer::ReadMeta(uint64_t fileOffset, void* dataBuf, uint32_t size)
+{
+    if (ReadAt(fileOffset, (uint8_t*)dataBuf, size) != TErrorCode::Success)
+        throw_winapi_exception("TDiskContainer.ReadFile");
+}
+
+void TDiskContainer::Open(HANDLE hFile)
+{
+    assert(hFile != INVALID_HANDLE_VALUE);
+    Close();
+
+    FHFile = hFile;
+
+    LARGE_INTEGER fileSize{ 0 };
+    if (!GetFileSizeEx(FHFile, &fileSize))
+        throw_winapi_exception("TDiskContainer.GetFileSizeEx");
+
+    if (!TryOpenVHDX(fileSize.QuadPart) && !TryOpenVHD(fileSize.QuadPart))
+    {
+        FFormat = TDiskFormat::Raw;
+        FDiskSize = fileSize.QuadPart;
+    }
+
+    if (FFormat != TDiskFormat::Raw)
+    {
+        GET_LOGGER;
+        logger.InfoFmt("Disk image is {} virtual disk, size {} bytes, {} of {} blocks allocated.", wtos(DiskFormatName(FFormat)), FDiskSize, FAllocatedBlocks, FBlocks.Count());
+    }
+}
+
+void TDiskContainer::Close()
+{
+    FHFile = INVALID_HANDLE_VALUE;
+    FFormat = TDiskFormat::Raw;
+    FDiskSize = 0;
+    FBlockSize = 0;
+    FSectorSize = 0;
+    FBlocks.Clear();
+    FAllocatedBlocks = 0;
+    FZeroBytes = 0;
+}
+
+// VHD footer is at the end of the file, dynamic disks have its copy at the beginning too
+bool TDiskContainer::TryOpenVHD(uint64_t fileSize)
+{
+    if (fileSize < VHD_FOOTER_SIZE) return false;
+
+    VHD_FOOTER footer;
+    ReadMeta(fileSize - VHD_FOOTER_SIZE, &footer, sizeof(footer));
+    if (memcmp(footer.Cookie, "conectix", sizeof(footer.Cookie)) != 0)
+    {
+        ReadMeta(0, &footer, sizeof(footer));
+        if (memcmp(footer.Cookie, "conectix", sizeof(footer.Cookie)) != 0) return false;
+    }
+
+    uint32_t diskType = std::byteswap(footer.DiskType);
+    FDiskSize = std::byteswap(footer.CurrentSize);
+
+    if (diskType == VHD_TYPE_FIXED)
+    {
+        if (FDiskSize > fileSize - VHD_FOOTER_SIZE) throw_format_exception("fixed VHD is shorter than its size");
+        FFormat = TDiskFormat::FixedVHD;
+        FSectorSize = VHD_SECTOR_SIZE;
+        return true;
+    }
+
+    if (diskType == VHD_TYPE_DIFFERENCING) throw std::runtime_error("Differencing VHD disks are not supported.");
+    if (diskType != VHD_TYPE_DYNAMIC) throw_format_exception(std::format("unknown VHD disk type {}", diskType));
+
+    VHD_DYNAMIC_HEADER header;
+    ReadMeta(std::byteswap(footer.DataOffset), &header, sizeof(header));
+    if (memcmp(header.Cookie, "cxsparse", sizeof(header.Cookie)) != 0) throw_format_exception("VHD dynamic header has not been found");
+
+    FBlockSize = std::byteswap(header.BlockSize);
+    uint32_t entries = std::byteswap(header.MaxTableEntries);
+    if ((FBlockSize == 0) || (FBlockSize % VHD_SECTOR_SIZE != 0) || (entries == 0) || ((uint64_t)entries * FBlockSize < FDiskSize))
+        throw_format_exception("VHD block allocation table does not cover the disk");
+
+    THArray<uint32_t> bat;
+    bat.SetCount(entries);
+    ReadMeta(std::byteswap(header.TableOffset), bat.GetValuePointer(0), entries * sizeof(uint32_t));
+
+    // sector bitmap of the block goes before block data, it is padded to sector size.
+    // bitmap is not used: sectors that have never been written in allocated block of dynamic disk contain zeros
+    uint32_t bitmapSize = (FBlockSize / VHD_SECTOR_SIZE / 8 + VHD_SECTOR_SIZE - 1) / VHD_SECTOR_SIZE * VHD_SECTOR_SIZE;
+
+    FBlocks.SetCapacity(entries);
+    for (uint32_t i = 0; i < entries; i++)
+    {
+        uint32_t sector = std::byteswap(bat[i]);
+        if (sector == VHD_UNUSED_BLOCK)
+        {
+            FBlocks.AddValue(ZERO_BLOCK);
+            continue;
+        }
+
+        FBlocks.AddValue((uint64_t)sector * VHD_SECTOR_SIZE + bitmapSize);
+        FAllocatedBlocks++;
+    }
+
+    FFormat = TDiskFormat::DynamicVHD;
+    FSectorSize = VHD_SECTOR_SIZE;
+    return true;
+}
+
+bool TDiskContainer::TryOpenVHDX(uint64_t fileSize)
+{
+    if (fileSize < VHDX_REGION_TABLE2_OFFSET + VHDX_REGION_TABLE_SIZE) return false;
+
+    char signature[8];
+    ReadMeta(0, signature, sizeof(signature));
+    if (memcmp(signature, "vhdxfile", sizeof(signature)) != 0) return false;
+
+    // two copies of header, valid one with larger sequence number is the current one
+    THArray<uint8_t> bufArr;
+    bufArr.SetCount(VHDX_REGION_TABLE_SIZE);
+    uint8_t* buf = bufArr.GetValuePointer(0);
+
+    VHDX_HEADER header{ 0 };
+    bool found = false;
+    for (uint64_t offset : { VHDX_HEADER1_OFFSET, VHDX_HEADER2_OFFSET })
+    {
+        ReadMeta(offset, buf, VHDX_HEADER_SIZE);
+        VHDX_HEADER* h = (VHDX_HEADER*)buf;
+        if ((memcmp(&h->Signature, "head", 4) != 0) || !CheckVHDXChecksum(buf, VHDX_HEADER_SIZE)) continue;
+        if (!found || (h->SequenceNumber > header.SequenceNumber)) header = *h;
+        found = true;
+    }
+
+    if (!found) throw_format_exception("VHDX header has not been found");
+    if (header.LogGuid != GUID{ 0 }) throw std::runtime_error("VHDX log has not been replayed, attach the disk in Windows once to replay it.");
+
+    // region table, second copy is used when first one is damaged
+    found = false;
+    for (uint64_t offset : { VHDX_REGION_TABLE1_OFFSET, VHDX_REGION_TABLE2_OFFSET })
+    {
+        ReadMeta(offset, buf, VHDX_REGION_TABLE_SIZE);
+        if ((memcmp(buf, "regi", 4) == 0) && CheckVHDXChecksum(buf, VHDX_REGION_TABLE_SIZE))
+        {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) throw_format_exception("VHDX region table has not been found");
+
+    VHDX_REGION_TABLE_HEADER* regions = (VHDX_REGION_TABLE_HEADER*)buf;
+    VHDX_REGION_TABLE_ENTRY* entries = (VHDX_REGION_TABLE_ENTRY*)(buf + sizeof(VHDX_REGION_TABLE_HEADER));
+    uint32_t maxEntries = (VHDX_REGION_TABLE_SIZE - sizeof(VHDX_REGION_TABLE_HEADER)) / sizeof(VHDX_REGION_TABLE_ENTRY);
+
+    VHDX_REGION_TABLE_ENTRY batRegion{ 0 }, metaRegion{ 0 };
+    for (uint32_t i = 0; i < std::min(regions->EntryCount, maxEntries); i++)
+    {
+        if (entries[i].Guid == VHDX_BAT_REGION) batRegion = entries[i];
+        else if (entries[i].Guid == VHDX_METADATA_REGION) metaRegion = entries[i];
+        else if (entries[i].Required & 1) throw_format_exception("VHDX has unknown required region");
+    }
+
+    if ((batRegion.Length == 0) || (metaRegion.Length == 0)) throw_format_exception("VHDX BAT or metadata region has not been found");
+
+    uint32_t logicalSectorSize = 0;
+    bool hasParent = false;
+    ReadVHDXMetadata(metaRegion, logicalSectorSize, hasParent);
+    if (hasParent) throw std::runtime_error("Differencing VHDX disks are not supported.");
+
+    // BAT has one sector bitmap entry after every chunkRatio payload entries
+    uint64_t chunkRatio = ((1ull << 23) * logicalSectorSize) / FBlockSize;
+    uint64_t blocksCount = (FDiskSize + FBlockSize - 1) / FBlockSize;
+    uint64_t batEntries = blocksCount + (blocksCount - 1) / chunkRatio;
+    if (batEntries * sizeof(uint64_t) > batRegion.Length) throw_format_exception("VHDX BAT is smaller than the disk");
+
+    THArray<uint64_t> bat;
+    bat.SetCount((uint32_t)batEntries);
+    ReadMeta(batRegion.FileOffset, bat.GetValuePointer(0), (uint32_t)(batEntries * sizeof(uint64_t)));
+
+    // NOT_PRESENT, UNDEFINED, ZERO and UNMAPPED blocks read as zeros, PARTIALLY_PRESENT is used by differencing disks only
+    FBlocks.SetCapacity((uint32_t)blocksCount);
+    for (uint64_t i = 0; i < blocksCount; i++)
+    {
+        uint64_t entry = bat[(uint32_t)(i + i / chunkRatio)];
+        if ((entry & VHDX_BAT_STATE_MASK) != VHDX_BAT_FULLY_PRESENT)
+        {
+            FBlocks.AddValue(ZERO_BLOCK);
+            continue;
+        }
+
+        FBlocks.AddValue((entry >> VHDX_BAT_OFFSET_SHIFT) * VHDX_MB);
+        FAllocatedBlocks++;
+    }
+
+    FFormat = TDiskFormat::VHDX;
+    FSectorSize = logicalSectorSize;
+    return true;
+}
+
+void TDiskContainer::ReadVHDXMetadata(const VHDX_REGION_TABLE_ENTRY& region, uint32_t& logicalSectorSize, bool& hasParent)
+{
+    THArray<uint8_t> meta;
+    meta.SetCount(region.Length);
+    ReadMeta(region.FileOffset, meta.GetValuePointer(0), region.Length);
+
+    VHDX_METADATA_TABLE_HEADER* header = (VHDX_METADATA_TABLE_HEADER*)meta.GetValuePointer(0);
+    if (memcmp(header->Signature, "metadata", sizeof(header->Signature)) != 0) throw_format_exception("VHDX metadata table has not been found");
+
+    VHDX_METADATA_TABLE_ENTRY* entries = (VHDX_METADATA_TABLE_ENTRY*)(header + 1);
+    uint32_t maxEntries = (std::min<uint32_t>(region.Length, 64 * 1024) - sizeof(VHDX_METADATA_TABLE_HEADER)) / sizeof(VHDX_METADATA_TABLE_ENTRY);
+
+    FBlockSize = 0;
+    FDiskSize = 0;
+    for (uint32_t i = 0; i < std::min<uint32_t>(header->EntryCount, maxEntries); i++)
+    {
+        const VHDX_METADATA_TABLE_ENTRY& entry = entries[i];
+        if ((entry.Offset > region.Length) || (entry.Length > region.Length - entry.Offset)) throw_format_exception("VHDX metadata item is outside of metadata region");
+        const uint8_t* item = meta.GetValuePointer(0) + entry.Offset;
+
+        if ((entry.ItemId == VHDX_FILE_PARAMETERS) && (entry.Length >= 8))
+        {
+            FBlockSize = ((const uint32_t*)item)[0];
+            hasParent = (((const uint32_t*)item)[1] & VHDX_HAS_PARENT) != 0;
+        }
+        else if ((entry.ItemId == VHDX_VIRTUAL_DISK_SIZE) && (entry.Length >= 8))
+            FDiskSize = *(const uint64_t*)item;
+        else if ((entry.ItemId == VHDX_LOGICAL_SECTOR_SIZE) && (entry.Length >= 4))
+            logicalSectorSize = *(const uint32_t*)item;
+    }
+
+    if ((FBlockSize == 0) || !std::has_single_bit(FBlockSize) || (FDiskSize == 0) || ((logicalSectorSize != 512) && (logicalSectorSize != 4096)))
+        throw_format_exception("VHDX metadata is incomplete");
+}
+
+bool TDiskContainer::CheckRange(uint64_t offset, uint64_t size) const
+{
+    assert(FHFile != INVALID_HANDLE_VALUE);
+
+    if ((offset > FDiskSize) || (size > FDiskSize - offset))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[TDiskContainer] Read is outside of the disk, offset {}, size {}, disk size {}", offset, size, FDiskSize);
+        return false;
+    }
+
+    return true;
+}
+
+TErrorCode TDiskContainer::Read(uint64_t offset, uint8_t* dataBuf, uint64_t size)
+{
+    return ReadVia(offset, dataBuf, size, [this](uint64_t fileOffset, uint8_t* buf, uint64_t len) { return ReadAt(fileOffset, buf, len); });
+}
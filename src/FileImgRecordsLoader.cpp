@@ -1,5 +1,8 @@
 #pragma once
 
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max 
+#define NOMINMAX
+
 //#include "gtest/gtest.h"
 #include "Readers.h"
 #include "Functions.h"
@@ -7,7 +10,7 @@
 
 int64_t TFileImageRecordsLoader::MFTRecIdToOffset(MFTRecIndex MFTRecID)
 {
-    return MFTRecIdToOffset(MFTRecID, FMFTDataRuns, FVolumeData.BytesPerCluster, FVolumeData.BytesPerMFTRec);
+    return FMFTExtents.RecIdToOffset(MFTRecID);
 }
 
 // MFT table may be fragmented. Fragments can be found in Data Runs in the first MFT record (file with name '$MFT', MFT rec #0)
@@ -15,27 +18,8 @@ int64_t TFileImageRecordsLoader::MFTRecIdToOffset(MFTRecIndex MFTRecID)
 // This offset starts from first byte of NTFS partition. 
 int64_t TFileImageRecordsLoader::MFTRecIdToOffset(MFTRecIndex MFTRecID, TDataRuns& runs, uint32_t BytesPerCluster, uint32_t BytesPerMFTRec)
 {
-    if (runs.Count() == 0) return -1;
-
-    uint64_t MFTRecIDBytes = MFTRecID * (uint64_t)BytesPerMFTRec;
-    uint64_t sumBytes = 0;
-    DATA_RUN_ITEM rli{ 0 };
-
-    for (uint i = 0; i < runs.Count(); i++)
-    {
-        rli = runs[i];
-        assert(rli.len > 0ul); // len>0
-
-        if (((rli.len * BytesPerCluster) % BytesPerMFTRec) != 0) // we've met len that is not divisible by BytesPerMFTRec
-            return -1;
-
-        sumBytes += rli.len * BytesPerCluster;
-        if (sumBytes > MFTRecIDBytes) break;
-    }
-
-    if (sumBytes <= MFTRecIDBytes) return -1;
-
-    return (rli.lcn + rli.len) * BytesPerCluster - (sumBytes - MFTRecIDBytes);
+    TMFTExtentMap extents(runs, BytesPerCluster, BytesPerMFTRec);
+    return extents.RecIdToOffset(MFTRecID);
 }
 
 #define throw_winapi_exception(_where_) {\
@@ -56,12 +40,23 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
     if (FHFile == INVALID_HANDLE_VALUE)
         throw_winapi_exception("TFileImageRecordsLoader.CreateFile");
 
+    // raw image, VHD or VHDX. all reads below go through the container
+    try
+    {
+        FContainer.Open(FHFile);
+    }
+    catch (...)
+    {
+        CloseHandle(FHFile);
+        FHFile = INVALID_HANDLE_VALUE;
+        throw;
+    }
+
     // try to find "NTFS   " in the beginning of the file (offset 3).
     // if found - file contain only NTFS partition without MBR
-    DWORD bytesRead = 0;
     NTFS_BOOT_SECTOR partNTFS{ 0 };
 
-    if (!(ReadFile(FHFile, &partNTFS, sizeof(partNTFS), &bytesRead, nullptr) && (bytesRead == sizeof(partNTFS))))
+    if (FContainer.Read(0, (uint8_t*)&partNTFS, sizeof(partNTFS)) != TErrorCode::Success)
         throw_winapi_exception("TFileImageRecordsLoader.ReadFile");
         //FAIL() << std::format(_T("Error reading file '{}', Error code: {}"), imgFileName, GetLastError());
 
@@ -77,41 +72,39 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
         MBR_PARTITION_ENTRY mbr{ 0 };
         DWORD mbrOff = 0x1BE; // fixed offset to first partition entry
 
+        // FirstLBA is counted in logical sectors of the disk. VHD and VHDX store sector size, for raw images 512 and 4K sectors are tried,
+        // right one gives NTFS boot sector at FirstLBA with the same BytesPerSector
+        uint32_t containerSectorSize = FContainer.GetSectorSize();
+        uint32_t sectorSizes[] = { (containerSectorSize != 0) ? containerSectorSize : DEFAULT_SECTOR_SIZE, (containerSectorSize != 0) ? 0 : 4096u };
+
         // look at list of partitions and find NTFS partition. 4 is max number of standard partitions.
-        for (size_t i = 0; i < 4; i++)
+        for (size_t i = 0; (i < 4) && (FPartitionOffset == 0); i++)
         {
-            if (SetFilePointer(FHFile, mbrOff, 0, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
-                throw_winapi_exception("TFileImageRecordsLoader.SetFilePointer");
-                //FAIL() << std::format(_T("Error setting file pointer for file '{}', Error code: {}"), imgFileName, GetLastError());
-
-            bytesRead = 0;
-
-            if (!(ReadFile(FHFile, &mbr, sizeof(mbr), &bytesRead, nullptr) && (bytesRead == sizeof(mbr))))
+            if (FContainer.Read(mbrOff, (uint8_t*)&mbr, sizeof(mbr)) != TErrorCode::Success)
                 throw_winapi_exception("TFileImageRecordsLoader.ReadFile");
                 //FAIL() << std::format(_T("Error reading file '{}', Error code: {}"), imgFileName, GetLastError());
 
             if (mbr.FirstLBA == 0)
                 throw std::runtime_error("Disk image file format is incorrect");
 
-            if (SetFilePointer(FHFile, mbr.FirstLBA * DEFAULT_SECTOR_SIZE, 0, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
-                throw_winapi_exception("TFileImageRecordsLoader.SetFilePointer");
-                 //FAIL() << std::format(_T("Error setting file pointer for file '{}', Error code: {}"), imgFileName, GetLastError());
-
-            if (!(ReadFile(FHFile, &partNTFS, sizeof(partNTFS), &bytesRead, nullptr) && (bytesRead == sizeof(partNTFS))))
-                throw_winapi_exception("TFileImageRecordsLoader.ReadFile");
-                //FAIL() << std::format(_T("Error reading file '{}', Error code: {}"), imgFileName, GetLastError());
-
-            assert(DEFAULT_SECTOR_SIZE == partNTFS.BytesPerSector);
-            assert(mbr.SectorCount == partNTFS.TotalSectors + 1);
-
-            if (memcmp(partNTFS.OemId, NTFS_LABEL, 8) == 0)
+            for (uint32_t sectorSize : sectorSizes)
             {
-                assert(0x07 == mbr.Type); // additional check for NTFS volume type
-                FPartitionOffset = mbr.FirstLBA * (uint64_t)DEFAULT_SECTOR_SIZE;
-                break;
+                if (sectorSize == 0) continue;
+
+                // partition beyond the end of the disk for this sector size, try the next one
+                if (FContainer.Read(mbr.FirstLBA * (uint64_t)sectorSize, (uint8_t*)&partNTFS, sizeof(partNTFS)) != TErrorCode::Success)
+                    continue;
+
+                if ((memcmp(partNTFS.OemId, NTFS_LABEL, 8) == 0) && (partNTFS.BytesPerSector == sectorSize))
+                {
+                    assert(0x07 == mbr.Type); // additional check for NTFS volume type
+                    assert(mbr.SectorCount == partNTFS.TotalSectors + 1);
+                    FPartitionOffset = mbr.FirstLBA * (uint64_t)sectorSize;
+                    break;
+                }
             }
 
-            mbrOff += sizeof(NTFS_BOOT_SECTOR);
+            mbrOff += sizeof(MBR_PARTITION_ENTRY);
         }
 
         assert(0 != FPartitionOffset); // check that we've found NTFS partition
@@ -131,8 +124,19 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
     FVolumeData.hVolume = INVALID_HANDLE_VALUE;// FHFile;
     FVolumeData.Name = convert_string<wchar_t>(imgFileName);
 
-    assert(DEFAULT_SECTOR_SIZE == FVolumeData.BytesPerSector);
-    assert(DEFAULT_BYTES_PER_MFT_REC == FVolumeData.BytesPerMFTRec);
+    // 1K and 4K records, 512 and 4K sectors have their own kernels. loader is not opened yet, so image file is closed here on error
+    try
+    {
+        SelectRecordKernels();
+    }
+    catch (...)
+    {
+        FContainer.Close();
+        CloseHandle(FHFile);
+        FHFile = INVALID_HANDLE_VALUE;
+        throw;
+    }
+    InitCaches();
 
     SetOpened(true); // needs to be before LoadMFTRecord
 
@@ -144,6 +148,7 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
     // these two temporary values needed for proper work of LoadMFTRecord
     FRecordsCount = 1;
     FMFTDataRuns.AddValue({ 2, 0, partNTFS.MftStartLcn });
+    FMFTExtents.Build(FMFTDataRuns, FVolumeData.BytesPerCluster, FVolumeData.BytesPerMFTRec);
     TErrorCode res = LoadMFTRecord(mftRef, mftRecData); // loading MFT record #0 which is $MFT file
     assert(TErrorCode::Success == res); // << "Error loading MFT record " << mftRef.sId.low;
 
@@ -167,6 +172,8 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
     assert(TErrorCode::Success == res);
     assert(FMFTDataRuns.Count() > 0ul);
 
+    FMFTExtents.Build(FMFTDataRuns, FVolumeData.BytesPerCluster, FVolumeData.BytesPerMFTRec);
+
     FRecordsCount = 0;
     for (auto& rli : FMFTDataRuns) FRecordsCount += rli.len;
 
@@ -181,6 +188,7 @@ void TFileImageRecordsLoader::Open(const string_t& imgFileName)
     assert(0 == (FRecordsCount * FVolumeData.BytesPerCluster) % FVolumeData.BytesPerMFTRec);
     FRecordsCount = (FRecordsCount * FVolumeData.BytesPerCluster) / FVolumeData.BytesPerMFTRec;
 
+    ReadMFTBitmap(prsr); // on error bitmap is empty, nothing is skipped
     auto expct = ReadMetaFilesCount(prsr);
     assert(expct);
     FMetaFilesCount = expct.value();
@@ -190,9 +198,11 @@ void TFileImageRecordsLoader::Close()
 {
     IRecordsLoader::Close();
 
+    FContainer.Close();
     CloseHandle(FHFile);
     FHFile = INVALID_HANDLE_VALUE;
     FMFTDataRuns.Clear();
+    FMFTExtents.Clear();
     FPartitionOffset = 0;
 
     SetOpened(false);
@@ -221,12 +231,7 @@ TErrorCode TFileImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uin
 
     assert(offset > 0); // offset>=0 must be
 
-    if (!SetFilePointer(FHFile, (uint32_t)FPartitionOffset + (uint32_t)offset, 0, FILE_BEGIN))
-        return TErrorCode::IOError;
-
-    DWORD bytesRead = 0;
-    if (!(ReadFile(FHFile, mftRecData, FVolumeData.BytesPerMFTRec, &bytesRead, nullptr) && (bytesRead == FVolumeData.BytesPerMFTRec)))
-        return TErrorCode::IOError;
+    CH_ERR(FContainer.Read(FPartitionOffset + offset, mftRecData, FVolumeData.BytesPerMFTRec));
 
     // check that we've read record with proper signature
     NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)mftRecData;
@@ -251,42 +256,262 @@ TErrorCode TFileImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uin
     return TErrorCode::Success;
 }
 
-TErrorCode TFileImageRecordsLoader::ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+TErrorCode TFileImageRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    assert(IsOpened());
+
+    // not allocated blocks of VHD and VHDX are filled with zeros by the container without I/O
+    return FContainer.Read(FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster, dataBuf, lcnCnt * FVolumeData.BytesPerCluster); // Read writes error message to log file
+}
+
+// Applies Update Sequence Array (USA) to MFT record refered by dataBuf
+TErrorCode TFileImageRecordsLoader::FixupUsaMFTRec(NTFS_RECORD_HEADER* mftRec)
+{
+    TFixupTimer timer(FStats, 1, FVolumeData.BytesPerMFTRec);
+    return FixupMFTRecord(mftRec);
+}
+
+
+// plans reading of $MFT extent by extent (according to FMFTExtents) with large sequential reads of up to chunkSize bytes
+// instead of seek+read for every single MFT record. ranges of records marked as free in $MFT bitmap are not read,
+// free gaps shorter than DEFAULT_COALESCE_GAP are read through to keep reads large.
+uint64_t TFileImageRecordsLoader::PlanMFTScan(uint32_t chunkSize, THArray<MFT_SCAN_CHUNK>& chunks)
 {
     assert(IsOpened());
+    assert(FMFTExtents.Count() > 0);
 
-    LARGE_INTEGER offset{ 0 };
-    DWORD bytesToRead, bytesRead;
+    uint32_t BytesPerCluster = FVolumeData.BytesPerCluster;
+    uint32_t BytesPerMFTRec = FVolumeData.BytesPerMFTRec;
 
-    offset.QuadPart = FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster;
+    // chunk must contain whole number of clusters and whole number of MFT records
+    uint64_t clustersPerRec = std::max(1u, BytesPerMFTRec / BytesPerCluster);
+    uint64_t chunkClusters = std::max<uint64_t>(chunkSize / BytesPerCluster, clustersPerRec);
+    chunkClusters -= chunkClusters % clustersPerRec;
+    assert((chunkClusters * BytesPerCluster) % BytesPerMFTRec == 0);
 
-    BOOL res = SetFilePointerEx(FHFile, offset, nullptr, FILE_BEGIN);
-    if (!res)
+    uint64_t chunkRecs = chunkClusters * BytesPerCluster / BytesPerMFTRec;
+    uint64_t gapRecs = std::max<uint64_t>(1, DEFAULT_COALESCE_GAP / BytesPerMFTRec);
+    uint64_t maxClusters = 0;
+
+    if (FMFTExtents.RecordsCount() < FRecordsCount)
     {
         GET_LOGGER;
-        logger.ErrorFmt("ReadClusters.SetFilePointerEx() has failed with error: {}", GetLastError());
-        return TErrorCode::IOError;
+        logger.WarnFmt("[ScanMFTRecords] $MFT Data Runs cover only {} MFT records out of {}.", FMFTExtents.RecordsCount(), FRecordsCount);
     }
 
-    // read lcnCnt clusters
-    bytesToRead = (DWORD)(lcnCnt * FVolumeData.BytesPerCluster);
-    res = ReadFile(FHFile, dataBuf, bytesToRead, &bytesRead, nullptr);
-    if (res)
+    chunks.Clear();
+
+    for (uint32_t e = 0; e < FMFTExtents.Count(); e++)
     {
-        assert(bytesToRead == bytesRead);
-        return TErrorCode::Success;
+        const MFT_EXTENT& ext = FMFTExtents.GetExtent(e);
+        MFTRecIndex extEnd = (MFTRecIndex)std::min<uint64_t>(ext.FirstRecID + FMFTExtents.ExtentRecsCount(e), FRecordsCount);
+        MFTRecIndex mftRecID = NextAllocatedRecord((MFTRecIndex)ext.FirstRecID);
+
+        while (mftRecID < extEnd)
+        {
+            // extend the read over allocated records and short free gaps
+            MFTRecIndex chunkEnd = (MFTRecIndex)std::min<uint64_t>((uint64_t)mftRecID + chunkRecs, extEnd);
+            MFTRecIndex readEnd = mftRecID;
+            while (true)
+            {
+                readEnd = std::min(NextFreeRecord(readEnd), chunkEnd);
+                MFTRecIndex nextAlloc = NextAllocatedRecord(readEnd);
+                if ((nextAlloc >= chunkEnd) || (nextAlloc - readEnd > gapRecs)) break;
+                readEnd = nextAlloc;
+            }
+
+            // read that starts or ends in the middle of a cluster takes one more cluster at each end
+            uint64_t offset = ext.Lcn * BytesPerCluster + (mftRecID - ext.FirstRecID) * BytesPerMFTRec;
+            uint64_t endOffset = offset + (uint64_t)(readEnd - mftRecID) * BytesPerMFTRec;
+            uint64_t lcnStart = offset / BytesPerCluster;
+            uint64_t lcnEnd = (endOffset + BytesPerCluster - 1) / BytesPerCluster;
+
+            chunks.AddValue({ mftRecID, readEnd, lcnStart, lcnEnd - lcnStart, (uint32_t)(offset - lcnStart * BytesPerCluster) });
+            maxClusters = std::max(maxClusters, lcnEnd - lcnStart);
+
+            mftRecID = NextAllocatedRecord(readEnd);
+        }
     }
-    else
+
+    return maxClusters;
+}
+
+TErrorCode TFileImageRecordsLoader::DeliverScanChunk(const MFT_SCAN_CHUNK& chunk, uint8_t* recs, TBitField& fixedUp, ScanMFTRecordsPred& pred, uint32_t& corruptedCnt)
+{
+    for (MFTRecIndex i = chunk.FirstRecID; i < chunk.EndRecID; i++)
     {
-        GET_LOGGER;
-        logger.ErrorFmt("ReadClusters.ReadFile() has failed with error: {}", GetLastError());
-        return TErrorCode::IOError;
+        if (!IsRecordAllocated(i)) continue; // record from a short free gap
+
+        NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)(recs + (uint64_t)(i - chunk.FirstRecID) * FVolumeData.BytesPerMFTRec);
+        if (!fixedUp.Test(i - chunk.FirstRecID))
+        {
+            if (ntfs_is_file_recp(mftRec->Signature)) corruptedCnt++; // otherwise consider it as Not In Use
+            continue;
+        }
+
+        CH_ERR(pred((MFT_FILE_RECORD*)mftRec, i));
     }
+
+    return TErrorCode::Success;
 }
 
-// Applies Update Sequence Array (USA) to MFT record refered by dataBuf
-TErrorCode TFileImageRecordsLoader::FixupUsaMFTRec(NTFS_RECORD_HEADER* mftRec)
+TErrorCode TFileImageRecordsLoader::ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize)
 {
-    return FixupUSA1(mftRec, FVolumeData.BytesPerMFTRec, FVolumeData.BytesPerSector);
+    assert(IsOpened());
+
+    THArray<MFT_SCAN_CHUNK> chunks;
+    uint64_t bufClusters = PlanMFTScan(chunkSize, chunks);
+    if (chunks.Count() == 0) return TErrorCode::Success;
+
+    TIOTagScope tagScope(*this, TIOTag::MFTRecord);
+
+    // aligned buffer lets unbuffered loaders read straight into it
+    uint8_t* dataBuf = (uint8_t*)_aligned_malloc(bufClusters * FVolumeData.BytesPerCluster, DEFAULT_IO_ALIGNMENT);
+    if (dataBuf == nullptr) return TErrorCode::IOError;
+
+    TBitField fixedUp; // status of records of the recent read
+    uint32_t corruptedCnt = 0;
+    TErrorCode result = TErrorCode::Success;
+
+    for (uint32_t c = 0; c < chunks.Count(); c++)
+    {
+        const MFT_SCAN_CHUNK& chunk = chunks[c];
+
+        result = DeviceReadClusters(chunk.LcnStart, chunk.LcnCnt, dataBuf); // ReadClusters writes error message to log file
+        if (result != TErrorCode::Success) break;
+
+        uint8_t* recs = dataBuf + chunk.Skip;
+        {
+            uint32_t count = chunk.EndRecID - chunk.FirstRecID;
+            TFixupTimer timer(FStats, count, (uint64_t)count * FVolumeData.BytesPerMFTRec);
+            FixupMFTRecords(recs, count, fixedUp);
+        }
+
+        result = DeliverScanChunk(chunk, recs, fixedUp, pred, corruptedCnt);
+        if (result != TErrorCode::Success) break;
+    }
+
+    _aligned_free(dataBuf);
+
+    if (corruptedCnt > 0)
+    {
+        GET_LOGGER;
+        logger.WarnFmt("[ScanMFTRecords] USA check failed for {} MFT records, they have been skipped.", corruptedCnt);
+    }
+
+    return result;
 }
 
+// sorts requested records by their offsets on disk and reads records located closer than DEFAULT_COALESCE_GAP
+// to each other by one read call (up to MAX_COALESCED_READ bytes)
+TErrorCode TFileImageRecordsLoader::LoadMFTRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred)
+{
+    assert(IsOpened());
+
+    struct REC_REQUEST
+    {
+        int64_t Offset; // offset of MFT record from the beginning of NTFS partition
+        uint32_t Index; // index in mftRecRefs
+    };
+
+    uint32_t BytesPerCluster = FVolumeData.BytesPerCluster;
+    uint32_t BytesPerMFTRec = FVolumeData.BytesPerMFTRec;
+
+    THArray<REC_REQUEST> reqs;
+    reqs.SetCapacity((uint)mftRecRefs.size());
+
+    for (uint32_t i = 0; i < mftRecRefs.size(); i++)
+    {
+        int64_t offset = (mftRecRefs[i].sId.low < FRecordsCount) ? MFTRecIdToOffset(mftRecRefs[i].sId.low) : -1;
+        if (offset == -1) // MFT rec ID is out of MFT bounds
+        {
+            CH_ERR(pred(i, mftRecRefs[i], nullptr, TErrorCode::WrongMFTRecID));
+            continue;
+        }
+
+        if (!IsRecordAllocated(mftRecRefs[i].sId.low)) // marked as free in $MFT bitmap, no need to read it
+        {
+            CH_ERR(pred(i, mftRecRefs[i], nullptr, TErrorCode::MFTRecordNotInUse));
+            continue;
+        }
+
+        reqs.AddValue({ offset, i });
+    }
+
+    if (reqs.Count() == 0) return TErrorCode::Success;
+
+    REC_REQUEST* req = reqs.GetValuePointer(0);
+    std::sort(req, req + reqs.Count(), [](const REC_REQUEST& a, const REC_REQUEST& b) { return (a.Offset < b.Offset) || ((a.Offset == b.Offset) && (a.Index < b.Index)); });
+
+    // split sorted records into groups, each group is read by one read call
+    THArray<DATA_RUN_ITEM> runs;   // clusters to read for each group
+    THArray<uint32_t> groupStarts; // index in req of the first record of each group, last item is a sentinel
+
+    uint32_t groupEnd = 0;
+    while (groupEnd < reqs.Count())
+    {
+        uint32_t groupStart = groupEnd;
+        int64_t startOffset = req[groupStart].Offset;
+        int64_t endOffset = startOffset + BytesPerMFTRec;
+        groupEnd++;
+
+        while ((groupEnd < reqs.Count()) &&
+               (req[groupEnd].Offset - endOffset <= DEFAULT_COALESCE_GAP) &&
+               (req[groupEnd].Offset + BytesPerMFTRec - startOffset <= MAX_COALESCED_READ))
+        {
+            endOffset = std::max(endOffset, req[groupEnd].Offset + BytesPerMFTRec);
+            groupEnd++;
+        }
+
+        // group may start and end in the middle of a cluster
+        uint64_t lcnStart = startOffset / BytesPerCluster;
+        uint64_t lcnEnd = (endOffset + BytesPerCluster - 1) / BytesPerCluster;
+
+        runs.AddValue({ lcnEnd - lcnStart, 0, lcnStart });
+        groupStarts.AddValue(groupStart);
+    }
+    groupStarts.AddValue(reqs.Count());
+
+    TIOTagScope tagScope(*this, TIOTag::MFTRecord);
+
+    // groups are independent, asynchronous loaders may have several of them in flight. records have their own cache, clusters cache is bypassed
+    TErrorCode result = ReadClustersAsync(std::span<const DATA_RUN_ITEM>(runs.GetValuePointer(0), runs.Count()),
+        [&](uint32_t runIndex, uint8_t* dataBuf, TErrorCode readRes)
+        {
+            TErrorCode res = readRes;
+            uint32_t groupStart = groupStarts[runIndex];
+            uint64_t groupOffset = runs[runIndex].lcn * BytesPerCluster;
+
+            for (uint32_t i = groupStart; i < groupStarts[runIndex + 1]; i++)
+            {
+                const MFT_REF& mftRecRef = mftRecRefs[req[i].Index];
+                uint8_t* mftRecData = (readRes == TErrorCode::Success) ? dataBuf + (req[i].Offset - groupOffset) : nullptr;
+
+                // the same record requested several times is fixed up only once
+                bool duplicate = (i > groupStart) && (req[i].Offset == req[i - 1].Offset);
+
+                if ((readRes == TErrorCode::Success) && !duplicate)
+                {
+                    NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)mftRecData;
+                    if (!ntfs_is_file_recp(mftRec->Signature)) // MFT rec must contain 'FILE' signature
+                    {
+                        GET_LOGGER;
+                        uint8_t* sign = mftRec->Signature;
+                        logger.WarnFmt("[LoadMFTRecords] Signature 'FILE' has not been found in MFT record {}. Signature found: {}{}{}{}",
+                            mftRecRef.sId.low, sign[0], sign[1], sign[2], sign[3]);
+                        res = TErrorCode::MFTRecordNotInUse;
+                    }
+                    else
+                    {
+                        res = FixupUsaMFTRec(mftRec);
+                    }
+                }
+
+                CH_ERR(pred(req[i].Index, mftRecRef, (res == TErrorCode::Success) ? mftRecData : nullptr, res));
+            }
+
+            return TErrorCode::Success;
+        }, false);
+
+    return result;
+}
@@ -0,0 +1,303 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include <bit>
+#include <iterator>
+#include <type_traits>
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define USA_SIMD_X86
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Batched USA fixup used by bulk scans. Every record of the batch is validated completely (signature, USA header,
+// all sector trailers) before any byte of it is changed, so records that fail the check stay untouched.
+// Kernels are templates on record shape: TFixedBlockShape for record and sector sizes met on real volumes (loops over sectors
+// have constant trip counts and are unrolled, record strides are constants), TBlockShape for any other sizes.
+
+template<uint32_t BlockSize, uint32_t SectorSize>
+struct TFixedBlockShape
+{
+    static_assert((SectorSize >= 512) && (BlockSize % SectorSize == 0));
+    static constexpr uint32_t BytesPerBlock = BlockSize;
+    static constexpr uint32_t BytesPerSector = SectorSize;
+    static constexpr uint32_t SectorsCnt = BlockSize / SectorSize;
+};
+
+struct TBlockShape
+{
+    uint32_t BytesPerBlock;
+    uint32_t BytesPerSector;
+    uint32_t SectorsCnt;
+};
+
+template<class TShape>
+static inline TShape MakeShape(uint32_t BytesPerBlock, uint32_t BytesPerSector)
+{
+    if constexpr (std::is_same_v<TShape, TBlockShape>)
+    {
+        return TBlockShape{ BytesPerBlock, BytesPerSector, BytesPerBlock / BytesPerSector };
+    }
+    else
+    {
+        assert((BytesPerBlock == TShape::BytesPerBlock) && (BytesPerSector == TShape::BytesPerSector));
+        UNREFERENCED_PARAMETER(BytesPerBlock);
+        UNREFERENCED_PARAMETER(BytesPerSector);
+        return TShape{};
+    }
+}
+
+// checks USA header of the record, USA must fit into the first sector before its trailer
+template<class TShape>
+static inline bool CheckUSALayout(const NTFS_RECORD_HEADER* record, const TShape& shape)
+{
+    return (record->FixupCnt == shape.SectorsCnt + 1) &&
+           ((record->FixupOffset & 1) == 0) &&
+           (record->FixupOffset + 2u * (shape.SectorsCnt + 1) <= shape.BytesPerSector - 2);
+}
+
+template<class TShape>
+static inline bool CheckUSAHeader(const NTFS_RECORD_HEADER* record, uint32_t signature, const TShape& shape)
+{
+    return (*(const uint32_t*)record->Signature == signature) && CheckUSALayout(record, shape);
+}
+
+// replaces sector trailers by saved values from USA, header and trailers must be checked before
+template<class TShape>
+static inline void ApplyUSA(NTFS_RECORD_HEADER* record, const TShape& shape)
+{
+    uint32_t wordsPerSector = shape.BytesPerSector >> 1;
+    const uint16_t* fixupArr = (const uint16_t*)(Add2Ptr(record, record->FixupOffset)) + 1;
+    uint16_t* sectorEnd = (uint16_t*)(record) + wordsPerSector - 1;
+
+    for (uint32_t s = 0; s < shape.SectorsCnt; s++, sectorEnd += wordsPerSector)
+        *sectorEnd = fixupArr[s];
+}
+
+// all sector trailers are equal to USN, header must be checked before
+template<class TShape>
+static inline bool CheckTrailers(const NTFS_RECORD_HEADER* record, const TShape& shape)
+{
+    uint32_t wordsPerSector = shape.BytesPerSector >> 1;
+    uint16_t checkValue = *(const uint16_t*)(Add2Ptr(record, record->FixupOffset));
+    const uint16_t* sectorEnd = (const uint16_t*)(record) + wordsPerSector - 1;
+
+    uint16_t diff = 0; // no branch per sector
+    for (uint32_t s = 0; s < shape.SectorsCnt; s++, sectorEnd += wordsPerSector)
+        diff |= (uint16_t)(checkValue ^ *sectorEnd);
+
+    return diff == 0;
+}
+
+template<class TShape>
+static bool CheckRecordScalar(const NTFS_RECORD_HEADER* record, uint32_t signature, const TShape& shape)
+{
+    return CheckUSAHeader(record, signature, shape) && CheckTrailers(record, shape);
+}
+
+#ifdef USA_SIMD_X86
+
+// validates 8 records at once, one record per 32-bit lane. returns 8-bit mask of valid records.
+template<class TShape>
+static uint32_t CheckRecords8AVX2(const uint8_t* records, uint32_t signature, const TShape& shape)
+{
+    const __m256i lowWord = _mm256_set1_epi32(0xFFFF);
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)shape.BytesPerBlock));
+
+    __m256i sign = _mm256_i32gather_epi32((const int*)records, offsets, 1);
+    __m256i hdr = _mm256_i32gather_epi32((const int*)(records + 4), offsets, 1); // FixupOffset | FixupCnt << 16
+    __m256i fixupOffset = _mm256_and_si256(hdr, lowWord);
+    __m256i fixupCnt = _mm256_srli_epi32(hdr, 16);
+
+    __m256i valid = _mm256_cmpeq_epi32(sign, _mm256_set1_epi32((int)signature));
+    valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(fixupCnt, _mm256_set1_epi32((int)shape.SectorsCnt + 1)));
+    valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_and_si256(fixupOffset, _mm256_set1_epi32(1)), _mm256_setzero_si256()));
+    valid = _mm256_andnot_si256(_mm256_cmpgt_epi32(fixupOffset, _mm256_set1_epi32((int)(shape.BytesPerSector - 2 - 2 * (shape.SectorsCnt + 1)))), valid);
+
+    if (_mm256_testz_si256(valid, valid)) return 0;
+
+    // USN is gathered only for lanes with correct header, FixupOffset of other lanes may point outside of the record
+    __m256i usn = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)records, _mm256_add_epi32(offsets, fixupOffset), valid, 1);
+    usn = _mm256_and_si256(usn, lowWord);
+
+    // trailer is the high word of the last dword of the sector
+    const uint8_t* lastDword = records + shape.BytesPerSector - 4;
+    for (uint32_t s = 0; s < shape.SectorsCnt; s++, lastDword += shape.BytesPerSector)
+    {
+        __m256i trailer = _mm256_srli_epi32(_mm256_i32gather_epi32((const int*)lastDword, offsets, 1), 16);
+        valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(trailer, usn));
+    }
+
+    return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(valid));
+}
+
+static bool HasAVX2()
+{
+    static const bool hasAVX2 = []()
+        {
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return false;
+
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx) return false;
+            if ((_xgetbv(0) & 0x6) != 0x6) return false; // OS saves XMM and YMM registers
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+        }();
+
+    return hasAVX2;
+}
+
+#endif // USA_SIMD_X86
+
+template<class TShape>
+static uint32_t FixupBatchKernel(uint8_t* records, uint32_t count, uint32_t BytesPerBlock, uint32_t BytesPerSector, NTFS_SIGNATURE signature, TBitField& fixedUp)
+{
+    const TShape shape = MakeShape<TShape>(BytesPerBlock, BytesPerSector);
+    uint32_t sign = (uint32_t)signature;
+    uint32_t fixedUpCnt = 0;
+
+    fixedUp.SetData((uint32_t)((count + TBitField::DWORD_MASK) >> TBitField::DWORD_2POWER), false);
+
+    uint32_t i = 0;
+
+#ifdef USA_SIMD_X86
+    if (HasAVX2() && (8ull * shape.BytesPerBlock <= INT32_MAX)) // gather offsets are 32-bit
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8_t* batch = records + (uint64_t)i * shape.BytesPerBlock;
+            uint32_t mask = CheckRecords8AVX2(batch, sign, shape);
+
+            for (; mask != 0; mask &= mask - 1)
+            {
+                uint32_t lane = (uint32_t)std::countr_zero(mask);
+                ApplyUSA((NTFS_RECORD_HEADER*)(batch + (uint64_t)lane * shape.BytesPerBlock), shape);
+                fixedUp.SetTrue(i + lane);
+                fixedUpCnt++;
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        NTFS_RECORD_HEADER* record = (NTFS_RECORD_HEADER*)(records + (uint64_t)i * shape.BytesPerBlock);
+
+        // tail of the batch and CPUs without AVX2, trailer loop of fixed shapes is unrolled and has no branches
+        if (!CheckRecordScalar(record, sign, shape)) continue;
+
+        ApplyUSA(record, shape);
+        fixedUp.SetTrue(i);
+        fixedUpCnt++;
+    }
+
+    return fixedUpCnt;
+}
+
+// signature is not checked, record is left untouched when USA header or any sector trailer is incorrect
+template<class TShape>
+static TErrorCode FixupKernel(NTFS_RECORD_HEADER* record, uint32_t BytesPerBlock, uint32_t BytesPerSector)
+{
+    const TShape shape = MakeShape<TShape>(BytesPerBlock, BytesPerSector);
+
+    if (!CheckUSALayout(record, shape) || !CheckTrailers(record, shape))
+    {
+        GET_LOGGER;
+        logger.Error("[FixupUSA1] Error: looks like data is corrupted in the sector");
+        return TErrorCode::CorruptedData; // looks like data is corrupted in this sector
+    }
+
+    ApplyUSA(record, shape);
+    return TErrorCode::Success;
+}
+
+template<class TShape>
+static constexpr USA_KERNELS MakeKernels(TRecordGeometry geometry)
+{
+    return USA_KERNELS{ geometry, &FixupKernel<TShape>, &FixupBatchKernel<TShape> };
+}
+
+static constexpr USA_KERNELS Kernels[] =
+{
+    MakeKernels<TBlockShape>(TRecordGeometry::Generic),
+    MakeKernels<TFixedBlockShape<1024, 512>>(TRecordGeometry::Rec1K_Sec512),
+    MakeKernels<TFixedBlockShape<4096, 512>>(TRecordGeometry::Rec4K_Sec512),
+    MakeKernels<TFixedBlockShape<4096, 4096>>(TRecordGeometry::Rec4K_Sec4K),
+};
+
+TRecordGeometry RecordGeometryOf(uint32_t BytesPerBlock, uint32_t BytesPerSector)
+{
+    if ((BytesPerBlock == 1024) && (BytesPerSector == 512)) return TRecordGeometry::Rec1K_Sec512;
+    if ((BytesPerBlock == 4096) && (BytesPerSector == 512)) return TRecordGeometry::Rec4K_Sec512;
+    if ((BytesPerBlock == 4096) && (BytesPerSector == 4096)) return TRecordGeometry::Rec4K_Sec4K;
+    return TRecordGeometry::Generic;
+}
+
+const char_t* RecordGeometryName(TRecordGeometry geometry)
+{
+    switch (geometry)
+    {
+    case TRecordGeometry::Generic: return _T("generic");
+    case TRecordGeometry::Rec1K_Sec512: return _T("1K records, 512 byte sectors");
+    case TRecordGeometry::Rec4K_Sec512: return _T("4K records, 512 byte sectors");
+    case TRecordGeometry::Rec4K_Sec4K: return _T("4K records, 4K sectors");
+    }
+    return _T("unknown");
+}
+
+const USA_KERNELS& GetUSAKernels(TRecordGeometry geometry)
+{
+    assert((uint32_t)geometry < std::size(Kernels));
+    assert(Kernels[(uint32_t)geometry].Geometry == geometry);
+    return Kernels[(uint32_t)geometry];
+}
+
+// picks USA kernels for MFT records of the opened volume, unusual sizes get generic kernels.
+// throws std::runtime_error when record size is not a whole number of sectors
+void IRecordsLoader::SelectRecordKernels()
+{
+    uint32_t recSize = FVolumeData.BytesPerMFTRec;
+    uint32_t sectorSize = FVolumeData.BytesPerSector;
+
+    if ((sectorSize < DEFAULT_SECTOR_SIZE) || !std::has_single_bit(sectorSize) || (recSize < sectorSize) || (recSize % sectorSize != 0))
+        throw std::runtime_error(std::format("Unsupported MFT record size {} with sector size {}", recSize, sectorSize));
+
+    FMFTKernels = &GetUSAKernels(RecordGeometryOf(recSize, sectorSize));
+
+    GET_LOGGER;
+    logger.DebugFmt("MFT record size {}, sector size {}, record kernels: {}", recSize, sectorSize, wtos(RecordGeometryName(FMFTKernels->Geometry)));
+}
+
+// USA fixup of one record (MFT record or Index Block), kernel is chosen by sizes on every call.
+// Loaders fix up MFT records by FixupMFTRecord that uses kernels chosen once at Open.
+TErrorCode IRecordsLoader::FixupUSA1(NTFS_RECORD_HEADER* record, uint32_t BytesPerBlock, uint32_t BytesPerSector)
+{
+    return GetUSAKernels(RecordGeometryOf(BytesPerBlock, BytesPerSector)).Fixup(record, BytesPerBlock, BytesPerSector);
+}
+
+/**
+* @brief Validates and fixes up count consecutive records (MFT records or Index Blocks) located in records buffer.
+* @details Record is fixed up when it has expected signature, correct USA header and all its sector trailers equal to USN.
+* Status of each record is returned in fixedUp bitfield (bit i is set when record i has been fixed up), failures are not logged.
+* Records that failed the check are not modified. AVX2 path checks 8 records at once, scalar path checks one record at a time.
+* @param records Buffer with count records, each BytesPerBlock bytes long
+* @param signature Expected signature: NTFS_SIGNATURE::magic_FILE for MFT records, NTFS_SIGNATURE::magic_INDX for Index Blocks
+* @param fixedUp Receives per record status, it is resized to fit count bits
+* @return number of fixed up records
+**/
+uint32_t IRecordsLoader::FixupUSABatch(uint8_t* records, uint32_t count, uint32_t BytesPerBlock, uint32_t BytesPerSector, NTFS_SIGNATURE signature, TBitField& fixedUp)
+{
+    assert(BytesPerSector >= 512);
+    assert((BytesPerBlock % BytesPerSector) == 0);
+
+    return GetUSAKernels(RecordGeometryOf(BytesPerBlock, BytesPerSector)).FixupBatch(records, count, BytesPerBlock, BytesPerSector, signature, fixedUp);
+}
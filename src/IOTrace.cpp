@@ -0,0 +1,501 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include "IOTrace.h"
+#include "Caches.h" // for DEFAULT_IO_ALIGNMENT
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+const char_t* IOTagName(TIOTag tag)
+{
+    switch (tag)
+    {
+    case TIOTag::Clusters: return _T("clusters");
+    case TIOTag::MFTRecord: return _T("record");
+    case TIOTag::IndexBlock: return _T("INDX");
+    case TIOTag::Bitmap: return _T("bitmap");
+    case TIOTag::AttrList: return _T("attrlist");
+    default: return _T("unknown");
+    }
+}
+
+TIOTraceWriter::TIOTraceWriter(const string_t& fileName, const IO_TRACE_HEADER& header)
+{
+    FHFile = CreateFile(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (FHFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("TIOTraceWriter.CreateFile");
+
+    DWORD written = 0;
+    if (!WriteFile(FHFile, &header, sizeof(header), &written, nullptr) || (written != sizeof(header)))
+    {
+        DWORD err = GetLastError();
+        CloseHandle(FHFile);
+        SetLastError(err);
+        throw_winapi_exception("TIOTraceWriter.WriteFile");
+    }
+
+    FBuf.SetCapacity(IO_TRACE_BUF_RECS);
+    FStart = TLoaderStats::Now();
+}
+
+TIOTraceWriter::~TIOTraceWriter()
+{
+    std::lock_guard<std::mutex> lk(FLock);
+    Flush();
+    CloseHandle(FHFile);
+}
+
+void TIOTraceWriter::Flush()
+{
+    if (FBuf.Count() == 0) return;
+
+    DWORD bytes = FBuf.Count() * sizeof(IO_TRACE_RECORD);
+    DWORD written = 0;
+    if (!FFailed && (!WriteFile(FHFile, FBuf.GetValuePointer(0), bytes, &written, nullptr) || (written != bytes)))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[TIOTraceWriter] WriteFile() has failed with error: {}, trace is incomplete.", GetLastError());
+        FFailed = true;
+    }
+
+    FBuf.Clear();
+}
+
+void TIOTraceWriter::AddRead(uint64_t offset, uint64_t length, TIOTag tag)
+{
+    IO_TRACE_RECORD rec{ offset, TLoaderStats::NanosecsSince(FStart), (uint32_t)std::min<uint64_t>(length, UINT32_MAX), (uint8_t)tag, { 0 } };
+
+    std::lock_guard<std::mutex> lk(FLock);
+    if (FFailed) return;
+
+    FBuf.AddValue(rec);
+    FCount++;
+    if (FBuf.Count() >= IO_TRACE_BUF_RECS) Flush();
+}
+
+TErrorCode LoadIOTrace(const string_t& fileName, IO_TRACE_HEADER& header, THArray<IO_TRACE_RECORD>& records)
+{
+    GET_LOGGER;
+    records.Clear();
+
+    HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        logger.ErrorFmt("[LoadIOTrace] Cannot open trace file '{}', error: {}", wtos(fileName), GetLastError());
+        return TErrorCode::IOError;
+    }
+
+    TErrorCode res = TErrorCode::Success;
+    LARGE_INTEGER fileSize{ 0 };
+    DWORD bytesRead = 0;
+
+    if (!GetFileSizeEx(hFile, &fileSize) || (fileSize.QuadPart < (LONGLONG)sizeof(IO_TRACE_HEADER)) ||
+        !ReadFile(hFile, &header, sizeof(header), &bytesRead, nullptr) || (bytesRead != sizeof(header)))
+    {
+        logger.ErrorFmt("[LoadIOTrace] Cannot read header of trace file '{}'", wtos(fileName));
+        res = TErrorCode::IOError;
+    }
+    else if ((memcmp(header.Magic, IO_TRACE_HEADER().Magic, sizeof(header.Magic)) != 0) || (header.Version != IO_TRACE_VERSION))
+    {
+        logger.ErrorFmt("[LoadIOTrace] '{}' is not an I/O trace file or it has unsupported version", wtos(fileName));
+        res = TErrorCode::CorruptedData;
+    }
+    else
+    {
+        uint64_t count = (fileSize.QuadPart - sizeof(IO_TRACE_HEADER)) / sizeof(IO_TRACE_RECORD); // incomplete last record is ignored
+        if (count * sizeof(IO_TRACE_RECORD) > MAXDWORD)
+        {
+            logger.ErrorFmt("[LoadIOTrace] Trace file '{}' is too big", wtos(fileName));
+            res = TErrorCode::InvalidArgument;
+        }
+        else if (count > 0)
+        {
+            records.SetCount((uint32_t)count);
+            DWORD bytes = (DWORD)(count * sizeof(IO_TRACE_RECORD));
+            if (!ReadFile(hFile, records.GetValuePointer(0), bytes, &bytesRead, nullptr) || (bytesRead != bytes))
+            {
+                logger.ErrorFmt("[LoadIOTrace] ReadFile() has failed with error: {}", GetLastError());
+                records.Clear();
+                res = TErrorCode::IOError;
+            }
+        }
+    }
+
+    CloseHandle(hFile);
+    return res;
+}
+
+bool StringToReplayBackend(const string_t& str, TReplayBackend& backend)
+{
+    if (str == _T("file")) backend = TReplayBackend::File;
+    else if (str == _T("mmap")) backend = TReplayBackend::Mapped;
+    else if (str == _T("direct")) backend = TReplayBackend::Direct;
+    else if (str == _T("async")) backend = TReplayBackend::Async;
+    else return false;
+
+    return true;
+}
+
+// one way of reading the target file. Read() issues a read, Drain() waits for reads that are still in flight
+class IReplayBackend
+{
+protected:
+    TLoaderStats& FStats;
+    uint64_t FFileSize{ 0 };
+    uint64_t FFailed{ 0 };
+public:
+    IReplayBackend(TLoaderStats& stats) : FStats(stats) {}
+    virtual ~IReplayBackend() {}
+    virtual void Read(uint64_t fileOffset, uint32_t length) = 0;
+    virtual void Drain() {}
+    uint64_t FileSize() const { return FFileSize; }
+    uint64_t Failed() const { return FFailed; }
+};
+
+static HANDLE OpenTarget(const string_t& targetFile, DWORD flags, uint64_t& fileSize)
+{
+    HANDLE hFile = CreateFile(targetFile.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | flags, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("ReplayIOTrace.CreateFile");
+
+    LARGE_INTEGER size{ 0 };
+    fileSize = GetFileSizeEx(hFile, &size) ? size.QuadPart : UINT64_MAX; // volume devices do not report size, reads are not checked then
+
+    return hFile;
+}
+
+// positional synchronous reads through system cache, like TFileImageRecordsLoader
+class TFileReplayBackend : public IReplayBackend
+{
+private:
+    HANDLE FHFile;
+    uint8_t* FBuf{ nullptr };
+    uint32_t FBufSize{ 0 };
+public:
+    TFileReplayBackend(const string_t& targetFile, TLoaderStats& stats) : IReplayBackend(stats)
+    {
+        FHFile = OpenTarget(targetFile, FILE_FLAG_RANDOM_ACCESS, FFileSize);
+    }
+
+    ~TFileReplayBackend() override
+    {
+        delete[] FBuf;
+        CloseHandle(FHFile);
+    }
+
+    void Read(uint64_t fileOffset, uint32_t length) override
+    {
+        if (length > FBufSize)
+        {
+            delete[] FBuf;
+            FBuf = DBG_NEW uint8_t[length];
+            FBufSize = length;
+        }
+
+        LARGE_INTEGER offset{ 0 };
+        offset.QuadPart = fileOffset;
+        OVERLAPPED overlapped{ 0 };
+        overlapped.Offset = offset.LowPart;
+        overlapped.OffsetHigh = offset.HighPart;
+
+        auto start = TLoaderStats::Now();
+        DWORD bytesRead = 0;
+        if (!ReadFile(FHFile, FBuf, length, &bytesRead, &overlapped) || (bytesRead != length)) FFailed++;
+        FStats.AddRead(fileOffset, length, TLoaderStats::NanosecsSince(start));
+    }
+};
+
+// memory copies from a read-only view of the whole file, like TMappedImageRecordsLoader
+class TMappedReplayBackend : public IReplayBackend
+{
+private:
+    uint8_t* FView{ nullptr };
+    uint8_t* FBuf{ nullptr };
+    uint32_t FBufSize{ 0 };
+public:
+    TMappedReplayBackend(const string_t& targetFile, TLoaderStats& stats) : IReplayBackend(stats)
+    {
+        HANDLE hFile = OpenTarget(targetFile, FILE_FLAG_RANDOM_ACCESS, FFileSize);
+
+        HANDLE hMap = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMap != nullptr) FView = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+        DWORD err = GetLastError();
+
+        if (hMap != nullptr) CloseHandle(hMap);
+        CloseHandle(hFile);
+
+        if (FView == nullptr)
+        {
+            SetLastError(err);
+            throw_winapi_exception("ReplayIOTrace.MapViewOfFile");
+        }
+    }
+
+    ~TMappedReplayBackend() override
+    {
+        delete[] FBuf;
+        UnmapViewOfFile(FView);
+    }
+
+    void Read(uint64_t fileOffset, uint32_t length) override
+    {
+        if (length > FBufSize)
+        {
+            delete[] FBuf;
+            FBuf = DBG_NEW uint8_t[length];
+            FBufSize = length;
+        }
+
+        auto start = TLoaderStats::Now();
+        memcpy(FBuf, FView + fileOffset, length); // bounds are checked by ReplayIOTrace
+        FStats.AddRead(fileOffset, length, TLoaderStats::NanosecsSince(start));
+    }
+};
+
+// unbuffered reads widened to device alignment, like TDirectImageRecordsLoader
+class TDirectReplayBackend : public IReplayBackend
+{
+private:
+    HANDLE FHFile;
+    uint8_t* FBuf{ nullptr };
+    uint64_t FBufSize{ 0 };
+    uint32_t FAlignment{ DEFAULT_IO_ALIGNMENT };
+public:
+    TDirectReplayBackend(const string_t& targetFile, TLoaderStats& stats) : IReplayBackend(stats)
+    {
+        FHFile = OpenTarget(targetFile, FILE_FLAG_NO_BUFFERING, FFileSize);
+
+        FILE_ALIGNMENT_INFO alignmentInfo{ 0 };
+        if (GetFileInformationByHandleEx(FHFile, FileAlignmentInfo, &alignmentInfo, sizeof(alignmentInfo)))
+            FAlignment = std::max(FAlignment, (uint32_t)alignmentInfo.AlignmentRequirement + 1);
+    }
+
+    ~TDirectReplayBackend() override
+    {
+        if (FBuf != nullptr) _aligned_free(FBuf);
+        CloseHandle(FHFile);
+    }
+
+    void Read(uint64_t fileOffset, uint32_t length) override
+    {
+        uint64_t mask = FAlignment - 1;
+        uint64_t alignedOffset = fileOffset & ~mask;
+        uint64_t alignedSize = (fileOffset + length - alignedOffset + mask) & ~mask;
+        if (alignedSize > MAXDWORD)
+        {
+            FFailed++;
+            return;
+        }
+
+        if (alignedSize > FBufSize)
+        {
+            if (FBuf != nullptr) _aligned_free(FBuf);
+            FBuf = (uint8_t*)_aligned_malloc(alignedSize, FAlignment);
+            FBufSize = (FBuf == nullptr) ? 0 : alignedSize;
+            if (FBuf == nullptr)
+            {
+                FFailed++;
+                return;
+            }
+        }
+
+        LARGE_INTEGER offset{ 0 };
+        offset.QuadPart = alignedOffset;
+        OVERLAPPED overlapped{ 0 };
+        overlapped.Offset = offset.LowPart;
+        overlapped.OffsetHigh = offset.HighPart;
+
+        auto start = TLoaderStats::Now();
+        DWORD bytesRead = 0;
+        if (!ReadFile(FHFile, FBuf, (DWORD)alignedSize, &bytesRead, &overlapped) || (bytesRead < fileOffset + length - alignedOffset)) FFailed++;
+        FStats.AddRead(alignedOffset, alignedSize, TLoaderStats::NanosecsSince(start));
+    }
+};
+
+// overlapped reads with up to queueDepth reads in flight, completions are taken from I/O completion port
+class TAsyncReplayBackend : public IReplayBackend
+{
+private:
+    struct REPLAY_READ
+    {
+        OVERLAPPED Overlapped; // must be the first member, completion port returns pointer to it
+        uint8_t* DataBuf;
+        uint32_t DataBufSize;
+        uint32_t Length;
+        uint64_t Offset;
+        TLoaderStats::TTimePoint IssueTime;
+    };
+
+    HANDLE FHFile;
+    HANDLE FIOPort{ nullptr };
+    REPLAY_READ* FSlots{ nullptr };
+    uint32_t FSlotsCount;
+    THArray<REPLAY_READ*> FFreeSlots;
+    uint32_t FInFlight{ 0 };
+
+    bool WaitOne()
+    {
+        DWORD bytesRead = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(FIOPort, &bytesRead, &key, &overlapped, INFINITE);
+        if (overlapped == nullptr) return false; // port itself has failed
+
+        REPLAY_READ* slot = (REPLAY_READ*)overlapped;
+        if (!ok || (bytesRead != slot->Length)) FFailed++;
+        FStats.AddRead(slot->Offset, slot->Length, TLoaderStats::NanosecsSince(slot->IssueTime));
+
+        FInFlight--;
+        FFreeSlots.AddValue(slot);
+        return true;
+    }
+public:
+    TAsyncReplayBackend(const string_t& targetFile, uint32_t queueDepth, TLoaderStats& stats) : IReplayBackend(stats), FSlotsCount(std::max(1u, queueDepth))
+    {
+        FHFile = OpenTarget(targetFile, FILE_FLAG_OVERLAPPED, FFileSize);
+
+        FIOPort = CreateIoCompletionPort(FHFile, nullptr, 0, 1);
+        if (FIOPort == nullptr)
+        {
+            DWORD err = GetLastError();
+            CloseHandle(FHFile);
+            SetLastError(err);
+            throw_winapi_exception("ReplayIOTrace.CreateIoCompletionPort");
+        }
+
+        FSlots = DBG_NEW REPLAY_READ[FSlotsCount];
+        ZeroMemory(FSlots, FSlotsCount * sizeof(REPLAY_READ));
+        for (uint32_t i = 0; i < FSlotsCount; i++) FFreeSlots.AddValue(&FSlots[i]);
+    }
+
+    ~TAsyncReplayBackend() override
+    {
+        Drain();
+        CloseHandle(FIOPort);
+        CloseHandle(FHFile);
+
+        if (FInFlight == 0) // buffers of reads that are still in flight are leaked intentionally
+        {
+            for (uint32_t i = 0; i < FSlotsCount; i++) delete[] FSlots[i].DataBuf;
+            delete[] FSlots;
+        }
+    }
+
+    void Read(uint64_t fileOffset, uint32_t length) override
+    {
+        if ((FFreeSlots.Count() == 0) && !WaitOne())
+        {
+            FFailed++;
+            return;
+        }
+
+        REPLAY_READ* slot = FFreeSlots.Pop();
+        if (length > slot->DataBufSize)
+        {
+            delete[] slot->DataBuf;
+            slot->DataBuf = DBG_NEW uint8_t[length];
+            slot->DataBufSize = length;
+        }
+
+        LARGE_INTEGER offset{ 0 };
+        offset.QuadPart = fileOffset;
+        ZeroMemory(&slot->Overlapped, sizeof(OVERLAPPED));
+        slot->Overlapped.Offset = offset.LowPart;
+        slot->Overlapped.OffsetHigh = offset.HighPart;
+        slot->Offset = fileOffset;
+        slot->Length = length;
+        slot->IssueTime = TLoaderStats::Now();
+
+        // completion packet is queued to the port even when ReadFile completes synchronously
+        if (!ReadFile(FHFile, slot->DataBuf, length, nullptr, &slot->Overlapped) && (GetLastError() != ERROR_IO_PENDING))
+        {
+            FFailed++;
+            FFreeSlots.AddValue(slot);
+            return;
+        }
+
+        FInFlight++;
+    }
+
+    void Drain() override
+    {
+        while ((FInFlight > 0) && WaitOne());
+    }
+};
+
+/**
+* @brief Replays reads of a trace against target file
+* @details Reads without known offset and reads that do not fit into the target file are not made, they are counted
+* as skipped and failed respectively. Reads failed by backend are counted as failed, replay continues after them.
+* @param records Trace records in order of issue
+* @param targetFile Disk image file or volume device (like \\.\C:) to read from
+* @param baseOffset Offset of NTFS partition in the target file, added to every read offset
+* @param backend How reads are made
+* @param queueDepth Max number of reads in flight for Async backend
+* @param stats Receives every read made, its latency and seek distance
+* @param result Counters of the whole replay
+* @return IOError when target file cannot be opened, Success otherwise
+**/
+TErrorCode ReplayIOTrace(const THArray<IO_TRACE_RECORD>& records, const string_t& targetFile, uint64_t baseOffset, TReplayBackend backend,
+    uint32_t queueDepth, TLoaderStats& stats, IO_REPLAY_RESULT& result)
+{
+    GET_LOGGER;
+    result = IO_REPLAY_RESULT();
+
+    IReplayBackend* rb = nullptr;
+    try
+    {
+        switch (backend)
+        {
+        case TReplayBackend::Mapped: rb = DBG_NEW TMappedReplayBackend(targetFile, stats); break;
+        case TReplayBackend::Direct: rb = DBG_NEW TDirectReplayBackend(targetFile, stats); break;
+        case TReplayBackend::Async: rb = DBG_NEW TAsyncReplayBackend(targetFile, queueDepth, stats); break;
+        default: rb = DBG_NEW TFileReplayBackend(targetFile, stats); break;
+        }
+    }
+    catch (std::system_error& ex)
+    {
+        logger.ErrorFmt("[ReplayIOTrace] Cannot open target file '{}': {}", wtos(targetFile), ex.what());
+        return TErrorCode::IOError;
+    }
+
+    auto start = TLoaderStats::Now();
+
+    for (uint32_t i = 0; i < records.Count(); i++)
+    {
+        const IO_TRACE_RECORD& rec = records[i];
+        if (rec.Offset == IO_TRACE_NO_OFFSET)
+        {
+            result.Skipped++;
+            continue;
+        }
+
+        uint64_t fileOffset = baseOffset + rec.Offset;
+        if ((rec.Length == 0) || (fileOffset + rec.Length > rb->FileSize()))
+        {
+            result.Failed++;
+            continue;
+        }
+
+        rb->Read(fileOffset, rec.Length);
+
+        result.Reads++;
+        result.Bytes += rec.Length;
+        if (rec.Tag < (uint8_t)TIOTag::Count) result.TagReads[rec.Tag]++;
+    }
+
+    rb->Drain();
+    result.Nanosecs = TLoaderStats::NanosecsSince(start);
+    result.Failed += rb->Failed();
+
+    delete rb;
+
+    if (result.Failed > 0)
+        logger.WarnFmt("[ReplayIOTrace] {} reads of the trace have failed", result.Failed);
+
+    return TErrorCode::Success;
+}
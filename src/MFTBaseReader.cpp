@@ -1,12 +1,18 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max 
+#define NOMINMAX
 
 #include "Debug.h"
+#include <array>
 #include "NTFS.h"
 #include "Functions.h" // for TErrorCode
 #include "Readers.h"
+#include "AttrRange.h"
+#include "RecordTable.h"
 
 /**
 * @brief Function for reading Index Blocks from Data Runs and passing them into predicate (second param) for processing
-* @details Reads all LCNs from Data Runs in node.DataRuns. For each LCN it calls predicate processIndexBlockPred for processing each Index Block.
+* @details Reads LCNs from Data Runs in node.DataRuns. Only clusters that hold Index Blocks marked in node.Bitmap are read, 
+* neighbouring allocated blocks are read by one call. For each LCN it calls predicate processIndexBlockPred for processing each Index Block.
 * Predicate can either extract list of files from LCN or add the LCN to cache for further processing, or do anything else.
 * When used to extract list of files from LCNs, files are extracted in random order (in order of LCNs in Data Runs) and does not go to sub-nodes.
 * node.Bitmap is used to select which Index Blocks are valid. Predicate processIndexBlockPred is called only for valid Index Blocks.
@@ -42,102 +48,238 @@ TErrorCode TMFTBaseReader::ProcessAllocDataRuns(DIR_NODE& node, ProcessiBlocksPr
 
     logger.DebugFmt("BITMAP Size in 64bit words: {}, Value64: {:#x}", node.Bitmap.Count(), *(uint64_t*)node.Bitmap.GetData());
 
-    int64_t iblockCounter = 0; // counter in Index Blocks (Index Block size may differ from cluster size)
-    uint8_t* dataBuf = nullptr;
-    uint64_t dataBufSize = 0;
-    uint32_t currRun = 0;
-    TErrorCode result = TErrorCode::Success;
+    // Turn ranges of set bits into cluster reads. Only clusters of allocated Index Blocks are read, adjacent allocated blocks 
+    // are merged into one read, range that crosses data run boundary is split into several reads.
+    THArray<DATA_RUN_ITEM> reads; // lcn, len of each read and VCN of its first cluster
+    THArray<uint64_t> firstBlocks; // number of the first Index Block in each read
+    uint32_t runIndex = 0;
+    uint64_t runVcn = 0; // number of clusters in runs before runIndex
+    uint64_t bitsEnd = (uint64_t)lastBit + 1;
+    int64_t bit = node.Bitmap.NextSetBit(0);
 
-    while (currRun < node.DataRuns.Count())
+    while ((bit != -1) && ((uint64_t)bit < bitsEnd) && (runIndex < node.DataRuns.Count()))
     {
-        if (iblockCounter > lastBit) // no more valid LCNs, break loop 
-            break;
+        uint64_t rangeEnd = std::min<uint64_t>(node.Bitmap.NextClearBit(bit), bitsEnd);
+        uint64_t vcnStart = (uint64_t)bit * node.IndexBlockSize / BytesPerCluster;
+        uint64_t vcnEnd = (rangeEnd * node.IndexBlockSize + BytesPerCluster - 1) / BytesPerCluster;
 
-        DATA_RUN_ITEM& rli = node.DataRuns[currRun];
-        logger.DebugFmt("[ProcessAllocDataRuns] Data Run Item VCN: {}, LCN: {}, Length:{}", rli.vcn, rli.lcn, rli.len);
+        logger.DebugFmt("[ProcessAllocDataRuns] Allocated Index Blocks# {}-{}. LastBit: {}.", bit, rangeEnd - 1, lastBit);
 
-        // check correctness of decoded LCNs
-        assert(rli.len < (uint64_t)getVolData().TotalClusters.QuadPart);
-        assert(rli.lcn < (uint64_t)getVolData().TotalClusters.QuadPart);
+        while (vcnStart < vcnEnd)
+        {
+            while ((runIndex < node.DataRuns.Count()) && (runVcn + node.DataRuns[runIndex].len <= vcnStart))
+                runVcn += node.DataRuns[runIndex++].len;
 
-        //uint32_t k = node.IndexBlockSize / getVolData().BytesPerCluster;
-        //assert(k > 0);
+            if (runIndex == node.DataRuns.Count()) break; // bitmap covers more blocks than data runs have
 
-        assert(lastBit + 1 - iblockCounter > 0);
-        //TODO return to this optimization later because assert((rliBufSize % getVolData().BytesPerCluster) == 0) fails for some reason
-        uint64_t rliBufSize = rli.len * getVolData().BytesPerCluster; //valuemin((uint64_t)(lastBit + 1 - iblockCounter) * node.IndexBlockSize, rli.len * getVolData().BytesPerCluster);
-        assert((rliBufSize % node.IndexBlockSize) == 0);
-        assert((rliBufSize % getVolData().BytesPerCluster) == 0);
+            DATA_RUN_ITEM& rli = node.DataRuns[runIndex];
 
-        if (rliBufSize > dataBufSize)
-        {
-            delete[] dataBuf;
-            dataBufSize = rliBufSize; //rlilen * getVolData().BytesPerCluster;
-            dataBuf = DBG_NEW uint8_t[dataBufSize]; 
-            assert(dataBuf);
-            //dataBufLen = rlilen;
-        }
+            // check correctness of decoded LCNs
+            assert(rli.len < (uint64_t)getVolData().TotalClusters.QuadPart);
+            assert(rli.lcn < (uint64_t)getVolData().TotalClusters.QuadPart);
+            assert(((rli.len * BytesPerCluster) % node.IndexBlockSize) == 0 || node.IndexBlockSize < BytesPerCluster);
 
-        result = FLoader.ReadClusters(rli.lcn, rliBufSize / getVolData().BytesPerCluster, dataBuf);
-        if (result != TErrorCode::Success) // ReadClusters wrties error message to log file in case of an error
-        {
-            //result = res;
-            break;
+            uint64_t len = std::min<uint64_t>(vcnEnd, runVcn + rli.len) - vcnStart;
+            uint64_t lcn = rli.lcn + (vcnStart - runVcn);
+
+            // Index Blocks smaller than cluster: neighbouring ranges may share a cluster
+            DATA_RUN_ITEM* last = (reads.Count() > 0) ? &reads[reads.Count() - 1] : nullptr;
+            uint64_t lastStart = (last == nullptr) ? 0 : firstBlocks[firstBlocks.Count() - 1] * node.IndexBlockSize / BytesPerCluster;
+            if ((last != nullptr) && (lastStart + last->len >= vcnStart) && (last->lcn + (vcnStart - lastStart) == lcn))
+            {
+                last->len = std::max(last->len, vcnStart + len - lastStart);
+            }
+            else
+            {
+                reads.AddValue({ len, rli.vcn + (vcnStart - runVcn), lcn });
+                firstBlocks.AddValue(vcnStart * BytesPerCluster / node.IndexBlockSize);
+            }
+
+            vcnStart += len;
         }
 
-        // how many Index Blocks we've read by recent ReadClusters call
-        uint64_t iblocksCount = rliBufSize / node.IndexBlockSize;
+        bit = node.Bitmap.NextSetBit(rangeEnd);
+    }
+
+    TErrorCode fixupResult = TErrorCode::Success;
+    uint32_t BytesPerSector = getVolData().BytesPerSector;
+    const USA_KERNELS& fixupKernels = GetUSAKernels(RecordGeometryOf(node.IndexBlockSize, BytesPerSector)); // 4K blocks on 512 byte sectors usually
 
-        NTFS_RECORD_HEADER* indexRec = (NTFS_RECORD_HEADER*)dataBuf;
+    TIOTagScope tagScope(FLoader, TIOTag::IndexBlock);
 
-        for (size_t i = 0; i < iblocksCount; i++)
+    // reads are independent, asynchronous loaders may have several of them in flight and return them in order of completion
+    TErrorCode result = FLoader.ReadClustersAsync(std::span<const DATA_RUN_ITEM>(reads.GetValuePointer(0), reads.Count()),
+        [&](uint32_t readIndex, uint8_t* dataBuf, TErrorCode res)
         {
-            if (node.Bitmap.Test(iblockCounter++)) // add only Index Blocks (not LCNs) which are marked in bitmap bitfield
+            if (res != TErrorCode::Success) // ReadClusters wrties error message to log file in case of an error
+                return res;
+
+            DATA_RUN_ITEM& rd = reads[readIndex];
+            logger.DebugFmt("[ProcessAllocDataRuns] Read VCN: {}, LCN: {}, Length:{}", rd.vcn, rd.lcn, rd.len);
+
+            // how many Index Blocks we've read by recent read call
+            uint64_t iblocksCount = rd.len * BytesPerCluster / node.IndexBlockSize;
+            uint64_t iblock = firstBlocks[readIndex];
+
+            for (uint64_t i = 0; i < iblocksCount; i++, iblock++)
             {
+                if (iblock >= bitsEnd) break; // no more valid Index Blocks
+                if (!node.Bitmap.Test(iblock)) continue; // block in a cluster shared with allocated blocks
+
+                NTFS_RECORD_HEADER* indexRec = (NTFS_RECORD_HEADER*)(dataBuf + i * node.IndexBlockSize);
+                uint64_t clusterOffset = i * node.IndexBlockSize / BytesPerCluster;
+
                 if (!ntfs_is_indx_recp(indexRec->Signature)) // bypass non 'INDX' clusters (usually filled by zero)
                 {
                     // Not sure if this is correct situation when list of LCNs in one data run has "holes" for which Bitmap attribute has 1 in appropriate cluster.
-                   
+
                     uint8_t* sign = indexRec->Signature;
                     logger.WarnFmt("[ProcessAllocDataRuns] Signature 'INDX' has not been found in LCN cluster {}. Signature found: {}{}{}{}", 
-                        rli.lcn + i* node.IndexBlockSize / getVolData().BytesPerCluster, sign[0], sign[1], sign[2], sign[3]);
-
-                 //   continue;
+                        rd.lcn + clusterOffset, sign[0], sign[1], sign[2], sign[3]);
                 }
                 else
                 {
                     // do fixups only for valid blocks
-                    result = FLoader.FixupUSA1((NTFS_RECORD_HEADER*)(dataBuf + i * node.IndexBlockSize), node.IndexBlockSize, getVolData().BytesPerSector);
-                    if (result != TErrorCode::Success)
+                    TFixupTimer timer(FLoader.GetStats(), 1, node.IndexBlockSize);
+                    res = fixupKernels.Fixup(indexRec, node.IndexBlockSize, BytesPerSector);
+                    if (res != TErrorCode::Success)
                     {
-                        //result = false;
+                        fixupResult = res; // rest of the read is skipped, other reads are still processed
                         break;
                     }
                 }
 
                 //process particular Index Block, either add to list of blocks in cache or get list of files from this record, depending on predicate
-                processIndexBlockPred(dataBuf + i * node.IndexBlockSize, rli.vcn + i*node.IndexBlockSize/getVolData().BytesPerCluster, rli.lcn + i*node.IndexBlockSize/getVolData().BytesPerCluster);
+                processIndexBlockPred(dataBuf + i * node.IndexBlockSize, rd.vcn + clusterOffset, rd.lcn + clusterOffset);
             }
-            else
-            {
-                logger.DebugFmt("[ProcessAllocDataRuns] Bitmap bit {}th is zero. LastBit: {}. Bypassing Index Block# {}.", 
-                    iblockCounter, lastBit, rli.lcn + i* node.IndexBlockSize / getVolData().BytesPerCluster);
-                
-                if (iblockCounter > lastBit) // no more valid LCNs 
-                    break;
-            }
-        }
 
-        currRun++;
-    }
+            return TErrorCode::Success;
+        });
 
-    delete[] dataBuf;
+    if (result == TErrorCode::Success) result = fixupResult;
 
     logger.Debug("---------- END OF PROCESSING ATTR_ALLOC Data Runs ---------");
 
     return result;
 }
 
+bool TMFTBaseReader::SetPrefetch(bool enable, uint32_t maxDepth)
+{
+    delete FPrefetcher;
+    FPrefetcher = nullptr;
+
+    if (!enable) return true;
+    if (!FLoader.SupportsConcurrentReads()) return false; // prefetch thread and parser would share the loader
+
+    FPrefetcher = DBG_NEW TRecordsPrefetcher(FLoader, maxDepth);
+    return true;
+}
+
+expected_uintptr TMFTBaseReader::LoadExtRecord(const MFT_REF& extRecRef)
+{
+    if (FExtIndex != nullptr)
+    {
+        MFT_FILE_RECORD* extRec = FExtIndex->Find(extRecRef);
+        if (extRec != nullptr) return (uint8_t*)extRec;
+    }
+
+    return FLoader.LoadMFTRecordCache(extRecRef);
+}
+
+uint8_t* TMFTBaseReader::BatchBuffer(size_t dirLevel, uint32_t recsCount)
+{
+    if (FBatchBufs.size() <= dirLevel) FBatchBufs.resize(dirLevel + 1);
+
+    std::vector<uint8_t>& buf = FBatchBufs[dirLevel];
+    size_t size = (size_t)std::min(recsCount, READ_ITEMS_BATCH_SIZE) * getVolData().BytesPerMFTRec;
+    if (buf.size() < size) buf.resize(size); // buffers of other levels are not moved, their records stay valid
+
+    return buf.data();
+}
+
+/**
+* @brief Loads batch of child MFT records and calls pred for each of them, like FLoader.LoadMFTRecords does.
+* @details Records already read by prefetcher are passed to pred first, remaining ones are loaded by one FLoader.LoadMFTRecords call.
+* pred gets the same records and the same indexes as without prefetcher, only order of pred calls differs.
+*/
+TErrorCode TMFTBaseReader::LoadChildRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred)
+{
+    if (FPrefetcher == nullptr) return FLoader.LoadMFTRecords(mftRecRefs, pred);
+
+    uint8_t* mftRecBuf = (uint8_t*)alloca(getVolData().BytesPerMFTRec);
+    THArray<MFT_REF> missRefs;
+    THArray<uint32_t> missIndexes; // indexes of missed records in mftRecRefs
+
+    for (uint32_t i = 0; i < mftRecRefs.size(); i++)
+    {
+        if (FPrefetcher->Take(mftRecRefs[i], mftRecBuf))
+        {
+            CH_ERR(pred(i, mftRecRefs[i], mftRecBuf, TErrorCode::Success));
+        }
+        else
+        {
+            missRefs.AddValue(mftRecRefs[i]);
+            missIndexes.AddValue(i);
+        }
+    }
+
+    if (missRefs.Count() == 0) return TErrorCode::Success;
+
+    return FLoader.LoadMFTRecords(std::span<const MFT_REF>(missRefs.GetValuePointer(0), missRefs.Count()),
+        [&pred, &missIndexes](uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)
+        {
+            return pred(missIndexes[index], mftRecRef, mftRecData, res);
+        });
+}
+
+
+// sizes of run length and LCN offset fields for every header byte of mapping pair: low nibble is size of length, high nibble is size of offset.
+// Size is the whole pair with header byte, 0 for headers that cannot start a pair (zero or more than 8 bytes length, more than 8 bytes offset)
+struct RUN_HEADER_INFO
+{
+    uint8_t LenBytes;
+    uint8_t OffBytes;
+    uint8_t Size;
+};
+
+static constexpr std::array<RUN_HEADER_INFO, 256> RunHeaders = []()
+    {
+        std::array<RUN_HEADER_INFO, 256> table{};
+        for (uint32_t h = 0; h < 256; h++)
+        {
+            uint8_t lenBytes = h & 0x0F;
+            uint8_t offBytes = (h >> 4) & 0x0F;
+            bool valid = (lenBytes > 0) && (lenBytes <= 8) && (offBytes <= 8);
+            table[h] = { lenBytes, offBytes, (uint8_t)(valid ? 1 + lenBytes + offBytes : 0) };
+        }
+        return table;
+    }();
+
+// mapping pairs are little-endian, the same as x86/x64, so 8 bytes are loaded at once and masked to the field size
+static inline uint64_t LoadLE64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t LoadLE(const uint8_t* p, uint32_t bytes, bool canOverread)
+{
+    if (bytes == 0) return 0;
+
+    uint64_t value;
+    if (canOverread)
+    {
+        value = LoadLE64(p);
+    }
+    else
+    {
+        value = 0;
+        memcpy(&value, p, bytes);
+    }
+
+    return (bytes == 8) ? value : value & ((1ull << (bytes * 8)) - 1);
+}
 
 TErrorCode TMFTBaseReader::DecodeDataRuns(MFT_ATTR_HEADER* attr, TDataRuns& runs)
 {
@@ -159,56 +301,47 @@ TErrorCode TMFTBaseReader::DecodeDataRuns(MFT_ATTR_HEADER* attr, TDataRuns& runs
 
     uint64_t currVCN = attr->nonres.StartVCN;
     uint64_t currLCN = 0;
+    uint32_t firstRun = runs.Count();
 
     // read all data runs 
     while ((datarun < attrEnd) && *datarun) // stop if we reached zero in both nibbles (half bytes) or reached attrEnd
     {
-        DATA_RUN_ITEM ri{ 0 };
-        int64_t deltaxcn; // can be negative, it's ok
-
-        ri.vcn = currVCN;
-        ri.lcn = currLCN;
-
-        uint8_t lens = *datarun;
-        uint8_t b = lens & 0x0F; // minor half byte is length (in bytes) of the following int value "number of clusters in current data run"
-        if (b)
+        const RUN_HEADER_INFO& hdr = RunHeaders[*datarun];
+        if ((hdr.Size == 0) || (datarun + hdr.Size > attrEnd))
         {
-            assert(b <= 8);
-            // reading number of bytes specified in minor half byte and interpret it as integer "number of clusters"
-            for (deltaxcn = datarun[b--]; b; b--)
-                deltaxcn = (deltaxcn << 8) + datarun[b];
+            // the length entry cannot be zero, fields cannot be longer than 8 bytes or go beyond the attribute
+            logger.ErrorFmt("[DataRunsDecode] Incorrect mapping pair header {:#x} at offset {} of {} attribute.", *datarun, Diff2Ptr(attr, datarun), AttrName(attr->AttrType));
+            return TErrorCode::CorruptedData;
         }
-        else
+
+        // both fields are loaded by 8 bytes when there are 8 bytes after each of them, otherwise only field bytes are read
+        bool canOverread = (datarun + 1 + hdr.LenBytes + 8 <= attrEnd);
+        uint64_t len = LoadLE(datarun + 1, hdr.LenBytes, canOverread);
+        int64_t deltaLCN = 0; // can be negative, it's ok
+        if (hdr.OffBytes > 0)
         {
-            // the length entry cannot be zero
-            logger.Error("[DataRunsDecode] Missing length entry in mapping pairs (run len) array.");
-            //deltaxcn = (int64_t)-1;
-            return TErrorCode::CorruptedData;
+            uint32_t shift = 64 - hdr.OffBytes * 8;
+            deltaLCN = (int64_t)(LoadLE(datarun + 1 + hdr.LenBytes, hdr.OffBytes, canOverread) << shift) >> shift; // sign extension
         }
 
-        assert(deltaxcn > 0);
-        ri.len = deltaxcn;
-        currVCN += deltaxcn;
+        assert((int64_t)len > 0);
 
-        // major half byte is a length (in bytes) the of LCN 
-        uint8_t b2 = lens & 0x0F;
-        uint8_t b3 = b = b2 + ((lens >> 4) & 0x0F);
-        deltaxcn = (datarun[b] & 0x80) ? (uint64_t)-1 : 0; // delta LCN can be negative in datarun! Fill initial deltaxcn with 0xFFF..FFF in that case 
-        //deltaxcn = datarun[b--]
-        for (; b > b2; b--) // read num of bytes specified in major half byte and interpret it as LCN
-            deltaxcn = (deltaxcn << 8) + datarun[b];
+        DATA_RUN_ITEM ri;
+        ri.vcn = currVCN;
+        ri.len = len;
+        currVCN += len;
 
-        currLCN += deltaxcn;
-        if (deltaxcn == 0) 
-            ri.lcn = 0; // for sparse files data run contains "virtual" LCN virtualy filled by zero
-        else 
-            ri.lcn = currLCN;
+        currLCN += deltaLCN;
+        ri.lcn = (deltaLCN == 0) ? 0 : currLCN; // for sparse files data run contains "virtual" LCN virtualy filled by zero
 
         runs.AddValue(ri);
+        datarun += hdr.Size; // move to the next data run
+    }
 
-        datarun += b3 + 1; // move to the next data run
-
-        logger.TraceFmt("[DataRunsDecode] Data Run#{}, VCN: {}, LCN: {}, Len: {}", runs.Count(), ri.vcn, ri.lcn, ri.len);
+    if (logger.ShouldLog(LogEngine::Levels::llTrace))
+    {
+        for (uint32_t i = firstRun; i < runs.Count(); i++)
+            logger.TraceFmt("[DataRunsDecode] Data Run#{}, VCN: {}, LCN: {}, Len: {}", i + 1, runs[i].vcn, runs[i].lcn, runs[i].len);
     }
 
     logger.DebugFmt("[DataRunsDecode] Total Data Runs: {}, Last VCN: {}", runs.Count(), currVCN);
@@ -216,7 +349,6 @@ TErrorCode TMFTBaseReader::DecodeDataRuns(MFT_ATTR_HEADER* attr, TDataRuns& runs
     return TErrorCode::Success;
 }
 
-
 /// calls predicate pred for all files got from ihdr
 /// DOES NOT go to subnodes
 void TMFTBaseReader::GetFileList(INDEX_HDR* ihdr, AddFileAttrPred pred)
@@ -365,54 +497,34 @@ void TMFTBaseReader::GetFileListFromNode(INDEX_HDR* ihdr, TLCNRecs& lcns, TFileL
 }
 
 // called for directory MFT records only
-// returns pointer to the first non-DOS ATTR_FILENAME attribute in mftRec
+// returns pointer to the first non-DOS ATTR_FILENAME attribute in mftRec, nullptr when record does not have it (broken record)
 // dir MFT rec can contain either one or two ATTR_FILENAME attributes, in case of two one of them is DOS attribute
 ATTR_FILE_NAME* TMFTBaseReader::GetDirNameAttr(MFT_FILE_RECORD* mftRec)
 {
     // should be called for dir MFT rec only
     assert(mftRec->Flags == (MFT_FLAG_IN_USE | MFT_FLAG_IS_DIRECTORY));
 
-    TAttrCollection collection;
-    auto res = FillAttrCollection(mftRec, MakeAttrBitmask(ATTR_FILENAME), collection);// fill collection only with ATTR_FILENAME attributes
-    assert(res == TErrorCode::Success);
-    if (res != TErrorCode::Success)
-        return nullptr;
-
-    auto& fileNames = collection.Get(ATTR_FILENAME);
-
-    // dir MFT record can contain only 1 or 2 ATTR_FILENAME attributes
-    assert(fileNames.Count() < 3);
-    assert(fileNames.Count() > 0);
-    
-    ATTR_FILE_NAME* attrFNameNDOS{ 0 };
-
-    auto attr = fileNames[0];
+    // walk stops at the first non-DOS name, DOS name is remembered only to check it against the non-DOS one
+    TAttrRange<MakeAttrBitmask(ATTR_FILENAME)> fileNames(*this, mftRec);
+    [[maybe_unused]] ATTR_FILE_NAME* attrFNameDOS{ nullptr };
 
-    attrFNameNDOS = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
-
-    if (fileNames.Count() == 1)
+    for (auto attr : fileNames)
     {
-        assert(attrFNameNDOS->NameType != FILE_NAME_DOS);
-    }
-    else
-    {
-        attr = fileNames[1];
-        auto attrFNameNDOS2 = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
-
-        if (attrFNameNDOS->NameType == FILE_NAME_DOS)
-        {
-            assert(attrFNameNDOS2->NameType != FILE_NAME_DOS);
-            assert(attrFNameNDOS->ParentDir.sId.low == attrFNameNDOS2->ParentDir.sId.low);
-            attrFNameNDOS = attrFNameNDOS2;
-        }
-        else
+        auto attrFName = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
+        if (attrFName->NameType != FILE_NAME_DOS)
         {
-            assert(attrFNameNDOS2->NameType == FILE_NAME_DOS);
-            assert(attrFNameNDOS->ParentDir.sId.low == attrFNameNDOS2->ParentDir.sId.low);
+            assert((attrFNameDOS == nullptr) || (attrFNameDOS->ParentDir.sId.low == attrFName->ParentDir.sId.low));
+            return attrFName;
         }
+
+        assert(attrFNameDOS == nullptr); // dir MFT record can contain only 1 or 2 ATTR_FILENAME attributes
+        attrFNameDOS = attrFName;
     }
 
-    return attrFNameNDOS;
+    // non-DOS name must be present, record without it (or with corrupted attributes) is broken
+    GET_LOGGER;
+    logger.ErrorFmt("[GetDirNameAttr] Directory MFT record {} does not have non-DOS file name.", mftRec->IndexMFTRec);
+    return nullptr;
 }
 
     /*
@@ -462,21 +574,18 @@ ATTR_FILE_NAME* TMFTBaseReader::GetDirNameAttr(MFT_FILE_RECORD* mftRec)
 }*/
 
 // fills array attrFileNames with pointers to all ATTR_FILENAME attributes which mftRec contains except DOS ones 
-// Goes inside of ATTR_LIST_ATTR attribute if MFT record has it
+// Goes inside of ATTR_LIST_ATTR attribute if MFT record has it. Names located in extension records are copied into nameCopies
+// (extension records may be evicted from records cache by following loads), so pointers are valid while mftRec and nameCopies exist
 // attrFileNames is cleared each time before filling with new values
-TErrorCode TMFTBaseReader::GetFileNameAttrPointers(MFT_FILE_RECORD* mftRec, THArray<ATTR_FILE_NAME*>& attrFileNames)
+TErrorCode TMFTBaseReader::GetFileNameAttrPointers(MFT_FILE_RECORD* mftRec, THArray<ATTR_FILE_NAME*>& attrFileNames, std::vector<std::unique_ptr<uint8_t[]>>& nameCopies)
 {
     attrFileNames.Clear();
 
-    TAttrCollection collection;
-    auto res = FillAttrCollection(mftRec, MakeAttrBitmask(ATTR_FILENAME), collection); // fill collection only with ATTR_FILENAME attributes
-    if (res != TErrorCode::Success)
-        return res;
-
     ATTR_FILE_NAME* attrFName;
     THash<MFTRecIndex, std::wstring> parents;
 
-    for (auto attr : collection.Get(ATTR_FILENAME))
+    TAttrRange<MakeAttrBitmask(ATTR_FILENAME)> fileNames(*this, mftRec);
+    for (auto attr : fileNames)
     {
         assert(attr->AttrType == ATTR_FILENAME);
         assert(attr->NonResidentFlag == ATTR_FLAG_RESIDENT);
@@ -490,11 +599,18 @@ TErrorCode TMFTBaseReader::GetFileNameAttrPointers(MFT_FILE_RECORD* mftRec, THAr
             if (parents.IfExists(attrFName->ParentDir.sId.low)) // all pairs (FileName, parent ID) should be different (excluding FILE_NAME_DOS)
                 assert(parents[attrFName->ParentDir.sId.low] != wnm);
             parents.SetValue(attrFName->ParentDir.sId.low, wnm);
+
+            if (((uint8_t*)attr < (uint8_t*)mftRec) || ((uint8_t*)attr >= Add2Ptr(mftRec, getVolData().BytesPerMFTRec))) // attribute is in extension record
+            {
+                nameCopies.push_back(std::make_unique_for_overwrite<uint8_t[]>(attr->res.DataSize));
+                memcpy(nameCopies.back().get(), attrFName, attr->res.DataSize);
+                attrFName = (ATTR_FILE_NAME*)nameCopies.back().get();
+            }
             attrFileNames.AddValue(attrFName);
         }
     }
 
-    return TErrorCode::Success;
+    return fileNames.Result();
 }
 
 
@@ -523,6 +639,8 @@ std::wstring TMFTBaseReader::GetPathByAttrFileName(ATTR_FILE_NAME* attrFileName)
         // dir can contain only one or two filenames
         // in case of two - one is DOS another is WIN
         attrFName = GetDirNameAttr(mftRec);
+        if (attrFName == nullptr) // GetDirNameAttr writes a message into log file
+            throw std::runtime_error("[GetPathByAttrFileName] directory MFT record without file name found!");
 
         str.assign(GetFName(attrFName), attrFName->FileNameLen);
         arrPath.AddValue(str);
@@ -566,8 +684,9 @@ TErrorCode TMFTBaseReader::PathByMFTRecID(MFT_REF mftRecRef, THArray<std::wstrin
         return res;
 
     THArray<ATTR_FILE_NAME*> attrFileNames;
+    std::vector<std::unique_ptr<uint8_t[]>> nameCopies; // GetPathByAttrFileName loads records, names of extension records are copied
 
-    res = GetFileNameAttrPointers(mftRec, attrFileNames); // get all file names except for DOS ones
+    res = GetFileNameAttrPointers(mftRec, attrFileNames, nameCopies); // get all file names except for DOS ones
     assert(res == TErrorCode::Success);
     if (res != TErrorCode::Success)
         return res;
@@ -622,22 +741,30 @@ TErrorCode TMFTBaseReader::FillAttrCollection(MFT_FILE_RECORD* mftRec, uint32_t
         {
             // RecRef - is a child MFT rec where attr value is located
 
-            // we need cache version because mftRecBuf should remain valid till we return back to GetMFTRecIdByPath in calls stack
-            auto mftRecBuf = FLoader.LoadMFTRecordCache(RecRef);
-            if (mftRecBuf)
+            // records of extension index stay valid while the index exists
+            MFT_FILE_RECORD* extRec = (FExtIndex != nullptr) ? FExtIndex->Find(RecRef) : nullptr;
+            if (extRec == nullptr)
             {
-                return FillAttrCollection((MFT_FILE_RECORD*)(*mftRecBuf), attrFilter, collection);
-            }
-            else
-            {
-                GET_LOGGER;
-                // error loading MFT record
-                // do not break loop and trying to load more records
-                logger.Error("[callAddItemToCollectionPred] LoadMFTRecordCache returned NULL!");
-                return mftRecBuf.error();
+                auto mftRecBuf = FLoader.LoadMFTRecordCache(RecRef);
+                if (!mftRecBuf)
+                {
+                    GET_LOGGER;
+                    // error loading MFT record
+                    // do not break loop and trying to load more records
+                    logger.Error("[callAddItemToCollectionPred] LoadMFTRecordCache returned NULL!");
+                    return mftRecBuf.error();
+                }
+
+                // collected pointers must stay valid till we return back to GetMFTRecIdByPath in calls stack,
+                // cached record may be evicted by loading of the next extension record (small or disabled records cache),
+                // so it is copied into the collection unless the loader keeps records in place
+                if (FLoader.RecordPointersStable())
+                    extRec = (MFT_FILE_RECORD*)mftRecBuf.value();
+                else
+                    extRec = collection.KeepRecord(mftRecBuf.value(), getVolData().BytesPerMFTRec);
             }
 
-            //return TErrorCode::Success;
+            return FillAttrCollection(extRec, attrFilter, collection);
         };
 
     MFT_ATTR_HEADER* currAttr = (MFT_ATTR_HEADER*)Add2Ptr(mftRec, mftRec->FirstAttrOffset);
@@ -681,8 +808,7 @@ TErrorCode TMFTBaseReader::FillAttrCollection(MFT_FILE_RECORD* mftRec, uint32_t
                 uint8_t* currAttrEnd = (uint8_t*)currAttr + currAttr->AttrSize;
                 uint64_t processedAttrSize = 0;
 
-                THArray<MFTRecIndex> visitedMFTRec;
-                visitedMFTRec.AddValue(mftRec->IndexMFTRec);
+                TVisitedRecs visitedMFTRec(mftRec->IndexMFTRec);
 
                 auto res = ParseAttrList(mftRec->IndexMFTRec, attrFilter, attrListItem, currAttrEnd, currAttr->res.DataSize, processedAttrSize, visitedMFTRec, callProcessChildMFTRecsPred);
                 if (res != TErrorCode::Success)
@@ -958,10 +1084,10 @@ TErrorCode TMFTBaseReader::ParseNonresAttrList(MFTRecIndex indexMFTRec, uint32_t
     if (res != TErrorCode::Success) // DataRunsDecode writes a message into log file in case of an error
         return res;
 
-    THArray<MFTRecIndex> visitedMFTRec;
     // this is do not not parse current indexMFTRec again when reading attrEntry->ref MFT records   
     // because attrs located in current MFT rec either already parsed or will be parsed during usual cycle of parsing 
-    visitedMFTRec.AddValue(indexMFTRec);
+    // the set is shared by all data runs, so extension record referred from several runs is parsed once
+    TVisitedRecs visitedMFTRec(indexMFTRec);
 
     uint32_t currRun = 0;
 
@@ -971,6 +1097,8 @@ TErrorCode TMFTBaseReader::ParseNonresAttrList(MFTRecIndex indexMFTRec, uint32_t
     // second data run is "officially" present, but is not parsed because of RealSize
     uint64_t processedAttrSize = 0;
 
+    TIOTagScope tagScope(FLoader, TIOTag::AttrList); // extension MFT records loaded below are tagged as MFT records anyway
+
     while (currRun < dataRuns.Count())
     {
         DATA_RUN_ITEM& rli = dataRuns[currRun];
@@ -1032,6 +1160,8 @@ TErrorCode TMFTBaseReader::ParseNonresBitmap(MFT_ATTR_HEADER* attr, TBitField& b
 
     uint64_t processedSize = 0;
 
+    TIOTagScope tagScope(FLoader, TIOTag::Bitmap);
+
     while (currRun < dataRuns.Count())
     {
         DATA_RUN_ITEM& rli = dataRuns[currRun];
@@ -1266,7 +1396,7 @@ TErrorCode TMFTBaseReader::GetFileListFromMFTRec(TAttrCollection& collection, TF
 
 //parses either resident or non-resident ATTR_LIST
 TErrorCode TMFTBaseReader::ParseAttrList(MFTRecIndex indexMFTRec, ATTR_LIST_ENTRY* startListItem, uint8_t* attrListEnd, uint64_t realSize, 
-                                         uint64_t& processedAttrSize, THArray<MFTRecIndex> visitedMFTRec, AttrListPred processChildMFTRecPred)
+                                         uint64_t& processedAttrSize, TVisitedRecs& visitedMFTRec, AttrListPred processChildMFTRecPred)
 {
     return ParseAttrList(indexMFTRec, ALL_ATTRS_FILTER, startListItem, attrListEnd, realSize, processedAttrSize, visitedMFTRec, processChildMFTRecPred);
 }
@@ -1274,7 +1404,7 @@ TErrorCode TMFTBaseReader::ParseAttrList(MFTRecIndex indexMFTRec, ATTR_LIST_ENTR
 // Parses both resident or non-resident ATTR_LISTs
 // Gets only attributes specified by attrFilter parameter (bitwise mask)
 TErrorCode TMFTBaseReader::ParseAttrList(MFTRecIndex indexMFTRec, uint32_t attrFilter, ATTR_LIST_ENTRY* startListItem, uint8_t* attrListEnd, uint64_t realSize, 
-                                         uint64_t& processedAttrSize, THArray<MFTRecIndex> visitedMFTRec, AttrListPred processChildMFTRecPred)
+                                         uint64_t& processedAttrSize, TVisitedRecs& visitedMFTRec, AttrListPred processChildMFTRecPred)
 {
     GET_LOGGER;
 
@@ -1314,13 +1444,13 @@ TErrorCode TMFTBaseReader::ParseAttrList(MFTRecIndex indexMFTRec, uint32_t attrF
             // because some attributes may reside in base mft record and the others in "child" mft record(s)
             // the attr list attribute itself is located in LCN cluster that is not mft record, it does not contain signature or Fixups values, etc.
 
-            if (visitedMFTRec.IndexOf(attrEntry->RecRef.sId.low) == -1) // whether we haven't parsed this MFT record yet
+            if (!visitedMFTRec.Contains(attrEntry->RecRef.sId.low)) // whether we haven't parsed this MFT record yet
             {
                 auto res = processChildMFTRecPred(attrEntry->RecRef);
                 if (res != TErrorCode::Success)
                     return res;
 
-                visitedMFTRec.AddValue(attrEntry->RecRef.sId.low);
+                visitedMFTRec.Add(attrEntry->RecRef.sId.low);
             }
 
             // StartVCN is a cluster where attribute portion value is located
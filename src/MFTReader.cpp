@@ -20,6 +20,7 @@
 #include "cli/HelpFormatter.h"
 #include "cli/DefaultParser.h"
 #include "Readers.h"
+#include "RecordTable.h"
 #include "MFTReader.h"
 
 
@@ -64,12 +65,19 @@ int _tmain(int argc, TCHAR* argv[])
         PrintUsage(options);
         return 1;
     }
+
+    if (!NumericOptionsValid(cmd))
+    {
+        logger.Error("Error. Incorrect numeric option value.\n");
+        PrintUsage(options);
+        return 1;
+    }
     
 
     try 
     {
         //TODO re-do this error handling to proper way
-        if (!cmd.HasOption(OPT_T))
+        if (!cmd.HasOption(OPT_T) && !cmd.HasOption(OPT_Y) && !cmd.HasOption(OPT_N))
             assert( (cmd.HasOption(OPT_R) && !cmd.HasOption(OPT_P) && !cmd.HasOption(OPT_S) && !cmd.HasOption(OPT_C)) ||
                     (cmd.HasOption(OPT_P) && !cmd.HasOption(OPT_R) && !cmd.HasOption(OPT_S) && !cmd.HasOption(OPT_C)) ||
                     (cmd.HasOption(OPT_S) && !cmd.HasOption(OPT_C) && !cmd.HasOption(OPT_R) && !cmd.HasOption(OPT_P)) ||
@@ -83,15 +91,13 @@ int _tmain(int argc, TCHAR* argv[])
 
             auto absPath = IRecordsLoader::AbsPath(volume);
 
-            IRecordsLoader* ldr{ nullptr };
+            IRecordsLoader* ldr = CreateRecordsLoader(absPath, cmd);
             if (IRecordsLoader::IsPath(absPath)) //TODO shall we check here that path refered by absPath really exist?
             {
-                ldr = new TFileImageRecordsLoader(absPath);
                 cout_t << std::format(_T("Information about MFT record ID: #{} on disk image file: {}"), mftRecID, ldr->GetVolumeData().Name) << std::endl;
             }
             else
             {
-                ldr = new TWinAPIRecordsLoader(absPath);
                 cout_t << std::format(_T("Information about MFT record ID: #{} on volume: {}"), mftRecID, ldr->GetVolumeData().Name) << std::endl;
             }
 
@@ -123,6 +129,7 @@ int _tmain(int argc, TCHAR* argv[])
                     logger.ErrorFmt("Error reading info about specified MFT record ID ({})", mftRecID);
             }
 
+            FinishIOTrace(*ldr);
             delete ldr;
 
         }
@@ -130,6 +137,7 @@ int _tmain(int argc, TCHAR* argv[])
         {         
             string_t path = cmd.GetOptionValue(OPT_P, 0);
             TWinAPIRecordsLoader ldr(path);
+            if (cmd.HasOption(OPT_W)) ldr.StartIOTrace(cmd.GetOptionValue(OPT_W, 0));
             TMFTStatCollector rdr(ldr);
             
             cout_t << path << std::endl;
@@ -171,6 +179,8 @@ int _tmain(int argc, TCHAR* argv[])
             {
                 cout_t << "Specified path is incorrect." << std::endl;
             }
+
+            FinishIOTrace(ldr);
         }
         else if (cmd.HasOption(OPT_S)) // volume statistics requested.
         {
@@ -179,19 +189,35 @@ int _tmain(int argc, TCHAR* argv[])
 
             auto absPath = IRecordsLoader::AbsPath(volume);
             
-            IRecordsLoader* ldr{ nullptr };
-            if (IRecordsLoader::IsPath(absPath)) //TODO shall we check here that path refered by volume really exist?
-                ldr = new TFileImageRecordsLoader(absPath);
-            else
-                ldr = new TWinAPIRecordsLoader(absPath); // TWinAPICacheRecordsLoader ldr(absPath);
+            IRecordsLoader* ldr = CreateRecordsLoader(absPath, cmd);
 
             TMFTStatCollector srdr(*ldr);
+            StartPrefetch(srdr, cmd);
+
+            // "linear" mode walks $MFT sequentially instead of directory indexes
+            // "extindex" mode walks directory indexes but takes extension records referred by ATTR_LIST from index built by one sequential pass
+            string_t mode = cmd.GetOptionValue(OPT_S, 1);
+            bool linear = (mode == _T("linear"));
+            TExtRecordIndex extIndex;
+            if (mode == _T("extindex"))
+            {
+                if (extIndex.Build(*ldr) == TErrorCode::Success)
+                    srdr.SetExtIndex(&extIndex);
+                else
+                    logger.Error("Error building extension records index, extension records are loaded from disk.");
+            }
 
-            auto res = srdr.CollectVolumeStat();
+            auto res = linear ? srdr.CollectVolumeStatLinear() : srdr.CollectVolumeStat();
             if (res != TErrorCode::Success)
                 logger.Error("Error reading volume files statistics.");
 
             srdr.ShowVolumeStat();
+            if (srdr.GetExtIndex() != nullptr)
+                logger.InfoFmt("Extension records index: {} records, {} hits, {} misses.", extIndex.Count(), extIndex.GetHits(), extIndex.GetMisses());
+            srdr.SetExtIndex(nullptr);
+            FinishPrefetch(srdr);
+            PrintLoaderStats(*ldr);
+            FinishIOTrace(*ldr);
 
             //ReadDirsV2(vol);
 
@@ -206,19 +232,27 @@ int _tmain(int argc, TCHAR* argv[])
 
             auto absPath = IRecordsLoader::AbsPath(volume);
 
-            IRecordsLoader* ldr{ nullptr };
-            if (IRecordsLoader::IsPath(absPath)) //TODO shall we check here that path refered by volume really exist?
-                ldr = new TFileImageRecordsLoader(absPath);
-            else
-                ldr = new TWinAPIRecordsLoader(absPath); // TWinAPICacheRecordsLoader ldr(absPath);
+            IRecordsLoader* ldr = CreateRecordsLoader(absPath, cmd);
 
             TMFTSearchReader srchrdr(*ldr);
+            StartPrefetch(srchrdr, cmd);
             srchrdr.ReadDirsV1();
+            FinishPrefetch(srchrdr);
+            PrintLoaderStats(*ldr);
+            FinishIOTrace(*ldr);
 
             logger.InfoFmt("File System reading time : {}", MillisecToStr<std::string>(Ticks::Finish(_T("FSReadingTime"))));
 
             delete ldr;
         }
+        else if (cmd.HasOption(OPT_Y)) // replay of I/O trace requested
+        {
+            RunIOTraceReplay(cmd);
+        }
+        else if (cmd.HasOption(OPT_N)) // snapshot of MFT records requested
+        {
+            RunMFTSnapshot(cmd);
+        }
         else if (cmd.HasOption(OPT_T))
         {
             TWinAPIRecordsLoader ldr(_T("C"));
@@ -254,11 +288,297 @@ int _tmain(int argc, TCHAR* argv[])
 
 
 
+// -d hdd|smb|<latency in microseconds> [bandwidth in MB/s]
+static LATENCY_MODEL ParseLatencyModel(CCommandLine& cmd)
+{
+    string_t model = cmd.GetOptionValue(OPT_D, 0);
+    string_t bandwidth = cmd.GetOptionValue(OPT_D, 1);
+
+    LATENCY_MODEL result;
+    if (model == _T("hdd")) result = LATENCY_MODEL::HDD();
+    else if (model == _T("smb")) result = LATENCY_MODEL::SMB();
+    else result = LATENCY_MODEL::Fixed(std::stoull(model) * 1000, 0); // exception will be thrown if option value cannot be converted into uint
+
+    if (!bandwidth.empty()) result.BytesPerSec = std::stoull(bandwidth) * 1024 * 1024;
+
+    return result;
+}
+
+// disk image loader TLoader, it is wrapped into TLatencyLoader when slow device is simulated (-d option)
+template<class TLoader, class... Args>
+static IRecordsLoader* NewImageLoader(const string_t& absPath, CCommandLine& cmd, Args... args)
+{
+    if (cmd.HasOption(OPT_D))
+        return new TLatencyLoader<TLoader>(ParseLatencyModel(cmd), absPath, args...);
+
+    return new TLoader(absPath, args...);
+}
+
+// creates loader for disk image file when absPath looks like a path, otherwise creates loader for a volume
+static IRecordsLoader* NewRecordsLoader(const string_t& absPath, CCommandLine& cmd)
+{
+    if (IRecordsLoader::IsPath(absPath)) //TODO shall we check here that path refered by absPath really exist?
+    {
+        if (IsMFTSnapshotFile(absPath)) // snapshot written by -n option, image loader options do not apply to it
+            return new TSnapshotRecordsLoader(absPath);
+
+        if (cmd.HasOption(OPT_M))
+            return NewImageLoader<TMappedImageRecordsLoader>(absPath, cmd);
+
+        if (cmd.HasOption(OPT_L))
+            return NewImageLoader<TSlabImageRecordsLoader>(absPath, cmd);
+
+        if (cmd.HasOption(OPT_U))
+            return NewImageLoader<TDirectImageRecordsLoader>(absPath, cmd);
+
+        if (cmd.HasOption(OPT_A))
+        {
+            string_t queueDepth = cmd.GetOptionValue(OPT_A, 0);
+            return NewImageLoader<TOverlappedImageRecordsLoader>(absPath, cmd, queueDepth.empty() ? DEFAULT_QUEUE_DEPTH : (uint32_t)std::stoul(queueDepth)); // value is checked by NumericOptionsValid
+        }
+
+        if (cmd.HasOption(OPT_F)) // prefetch thread shares the loader with the parser
+            return NewImageLoader<TConcurrentImageRecordsLoader>(absPath, cmd);
+
+        return NewImageLoader<TFileImageRecordsLoader>(absPath, cmd);
+    }
+
+    return new TWinAPIRecordsLoader(absPath); // TWinAPICacheRecordsLoader ldr(absPath);
+}
+
+// trace of device reads (-w option) starts right after the loader is opened
+IRecordsLoader* CreateRecordsLoader(const string_t& absPath, CCommandLine& cmd)
+{
+    IRecordsLoader* ldr = NewRecordsLoader(absPath, cmd);
+
+    if (cmd.HasOption(OPT_W))
+    {
+        try
+        {
+            ldr->StartIOTrace(cmd.GetOptionValue(OPT_W, 0));
+        }
+        catch (...)
+        {
+            delete ldr;
+            throw;
+        }
+    }
+
+    return ldr;
+}
+
+void FinishIOTrace(IRecordsLoader& ldr)
+{
+    if (!ldr.IsIOTracing()) return;
+
+    uint64_t count = ldr.StopIOTrace();
+    cout_t << std::endl << std::format(_T("{:<{}}: {} reads recorded"), _T("I/O trace"), F_WIDTH, count) << std::endl;
+}
+
+// -f [max window depth in records]
+void StartPrefetch(TMFTBaseReader& rdr, CCommandLine& cmd)
+{
+    if (!cmd.HasOption(OPT_F)) return;
+
+    string_t maxDepth = cmd.GetOptionValue(OPT_F, 0);
+    if (!rdr.SetPrefetch(true, maxDepth.empty() ? DEFAULT_PREFETCH_DEPTH : (uint32_t)std::stoul(maxDepth))) // exception will be thrown if option value cannot be converted into uint
+    {
+        GET_LOGGER;
+        logger.Warn("Prefetching is not available with selected loader, child records are read without it.");
+    }
+}
+
+// prefetch thread must be stopped before the loader is closed
+void FinishPrefetch(TMFTBaseReader& rdr)
+{
+    if (rdr.GetPrefetcher() == nullptr) return;
+
+    PREFETCH_STATS stats = rdr.GetPrefetcher()->GetStats();
+    rdr.SetPrefetch(false);
+
+    cout_t << std::endl << std::format(_T("{:<{}}: {} pushed, {} loaded, {} hits, {} late hits, {} misses, {} wasted"), _T("Prefetch"), F_WIDTH,
+        stats.Pushed, stats.Issued, stats.Hits, stats.LateHits, stats.Misses, stats.Wasted) << std::endl;
+    cout_t << std::format(_T("{:<{}}: {} records, max {} records"), _T("Prefetch window"), F_WIDTH, stats.Depth, stats.MaxDepth) << std::endl;
+}
+
+// latency percentiles and seek distances of device reads
+static void PrintReadsHistogram(const LOADER_IO_STATS& stats)
+{
+    if (stats.Reads.Calls == 0) return;
+
+    cout_t << std::format(_T("{:<{}}: p50 {} us, p90 {} us, p99 {} us, max {} us"), _T("Read latency"), F_WIDTH,
+        stats.LatencyPercentile(50) / 1000, stats.LatencyPercentile(90) / 1000, stats.LatencyPercentile(99) / 1000, stats.LatencyPercentile(100) / 1000) << std::endl;
+
+    cout_t << std::format(_T("{:<{}}: {} sequential, {} backward, {} with unknown offset"), _T("Seeks"), F_WIDTH,
+        stats.SeekHist[0], stats.BackwardSeeks, stats.UnknownOffsetReads) << std::endl;
+    for (uint32_t b = 1; b < SEEK_HIST_BUCKETS; b++)
+    {
+        if (stats.SeekHist[b] == 0) continue;
+        uint64_t bucketEnd = (b < 64) ? (1ull << b) : UINT64_MAX;
+        cout_t << std::format(_T("{:<{}}  < {:>20} bytes: {}"), _T(""), F_WIDTH, bucketEnd, stats.SeekHist[b]) << std::endl;
+    }
+}
+
+// shows where time of the run has gone: loader calls, reads and their latencies, seeks between reads, USA fixups
+void PrintLoaderStats(IRecordsLoader& ldr)
+{
+    LOADER_IO_STATS stats = ldr.GetIOStats();
+    const char_t* callNames[IO_CALLS_COUNT] = { _T("LoadMFTRecord"), _T("LoadMFTRecordCache"), _T("ReadClusters") };
+
+    auto printLine = [](const char_t* name, const IO_CALL_STATS& item)
+        {
+            cout_t << std::format(_T("{:<{}}: {:>10} calls {:>14} bytes {:>10} ms"), name, F_WIDTH, item.Calls, item.Bytes, item.Nanosecs / 1'000'000) << std::endl;
+        };
+
+    cout_t << std::endl << _T("Loader I/O statistics.") << std::endl;
+    for (uint32_t i = 0; i < IO_CALLS_COUNT; i++)
+        printLine(callNames[i], stats.Calls[i]);
+    printLine(_T("Reads"), stats.Reads);
+    printLine(_T("USA fixups"), stats.Fixups);
+
+    cout_t << std::format(_T("{:<{}}: {} hits, {} misses"), _T("Records cache"), F_WIDTH, stats.RecCacheHits, stats.RecCacheMisses) << std::endl;
+    cout_t << std::format(_T("{:<{}}: {} hits, {} misses"), _T("Clusters cache"), F_WIDTH, stats.ClusterCacheHits, stats.ClusterCacheMisses) << std::endl;
+
+    auto imgLoader = dynamic_cast<TFileImageRecordsLoader*>(&ldr);
+    if ((imgLoader != nullptr) && (imgLoader->GetContainer().GetFormat() != TDiskFormat::Raw))
+    {
+        const TDiskContainer& container = imgLoader->GetContainer();
+        cout_t << std::format(_T("{:<{}}: {}, {} of {} blocks allocated, {} bytes read as zeros"), _T("Virtual disk"), F_WIDTH,
+            DiskFormatName(container.GetFormat()), container.GetAllocatedBlocks(), container.GetBlocksCount(), container.GetZeroBytes()) << std::endl;
+    }
+
+    PrintReadsHistogram(stats);
+}
+
+// replays trace recorded by -w option: -y <trace file> <disk image or volume> [file|mmap|direct|async] [queue depth]
+void RunIOTraceReplay(CCommandLine& cmd)
+{
+    GET_LOGGER;
+
+    string_t traceFile = cmd.GetOptionValue(OPT_Y, 0);
+    string_t target = cmd.GetOptionValue(OPT_Y, 1);
+    string_t backendName = cmd.GetOptionValue(OPT_Y, 2, _T("file"));
+    string_t queueDepth = cmd.GetOptionValue(OPT_Y, 3);
+
+    TReplayBackend backend;
+    if (!StringToReplayBackend(backendName, backend))
+    {
+        logger.ErrorFmt("Unknown I/O backend: {}. Use one of: file, mmap, direct, async.", wtos(backendName));
+        return;
+    }
+
+    IO_TRACE_HEADER header;
+    THArray<IO_TRACE_RECORD> records;
+    if (LoadIOTrace(traceFile, header, records) != TErrorCode::Success) return; // LoadIOTrace writes error message to log file
+
+    // trace offsets are from the beginning of NTFS volume, disk image may have partition table before it
+    uint64_t baseOffset = 0;
+    auto absPath = IRecordsLoader::AbsPath(target);
+    if (IRecordsLoader::IsPath(absPath))
+    {
+        TFileImageRecordsLoader img(absPath);
+        if (!img.GetContainer().IsFlat())
+        {
+            // replay backends read the image file directly, blocks of virtual disk are not contiguous there
+            logger.ErrorFmt("I/O trace cannot be replayed on {} disk image.", wtos(DiskFormatName(img.GetContainer().GetFormat())));
+            return;
+        }
+
+        baseOffset = img.GetPartitionOffset();
+        target = absPath;
+    }
+    else
+    {
+        target = IRecordsLoader::NormalizeVolume(target);
+    }
+
+    TLoaderStats stats;
+    IO_REPLAY_RESULT result;
+    if (ReplayIOTrace(records, target, baseOffset, backend, queueDepth.empty() ? DEFAULT_QUEUE_DEPTH : (uint32_t)std::stoul(queueDepth), stats, result) != TErrorCode::Success)
+        return; // ReplayIOTrace writes error message to log file
+
+    cout_t << std::format(_T("Replay of I/O trace {} on {} with '{}' backend."), traceFile, target, backendName) << std::endl;
+    cout_t << std::format(_T("{:<{}}: {} reads, {} bytes, {} skipped, {} failed"), _T("Trace"), F_WIDTH, records.Count(), result.Bytes, result.Skipped, result.Failed) << std::endl;
+    for (uint32_t t = 0; t < (uint32_t)TIOTag::Count; t++)
+        if (result.TagReads[t] > 0) cout_t << std::format(_T("{:<{}}  {:<10}: {}"), _T(""), F_WIDTH, IOTagName((TIOTag)t), result.TagReads[t]) << std::endl;
+
+    uint64_t ms = std::max<uint64_t>(result.Nanosecs / 1'000'000, 1);
+    cout_t << std::format(_T("{:<{}}: {} ms, {} reads/s, {} MB/s"), _T("Replay time"), F_WIDTH, ms, result.Reads * 1000 / ms, result.Bytes * 1000 / ms / (1024 * 1024)) << std::endl;
+
+    LOADER_IO_STATS ioStats;
+    stats.Snapshot(ioStats);
+    PrintReadsHistogram(ioStats);
+}
+
+// writes snapshot of MFT records: -n <disk image or volume> <snapshot file> [z]
+void RunMFTSnapshot(CCommandLine& cmd)
+{
+    GET_LOGGER;
+
+    string_t volume = cmd.GetOptionValue(OPT_N, 0);
+    string_t snapshotFile = cmd.GetOptionValue(OPT_N, 1);
+    bool compress = (cmd.GetOptionValue(OPT_N, 2) == _T("z"));
+
+    Ticks::Start(_T("SnapshotTime"));
+
+    auto absPath = IRecordsLoader::AbsPath(volume);
+    IRecordsLoader* ldr = CreateRecordsLoader(absPath, cmd);
+
+    MFT_SNAPSHOT_INFO info;
+    TErrorCode res = WriteMFTSnapshot(*ldr, snapshotFile, compress, info);
+
+    if (res == TErrorCode::Success)
+    {
+        cout_t << std::format(_T("Snapshot of MFT records of {} is written into {}."), ldr->GetVolumeData().Name, snapshotFile) << std::endl;
+        cout_t << std::format(_T("{:<{}}: {} of {}"), _T("Records"), F_WIDTH, info.Records, ldr->GetRecordsCount()) << std::endl;
+        cout_t << std::format(_T("{:<{}}: {} blocks, {} bytes of records, {} bytes in file"), _T("Snapshot"), F_WIDTH, info.Blocks, info.RawBytes, info.FileBytes) << std::endl;
+        PrintLoaderStats(*ldr);
+    }
+    else
+    {
+        logger.Error("Error writing snapshot of MFT records.");
+    }
+
+    FinishIOTrace(*ldr);
+    logger.InfoFmt("Snapshot writing time : {}", MillisecToStr<std::string>(Ticks::Finish(_T("SnapshotTime"))));
+
+    delete ldr;
+}
+
 void PrintUsage(COptionsList& options)
 {
     cout_t << CHelpFormatter::Format(_T("MFTReader"), &options) << std::endl;
 }
 
+// true when argument argIdx of opt is omitted or is a decimal number from minValue to UINT32_MAX
+static bool UIntArgValid(CCommandLine& cmd, const string_t& opt, size_t argIdx, uint32_t minValue)
+{
+    string_t value = cmd.GetOptionValue(opt, argIdx);
+    if (value.empty()) return true;
+    if (!std::all_of(value.begin(), value.end(), [](char_t c) { return (c >= _T('0')) && (c <= _T('9')); })) return false;
+    if (value.size() > 10) return false; // more digits than UINT32_MAX has, std::stoull below cannot overflow
+
+    uint64_t number = std::stoull(value);
+    return (number >= minValue) && (number <= UINT32_MAX);
+}
+
+// numeric option values are checked right after parsing, so bad input prints usage instead of exception from std::stoul in the middle of work
+bool NumericOptionsValid(CCommandLine& cmd)
+{
+    if (cmd.HasOption(OPT_A) && !UIntArgValid(cmd, OPT_A, 0, 1)) return false; // queue depth
+    if (cmd.HasOption(OPT_F) && !UIntArgValid(cmd, OPT_F, 0, 1)) return false; // max records read ahead
+    if (cmd.HasOption(OPT_Y) && !UIntArgValid(cmd, OPT_Y, 3, 1)) return false; // queue depth of async backend
+
+    if (cmd.HasOption(OPT_D))
+    {
+        string_t model = cmd.GetOptionValue(OPT_D, 0);
+        if ((model != _T("hdd")) && (model != _T("smb")) && !UIntArgValid(cmd, OPT_D, 0, 0)) return false; // latency in microseconds
+        if (!UIntArgValid(cmd, OPT_D, 1, 1)) return false; // bandwidth in MB/s
+    }
+
+    return true;
+}
+
 void DefineOptions(COptionsList& options)
 {
     COption mm;
@@ -270,13 +590,43 @@ void DefineOptions(COptionsList& options)
     options.AddOption(pp);
 
     COption ss;
-    ss.ShortName(OPT_S).LongName(_T("stat")).Descr(_T("Show interesting volume/disk statistics.")).Required(false).NumArgs(1).RequiredArgs(0);
+    ss.ShortName(OPT_S).LongName(_T("stat")).Descr(_T("Show interesting volume/disk statistics. Optional second argument 'linear' collects statistics by one sequential pass over $MFT instead of walking directories, 'extindex' walks directories but reads extension records of ATTR_LIST from index built by one sequential pass over $MFT.")).Required(false).NumArgs(2).RequiredArgs(0);
     options.AddOption(ss);
 
     COption cc;
     cc.ShortName(OPT_C).LongName(_T("cache")).Descr(_T("Build cache for file search and show some statistics.")).Required(false).NumArgs(1).RequiredArgs(0);
     options.AddOption(cc);
 
+    options.AddOption(OPT_M, _T("mmap"), _T("Memory-map disk image file instead of reading it record by record. Used together with -r, -s, -c options when disk image file is specified."), 0, false);
+
+    options.AddOption(OPT_L, _T("load"), _T("Load the whole MFT of disk image file into memory at start. Used together with -r, -s, -c options when disk image file is specified."), 0, false);
+
+    COption aa;
+    aa.ShortName(OPT_A).LongName(_T("async")).Descr(_T("Read disk image file asynchronously with several reads in flight. Optional argument is queue depth (max number of reads in flight). Used together with -r, -s, -c options when disk image file is specified.")).Required(false).NumArgs(1).RequiredArgs(0);
+    options.AddOption(aa);
+
+    options.AddOption(OPT_U, _T("unbuffered"), _T("Read disk image file bypassing system file cache, for one-pass scans of huge images. Used together with -r, -s, -c options when disk image file is specified."), 0, false);
+
+    COption dd;
+    dd.ShortName(OPT_D).LongName(_T("slow")).Descr(_T("Simulate slow device under disk image file: every read is delayed. First argument is device model: hdd, smb or fixed read latency in microseconds, second optional argument is bandwidth cap in MB/s. Used together with -r, -s, -c options when disk image file is specified.")).Required(false).NumArgs(2).RequiredArgs(1);
+    options.AddOption(dd);
+
+    COption ww;
+    ww.ShortName(OPT_W).LongName(_T("trace")).Descr(_T("Record every read from disk (offset, length, time, kind of data) into binary trace file specified as argument. Used together with -r, -p, -s, -c options.")).Required(false).NumArgs(1).RequiredArgs(1);
+    options.AddOption(ww);
+
+    COption ff;
+    ff.ShortName(OPT_F).LongName(_T("prefetch")).Descr(_T("Read records of child items ahead of the parser while directory index is being parsed. Optional argument is max number of records read ahead. Used together with -s, -c options, disk image file is read by thread-safe loader then.")).Required(false).NumArgs(1).RequiredArgs(0);
+    options.AddOption(ff);
+
+    COption nn;
+    nn.ShortName(OPT_N).LongName(_T("snapshot")).Descr(_T("Write all in-use MFT records of disk image file or volume into snapshot file. Arguments: disk image file or volume, snapshot file, optional 'z' to compress snapshot. Snapshot file can be specified instead of disk image file in -r, -s, -c options.")).Required(false).NumArgs(3).RequiredArgs(2);
+    options.AddOption(nn);
+
+    COption yy;
+    yy.ShortName(OPT_Y).LongName(_T("replay")).Descr(_T("Replay trace recorded by -w option at full speed. Arguments: trace file, disk image file or volume, I/O backend (file, mmap, direct, async; file by default), queue depth for async backend.")).Required(false).NumArgs(4).RequiredArgs(2);
+    options.AddOption(yy);
+
     options.AddOption(OPT_T, _T("test"), _T("For testing purposes."), 0, false);
 }
 
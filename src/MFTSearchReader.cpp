@@ -167,8 +167,7 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                 assert(IsBASERec); // ATTR_LIST cannot be located in child record
                 assert(node.FileList.Count() == 0);
 
-                THArray<MFTRecIndex> visitedMFTRec;
-                visitedMFTRec.AddValue(mftRec->IndexMFTRec);
+                TVisitedRecs visitedMFTRec(mftRec->IndexMFTRec);
 
                 ATTR_LIST_ENTRY* attrListItem = (ATTR_LIST_ENTRY*)attrValue;
                 uint8_t* currAttrEnd = Add2Ptr(currAttr, currAttr->AttrSize);
@@ -177,9 +176,6 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                 assert(attrListItem->StartVCN == 0);
                 assert(((uint32_t)(attrListItem->AttrType) & 0x0F) == 0); // Attr type minor byte is always zero
 
-                // at least one attribute is located in another MFT record, so we will need this alloc at least once
-                uint8_t* mftRecBuf = (uint8_t*)alloca(getVolData().BytesPerMFTRec);
-
                 while (true)
                 {
                     // attributes in attr list located in a separate cluster may refer back to the base record
@@ -201,12 +197,13 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                             assert(attrListItem->StartVCN == 0);
                         }
 
-                        if (visitedMFTRec.IndexOf(attrListItem->RecRef.sId.low) == -1) // make sure we parse each record only once
+                        if (!visitedMFTRec.Contains(attrListItem->RecRef.sId.low)) // make sure we parse each record only once
                         {
-                            if (TErrorCode::Success == FLoader.LoadMFTRecord(attrListItem->RecRef, mftRecBuf))
+                            auto extRec = LoadExtRecord(attrListItem->RecRef);
+                            if (extRec)
                             {
-                                if (TErrorCode::Success == ParseMFTRecord(mftRecBuf, node, addFilePred /*parentIdx, level*/)) //TODO shall we break in case of an error in LoadMFTRecord or ParseMFTRecord 
-                                    visitedMFTRec.AddValue(attrListItem->RecRef.sId.low);
+                                if (TErrorCode::Success == ParseMFTRecord(extRec.value(), node, addFilePred /*parentIdx, level*/)) //TODO shall we break in case of an error in LoadMFTRecord or ParseMFTRecord 
+                                    visitedMFTRec.Add(attrListItem->RecRef.sId.low);
                                 else
                                     logger.Error("ParseMFTRecord finished with error.");
                             }
@@ -347,6 +344,7 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                 auto dataBufSize = rli.len * getVolData().BytesPerCluster;
                 uint8_t* dataBuf = (uint8_t*)alloca(dataBufSize);
 
+                TIOTagScope tagScope(FLoader, TIOTag::AttrList);
                 if (TErrorCode::Success != FLoader.ReadClusters(rli.lcn, rli.len, dataBuf)) // ReadClusters writes a message into log file in case of an error
                 {
                     logger.Error("ReadClusters finished with error.");  
@@ -362,8 +360,7 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                 assert(attrListItem->StartVCN == 0);
                 assert(((uint32_t)(attrListItem->AttrType) & 0x0F) == 0); // Attr type minor byte is always zero
 
-                THArray<MFTRecIndex> visitedMFTRec;
-                visitedMFTRec.AddValue(mftRec->IndexMFTRec);
+                TVisitedRecs visitedMFTRec(mftRec->IndexMFTRec);
 
                 while (true) // loop by LCNs in one data run
                 {
@@ -395,9 +392,9 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                             assert(attrListItem->StartVCN == 0);
                         }
 
-                        if (visitedMFTRec.IndexOf(attrListItem->RecRef.sId.low) == -1) // make sure we parse each record only once
+                        if (!visitedMFTRec.Contains(attrListItem->RecRef.sId.low)) // make sure we parse each record only once
                         {
-                            auto mftRecBuf = FLoader.LoadMFTRecordCache(attrListItem->RecRef);
+                            auto mftRecBuf = LoadExtRecord(attrListItem->RecRef);
                             assert(mftRecBuf);
                             if (mftRecBuf)
                             {
@@ -411,7 +408,7 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
                                 logger.Error("LoadMFTRecordCache returned nullptr.");
                             }
 
-                            visitedMFTRec.AddValue(attrListItem->RecRef.sId.low);
+                            visitedMFTRec.Add(attrListItem->RecRef.sId.low);
                         }
                     }
 
@@ -470,12 +467,8 @@ TErrorCode TMFTSearchReader::ParseMFTRecord(uint8_t* mftRecData, DIR_NODE& node,
 */
 TErrorCode TMFTSearchReader::ReadDirectoryV1(uint32_t parentIdx, CACHE_ITEM* parentItem, uint64_t& dirSize, ProgressCallbackPtr callback)
 {
-    static int32_t ProgressCounter = 0;
-
     if (parentItem == nullptr) assert(parentIdx == 0); // parentIdx must be 0 for root item
 
-    GET_LOGGER;
-
     uint8_t* mftRecBuf = (uint8_t*)alloca(getVolData().BytesPerMFTRec);
 
     MFT_REF MFTRef{0};
@@ -487,10 +480,37 @@ TErrorCode TMFTSearchReader::ReadDirectoryV1(uint32_t parentIdx, CACHE_ITEM* par
     auto res = FLoader.LoadMFTRecord(MFTRef, mftRecBuf);
     if (res != TErrorCode::Success)
     {
+        GET_LOGGER;
         logger.Error("LoadMFTRecord finished with error.");
         return res;
     }
 
+    return ReadDirectoryV1Buf(parentIdx, parentItem, mftRecBuf, dirSize, callback);
+}
+
+/**
+ * @brief The same as ReadDirectoryV1 but MFT record of parentItem is already loaded into mftRecBuf.
+ * @details MFT records of subdirectories are loaded by batches of READ_ITEMS_BATCH_SIZE items via FLoader.LoadMFTRecords
+ * that allows loader to sort records by their offsets and read them with fewer and larger read calls.
+ * Subdirectories are still processed in the same order as they are listed in the level, so FFileList content does not depend on batching.
+ * When prefetching is on, records of subdirectories are read by TRecordsPrefetcher while Index Blocks of this directory are being parsed.
+*/
+TErrorCode TMFTSearchReader::ReadDirectoryV1Buf(uint32_t parentIdx, CACHE_ITEM* parentItem, uint8_t* mftRecBuf, uint64_t& dirSize, ProgressCallbackPtr callback)
+{
+    static int32_t ProgressCounter = 0;
+
+    if (parentItem == nullptr) assert(parentIdx == 0); // parentIdx must be 0 for root item
+
+    GET_LOGGER;
+
+    MFT_REF MFTRef{0};
+    if (parentItem == nullptr)
+        MFTRef.Id = MFT_ROOT_REC_ID;
+    else
+        MFTRef = parentItem->FMFTRecID;
+
+    TErrorCode res = TErrorCode::Success;
+
     // if we are on the root dir - add root item into FFileList
     // then change levelIdx to 1 to properly read root dirs/files into level 1 instead of 0
     if (parentItem == nullptr)
@@ -543,9 +563,18 @@ TErrorCode TMFTSearchReader::ReadDirectoryV1(uint32_t parentIdx, CACHE_ITEM* par
         {
             // we need this check here to do NOT add NTFS internal files in to list
             if (!FLoader.IsMetaFile(ref.sId.low))
+            {
                 level->AddValue(parentIdx, ref, attr);
+
+                // records of subdirectories are read by prefetcher while we are still parsing the index of this directory
+                uint32_t fileAttrib = attr->dup.FileAttrib;
+                if ((FPrefetcher != nullptr) && (fileAttrib & (uint32_t)FILE_ATTR_FLAGS::DIRECTORY) && !(fileAttrib & (uint32_t)FILE_ATTR_FLAGS::REPARSE_POINT))
+                    FPrefetcher->Push(ref);
+            }
         };
 
+    TPrefetchGroup prefetchGroup(FPrefetcher); // subdirectories pushed above are taken by LoadChildRecords below
+
     DIR_NODE node;
     // ParseMFTRecord may add several files into level from INDEX_ROOT attr using addToFileListPred predicate
     res = ParseMFTRecord(mftRecBuf, node, addToFileListPred/*parentIdx, level */ ); 
@@ -614,39 +643,93 @@ TErrorCode TMFTSearchReader::ReadDirectoryV1(uint32_t parentIdx, CACHE_ITEM* par
     dirSize = 0;
     parentItem->FFilesCount = newcnt - startPos;
 
-    for (uint32_t i = startPos; i < newcnt; i++)
+    uint32_t bytesPerMFTRec = getVolData().BytesPerMFTRec;
+    uint8_t* recsBuf = nullptr;   // taken when the first subdirectory is met
+    THArray<MFT_REF> batchRefs;   // MFT records of subdirectories of the current batch
+    THArray<TErrorCode> batchRes; // load results of batch records
+
+    for (uint32_t batchStart = startPos; batchStart < newcnt; batchStart += READ_ITEMS_BATCH_SIZE)
     {
-        assert(item);
-        //if (!item->NtfsInternal())
-        assert(!FLoader.IsMetaFile(item->FMFTRecID.sId.low)); // meta files should not present in the list
+        uint32_t batchEnd = std::min(batchStart + READ_ITEMS_BATCH_SIZE, newcnt);
 
-        if (item->IsDir())
+        // level does not grow during this loop (subdirs add their items into the next levels), so item pointers stay valid
+        CACHE_ITEM* batchItem = item;
+        batchRefs.Clear();
+        for (uint32_t i = batchStart; i < batchEnd; i++)
         {
-            if (!item->IsReparse()) //bypass reparse items
-            {
-                uint64_t childDirSize{ 0 };
-                if (TErrorCode::Success != ReadDirectoryV1(i, item, childDirSize, callback))
-                    logger.ErrorFmt("ReadDirectoryV1 finished with error for MFT Rec ID: {}", item->FMFTRecID.toHexString());
-                dirSize += childDirSize;
-            }
+            assert(batchItem);
+            if (batchItem->IsDir() && !batchItem->IsReparse()) //bypass reparse items
+                batchRefs.AddValue(batchItem->FMFTRecID);
+            batchItem = level->Next(batchItem);
         }
-        else // file, not a directory
+
+        if (batchRefs.Count() > 0)
         {
-            dirSize += item->FileAttr.dup.FileSize;
+            if (recsBuf == nullptr)
+                recsBuf = BatchBuffer(parentItem->FLevel, newcnt - startPos);
+
+            // records pred has not been called for keep NotFound
+            batchRes.SetCount(batchRefs.Count());
+            for (uint32_t j = 0; j < batchRes.Count(); j++) batchRes[j] = TErrorCode::NotFound;
+
+            TErrorCode loadRes = LoadChildRecords(std::span<const MFT_REF>(batchRefs.GetValuePointer(0), batchRefs.Count()),
+                [recsBuf, bytesPerMFTRec, &batchRes](uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)
+                {
+                    batchRes[index] = res;
+                    if (res == TErrorCode::Success)
+                        memcpy(recsBuf + (uint64_t)index * bytesPerMFTRec, mftRecData, bytesPerMFTRec);
+                    return TErrorCode::Success;
+                });
+
+            if (loadRes != TErrorCode::Success)
+            {
+                logger.ErrorFmt("LoadChildRecords finished with error {} for directory MFT Rec ID: {}", (uint32_t)loadRes, parentItem->FMFTRecID.toHexString());
+                return loadRes;
+            }
         }
 
-        // print only dirs of first level.
-        if (parentItem->FLevel == 0)
+        uint32_t batchIndex = 0; // index of the next subdirectory in batchRefs
+        for (uint32_t i = batchStart; i < batchEnd; i++)
         {
-            // callback can be NULL
-            if (callback) callback(ProgressCounter++); //call callback only for items from root directory
-            logger.InfoFmt("{:<25}  [{}]", wtos(std::wstring(item->Name(), item->FileAttr.FileNameLen)), toStringSepA(item->FileAttr.dup.FileSize));
-        }
+            assert(item);
+            //if (!item->NtfsInternal())
+            assert(!FLoader.IsMetaFile(item->FMFTRecID.sId.low)); // meta files should not present in the list
+
+            if (item->IsDir())
+            {
+                if (!item->IsReparse()) //bypass reparse items
+                {
+                    uint64_t childDirSize{ 0 };
+                    res = batchRes[batchIndex];
+                    if (res != TErrorCode::Success)
+                        logger.Error("LoadMFTRecord finished with error.");
+                    else
+                        res = ReadDirectoryV1Buf(i, item, recsBuf + (uint64_t)batchIndex * bytesPerMFTRec, childDirSize, callback);
+
+                    if (TErrorCode::Success != res)
+                        logger.ErrorFmt("ReadDirectoryV1 finished with error for MFT Rec ID: {}", item->FMFTRecID.toHexString());
+                    dirSize += childDirSize;
+                    batchIndex++;
+                }
+            }
+            else // file, not a directory
+            {
+                dirSize += item->FileAttr.dup.FileSize;
+            }
+
+            // print only dirs of first level.
+            if (parentItem->FLevel == 0)
+            {
+                // callback can be NULL
+                if (callback) callback(ProgressCounter++); //call callback only for items from root directory
+                logger.InfoFmt("{:<25}  [{}]", wtos(std::wstring(item->Name(), item->FileAttr.FileNameLen)), toStringSepA(item->FileAttr.dup.FileSize));
+            }
 
-        //if (parentItem->FLevel == 1) 
-        //    logger.InfoFmt("\t{} [{}]", wtos(std::wstring(item->Name(), item->FileAttr.FileNameLen)), toStringSepA(item->FileAttr.dup.FileSize));
+            //if (parentItem->FLevel == 1) 
+            //    logger.InfoFmt("\t{} [{}]", wtos(std::wstring(item->Name(), item->FileAttr.FileNameLen)), toStringSepA(item->FileAttr.dup.FileSize));
 
-        item = level->Next(item);
+            item = level->Next(item);
+        }
     }
 
     parentItem->FileAttr.dup.FileSize = dirSize;
@@ -0,0 +1,222 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include "MFTSnapshot.h"
+#include "Readers.h"
+#include "Utils.h"
+
+bool IsMFTSnapshotFile(const string_t& fileName)
+{
+    HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    MFT_SNAPSHOT_HEADER header;
+    DWORD bytesRead = 0;
+    BOOL res = ReadFile(hFile, &header, sizeof(header), &bytesRead, nullptr);
+    CloseHandle(hFile);
+
+    return res && (bytesRead == sizeof(header)) && (memcmp(header.Magic, MFT_SNAPSHOT_HEADER().Magic, sizeof(header.Magic)) == 0);
+}
+
+static TErrorCode WriteBuf(HANDLE hFile, const void* buf, uint64_t size)
+{
+    const uint8_t* data = (const uint8_t*)buf;
+
+    while (size > 0)
+    {
+        DWORD toWrite = (DWORD)std::min<uint64_t>(size, 1u << 30);
+        DWORD written = 0;
+        if (!WriteFile(hFile, data, toWrite, &written, nullptr) || (written != toWrite))
+        {
+            GET_LOGGER;
+            logger.ErrorFmt("[WriteMFTSnapshot] WriteFile has failed with error: {}", GetLastError());
+            return TErrorCode::IOError;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return TErrorCode::Success;
+}
+
+// $MFT Data Runs taken from $DATA attribute of MFT record #0, the same way as TFileImageRecordsLoader::Open does
+static TErrorCode ReadMFTDataRuns(IRecordsLoader& loader, TDataRuns& runs)
+{
+    uint8_t* mftRecData = (uint8_t*)alloca(loader.GetVolumeData().BytesPerMFTRec);
+    MFT_REF mftRef{ 0 };
+    CH_ERR(loader.LoadMFTRecord(mftRef, mftRecData));
+
+    TMFTBaseReader prsr(loader);
+    TAttrCollection collection;
+    CH_ERR(prsr.FillAttrCollection((MFT_FILE_RECORD*)mftRecData, MakeAttrBitmask(ATTR_DATA), collection));
+
+    auto& adata = collection.Get(ATTR_DATA);
+    if (adata.Count() == 0) return TErrorCode::CorruptedData;
+
+    return prsr.DecodeDataRuns(adata[0], runs);
+}
+
+// writes everything after the header, header is written by the caller when all offsets are known
+static TErrorCode WriteSnapshotBody(IRecordsLoader& loader, HANDLE hFile, COMPRESSOR_HANDLE compressor, MFT_SNAPSHOT_HEADER& header, MFT_SNAPSHOT_INFO& info)
+{
+    const VOLUME_DATA& volData = loader.GetVolumeData();
+    uint32_t recSize = volData.BytesPerMFTRec;
+    uint32_t blockSize = SNAPSHOT_RECS_PER_BLOCK * recSize;
+
+    TDataRuns runs;
+    CH_ERR(ReadMFTDataRuns(loader, runs));
+
+    header.BlocksCount = (uint32_t)((header.RecordsCount + SNAPSHOT_RECS_PER_BLOCK - 1) / SNAPSHOT_RECS_PER_BLOCK);
+
+    THArray<SNAPSHOT_BLOCK> blocks;
+    blocks.SetCapacity(header.BlocksCount);
+    for (uint32_t i = 0; i < header.BlocksCount; i++) blocks.AddValue({ 0, 0, 0 });
+
+    TBitField stored;
+    stored.SetData(header.BlocksCount, false);
+
+    uint8_t* blockBuf = DBG_NEW uint8_t[blockSize];
+    uint8_t* compressBuf = (compressor != nullptr) ? DBG_NEW uint8_t[blockSize] : nullptr;
+    uint64_t fileOffset = sizeof(MFT_SNAPSHOT_HEADER);
+    uint32_t currBlock = UINT32_MAX;
+    uint32_t blockRecs = 0;
+
+    auto flushBlock = [&]() -> TErrorCode
+        {
+            if (blockRecs == 0) return TErrorCode::Success;
+
+            uint32_t rawSize = blockRecs * recSize;
+            const uint8_t* data = blockBuf;
+            SIZE_T size = rawSize;
+
+            // blocks that do not shrink (Compress fails with ERROR_INSUFFICIENT_BUFFER) are stored as is
+            SIZE_T compressedSize = 0;
+            if ((compressor != nullptr) && Compress(compressor, blockBuf, rawSize, compressBuf, rawSize - 1, &compressedSize))
+            {
+                data = compressBuf;
+                size = compressedSize;
+            }
+
+            CH_ERR(WriteBuf(hFile, data, size));
+
+            blocks[currBlock] = { fileOffset, (uint32_t)size, rawSize };
+            fileOffset += size;
+            info.RawBytes += rawSize;
+            info.Blocks++;
+            blockRecs = 0;
+
+            return TErrorCode::Success;
+        };
+
+    // records come in MFT record ID order, so blocks are filled one by one
+    TErrorCode res = loader.ScanMFTRecords([&](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            if (mftRecID >= header.RecordsCount) return TErrorCode::Success;
+
+            uint32_t block = mftRecID / SNAPSHOT_RECS_PER_BLOCK;
+            assert((currBlock == UINT32_MAX) || (block >= currBlock));
+            if (block != currBlock)
+            {
+                CH_ERR(flushBlock());
+                currBlock = block;
+            }
+
+            memcpy(blockBuf + (uint64_t)blockRecs * recSize, mftRec, recSize);
+            blockRecs++;
+            stored.SetTrue(mftRecID);
+            info.Records++;
+
+            return TErrorCode::Success;
+        });
+
+    if (res == TErrorCode::Success) res = flushBlock();
+
+    delete[] blockBuf;
+    delete[] compressBuf;
+    CH_ERR(res);
+
+    header.StoredCount = info.Records;
+    header.VolumeNameLen = (uint32_t)volData.Name.size();
+    header.RunsCount = runs.Count();
+    header.BitmapWords = loader.GetMFTBitmap().Count();
+
+    // uint64_t tables go first and start at 8 bytes boundary, loader uses them right from the file mapping
+    uint64_t padding = 0;
+    uint32_t paddingSize = (uint32_t)((sizeof(uint64_t) - fileOffset % sizeof(uint64_t)) % sizeof(uint64_t));
+    CH_ERR(WriteBuf(hFile, &padding, paddingSize));
+    header.TablesOffset = fileOffset + paddingSize;
+
+    CH_ERR(WriteBuf(hFile, stored.GetData(), (uint64_t)header.BlocksCount * sizeof(uint64_t)));
+    CH_ERR(WriteBuf(hFile, const_cast<TBitField&>(loader.GetMFTBitmap()).GetData(), (uint64_t)header.BitmapWords * sizeof(uint64_t)));
+    CH_ERR(WriteBuf(hFile, blocks.GetValuePointer(0), (uint64_t)header.BlocksCount * sizeof(SNAPSHOT_BLOCK)));
+
+    for (uint32_t i = 0; i < runs.Count(); i++)
+    {
+        SNAPSHOT_RUN run{ runs[i].lcn, runs[i].len };
+        CH_ERR(WriteBuf(hFile, &run, sizeof(run)));
+    }
+
+    CH_ERR(WriteBuf(hFile, volData.Name.c_str(), header.VolumeNameLen * sizeof(wchar_t)));
+
+    info.FileBytes = header.TablesOffset + (uint64_t)header.VolumeNameLen * sizeof(wchar_t) + (uint64_t)header.RunsCount * sizeof(SNAPSHOT_RUN) +
+        ((uint64_t)header.BitmapWords + header.BlocksCount) * sizeof(uint64_t) + (uint64_t)header.BlocksCount * sizeof(SNAPSHOT_BLOCK);
+
+    // all offsets are known now, header goes to the beginning of the file
+    LARGE_INTEGER zero{ 0 };
+    if (!SetFilePointerEx(hFile, zero, nullptr, FILE_BEGIN))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[WriteMFTSnapshot] SetFilePointerEx has failed with error: {}", GetLastError());
+        return TErrorCode::IOError;
+    }
+
+    return WriteBuf(hFile, &header, sizeof(header));
+}
+
+TErrorCode WriteMFTSnapshot(IRecordsLoader& loader, const string_t& snapshotFile, bool compress, MFT_SNAPSHOT_INFO& info)
+{
+    assert(loader.IsOpened());
+    GET_LOGGER;
+
+    info = MFT_SNAPSHOT_INFO();
+
+    MFT_SNAPSHOT_HEADER header;
+    header.Flags = compress ? SNAPSHOT_FLAG_COMPRESSED : 0;
+    header.MetaFilesCount = loader.GetMetaFilesCount();
+    header.VolumeData = loader.GetVolumeData();
+    header.RecordsCount = loader.GetRecordsCount();
+
+    auto imgLoader = dynamic_cast<TFileImageRecordsLoader*>(&loader);
+    header.PartitionOffset = (imgLoader != nullptr) ? imgLoader->GetPartitionOffset() : 0;
+
+    COMPRESSOR_HANDLE compressor = nullptr;
+    if (compress && !CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &compressor))
+    {
+        logger.ErrorFmt("[WriteMFTSnapshot] CreateCompressor has failed with error: {}", GetLastError());
+        return TErrorCode::IOError;
+    }
+
+    HANDLE hFile = CreateFile(snapshotFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        logger.ErrorFmt("[WriteMFTSnapshot] Cannot create snapshot file '{}', error: {}", wtos(snapshotFile), GetLastError());
+        if (compressor != nullptr) CloseCompressor(compressor);
+        return TErrorCode::IOError;
+    }
+
+    TErrorCode res = WriteBuf(hFile, &header, sizeof(header)); // placeholder, rewritten at the end
+    if (res == TErrorCode::Success)
+        res = WriteSnapshotBody(loader, hFile, compressor, header, info);
+
+    CloseHandle(hFile);
+    if (compressor != nullptr) CloseCompressor(compressor);
+
+    if (res != TErrorCode::Success)
+    {
+        logger.ErrorFmt("[WriteMFTSnapshot] Snapshot has not been written, error: {}", (uint32_t)res);
+        DeleteFile(snapshotFile.c_str());
+    }
+
+    return res;
+}
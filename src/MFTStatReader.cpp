@@ -15,6 +15,7 @@
 #include "Functions.h"
 #include "NTFS.h"
 #include "Readers.h"
+#include "RecordTable.h"
 
 
 /** 
@@ -68,11 +69,15 @@ TErrorCode TMFTStatCollector::ReadMftItemInfoBuf(MFT_FILE_RECORD* mftRec, IFILE_
 {
     GET_LOGGER;
 
-    AddFileAttrPred addToFileListPred = [&itemInfo](const ATTR_FILE_NAME* attr, const MFT_REF& ref)
+    AddFileAttrPred addToFileListPred = [this, &itemInfo](const ATTR_FILE_NAME* attr, const MFT_REF& ref)
         {
             std::wstring wnm(GetFName(attr), attr->FileNameLen);
             
             itemInfo.Node.FileList.AddValue({convert_string<ci_string::value_type>(wnm).c_str(), *attr, ref});
+
+            // child records are read by prefetcher while we are still parsing the index, ReadMftChildItems takes them
+            if ((FPrefetcher != nullptr) && !FLoader.IsMetaFile(ref.sId.low))
+                FPrefetcher->Push(ref);
         };
 
     AttrListPred callReadMftItemInfoPred = [this, iFileItem, &itemInfo](const MFT_REF& ref)
@@ -81,7 +86,8 @@ TErrorCode TMFTStatCollector::ReadMftItemInfoBuf(MFT_FILE_RECORD* mftRec, IFILE_
             //tmpFileItem.MFTRecID = ref;
 
             // ref - is a child MFT rec where attr value is located
-            auto res = ReadMftItemInfo(ref, iFileItem, itemInfo);
+            MFT_FILE_RECORD* extRec = (FExtIndex != nullptr) ? FExtIndex->Find(ref) : nullptr;
+            auto res = (extRec != nullptr) ? ReadMftItemInfoBuf(extRec, iFileItem, itemInfo) : ReadMftItemInfo(ref, iFileItem, itemInfo);
             if (res != TErrorCode::Success) // ReadMftItemInfo writes message to log file in case of an error
             {
                 //do nothing, continue executing
@@ -374,8 +380,7 @@ TErrorCode TMFTStatCollector::ReadMftItemInfoBuf(MFT_FILE_RECORD* mftRec, IFILE_
 
                 logger.Debug("[Resident ATTR_LIST_ATTR] - START PARSING");
 
-                THArray<MFTRecIndex> visitedMFTRec;
-                visitedMFTRec.AddValue(mftRec->IndexMFTRec);
+                TVisitedRecs visitedMFTRec(mftRec->IndexMFTRec);
 
                 ATTR_LIST_ENTRY* attrEntry = (ATTR_LIST_ENTRY*)attrValue;
                 uint8_t* attrEntryEnd = Add2Ptr(currAttr, currAttr->AttrSize);
@@ -778,6 +783,8 @@ TErrorCode TMFTStatCollector::ReadMftItems(MFT_REF mftRecRef, IFILE_NAME* fileIt
 
     if (fileItem) assert(mftRecRef.Id == fileItem->MFTRecID.Id);
 
+    TPrefetchGroup prefetchGroup(FPrefetcher); // children pushed by ReadMftItemInfo are taken by ReadMftChildItems
+
     ITEM_INFO itemInfo;
     auto res = ReadMftItemInfo(mftRecRef, fileItem, itemInfo);
     if (res != TErrorCode::Success)
@@ -786,6 +793,38 @@ TErrorCode TMFTStatCollector::ReadMftItems(MFT_REF mftRecRef, IFILE_NAME* fileIt
         return res;
     }
 
+    return ReadMftChildItems(itemInfo, dirLevel, callback);
+}
+
+// the same as ReadMftItems but MFT record of the item is already loaded into mftRec
+TErrorCode TMFTStatCollector::ReadMftItemsBuf(MFT_FILE_RECORD* mftRec, IFILE_NAME* fileItem, uint32_t dirLevel, ReadMftItemsCallback callback)
+{
+    GET_LOGGER;
+
+    TPrefetchGroup prefetchGroup(FPrefetcher);
+
+    ITEM_INFO itemInfo;
+    auto res = ReadMftItemInfoBuf(mftRec, fileItem, itemInfo);
+    if (res != TErrorCode::Success)
+    {
+        logger.ErrorFmt("ReadMftItemInfo() finished with error for MFT Rec ID: {}", MFT_REF::toHexString(mftRec->IndexMFTRec));
+        return res;
+    }
+
+    return ReadMftChildItems(itemInfo, dirLevel, callback);
+}
+
+/**
+* @brief Adds itemInfo to FItemsList and reads all child items of itemInfo (if itemInfo is a directory).
+* @details MFT records of child items are loaded by batches of READ_ITEMS_BATCH_SIZE records via FLoader.LoadMFTRecords
+* that allows loader to sort records by their offsets and read them with fewer and larger read calls.
+* Child items are processed in the same order as they are listed in directory, so FItemsList order does not depend on batching.
+* When prefetching is on, most of child records have already been read by TRecordsPrefetcher while the directory was being parsed.
+*/
+TErrorCode TMFTStatCollector::ReadMftChildItems(ITEM_INFO& itemInfo, uint32_t dirLevel, ReadMftItemsCallback callback)
+{
+    GET_LOGGER;
+
     assert(itemInfo.Node.Bitmap.Count() == 0);
     assert(itemInfo.Node.DataRuns.Count() == 0);
 
@@ -795,16 +834,72 @@ TErrorCode TMFTStatCollector::ReadMftItems(MFT_REF mftRecRef, IFILE_NAME* fileIt
     itemInfo.FilesCount = itemInfo.Node.FileList.Count();
     FItemsList.AddValue(itemInfo);
 
-    for (auto& item : itemInfo.Node.FileList)
-    {     
-        //if (!item.NtfsInternal()) // bypass hidden mft metafiles
-        if (!FLoader.IsMetaFile(item.MFTRecID.sId.low))
+    TFileList& fileList = itemInfo.Node.FileList;
+    if (fileList.Count() == 0) return TErrorCode::Success;
+
+    uint32_t bytesPerMFTRec = getVolData().BytesPerMFTRec;
+    uint8_t* recsBuf = BatchBuffer(dirLevel, fileList.Count());
+    THArray<MFT_REF> batchRefs;    // MFT records of the batch to load
+    THArray<uint32_t> batchItems;  // indexes of batch records in fileList
+    THArray<TErrorCode> batchRes;  // load results of batch records
+
+    for (uint32_t batchStart = 0; batchStart < fileList.Count(); batchStart += READ_ITEMS_BATCH_SIZE)
+    {
+        uint32_t batchEnd = std::min(batchStart + READ_ITEMS_BATCH_SIZE, fileList.Count());
+
+        batchRefs.Clear();
+        batchItems.Clear();
+        for (uint32_t i = batchStart; i < batchEnd; i++)
         {
+            //if (!item.NtfsInternal()) // bypass hidden mft metafiles
+            if (!FLoader.IsMetaFile(fileList[i].MFTRecID.sId.low))
+            {
+                batchRefs.AddValue(fileList[i].MFTRecID);
+                batchItems.AddValue(i);
+            }
+        }
+
+        if (batchRefs.Count() == 0) continue;
+
+        // records pred has not been called for keep NotFound
+        batchRes.SetCount(batchRefs.Count());
+        for (uint32_t j = 0; j < batchRes.Count(); j++) batchRes[j] = TErrorCode::NotFound;
+
+        TErrorCode loadRes = LoadChildRecords(std::span<const MFT_REF>(batchRefs.GetValuePointer(0), batchRefs.Count()),
+            [recsBuf, bytesPerMFTRec, &batchRes](uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)
+            {
+                batchRes[index] = res;
+                if (res == TErrorCode::Success)
+                    memcpy(recsBuf + (uint64_t)index * bytesPerMFTRec, mftRecData, bytesPerMFTRec);
+                return TErrorCode::Success;
+            });
+
+        if (loadRes != TErrorCode::Success)
+        {
+            logger.ErrorFmt("LoadChildRecords finished with error {} for directory MFT Rec ID: {}", (uint32_t)loadRes, itemInfo.MFTRecID.toHexString());
+            return loadRes;
+        }
+
+        for (uint32_t j = 0; j < batchRefs.Count(); j++)
+        {
+            IFILE_NAME& item = fileList[batchItems[j]];
+
             if ((dirLevel == 0) && (callback)) callback(item.ciName.c_str()); // cout_t << item.ciName.c_str() /*<< " [" <<item.Attr.dup.FileSize << "]"*/ << std::endl;
             //if ((dirLevel == 1) && (callback)) callback(std::wstring(_T("\t")) + item.ciName.c_str()); //cout_t << _T("\t") << item.ciName.c_str() << std::endl;
 
             // reading detailed info about each item (files, directories and reparse points)
-            res = ReadMftItems(item.MFTRecID, &item, dirLevel + 1, callback);
+            TErrorCode res = batchRes[j];
+            if (res != TErrorCode::Success)
+            {
+                logger.ErrorFmt("LoadMFTRecord finished with error for MFT Rec ID: {}", item.MFTRecID.toHexString());
+            }
+            else
+            {
+                auto mftRec = (MFT_FILE_RECORD*)(recsBuf + (uint64_t)j * bytesPerMFTRec);
+                assert(item.MFTRecID.sId.low == mftRec->IndexMFTRec);
+                res = ReadMftItemsBuf(mftRec, &item, dirLevel + 1, callback);
+            }
+
             if (res != TErrorCode::Success)
             {
                 logger.ErrorFmt("ReadMftItems() finished with error for MFT Rec ID: {}", item.MFTRecID.toHexString());
@@ -1054,6 +1149,207 @@ TErrorCode TMFTStatCollector::CollectVolumeStat()
     return TErrorCode::Success;
 }
 
+/**
+* @brief The same as CollectVolumeStat but statistics are calculated from TMFTRecordTable built by one sequential pass over $MFT.
+* @details No directory indexes are read, so every in-use base record is counted once (hard links do not make duplicates)
+* and orphaned files are counted too. Statistics that need non-resident attributes data (data runs, data stream names,
+* files count in directories) are not calculated.
+* Extension records index attached by SetExtIndex is filled by the same pass, so it can be used by following reads of this reader.
+* @return TErrorCode value that contains code for success or code of error occurred
+*/
+TErrorCode TMFTStatCollector::CollectVolumeStatLinear()
+{
+    GET_LOGGER;
+
+    TMFTRecordTable table;
+
+    Ticks::Start(_T("Loading time"));
+    auto res = table.Build(FLoader, FExtIndex); // attached ext index is filled by the same pass
+    if (res != TErrorCode::Success)
+    {
+        logger.ErrorFmt("Error reading volume {}.", wtos(getVolData().Name));
+        return res;
+    }
+    Ticks::Finish(_T("Loading time"));
+
+    Ticks::Start(_T("Calc statistic"));
+    FStatistics.Clear();
+
+    uint32_t rows = table.RowsCount();
+    if (rows == 0)
+    {
+        Ticks::Finish(_T("Calc statistic"));
+        return TErrorCode::Success;
+    }
+
+    // per row counters that need a pass over names columns
+    THArray<uint16_t> dosNames, bothNames;
+    THArray<uint32_t> nameSymbols;
+    dosNames.SetCount(rows);
+    bothNames.SetCount(rows);
+    nameSymbols.SetCount(rows);
+    memset(dosNames.GetValuePointer(0), 0, rows * sizeof(uint16_t));
+    memset(bothNames.GetValuePointer(0), 0, rows * sizeof(uint16_t));
+    memset(nameSymbols.GetValuePointer(0), 0, rows * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < table.NamesTotal(); i++)
+    {
+        uint32_t row = table.NameRow[i];
+        if (table.NameType[i] == FILE_NAME_DOS) dosNames[row]++;
+        if (table.NameType[i] == FILE_NAME_UNICODE_AND_DOS) bothNames[row]++;
+        nameSymbols[row] += table.NameLen[i];
+    }
+
+    auto countRows = [rows](auto pred)
+        {
+            int64_t cnt = 0;
+            for (uint32_t row = 0; row < rows; row++)
+                if (pred(row)) cnt++;
+            return cnt;
+        };
+
+    auto maxRow = [rows](auto& column)
+        {
+            uint32_t res = 0;
+            for (uint32_t row = 1; row < rows; row++)
+                if (column[row] > column[res]) res = row;
+            return res;
+        };
+
+    auto mainName = [&table](uint32_t row)
+        {
+            return (table.MainName[row] == TABLE_NO_NAME) ? std::wstring() : std::wstring(table.Name(table.MainName[row]));
+        };
+
+    auto hasAttr = [&table](uint32_t row, ATTR_TYPE attrType) { return table.AttrCounters[MATI(attrType)][row] > 0; };
+    auto nonResident = [&table](uint32_t row, ATTR_TYPE attrType) { return (table.NonResidentAttrs[row] & MakeAttrBitmask(attrType)) != 0; };
+
+    int64_t value;
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row); });
+    FStatistics.SetValue(L"Total Items Count: ", toStringSepW(rows));
+    FStatistics.SetValue(L"Total Dirs Count: ", toStringSepW(value));
+    FStatistics.SetValue(L"Total Files Count: ", toStringSepW(rows - value));
+
+    value = countRows([&](uint32_t row) { return table.AttrsCount[row] > 9; });
+    FStatistics.SetValue(L"Attrs Count > 9: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.HardLinks[row] > 9; });
+    FStatistics.SetValue(L"Hard links Count > 9: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.NamesCount[row] > 13; });
+    FStatistics.SetValue(L"Filenames Count > 13: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.NamesCount[row] == 1; });
+    FStatistics.SetValue(L"Filenames Count = 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.NamesCount[row] == 0; });
+    FStatistics.SetValue(L"Filenames Count = 0: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.HardLinks[row] == 1); });
+    FStatistics.SetValue(L"Dir Hard links Count = 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.HardLinks[row] == 2); });
+    FStatistics.SetValue(L"Dir Hard links Count = 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.HardLinks[row] > 2); });
+    FStatistics.SetValue(L"Dirs with Hard Links Count > 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.NamesCount[row] > 2); });
+    FStatistics.SetValue(L"Dir Filenames Count > 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.NamesCount[row] == 1); });
+    FStatistics.SetValue(L"Dir Filenames Count = 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && (table.NamesCount[row] == 2); });
+    FStatistics.SetValue(L"Dir Filenames Count = 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.IsDir(row) && hasAttr(row, ATTR_LIST_ATTR); });
+    FStatistics.SetValue(L"Dir Has ATTR_LIST attribute: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return nonResident(row, ATTR_LIST_ATTR); });
+    FStatistics.SetValue(L"Have non-resident ATTR_LIST: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return nonResident(row, ATTR_BITMAP); });
+    FStatistics.SetValue(L"Have non-resident BITMAP: ", toStringSepW(value));
+
+    // table keeps one residency bit per attribute type, so files that have both resident and non-resident DATA are counted as non-resident
+    value = countRows([&](uint32_t row) { return hasAttr(row, ATTR_DATA) && !nonResident(row, ATTR_DATA); });
+    FStatistics.SetValue(L"Have resident Data: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return nonResident(row, ATTR_DATA); });
+    FStatistics.SetValue(L"Have non-resident Data: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return hasAttr(row, ATTR_REPARSE); });
+    FStatistics.SetValue(L"Reparse Points Count: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.AttrCounters[MATI(ATTR_LOGGED_UTILITY_STREAM)][row] > 1; });
+    FStatistics.SetValue(L"Logged Utility Streams Count > 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return table.AttrCounters[MATI(ATTR_LOGGED_UTILITY_STREAM)][row] > 2; });
+    FStatistics.SetValue(L"Logged Utility Streams Count > 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return hasAttr(row, ATTR_ID); });
+    FStatistics.SetValue(L"Have Object ID: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return !hasAttr(row, ATTR_DATA); });
+    FStatistics.SetValue(L"DOES NOT have Data attribute: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return dosNames[row] == 0; });
+    FStatistics.SetValue(L"Files with DOS name count = 0: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return dosNames[row] == 1; });
+    FStatistics.SetValue(L"Files with DOS name count = 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return dosNames[row] == 2; });
+    FStatistics.SetValue(L"Files with DOS name count = 2: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return bothNames[row] == 1; });
+    FStatistics.SetValue(L"Files with UNICODE_AND_DOS name count = 1: ", toStringSepW(value));
+
+    value = countRows([&](uint32_t row) { return bothNames[row] == 2; });
+    FStatistics.SetValue(L"Files with UNICODE_AND_DOS name count = 2: ", toStringSepW(value));
+
+    uint32_t maxHardLinks = maxRow(table.HardLinks);
+    FStatistics.SetValue(L"Max Hard Links Count: ", std::format(L"{}, file name: '{}' (mft red id: {})", table.HardLinks[maxHardLinks], mainName(maxHardLinks), table.RecID[maxHardLinks]));
+
+    uint32_t maxAttrs = maxRow(table.AttrsCount);
+    FStatistics.SetValue(L"Max Attrs Count: ", std::format(L"{}, file name: '{}' (mft rec id: {})", table.AttrsCount[maxAttrs], mainName(maxAttrs), table.RecID[maxAttrs]));
+
+    uint32_t maxFilenames = maxRow(table.NamesCount);
+    FStatistics.SetValue(L"Max File Names Count: ", std::format(L"{}, file name : '{}' (mft rec id : {})", table.NamesCount[maxFilenames], mainName(maxFilenames), table.RecID[maxFilenames]));
+
+    // average length of all filenames inside one MFT record, records without names are not counted
+    uint64_t fileNamesTotalSymbols = 0;
+    uint32_t namedRows = 0;
+    for (uint32_t row = 0; row < rows; row++)
+    {
+        if (table.NamesCount[row] == 0) continue;
+        fileNamesTotalSymbols += nameSymbols[row] / table.NamesCount[row];
+        namedRows++;
+    }
+    uint64_t fileNamesAverageSymbols = (namedRows > 0) ? fileNamesTotalSymbols / namedRows : 0; // average file length in symbols
+
+    FStatistics.SetValue(L"\nFilenames Average Length (symbols): ", toStringSepW(fileNamesAverageSymbols));
+    FStatistics.SetValue(L"Filenames Average Length (bytes): ", toStringSepW(fileNamesAverageSymbols * sizeof(wchar_t)));
+
+    std::wstringstream strstream;
+    for (int i = 1; i < ATTR_TYPE_CNT; i++) // bypass ATTR_ZERO
+    {
+        strstream << AttrTypeNames[i] << " = " << table.AttrCounters[i][maxAttrs] << std::endl;
+    }
+    FStatistics.SetValue(L"\nAttribute counts for '" + mainName(maxAttrs) + L"':\n", strstream.str());
+
+    FStatistics.SetValue(L"\nRecord table size (bytes): ", toStringSepW(table.MemorySize()));
+    if (FExtIndex != nullptr)
+        FStatistics.SetValue(L"Extension records index size (bytes): ", toStringSepW(FExtIndex->MemorySize()));
+
+    Ticks::Finish(_T("Calc statistic"));
+    Ticks::PrintTime();
+
+    return TErrorCode::Success;
+}
+
 void TMFTStatCollector::ShowVolumeStat()
 {
     if (FStatistics.Count() == 0)
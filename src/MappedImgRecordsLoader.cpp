@@ -0,0 +1,212 @@
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+void TMappedImageRecordsLoader::MapImage(const string_t& imgFileName)
+{
+    assert(nullptr == FView);
+
+    HANDLE hFile = CreateFile(imgFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("TMappedImageRecordsLoader.CreateFile");
+
+    LARGE_INTEGER fileSize{ 0 };
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        CloseHandle(hFile);
+        throw_winapi_exception("TMappedImageRecordsLoader.GetFileSizeEx");
+    }
+
+    // PAGE_WRITECOPY allows FILE_MAP_COPY views: pages we write to (USA fixups) become private copies, image file stays untouched
+    HANDLE hMap = CreateFileMapping(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (hMap == nullptr)
+    {
+        CloseHandle(hFile);
+        throw_winapi_exception("TMappedImageRecordsLoader.CreateFileMapping");
+    }
+
+    // two views of the same section: read-only one with raw image data and copy-on-write one used as private overlay for fixed up records.
+    // they share physical pages until a page in the overlay is written to.
+    FView = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    FOverlay = (FView == nullptr) ? nullptr : (uint8_t*)MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0);
+    DWORD err = GetLastError();
+
+    // views keep references to mapping object and file, so handles are not needed anymore
+    CloseHandle(hMap);
+    CloseHandle(hFile);
+
+    if (FOverlay == nullptr)
+    {
+        UnmapImage();
+        SetLastError(err);
+        throw_winapi_exception("TMappedImageRecordsLoader.MapViewOfFile");
+    }
+
+    FViewSize = fileSize.QuadPart;
+}
+
+void TMappedImageRecordsLoader::UnmapImage()
+{
+    if (FView != nullptr) UnmapViewOfFile(FView);
+    if (FOverlay != nullptr) UnmapViewOfFile(FOverlay);
+    FView = nullptr;
+    FOverlay = nullptr;
+    FViewSize = 0;
+}
+
+// mapping is created first because TFileImageRecordsLoader::Open loads MFT record #0 via our InternalLoadMFTRecord
+void TMappedImageRecordsLoader::Open(const string_t& imgFileName)
+{
+    assert(!IsOpened());
+
+    MapImage(imgFileName);
+
+    try
+    {
+        TFileImageRecordsLoader::Open(imgFileName);
+    }
+    catch (...)
+    {
+        UnmapImage();
+        throw;
+    }
+
+    // records of VHD/VHDX are not contiguous in the view, so overlay is used for flat images only
+    if (FContainer.IsFlat())
+        FFixedUp.SetData((uint32_t)((FRecordsCount + TBitField::DWORD_MASK) >> TBitField::DWORD_2POWER), false);
+}
+
+void TMappedImageRecordsLoader::Close()
+{
+    // records returned by LoadMFTRecordCache point into the overlay view, they become invalid here
+    TFileImageRecordsLoader::Close();
+    UnmapImage();
+    FFixedUp.SetData(0u, false);
+}
+
+std::expected<uint64_t, TErrorCode> TMappedImageRecordsLoader::MFTRecFileOffset(MFTRecIndex mftRecID)
+{
+    assert(IsOpened());
+    assert(FRecordsCount > 0);
+
+    // check that MFT Rec ID is less than MFT table size
+    if (mftRecID >= FRecordsCount)
+        return std::unexpected(TErrorCode::WrongMFTRecID);
+
+    auto offset = MFTRecIdToOffset(mftRecID);
+    if (offset == -1) return std::unexpected(TErrorCode::WrongMFTRecID); // MFT rec ID is out of MFT bounds
+
+    assert(offset > 0); // offset>=0 must be
+
+    uint64_t fileOffset = FPartitionOffset + (uint64_t)offset;
+    if (fileOffset + FVolumeData.BytesPerMFTRec > FViewSize) // attempt to read outside of a file
+        return std::unexpected(TErrorCode::IOError);
+
+    return fileOffset;
+}
+
+// copies range of virtual disk from the read-only view, offsets of VHD/VHDX are translated by the container. No syscalls are made.
+TErrorCode TMappedImageRecordsLoader::ReadView(uint64_t diskOffset, uint8_t* dataBuf, uint64_t size)
+{
+    return FContainer.ReadVia(diskOffset, dataBuf, size, [this](uint64_t fileOffset, uint8_t* buf, uint64_t len)
+        {
+            if (fileOffset + len > FViewSize)
+            {
+                GET_LOGGER;
+                logger.ErrorFmt("[ReadView] attempt to read outside of the image: offset {}, size {}", fileOffset, len);
+                return TErrorCode::IOError;
+            }
+
+            memcpy(buf, FView + fileOffset, len);
+            return TErrorCode::Success;
+        });
+}
+
+TErrorCode TMappedImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    if (FContainer.IsFlat())
+    {
+        auto offset = MFTRecFileOffset(mftRecRef.sId.low);
+        if (!offset) return offset.error();
+
+        // record may already be fixed up in the overlay by LoadMFTRecordCache, then just copy it from there
+        if ((FFixedUp.BitsCount() > 0) && FFixedUp.Test(mftRecRef.sId.low))
+        {
+            memcpy(mftRecData, FOverlay + offset.value(), FVolumeData.BytesPerMFTRec);
+            return TErrorCode::Success;
+        }
+
+        memcpy(mftRecData, FView + offset.value(), FVolumeData.BytesPerMFTRec);
+    }
+    else
+    {
+        if (mftRecRef.sId.low >= FRecordsCount)
+            return TErrorCode::WrongMFTRecID;
+
+        auto offset = MFTRecIdToOffset(mftRecRef.sId.low);
+        if (offset == -1) return TErrorCode::WrongMFTRecID; // MFT rec ID is out of MFT bounds
+
+        CH_ERR(ReadView(FPartitionOffset + (uint64_t)offset, mftRecData, FVolumeData.BytesPerMFTRec));
+    }
+
+    // check that we've read record with proper signature
+    NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)mftRecData;
+    if (!ntfs_is_file_recp(mftRec->Signature)) // MFT rec must contain 'FILE' signature
+    {
+        if (!internalCall)
+        {
+            GET_LOGGER;
+            uint8_t* sign = mftRec->Signature;
+            logger.WarnFmt("[LoadMFTRecord] Signature 'FILE' has not been found in MFT record {}. Signature found: {}{}{}{}",
+                mftRecRef.sId.low, sign[0], sign[1], sign[2], sign[3]);
+        }
+        //record is inside MFT table but it does not contain 'FILE' signature - consider it as Not In Use
+        return TErrorCode::MFTRecordNotInUse;
+    }
+
+    // fixup is applied to the copy, views stay untouched
+    return FixupUsaMFTRec(mftRec);
+}
+
+expected_uintptr TMappedImageRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    if (FFixedUp.BitsCount() == 0) // we are inside of Open() yet or image is VHD/VHDX, overlay bitmap is not used
+        return IRecordsLoader::InternalLoadMFTRecordCache(mftRecRef);
+
+    auto offset = MFTRecFileOffset(mftRecRef.sId.low);
+    if (!offset) return std::unexpected(offset.error());
+
+    uint8_t* rec = FOverlay + offset.value();
+    if (FFixedUp.Test(mftRecRef.sId.low)) return rec; // already fixed up, nothing to do
+
+    NTFS_RECORD_HEADER* mftRec = (NTFS_RECORD_HEADER*)rec;
+    if (!ntfs_is_file_recp(mftRec->Signature))
+        return std::unexpected(TErrorCode::MFTRecordNotInUse);
+
+    // writing into FILE_MAP_COPY view creates private copy of the page, image file and FView are not modified.
+    // all sectors are checked before the first write, so corrupted records are never left partially fixed up in the view
+    auto res = FixupUsaMFTRec(mftRec);
+    if (res != TErrorCode::Success)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[LoadMFTRecordCache] USA check failed, MFT record {} looks corrupted", mftRecRef.sId.low);
+        return std::unexpected(res);
+    }
+
+    FFixedUp.SetTrue(mftRecRef.sId.low);
+
+    return rec;
+}
+
+TErrorCode TMappedImageRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    assert(IsOpened());
+
+    // raw data from the read-only view, fixups made in the overlay are not visible here
+    return ReadView(FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster, dataBuf, lcnCnt * FVolumeData.BytesPerCluster);
+}
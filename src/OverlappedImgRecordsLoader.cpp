@@ -0,0 +1,192 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max 
+#define NOMINMAX
+
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+// one read request in flight
+struct ASYNC_READ
+{
+    OVERLAPPED Overlapped; // must be the first member, completion port returns pointer to it
+    uint8_t* DataBuf;
+    uint64_t DataBufSize;
+    uint32_t RunIndex;
+    DWORD BytesToRead;
+    TLoaderStats::TTimePoint IssueTime; // read latency is measured from issue to completion
+};
+
+void TOverlappedImageRecordsLoader::Open(const string_t& imgFileName)
+{
+    assert(!IsOpened());
+
+    TFileImageRecordsLoader::Open(imgFileName);
+    OpenAsync(imgFileName);
+}
+
+void TOverlappedImageRecordsLoader::Close()
+{
+    CloseAsync();
+    TFileImageRecordsLoader::Close();
+}
+
+// failures here are not fatal, loader just continues with synchronous reads
+void TOverlappedImageRecordsLoader::OpenAsync(const string_t& imgFileName)
+{
+    GET_LOGGER;
+
+    if (FQueueDepth <= 1)
+    {
+        logger.Info("[TOverlappedImageRecordsLoader] Queue depth is 1, synchronous reads are used.");
+        return;
+    }
+
+    // one run of VHD/VHDX may be spread over several blocks of the image file or not be stored at all
+    if (!FContainer.IsFlat())
+    {
+        logger.InfoFmt("[TOverlappedImageRecordsLoader] Image is {} disk, synchronous reads are used.", wtos(DiskFormatName(FContainer.GetFormat())));
+        return;
+    }
+
+    FHAsyncFile = CreateFile(imgFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    if (FHAsyncFile == INVALID_HANDLE_VALUE)
+    {
+        logger.WarnFmt("[TOverlappedImageRecordsLoader] CreateFile has failed with error: {}. Falling back to synchronous reads.", GetLastError());
+        return;
+    }
+
+    FIOPort = CreateIoCompletionPort(FHAsyncFile, nullptr, 0, 1);
+    if (FIOPort == nullptr)
+    {
+        logger.WarnFmt("[TOverlappedImageRecordsLoader] CreateIoCompletionPort has failed with error: {}. Falling back to synchronous reads.", GetLastError());
+        CloseAsync();
+    }
+}
+
+void TOverlappedImageRecordsLoader::CloseAsync()
+{
+    if (FIOPort != nullptr) CloseHandle(FIOPort);
+    if (FHAsyncFile != INVALID_HANDLE_VALUE) CloseHandle(FHAsyncFile);
+    FIOPort = nullptr;
+    FHAsyncFile = INVALID_HANDLE_VALUE;
+}
+
+// issues up to FQueueDepth overlapped reads and calls pred for every completed read as soon as completion arrives.
+// when pred returns an error no more reads are issued, reads which are already in flight are waited for but not passed to pred.
+TErrorCode TOverlappedImageRecordsLoader::ReadClustersAsync(std::span<const DATA_RUN_ITEM> runs, ReadClustersPred pred, bool useCache)
+{
+    assert(IsOpened());
+
+    if (!IsAsync() || (runs.size() <= 1))
+        return IRecordsLoader::ReadClustersAsync(runs, pred, useCache); // synchronous fallback
+
+    GET_LOGGER;
+
+    uint32_t slotsCount = std::min<uint32_t>(FQueueDepth, (uint32_t)runs.size());
+    ASYNC_READ* slots = DBG_NEW ASYNC_READ[slotsCount];
+    ZeroMemory(slots, slotsCount * sizeof(ASYNC_READ));
+
+    THArray<ASYNC_READ*> freeSlots;
+    for (uint32_t i = 0; i < slotsCount; i++) freeSlots.AddValue(&slots[i]);
+
+    TErrorCode result = TErrorCode::Success;
+    uint32_t nextRun = 0;
+    uint32_t inFlight = 0;
+
+    while (true)
+    {
+        // fill the queue
+        while ((result == TErrorCode::Success) && (nextRun < runs.size()) && (freeSlots.Count() > 0))
+        {
+            ASYNC_READ* slot = freeSlots.Pop();
+            const DATA_RUN_ITEM& run = runs[nextRun];
+
+            uint64_t bytesToRead = run.len * FVolumeData.BytesPerCluster;
+            assert(bytesToRead <= MAXDWORD);
+            if (bytesToRead > slot->DataBufSize)
+            {
+                delete[] slot->DataBuf;
+                slot->DataBuf = DBG_NEW uint8_t[bytesToRead];
+                slot->DataBufSize = bytesToRead;
+            }
+
+            LARGE_INTEGER offset{ 0 };
+            offset.QuadPart = FPartitionOffset + run.lcn * FVolumeData.BytesPerCluster;
+
+            ZeroMemory(&slot->Overlapped, sizeof(OVERLAPPED));
+            slot->Overlapped.Offset = offset.LowPart;
+            slot->Overlapped.OffsetHigh = offset.HighPart;
+            slot->RunIndex = nextRun++;
+            slot->BytesToRead = (DWORD)bytesToRead;
+
+            // runs that are entirely in clusters cache are passed to pred right away, no disk read is made for them
+            if (useCache && ClustersCached(run.lcn, run.len))
+            {
+                TErrorCode res = ReadClusters(run.lcn, run.len, slot->DataBuf);
+                result = pred(slot->RunIndex, (res == TErrorCode::Success) ? slot->DataBuf : nullptr, res);
+                freeSlots.AddValue(slot);
+                continue;
+            }
+
+            TraceRead(run.lcn * FVolumeData.BytesPerCluster, bytesToRead, FIOTag);
+            if (FStats.Enabled()) slot->IssueTime = TLoaderStats::Now();
+
+            // completion packet is queued to the port even when ReadFile completes synchronously
+            if (!ReadFile(FHAsyncFile, slot->DataBuf, slot->BytesToRead, nullptr, &slot->Overlapped) && (GetLastError() != ERROR_IO_PENDING))
+            {
+                logger.ErrorFmt("ReadClustersAsync.ReadFile() has failed with error: {}", GetLastError());
+                result = pred(slot->RunIndex, nullptr, TErrorCode::IOError);
+                freeSlots.AddValue(slot);
+                continue;
+            }
+
+            inFlight++;
+        }
+
+        if (inFlight == 0) break;
+
+        // wait for any read to complete
+        DWORD bytesRead = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(FIOPort, &bytesRead, &key, &overlapped, INFINITE);
+        if (overlapped == nullptr) // port itself has failed, nothing is dequeued
+        {
+            logger.ErrorFmt("ReadClustersAsync.GetQueuedCompletionStatus() has failed with error: {}", GetLastError());
+            assert(false);
+            result = TErrorCode::IOError;
+            break;
+        }
+
+        ASYNC_READ* slot = (ASYNC_READ*)overlapped;
+        inFlight--;
+
+        if (FStats.Enabled())
+            FStats.AddRead(runs[slot->RunIndex].lcn * FVolumeData.BytesPerCluster, slot->BytesToRead, TLoaderStats::NanosecsSince(slot->IssueTime));
+
+        if (result == TErrorCode::Success) // after an error completions are just drained
+        {
+            if (ok && (bytesRead == slot->BytesToRead))
+            {
+                if (useCache) CacheClusters(runs[slot->RunIndex].lcn, runs[slot->RunIndex].len, slot->DataBuf);
+                result = pred(slot->RunIndex, slot->DataBuf, TErrorCode::Success);
+            }
+            else
+            {
+                logger.ErrorFmt("ReadClustersAsync read of run {} has failed with error: {}, bytes read: {}", slot->RunIndex, ok ? 0ul : GetLastError(), bytesRead);
+                result = pred(slot->RunIndex, nullptr, TErrorCode::IOError);
+            }
+        }
+
+        freeSlots.AddValue(slot);
+    }
+
+    // buffers can be freed only when no reads are in flight, otherwise they are leaked intentionally
+    if (inFlight == 0)
+    {
+        for (uint32_t i = 0; i < slotsCount; i++) delete[] slots[i].DataBuf;
+        delete[] slots;
+    }
+
+    return result;
+}
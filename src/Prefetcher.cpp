@@ -0,0 +1,244 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include "Prefetcher.h"
+#include "Loaders.h"
+
+TRecordsPrefetcher::TRecordsPrefetcher(IRecordsLoader& loader, uint32_t maxDepth) : FLoader(loader)
+{
+    assert(FLoader.IsOpened());
+    assert(FLoader.SupportsConcurrentReads());
+
+    FRecSize = FLoader.GetVolumeData().BytesPerMFTRec;
+    FMaxDepth = std::max(maxDepth, PREFETCH_MIN_DEPTH);
+    FDepth = PREFETCH_MIN_DEPTH;
+    FStats.Depth = FStats.MaxDepth = FDepth;
+    FEntries.reserve(FMaxDepth);
+
+    FThread = std::thread(&TRecordsPrefetcher::PrefetchThread, this);
+}
+
+TRecordsPrefetcher::~TRecordsPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lk(FLock);
+        FStop = true;
+    }
+    FWorkCond.notify_one();
+    FThread.join(); // batch being loaded is finished first
+
+    for (auto& [id, entry] : FEntries)
+        delete[] entry.Data;
+
+    for (uint32_t i = 0; i < FFreeBufs.Count(); i++)
+        delete[] FFreeBufs[i];
+}
+
+// there is a ref to issue and room for it in the window
+bool TRecordsPrefetcher::HasWork()
+{
+    if (FInWindow >= FDepth) return false;
+
+    for (auto& group : FGroups)
+        if (!group.empty()) return true;
+
+    return false;
+}
+
+void TRecordsPrefetcher::ReleaseEntry(ENTRY& entry)
+{
+    if (entry.Data != nullptr) FFreeBufs.AddValue(entry.Data);
+    entry.Data = nullptr;
+    assert(FInWindow > 0);
+    FInWindow--;
+}
+
+void TRecordsPrefetcher::PrefetchThread()
+{
+    // I/O trace tags are per thread: scopes entered by the parser thread at the same time do not change tags of prefetch reads
+    TIOTagScope tagScope(FLoader, TIOTag::MFTRecord);
+
+    THArray<MFT_REF> batch;
+    batch.SetCapacity(PREFETCH_BATCH_SIZE);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lk(FLock);
+            FWorkCond.wait(lk, [this] { return FStop || HasWork(); });
+            if (FStop) return;
+
+            // innermost group goes first, its records are needed first
+            batch.Clear();
+            for (uint32_t g = (uint32_t)FGroups.size(); g-- > 0 && batch.Count() < PREFETCH_BATCH_SIZE && FInWindow < FDepth; )
+            {
+                auto& group = FGroups[g];
+                while (!group.empty() && batch.Count() < PREFETCH_BATCH_SIZE && FInWindow < FDepth)
+                {
+                    MFT_REF ref = group.front();
+                    group.pop_front();
+
+                    auto it = FEntries.find(ref.sId.low);
+                    if ((it == FEntries.end()) || (it->second.State != TState::Queued) || (it->second.Group != g)) continue; // taken by parser
+
+                    it->second.State = TState::InFlight;
+                    FInWindow++;
+                    batch.AddValue(ref);
+                }
+            }
+
+            FStats.Issued += batch.Count();
+        }
+
+        if (batch.Count() == 0) continue;
+
+        FLoader.LoadMFTRecords(std::span<const MFT_REF>(batch.GetValuePointer(0), batch.Count()),
+            [this](uint32_t index, const MFT_REF& mftRecRef, uint8_t* mftRecData, TErrorCode res)
+            {
+                UNREFERENCED_PARAMETER(index);
+                std::lock_guard<std::mutex> lk(FLock);
+
+                auto it = FEntries.find(mftRecRef.sId.low);
+                assert(it != FEntries.end());
+                ENTRY& entry = it->second;
+
+                // group has been closed while record was loading, or record has failed to load - parser loads it by itself
+                if ((entry.State == TState::Discarded) || (res != TErrorCode::Success))
+                {
+                    if (entry.State == TState::Discarded)
+                    {
+                        FStats.Wasted++;
+                        FPeriodWasted++;
+                    }
+                    ReleaseEntry(entry);
+                    FEntries.erase(it);
+                }
+                else
+                {
+                    entry.Data = (FFreeBufs.Count() > 0) ? FFreeBufs.Pop() : DBG_NEW uint8_t[FRecSize];
+                    memcpy(entry.Data, mftRecData, FRecSize);
+                    entry.State = TState::Ready;
+                }
+
+                FReadyCond.notify_all();
+                return TErrorCode::Success;
+            });
+    }
+}
+
+void TRecordsPrefetcher::BeginGroup()
+{
+    std::lock_guard<std::mutex> lk(FLock);
+    FGroups.emplace_back();
+}
+
+void TRecordsPrefetcher::EndGroup()
+{
+    std::lock_guard<std::mutex> lk(FLock);
+    assert(!FGroups.empty());
+
+    uint32_t group = (uint32_t)FGroups.size() - 1;
+    FGroups.pop_back();
+
+    for (auto it = FEntries.begin(); it != FEntries.end(); )
+    {
+        ENTRY& entry = it->second;
+        if (entry.Group != group)
+        {
+            ++it;
+            continue;
+        }
+
+        if (entry.State == TState::InFlight) // prefetch thread frees it when load is finished
+        {
+            entry.State = TState::Discarded;
+            entry.Group = UINT32_MAX;
+            ++it;
+            continue;
+        }
+
+        if (entry.State == TState::Ready)
+        {
+            FStats.Wasted++;
+            FPeriodWasted++;
+            ReleaseEntry(entry);
+        }
+
+        it = FEntries.erase(it);
+    }
+
+    FWorkCond.notify_one();
+}
+
+void TRecordsPrefetcher::Push(const MFT_REF& mftRecRef)
+{
+    std::lock_guard<std::mutex> lk(FLock);
+    if (FGroups.empty()) return;
+
+    uint32_t group = (uint32_t)FGroups.size() - 1;
+    if (!FEntries.try_emplace(mftRecRef.sId.low, ENTRY{ TState::Queued, group, nullptr }).second) return; // hard links of the same record
+
+    FGroups.back().push_back(mftRecRef);
+    FStats.Pushed++;
+
+    FWorkCond.notify_one();
+}
+
+bool TRecordsPrefetcher::Take(const MFT_REF& mftRecRef, uint8_t* mftRecData)
+{
+    std::unique_lock<std::mutex> lk(FLock);
+
+    FPeriodTakes++;
+    auto it = FEntries.find(mftRecRef.sId.low);
+    bool late = (it != FEntries.end()) && (it->second.State == TState::InFlight);
+
+    if (late)
+    {
+        FStats.LateHits++;
+        FPeriodBehind++;
+        FReadyCond.wait(lk, [&] { it = FEntries.find(mftRecRef.sId.low); return (it == FEntries.end()) || (it->second.State != TState::InFlight); });
+    }
+    else if ((it != FEntries.end()) && (it->second.State == TState::Ready))
+    {
+        FStats.Hits++;
+    }
+
+    bool found = (it != FEntries.end()) && (it->second.State == TState::Ready);
+    if (found)
+    {
+        memcpy(mftRecData, it->second.Data, FRecSize);
+        ReleaseEntry(it->second);
+        FEntries.erase(it);
+    }
+    else
+    {
+        FStats.Misses++;
+        if (!late) FPeriodBehind++;
+        if ((it != FEntries.end()) && (it->second.State == TState::Queued)) FEntries.erase(it); // stays in group queue till prefetch thread drops it
+    }
+
+    if (FPeriodTakes >= PREFETCH_ADAPT_PERIOD) Adapt();
+
+    FWorkCond.notify_one();
+    return found;
+}
+
+// parser often gets ahead of prefetch thread - window is too small to hide read latency, grow it.
+// records are often thrown away unused - window is larger than parser consumes, shrink it.
+void TRecordsPrefetcher::Adapt()
+{
+    if ((FPeriodBehind * 4 > FPeriodTakes) && (FDepth < FMaxDepth))
+        FDepth = std::min(FDepth * 2, FMaxDepth);
+    else if ((FPeriodWasted * 4 > FPeriodTakes) && (FDepth > PREFETCH_MIN_DEPTH))
+        FDepth = std::max(FDepth / 2, PREFETCH_MIN_DEPTH);
+
+    FStats.Depth = FDepth;
+    FStats.MaxDepth = std::max(FStats.MaxDepth, FDepth);
+    FPeriodTakes = FPeriodBehind = FPeriodWasted = 0;
+}
+
+PREFETCH_STATS TRecordsPrefetcher::GetStats()
+{
+    std::lock_guard<std::mutex> lk(FLock);
+    return FStats;
+}
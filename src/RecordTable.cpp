@@ -0,0 +1,344 @@
+#include <cassert>
+#include <algorithm>
+#include <numeric>
+#include "RecordTable.h"
+#include "Loaders.h"
+
+// resident attribute data must fit into the attribute
+static bool ResDataInAttr(MFT_ATTR_HEADER* attr, uint32_t minSize)
+{
+    return (attr->NonResidentFlag == ATTR_FLAG_RESIDENT) && (attr->res.DataSize >= minSize) &&
+        ((uint32_t)attr->res.DataOffset + attr->res.DataSize <= attr->AttrSize);
+}
+
+void TMFTRecordTable::Clear()
+{
+    FRowOfRec.Clear();
+
+    RecID.Clear();
+    SeqNum.Clear();
+    Flags.Clear();
+    HardLinks.Clear();
+    FileAttrib.Clear();
+    CreateTime.Clear();
+    ModifyTime.Clear();
+    ModifyAttrTime.Clear();
+    AccessTime.Clear();
+    DataSize.Clear();
+    AllocSize.Clear();
+    AttrsCount.Clear();
+    for (uint32_t i = 0; i < ATTR_TYPE_CNT; i++) AttrCounters[i].Clear();
+    NonResidentAttrs.Clear();
+    MainName.Clear();
+    NamesCount.Clear();
+
+    NameRow.Clear();
+    NameParent.Clear();
+    NameOffset.Clear();
+    NameLen.Clear();
+    NameType.Clear();
+    NamePool.Clear();
+}
+
+uint32_t TMFTRecordTable::AddRow(MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+{
+    uint32_t row = RecID.Count();
+
+    RecID.AddValue(mftRecID);
+    SeqNum.AddValue(mftRec->SeqNum);
+    Flags.AddValue(mftRec->Flags);
+    HardLinks.AddValue(mftRec->HardLinksCnt);
+    FileAttrib.AddValue(0);
+    CreateTime.AddValue(0);
+    ModifyTime.AddValue(0);
+    ModifyAttrTime.AddValue(0);
+    AccessTime.AddValue(0);
+    DataSize.AddValue(0);
+    AllocSize.AddValue(0);
+    AttrsCount.AddValue(0);
+    for (uint32_t i = 0; i < ATTR_TYPE_CNT; i++) AttrCounters[i].AddValue(0);
+    NonResidentAttrs.AddValue(0);
+    MainName.AddValue(TABLE_NO_NAME);
+    NamesCount.AddValue(0);
+
+    FRowOfRec[mftRecID] = row;
+    return row;
+}
+
+void TMFTRecordTable::AddName(uint32_t row, ATTR_FILE_NAME* fileName)
+{
+    uint32_t nameIdx = NameRow.Count();
+
+    NameRow.AddValue(row);
+    NameParent.AddValue(fileName->ParentDir);
+    NameOffset.AddValue(NamePool.Count());
+    NameLen.AddValue(fileName->FileNameLen);
+    NameType.AddValue(fileName->NameType);
+
+    wchar_t* name = GetFName(fileName);
+    for (uint32_t i = 0; i < fileName->FileNameLen; i++) NamePool.AddValue(name[i]);
+
+    NamesCount[row]++;
+    if ((MainName[row] == TABLE_NO_NAME) && (fileName->NameType != FILE_NAME_DOS)) MainName[row] = nameIdx;
+}
+
+// adds attributes of base or extension record mftRec to the row of base record
+void TMFTRecordTable::AddAttrs(uint32_t row, MFT_FILE_RECORD* mftRec)
+{
+    bool isBase = (mftRec->ParentFileRec.Id == 0);
+    MFT_ATTR_HEADER* attr = (MFT_ATTR_HEADER*)Add2Ptr(mftRec, mftRec->FirstAttrOffset);
+
+    while (true)
+    {
+        if (!AttrInRecord(mftRec, attr, FRecSize))
+        {
+            GET_LOGGER;
+            logger.WarnFmt("[TMFTRecordTable] MFT record {} has corrupted attribute at offset {}, rest of the record is skipped.",
+                (uint32_t)mftRec->IndexMFTRec, Diff2Ptr(mftRec, attr));
+            break;
+        }
+        if (attr->AttrType == ATTR_END) break;
+
+        if (attr->AttrType <= ATTR_LOGGED_UTILITY_STREAM)
+        {
+            AttrCounters[MATI(attr->AttrType)][row]++;
+            if (attr->NonResidentFlag != ATTR_FLAG_RESIDENT) NonResidentAttrs[row] |= MakeAttrBitmask(attr->AttrType);
+        }
+        AttrsCount[row]++;
+
+        switch (attr->AttrType)
+        {
+        case ATTR_STD_INFO:
+            // old (NTFS 1.x) STD_INFO is shorter than ATTR_STD_INFO5 but has the same fields up to FileAttrib
+            if (isBase && ResDataInAttr(attr, offsetof(ATTR_STD_INFO5, FileAttrib) + sizeof(uint32_t)))
+            {
+                ATTR_STD_INFO5* stdInfo = (ATTR_STD_INFO5*)Add2Ptr(attr, attr->res.DataOffset);
+                FileAttrib[row] = stdInfo->FileAttrib;
+                CreateTime[row] = stdInfo->CreateTime;
+                ModifyTime[row] = stdInfo->ModifyTime;
+                ModifyAttrTime[row] = stdInfo->ModifyAttrTime;
+                AccessTime[row] = stdInfo->LastAccessTime;
+            }
+            break;
+        case ATTR_FILENAME:
+            if (ResDataInAttr(attr, sizeof(ATTR_FILE_NAME)))
+            {
+                ATTR_FILE_NAME* fileName = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
+                if (sizeof(ATTR_FILE_NAME) + fileName->FileNameLen * sizeof(wchar_t) <= attr->res.DataSize)
+                    AddName(row, fileName);
+            }
+            break;
+        case ATTR_DATA:
+            if (attr->AttrNameSize != 0) break; // named streams are counted by AttrCounters only
+            if (attr->NonResidentFlag == ATTR_FLAG_RESIDENT)
+            {
+                DataSize[row] = attr->res.DataSize;
+                AllocSize[row] = attr->res.DataSize;
+            }
+            else if (attr->nonres.StartVCN == 0) // sizes are valid in the first extent only
+            {
+                DataSize[row] = attr->nonres.RealSize;
+                AllocSize[row] = attr->nonres.AllocatedSize;
+            }
+            break;
+        default:
+            break;
+        }
+
+        attr = (MFT_ATTR_HEADER*)Add2Ptr(attr, attr->AttrSize);
+    }
+}
+
+uint32_t TMFTRecordTable::BaseRowOf(const MFT_FILE_RECORD* extRec) const
+{
+    uint32_t row = RowOf(extRec->ParentFileRec.sId.low);
+    if (row == TABLE_NO_ROW) return TABLE_NO_ROW;
+
+    uint16_t seq = extRec->ParentFileRec.sId.seq;
+    return ((seq == 0) || (seq == SeqNum[row])) ? row : TABLE_NO_ROW;
+}
+
+/**
+* @brief Fills the table by one sequential pass over all MFT records, previous content is cleared.
+* @details Base records get their rows in the order of MFT record numbers. Extension records that follow their base record
+* (the usual case) are added to its row at once, the rest are remembered and loaded one by one after the scan.
+* Records without MFT_FLAG_IN_USE, extension records of base records that are not in use and stale extension records
+* (their ParentFileRec sequence number differs from the one of the base record) are skipped.
+* @return TErrorCode::Success or error returned by the loader
+*/
+TErrorCode TMFTRecordTable::Build(IRecordsLoader& loader, TExtRecordIndex* extIndex)
+{
+    Clear();
+    FRecSize = loader.GetVolumeData().BytesPerMFTRec;
+    if (extIndex != nullptr) extIndex->Reset(FRecSize);
+
+    uint32_t recsCount = (uint32_t)loader.GetRecordsCount();
+    FRowOfRec.SetCount(recsCount);
+    if (recsCount > 0) memset(FRowOfRec.GetValuePointer(0), 0xFF, recsCount * sizeof(uint32_t)); // TABLE_NO_ROW
+
+    THArray<MFTRecIndex> pendingExt; // extension records met before their base records
+
+    TErrorCode res = loader.ScanMFTRecords([this, recsCount, extIndex, &pendingExt](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            if ((mftRec->Flags & MFT_FLAG_IN_USE) == 0) return TErrorCode::Success;
+            if (mftRecID >= recsCount) return TErrorCode::Success;
+
+            if (mftRec->ParentFileRec.Id != 0)
+            {
+                if (extIndex != nullptr) extIndex->Add(mftRec, mftRecID);
+
+                if (RowOf(mftRec->ParentFileRec.sId.low) == TABLE_NO_ROW)
+                    pendingExt.AddValue(mftRecID);
+                else if (uint32_t baseRow = BaseRowOf(mftRec); baseRow != TABLE_NO_ROW)
+                    AddAttrs(baseRow, mftRec);
+                return TErrorCode::Success;
+            }
+
+            AddAttrs(AddRow(mftRec, mftRecID), mftRec);
+            return TErrorCode::Success;
+        });
+
+    if (res != TErrorCode::Success)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[TMFTRecordTable] Scan of MFT records failed with error {}.", (uint32_t)res);
+        return res;
+    }
+
+    if (extIndex != nullptr) extIndex->Finish();
+
+    if (pendingExt.Count() > 0)
+    {
+        THArray<uint8_t> recBuf;
+        recBuf.SetCount(loader.GetVolumeData().BytesPerMFTRec);
+        MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)recBuf.GetValuePointer(0);
+
+        for (uint32_t i = 0; i < pendingExt.Count(); i++)
+        {
+            MFT_REF ref{ pendingExt[i] };
+            CH_ERR(loader.LoadMFTRecord(ref, recBuf.GetValuePointer(0))); // LoadMFTRecord writes a message into log file in case of an error
+
+            uint32_t baseRow = BaseRowOf(mftRec);
+            if (baseRow != TABLE_NO_ROW) AddAttrs(baseRow, mftRec); // orphaned and stale extension records are skipped
+        }
+    }
+
+    GET_LOGGER;
+    logger.DebugFmt("[TMFTRecordTable] {} rows, {} names, {} extension records loaded after the scan, {} bytes.",
+        RowsCount(), NamesTotal(), pendingExt.Count(), MemorySize());
+
+    return TErrorCode::Success;
+}
+
+uint64_t TMFTRecordTable::MemorySize() const
+{
+    uint64_t rowSize = sizeof(MFTRecIndex) + 3 * sizeof(uint16_t) + sizeof(uint32_t) + 6 * sizeof(uint64_t) +
+        (1 + ATTR_TYPE_CNT) * sizeof(uint16_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t);
+    uint64_t nameSize = 2 * sizeof(uint32_t) + sizeof(MFT_REF) + 2 * sizeof(uint8_t);
+
+    return (uint64_t)FRowOfRec.Count() * sizeof(uint32_t) + (uint64_t)RowsCount() * rowSize +
+        (uint64_t)NamesTotal() * nameSize + (uint64_t)NamePool.Count() * sizeof(wchar_t);
+}
+
+void TExtRecordIndex::Clear()
+{
+    FRecs.Clear();
+    FExtIDs.Clear();
+    FBaseIDs.Clear();
+    FByBase.Clear();
+    FHits = FMisses = 0;
+}
+
+void TExtRecordIndex::Reset(uint32_t recSize)
+{
+    Clear();
+    FRecSize = recSize;
+}
+
+void TExtRecordIndex::Add(MFT_FILE_RECORD* extRec, MFTRecIndex extRecID)
+{
+    assert(FRecSize > 0);
+    assert((Count() == 0) || (FExtIDs[Count() - 1] < extRecID));
+    assert(extRec->ParentFileRec.Id != 0);
+
+    uint32_t offset = FRecs.Count();
+    FRecs.SetCount(offset + FRecSize);
+    memcpy(FRecs.GetValuePointer(offset), extRec, FRecSize);
+
+    FExtIDs.AddValue(extRecID);
+    FBaseIDs.AddValue(extRec->ParentFileRec.sId.low);
+}
+
+void TExtRecordIndex::Finish()
+{
+    FByBase.SetCount(Count());
+    std::iota(FByBase.begin(), FByBase.end(), 0);
+    std::sort(FByBase.begin(), FByBase.end(), [this](uint32_t a, uint32_t b)
+        {
+            return (FBaseIDs[a] < FBaseIDs[b]) || ((FBaseIDs[a] == FBaseIDs[b]) && (a < b));
+        });
+}
+
+TErrorCode TExtRecordIndex::Build(IRecordsLoader& loader)
+{
+    Reset(loader.GetVolumeData().BytesPerMFTRec);
+
+    TErrorCode res = loader.ScanMFTRecords([this](MFT_FILE_RECORD* mftRec, MFTRecIndex mftRecID)
+        {
+            if (((mftRec->Flags & MFT_FLAG_IN_USE) != 0) && (mftRec->ParentFileRec.Id != 0)) Add(mftRec, mftRecID);
+            return TErrorCode::Success;
+        });
+
+    if (res != TErrorCode::Success)
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[TExtRecordIndex] Scan of MFT records failed with error {}.", (uint32_t)res);
+        Clear();
+        return res;
+    }
+
+    Finish();
+    return TErrorCode::Success;
+}
+
+MFT_FILE_RECORD* TExtRecordIndex::Find(const MFT_REF& extRecRef)
+{
+    // slots go in increasing order of record numbers
+    uint32_t lo = 0, hi = Count();
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (FExtIDs[mid] < extRecRef.sId.low) lo = mid + 1; else hi = mid;
+    }
+
+    if ((lo < Count()) && (FExtIDs[lo] == extRecRef.sId.low))
+    {
+        MFT_FILE_RECORD* extRec = Record(lo);
+        if ((extRecRef.sId.seq == 0) || (extRecRef.sId.seq == extRec->SeqNum))
+        {
+            FHits++;
+            return extRec;
+        }
+    }
+
+    FMisses++;
+    return nullptr;
+}
+
+std::span<const uint32_t> TExtRecordIndex::ExtensionsOf(MFTRecIndex baseRecID) const
+{
+    assert(FByBase.Count() == Count()); // Finish() has been called
+
+    uint32_t lo = 0, hi = FByBase.Count();
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (FBaseIDs[FByBase[mid]] < baseRecID) lo = mid + 1; else hi = mid;
+    }
+
+    uint32_t first = lo;
+    while ((lo < FByBase.Count()) && (FBaseIDs[FByBase[lo]] == baseRecID)) lo++;
+    if (lo == first) return {};
+
+    return std::span<const uint32_t>(FByBase.GetValuePointer(first), lo - first);
+}
@@ -0,0 +1,162 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max 
+#define NOMINMAX
+
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+// TFileImageRecordsLoader::Open reads $MFT Data Runs and meta files count from disk, slab is filled after that
+void TSlabImageRecordsLoader::Open(const string_t& imgFileName)
+{
+    TFileImageRecordsLoader::Open(imgFileName);
+
+    if (LoadAllMFTRecords() != TErrorCode::Success)
+    {
+        Close();
+        throw std::runtime_error("Error loading MFT records into memory");
+    }
+}
+
+void TSlabImageRecordsLoader::Close()
+{
+    // records returned by LoadMFTRecordCache become invalid here
+    TFileImageRecordsLoader::Close();
+    FSlab.Clear();
+}
+
+// reads records of one slab page. records of the page are contiguous on disk within one $MFT extent,
+// so page is read by one call per extent it crosses, directly into the page when read is cluster-aligned.
+TErrorCode TSlabImageRecordsLoader::LoadPage(uint32_t pageIndex, uint8_t*& bounceBuf, uint64_t& bounceBufSize)
+{
+    uint32_t BytesPerCluster = FVolumeData.BytesPerCluster;
+    uint32_t BytesPerMFTRec = FVolumeData.BytesPerMFTRec;
+
+    MFTRecIndex firstID = pageIndex * FSlab.RecsPerPage();
+    MFTRecIndex lastID = (MFTRecIndex)std::min<uint64_t>((uint64_t)firstID + FSlab.RecsPerPage(), FSlab.RecordsCount());
+    uint8_t* page = FSlab.AcquirePage(pageIndex);
+    TIOTagScope tagScope(*this, TIOTag::MFTRecord);
+
+    MFTRecIndex id = firstID;
+    while (id < lastID)
+    {
+        int64_t extIndex = FMFTExtents.FindExtent(id);
+        if (extIndex == -1) break; // the rest of records are out of MFT bounds
+
+        const MFT_EXTENT& ext = FMFTExtents.GetExtent((uint32_t)extIndex);
+        MFTRecIndex pieceEnd = (MFTRecIndex)std::min<uint64_t>(lastID, ext.FirstRecID + FMFTExtents.ExtentRecsCount((uint32_t)extIndex));
+
+        uint64_t offset = (uint64_t)FMFTExtents.RecIdToOffset(id);
+        uint64_t bytes = (uint64_t)(pieceEnd - id) * BytesPerMFTRec;
+        uint8_t* dst = page + (uint64_t)(id - firstID) * BytesPerMFTRec;
+
+        if ((offset % BytesPerCluster == 0) && (bytes % BytesPerCluster == 0))
+        {
+            CH_ERR(DeviceReadClusters(offset / BytesPerCluster, bytes / BytesPerCluster, dst)); // ReadClusters writes error message to log file
+        }
+        else // piece starts or ends in the middle of a cluster, read through bounce buffer
+        {
+            uint64_t lcnStart = offset / BytesPerCluster;
+            uint64_t lcnEnd = (offset + bytes + BytesPerCluster - 1) / BytesPerCluster;
+            uint64_t bufSize = (lcnEnd - lcnStart) * BytesPerCluster;
+            if (bufSize > bounceBufSize)
+            {
+                delete[] bounceBuf;
+                bounceBuf = DBG_NEW uint8_t[bufSize];
+                bounceBufSize = bufSize;
+            }
+
+            CH_ERR(DeviceReadClusters(lcnStart, lcnEnd - lcnStart, bounceBuf));
+            memcpy(dst, bounceBuf + (offset - lcnStart * BytesPerCluster), bytes);
+        }
+
+        id = pieceEnd;
+    }
+
+    // fixup records in place, only records with 'FILE' signature and correct USA become present
+    TBitField fixedUp;
+    {
+        TFixupTimer timer(FStats, id - firstID, (uint64_t)(id - firstID) * BytesPerMFTRec);
+        FixupMFTRecords(page, id - firstID, fixedUp);
+    }
+
+    uint32_t corruptedCnt = 0;
+    for (MFTRecIndex i = firstID; i < id; i++)
+    {
+        if (fixedUp.Test(i - firstID))
+            FSlab.SetPresent(i);
+        else if (ntfs_is_file_recp(page + (uint64_t)(i - firstID) * BytesPerMFTRec))
+            corruptedCnt++;
+    }
+
+    if (corruptedCnt > 0)
+    {
+        GET_LOGGER;
+        logger.WarnFmt("[LoadPage] USA check failed for {} MFT records of page {}, they are skipped.", corruptedCnt, pageIndex);
+    }
+
+    return TErrorCode::Success;
+}
+
+TErrorCode TSlabImageRecordsLoader::LoadAllMFTRecords()
+{
+    assert(IsOpened());
+
+    FSlab.Init(FVolumeData.BytesPerMFTRec, FRecordsCount);
+
+    uint8_t* bounceBuf = nullptr;
+    uint64_t bounceBufSize = 0;
+    TErrorCode res = TErrorCode::Success;
+
+    for (uint32_t page = 0; page < FSlab.PagesCount(); page++)
+    {
+        // pages where all records are free in $MFT bitmap are neither read nor allocated, 
+        // their records are loaded from disk by InternalLoadMFTRecord if somebody asks for them
+        MFTRecIndex firstID = page * FSlab.RecsPerPage();
+        if (NextAllocatedRecord(firstID) >= std::min<uint64_t>((uint64_t)firstID + FSlab.RecsPerPage(), FSlab.RecordsCount()))
+            continue;
+
+        res = LoadPage(page, bounceBuf, bounceBufSize);
+        if (res != TErrorCode::Success) break;
+    }
+
+    delete[] bounceBuf;
+
+    GET_LOGGER;
+    logger.InfoFmt("[LoadAllMFTRecords] {} MFT records loaded into memory, {} of them are in use. Memory used: {} bytes.", 
+        FSlab.RecordsCount(), FSlab.PresentCount(), FSlab.MemSize());
+
+    return res;
+}
+
+TErrorCode TSlabImageRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    if (FSlab.RecordsCount() == 0) // we are inside of Open() yet, slab is not filled
+        return TFileImageRecordsLoader::InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+
+    if (mftRecRef.sId.low >= FRecordsCount)
+        return TErrorCode::WrongMFTRecID;
+
+    uint8_t* rec = FSlab.GetRec(mftRecRef.sId.low);
+    if (rec == nullptr) // record without 'FILE' signature or corrupted one
+    {
+        // load it again from disk to get exact error code and log message
+        return TFileImageRecordsLoader::InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+    }
+
+    memcpy(mftRecData, rec, FVolumeData.BytesPerMFTRec);
+    return TErrorCode::Success;
+}
+
+expected_uintptr TSlabImageRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    if (FSlab.RecordsCount() == 0) // we are inside of Open() yet, slab is not filled
+        return IRecordsLoader::InternalLoadMFTRecordCache(mftRecRef);
+
+    if (mftRecRef.sId.low >= FRecordsCount)
+        return std::unexpected(TErrorCode::WrongMFTRecID);
+
+    uint8_t* rec = FSlab.GetRec(mftRecRef.sId.low);
+    if (rec == nullptr) return std::unexpected(TErrorCode::MFTRecordNotInUse);
+
+    return rec;
+}
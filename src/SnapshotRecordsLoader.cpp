@@ -0,0 +1,360 @@
+// this is to remove defines min, max in windows headers because they conflict with std::min std::max
+#define NOMINMAX
+
+#include "Readers.h"
+#include "Functions.h"
+#include "Utils.h"
+
+#define throw_winapi_exception(_where_) {\
+    DWORD err = GetLastError(); \
+    auto errMsg = GetErrorMessageTextA(err, (_where_)); \
+    throw std::system_error(std::error_code(err, std::system_category()), errMsg); }
+
+#define throw_format_exception(_what_) throw std::runtime_error(std::string("Snapshot file format is incorrect: ") + (_what_))
+
+void TSnapshotRecordsLoader::MapSnapshot(const string_t& snapshotFile)
+{
+    assert(nullptr == FView);
+
+    HANDLE hFile = CreateFile(snapshotFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        throw_winapi_exception("TSnapshotRecordsLoader.CreateFile");
+
+    LARGE_INTEGER fileSize{ 0 };
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        CloseHandle(hFile);
+        throw_winapi_exception("TSnapshotRecordsLoader.GetFileSizeEx");
+    }
+
+    if ((uint64_t)fileSize.QuadPart < sizeof(MFT_SNAPSHOT_HEADER))
+    {
+        CloseHandle(hFile);
+        throw_format_exception("file is too small");
+    }
+
+    // copy-on-write view: pointers returned by LoadMFTRecordCache point into it and callers may write there, snapshot file stays untouched
+    HANDLE hMap = CreateFileMapping(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (hMap == nullptr)
+    {
+        CloseHandle(hFile);
+        throw_winapi_exception("TSnapshotRecordsLoader.CreateFileMapping");
+    }
+
+    FView = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0);
+    DWORD err = GetLastError();
+
+    // view keeps references to mapping object and file, so handles are not needed anymore
+    CloseHandle(hMap);
+    CloseHandle(hFile);
+
+    if (FView == nullptr)
+    {
+        SetLastError(err);
+        throw_winapi_exception("TSnapshotRecordsLoader.MapViewOfFile");
+    }
+
+    FViewSize = fileSize.QuadPart;
+}
+
+// checks header and tables of snapshot and fills loader fields from them
+void TSnapshotRecordsLoader::LoadTables()
+{
+    FHeader = (const MFT_SNAPSHOT_HEADER*)FView;
+
+    if (memcmp(FHeader->Magic, MFT_SNAPSHOT_HEADER().Magic, sizeof(FHeader->Magic)) != 0)
+        throw_format_exception("signature has not been found");
+
+    if (FHeader->Version != MFT_SNAPSHOT_VERSION)
+        throw_format_exception(std::format("unsupported version {}", (uint32_t)FHeader->Version));
+
+    uint32_t recSize = FHeader->VolumeData.BytesPerFileRecordSegment;
+    if ((recSize == 0) || (FHeader->VolumeData.BytesPerCluster == 0) || (FHeader->VolumeData.BytesPerSector == 0))
+        throw_format_exception("volume geometry is broken");
+
+    if (FHeader->BlocksCount != (FHeader->RecordsCount + SNAPSHOT_RECS_PER_BLOCK - 1) / SNAPSHOT_RECS_PER_BLOCK)
+        throw_format_exception("blocks count does not match records count");
+
+    uint64_t tablesSize = (uint64_t)FHeader->VolumeNameLen * sizeof(wchar_t) + (uint64_t)FHeader->RunsCount * sizeof(SNAPSHOT_RUN) +
+        ((uint64_t)FHeader->BitmapWords + FHeader->BlocksCount) * sizeof(uint64_t) + (uint64_t)FHeader->BlocksCount * sizeof(SNAPSHOT_BLOCK);
+    if ((FHeader->TablesOffset < sizeof(MFT_SNAPSHOT_HEADER)) || (FHeader->TablesOffset > FViewSize) || (tablesSize > FViewSize - FHeader->TablesOffset))
+        throw_format_exception("tables are outside of the file");
+
+    if ((FHeader->TablesOffset % sizeof(uint64_t)) != 0)
+        throw_format_exception("tables are not aligned");
+
+    const uint8_t* table = FView + FHeader->TablesOffset;
+
+    FStored = (const uint64_t*)table;
+    table += (uint64_t)FHeader->BlocksCount * sizeof(uint64_t);
+
+    if (FHeader->BitmapWords > 0) FMFTBitmap.SetData((const uint64_t*)table, FHeader->BitmapWords);
+    table += (uint64_t)FHeader->BitmapWords * sizeof(uint64_t);
+
+    FBlocks = (const SNAPSHOT_BLOCK*)table;
+    table += (uint64_t)FHeader->BlocksCount * sizeof(SNAPSHOT_BLOCK);
+
+    auto& volDataBuf = (NTFS_VOLUME_DATA_BUFFER&)FVolumeData;
+    volDataBuf = FHeader->VolumeData;
+    FVolumeData.hVolume = INVALID_HANDLE_VALUE;
+    InitCaches();
+
+    uint64_t vcn = 0;
+    for (uint32_t i = 0; i < FHeader->RunsCount; i++, table += sizeof(SNAPSHOT_RUN))
+    {
+        const SNAPSHOT_RUN* run = (const SNAPSHOT_RUN*)table;
+        FMFTDataRuns.AddValue({ run->Len, vcn, run->Lcn });
+        vcn += run->Len;
+    }
+    FMFTExtents.Build(FMFTDataRuns, FVolumeData.BytesPerCluster, FVolumeData.BytesPerMFTRec);
+
+    FVolumeData.Name.assign((const wchar_t*)table, FHeader->VolumeNameLen);
+
+    uint64_t storedCount = 0;
+    for (uint32_t i = 0; i < FHeader->BlocksCount; i++)
+    {
+        const SNAPSHOT_BLOCK& block = FBlocks[i];
+        uint32_t recsCount = std::popcount(FStored[i]);
+        storedCount += recsCount;
+
+        if (block.RawSize != recsCount * recSize)
+            throw_format_exception(std::format("size of block {} does not match its records", i));
+
+        if ((block.Offset < sizeof(MFT_SNAPSHOT_HEADER)) || (block.Offset + block.Size > FHeader->TablesOffset) || (block.Size > block.RawSize))
+            throw_format_exception(std::format("block {} is outside of blocks area", i));
+    }
+
+    if (storedCount != FHeader->StoredCount)
+        throw_format_exception("stored records count does not match stored records bitmap");
+
+    FRecordsCount = FHeader->RecordsCount;
+    FMetaFilesCount = FHeader->MetaFilesCount;
+    FPartitionOffset = FHeader->PartitionOffset;
+}
+
+// index blocks and other non-resident attributes are not in snapshot, they are read from the source when it is available
+void TSnapshotRecordsLoader::OpenSource()
+{
+    string_t source = IsPath(FVolumeData.Name) ? FVolumeData.Name : NormalizeVolume(FVolumeData.Name);
+    if (!source.empty())
+        FHSource = CreateFile(source.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    // source image may be VHD/VHDX, PartitionOffset is an offset inside of the virtual disk then
+    if ((FHSource != INVALID_HANDLE_VALUE) && IsPath(FVolumeData.Name))
+    {
+        try
+        {
+            FSourceContainer.Open(FHSource);
+        }
+        catch (const std::exception& e)
+        {
+            GET_LOGGER;
+            logger.WarnFmt("[TSnapshotRecordsLoader] Source image '{}' cannot be opened: {}", wtos(FVolumeData.Name), e.what());
+            CloseHandle(FHSource);
+            FHSource = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    if (FHSource == INVALID_HANDLE_VALUE)
+    {
+        GET_LOGGER;
+        logger.WarnFmt("[TSnapshotRecordsLoader] Source '{}' of the snapshot is not available, only MFT records can be read.", wtos(FVolumeData.Name));
+    }
+}
+
+void TSnapshotRecordsLoader::Open(const string_t& snapshotFile)
+{
+    assert(!IsOpened());
+
+    GET_LOGGER;
+    logger.DebugFmt("Opening MFT snapshot: {}", wtos(snapshotFile));
+
+    MapSnapshot(snapshotFile);
+    SetOpened(true); // Close() below cleans up everything we have done so far
+
+    try
+    {
+        LoadTables();
+
+        if (IsCompressed())
+        {
+            if (!CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &FDecompressor))
+                throw_winapi_exception("TSnapshotRecordsLoader.CreateDecompressor");
+
+            FBlockCache.Init(SNAPSHOT_RECS_PER_BLOCK * FVolumeData.BytesPerMFTRec, FBlockCache.Budget());
+            FBlockBuf = DBG_NEW uint8_t[FBlockCache.RecordSize()];
+        }
+
+        OpenSource();
+    }
+    catch (...)
+    {
+        Close();
+        throw;
+    }
+}
+
+void TSnapshotRecordsLoader::Close()
+{
+    IRecordsLoader::Close();
+
+    // records returned by LoadMFTRecordCache point into the view, they become invalid here
+    if (FView != nullptr) UnmapViewOfFile(FView);
+    FView = nullptr;
+    FViewSize = 0;
+    FHeader = nullptr;
+    FStored = nullptr;
+    FBlocks = nullptr;
+
+    FSourceContainer.Close();
+    if (FHSource != INVALID_HANDLE_VALUE) CloseHandle(FHSource);
+    FHSource = INVALID_HANDLE_VALUE;
+
+    if (FDecompressor != nullptr) CloseDecompressor(FDecompressor);
+    FDecompressor = nullptr;
+
+    FBlockCache.Clear();
+    delete[] FBlockBuf;
+    FBlockBuf = nullptr;
+    FMFTDataRuns.Clear();
+    FMFTExtents.Clear();
+    FPartitionOffset = 0;
+
+    SetOpened(false);
+}
+
+expected_uintptr TSnapshotRecordsLoader::GetBlock(uint32_t blockIndex)
+{
+    const SNAPSHOT_BLOCK& block = FBlocks[blockIndex];
+    if (block.Size == block.RawSize) return FView + block.Offset; // stored as is
+
+    uint8_t* data = FBlockCache.GetRec(blockIndex);
+    if (data != nullptr) return data;
+
+    SIZE_T decompressedSize = 0;
+    if (!Decompress(FDecompressor, FView + block.Offset, block.Size, FBlockBuf, block.RawSize, &decompressedSize) || (decompressedSize != block.RawSize))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("[TSnapshotRecordsLoader] Block {} cannot be decompressed, error: {}", blockIndex, GetLastError());
+        return std::unexpected(TErrorCode::CorruptedData);
+    }
+
+    return FBlockCache.AddRec(blockIndex, FBlockBuf);
+}
+
+expected_uintptr TSnapshotRecordsLoader::GetRecord(MFTRecIndex mftRecID)
+{
+    assert(IsOpened());
+
+    // check that MFT Rec ID is less than MFT table size
+    if (mftRecID >= FRecordsCount)
+        return std::unexpected(TErrorCode::WrongMFTRecID);
+
+    uint32_t blockIndex = mftRecID / SNAPSHOT_RECS_PER_BLOCK;
+    uint64_t bit = 1ull << (mftRecID % SNAPSHOT_RECS_PER_BLOCK);
+    uint64_t stored = FStored[blockIndex];
+    if ((stored & bit) == 0) return std::unexpected(TErrorCode::MFTRecordNotInUse); // record was free or had no 'FILE' signature
+
+    auto block = GetBlock(blockIndex);
+    if (!block) return block;
+
+    // records of the block are stored one after another, position of the record is number of stored records before it
+    uint32_t pos = std::popcount(stored & (bit - 1));
+    return block.value() + (uint64_t)pos * FVolumeData.BytesPerMFTRec;
+}
+
+TErrorCode TSnapshotRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    UNREFERENCED_PARAMETER(internalCall);
+
+    auto rec = GetRecord(mftRecRef.sId.low);
+    if (!rec) return rec.error();
+
+    memcpy(mftRecData, rec.value(), FVolumeData.BytesPerMFTRec);
+    return TErrorCode::Success;
+}
+
+expected_uintptr TSnapshotRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    // decompressed blocks may be evicted from FBlockCache, records of them go through FMFTRecCache
+    if (IsCompressed()) return IRecordsLoader::InternalLoadMFTRecordCache(mftRecRef);
+
+    return GetRecord(mftRecRef.sId.low);
+}
+
+TErrorCode TSnapshotRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    assert(IsOpened());
+
+    if (FHSource == INVALID_HANDLE_VALUE) return TErrorCode::IOError;
+
+    if (FSourceContainer.IsOpened())
+        return FSourceContainer.Read(FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster, dataBuf, lcnCnt * FVolumeData.BytesPerCluster);
+
+    LARGE_INTEGER offset{ 0 };
+    offset.QuadPart = FPartitionOffset + lcnStart * FVolumeData.BytesPerCluster;
+
+    if (!SetFilePointerEx(FHSource, offset, nullptr, FILE_BEGIN))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("ReadClusters.SetFilePointerEx() has failed with error: {}", GetLastError());
+        return TErrorCode::IOError;
+    }
+
+    DWORD bytesToRead = (DWORD)(lcnCnt * FVolumeData.BytesPerCluster);
+    DWORD bytesRead = 0;
+    if (!ReadFile(FHSource, dataBuf, bytesToRead, &bytesRead, nullptr) || (bytesRead != bytesToRead))
+    {
+        GET_LOGGER;
+        logger.ErrorFmt("ReadClusters.ReadFile() has failed with error: {}", GetLastError());
+        return TErrorCode::IOError;
+    }
+
+    return TErrorCode::Success;
+}
+
+TErrorCode TSnapshotRecordsLoader::ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize)
+{
+    UNREFERENCED_PARAMETER(chunkSize);
+    assert(IsOpened());
+
+    uint32_t recSize = FVolumeData.BytesPerMFTRec;
+    uint8_t* blockBuf = IsCompressed() ? DBG_NEW uint8_t[SNAPSHOT_RECS_PER_BLOCK * recSize] : nullptr;
+    TErrorCode res = TErrorCode::Success;
+
+    // blocks are decompressed into our own buffer, scan does not evict blocks needed by random lookups from FBlockCache
+    for (uint32_t i = 0; (i < FHeader->BlocksCount) && (res == TErrorCode::Success); i++)
+    {
+        const SNAPSHOT_BLOCK& block = FBlocks[i];
+        if (block.RawSize == 0) continue;
+
+        uint8_t* recs = FView + block.Offset;
+        auto start = TLoaderStats::Now();
+
+        if (block.Size < block.RawSize)
+        {
+            SIZE_T decompressedSize = 0;
+            if (!Decompress(FDecompressor, recs, block.Size, blockBuf, block.RawSize, &decompressedSize) || (decompressedSize != block.RawSize))
+            {
+                GET_LOGGER;
+                logger.ErrorFmt("[TSnapshotRecordsLoader] Block {} cannot be decompressed, error: {}", i, GetLastError());
+                res = TErrorCode::CorruptedData;
+                break;
+            }
+            recs = blockBuf;
+        }
+
+        FStats.AddRead(-1, block.Size, TLoaderStats::NanosecsSince(start));
+
+        uint64_t stored = FStored[i];
+        for (uint32_t pos = 0; stored != 0; stored &= stored - 1, pos++)
+        {
+            MFTRecIndex mftRecID = i * SNAPSHOT_RECS_PER_BLOCK + std::countr_zero(stored);
+            res = pred((MFT_FILE_RECORD*)(recs + (uint64_t)pos * recSize), mftRecID);
+            if (res != TErrorCode::Success) break;
+        }
+    }
+
+    delete[] blockBuf;
+    return res;
+}
@@ -9,6 +9,7 @@ void TWinAPICacheRecordsLoader::Open(const string_t& vol)
     ReadAllMftRecords();
 
     TMFTBaseReader parser(*this);
+    ReadMFTBitmap(parser); // on error bitmap is empty, nothing is skipped
     auto expct = ReadMetaFilesCount(parser); // need to be places after ReadAllMftRecords
     assert(expct);
     FMetaFilesCount = expct.value();
@@ -56,22 +57,37 @@ void TWinAPICacheRecordsLoader::Open(const string_t& vol)
 
 }
 
+void TWinAPICacheRecordsLoader::Close()
+{
+    TWinAPIRecordsLoader::Close();
+    FSlab.Clear();
+}
+
 TErrorCode TWinAPICacheRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
 {
     UNREFERENCED_PARAMETER(internalCall);
 
     if(!IsOpened()) return TErrorCode::IOError;
-    assert(mftRecRef.sId.low < FRecordsCount);
+    if (mftRecRef.sId.low >= FRecordsCount) return TErrorCode::WrongMFTRecID;
 
-    if (FBitmap.Test(mftRecRef.sId.low))
-    {
-        //TODO mft rec copying happens here, think how to avoid that
-        FRecs.Get(mftRecRef.sId.low, mftRecData);
-        return TErrorCode::Success;
-    }
-    else
+    uint8_t* rec = FSlab.GetRec(mftRecRef.sId.low);
+    if (rec == nullptr)
         return TErrorCode::MFTRecordNotInUse; // Not In USe because mftRecRef.sId.low < FRecordsCount
-    
+
+    //TODO mft rec copying happens here, use LoadMFTRecordCache to avoid that
+    memcpy(mftRecData, rec, FVolumeData.BytesPerMFTRec);
+    return TErrorCode::Success;
+}
+
+expected_uintptr TWinAPICacheRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    if (!IsOpened()) return std::unexpected(TErrorCode::IOError);
+    if (mftRecRef.sId.low >= FRecordsCount) return std::unexpected(TErrorCode::WrongMFTRecID);
+
+    uint8_t* rec = FSlab.GetRec(mftRecRef.sId.low);
+    if (rec == nullptr) return std::unexpected(TErrorCode::MFTRecordNotInUse);
+
+    return rec;
 }
 
 TErrorCode TWinAPICacheRecordsLoader::ReadAllMftRecords()
@@ -83,11 +99,7 @@ TErrorCode TWinAPICacheRecordsLoader::ReadAllMftRecords()
 
     // calculate number of MFT records
     inputBuf.FileReferenceNumber.QuadPart = FVolumeData.MftValidDataLength.QuadPart / FVolumeData.BytesPerMFTRec;
-    FBitmap.SetData(((inputBuf.FileReferenceNumber.QuadPart - 1) >> TBitField::DWORD_2POWER) + 1, false);
-
-    FRecs.Clear();
-    FRecs.SetItemSize(FVolumeData.BytesPerMFTRec);
-    FRecs.SetCount(inputBuf.FileReferenceNumber.LowPart);
+    FSlab.Init(FVolumeData.BytesPerMFTRec, inputBuf.FileReferenceNumber.QuadPart);
 
     inputBuf.FileReferenceNumber.QuadPart--; // last MFT record index
 
@@ -113,8 +125,7 @@ TErrorCode TWinAPICacheRecordsLoader::ReadAllMftRecords()
         if (ntfs_is_file_recp(mftRecord->RecHeader.Signature))
         {
             //add to cache only if signature is valid
-            FRecs.Update(mftRecord->IndexMFTRec, mftRecData);
-            FBitmap.SetTrue(mftRecord->IndexMFTRec);
+            FSlab.AddRec(mftRecord->IndexMFTRec, mftRecData);
         }
         else
         {
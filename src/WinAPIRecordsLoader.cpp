@@ -1,5 +1,6 @@
 
 #include "Readers.h"
+#include "AttrRange.h"
 #include "Utils.h"
 
 // make volume look like \\.\C:
@@ -51,70 +52,124 @@ bool IRecordsLoader::IsPath(const string_t& str)
     return true;
 }
 
-// FixupUSA1 makes USA fixes in buffer refered by record param.
-// This function is going to be used for processing ALLOC attr Index Blocks or MFT records (only when they read directly from disk, not via WINAPI). 
-// When MFT records loadded via WINAPI call they already have USA fixed up.
-// BytesPerBlock value is usually defined in ATTR_ROOT attr (field IndexBlockSize) and it may differ from filesystem's ClusterSize.
-// For MFT records BytesPerBlock is standard MFT record size (BytesPerMFTRec)
-// record buffer should be at least BytesPerBlock size
-TErrorCode  IRecordsLoader::FixupUSA1(NTFS_RECORD_HEADER* record, uint32_t BytesPerBlock, uint32_t BytesPerSector)
+expected_uintptr IRecordsLoader::InternalLoadMFTRecordCache(MFT_REF mftRecRef) // returns NULL if error occurred during loading MFT record
 {
-    UNREFERENCED_PARAMETER(BytesPerBlock);
+    assert(IsOpened());
+
+    if (!FMFTRecCache.Enabled()) // records cache is disabled, record is kept in loader buffer till the next call
+    {
+        FUncachedRec.SetCount(FVolumeData.BytesPerMFTRec);
+        TErrorCode res = LoadMFTRecord(mftRecRef, FUncachedRec.GetValuePointer(0));
+        if (res != TErrorCode::Success) return std::unexpected(res);
+        return FUncachedRec.GetValuePointer(0);
+    }
+
+    assert(FMFTRecCache.RecordSize() == FVolumeData.BytesPerMFTRec); // sized by InitCaches at Open
+
+    //we use mftRecRef.sId.low here because high part of mftRecRef.Id may change when MFT record is modified
+    uint8_t* result = FMFTRecCache.GetRec(mftRecRef.sId.low);
+
+    if (result == nullptr) // no value in cache, load MFT record from disk
+    {
+        uint8_t* mftRecBuf = (uint8_t*)alloca(FVolumeData.BytesPerMFTRec);
+        TErrorCode res = LoadMFTRecord(mftRecRef, mftRecBuf);
+        if (res != TErrorCode::Success)
+            return std::unexpected(res); // error loading MFT record
 
-    uint32_t wordsPerSector = BytesPerSector >> 1;
+        return FMFTRecCache.AddRec(mftRecRef.sId.low, mftRecBuf); // update cache
+    }
 
-    uint16_t sectorsCnt = record->FixupCnt - 1;
-    assert(sectorsCnt == BytesPerBlock / BytesPerSector);
+    GET_LOGGER;
+    logger.Info("[LoadMFTRecordCache] Record is loaded from cache!");
 
-    uint16_t* fixupArr = (uint16_t*)(Add2Ptr(record, record->FixupOffset));
-    uint16_t checkValue = *fixupArr;
-    fixupArr++; // now it refers to first array item
+    return result; // return MFT record from cache
+}
 
-    uint16_t* sectorEnd = (uint16_t*)(record)+wordsPerSector - 1;
+// sets memory limit for records cache used by LoadMFTRecordCache, clears the cache
+void IRecordsLoader::SetRecCacheBudget(uint64_t budget)
+{
+    FMFTRecCache.Init(FVolumeData.BytesPerMFTRec > 0 ? FVolumeData.BytesPerMFTRec : DEFAULT_BYTES_PER_MFT_REC, budget);
+}
 
-    uint32_t s = 0;
-    while (s < sectorsCnt)
+void IRecordsLoader::SetClusterCacheBudget(uint64_t budget)
+{
+    FClusterCache.Init(FVolumeData.BytesPerCluster > 0 ? FVolumeData.BytesPerCluster : DEFAULT_BYTES_PER_CLUSTER, budget);
+}
+
+// budgets set before Open are kept, caches get record and cluster sizes of the opened volume
+void IRecordsLoader::InitCaches()
+{
+    SetRecCacheBudget(FMFTRecCache.Budget());
+    SetClusterCacheBudget(FClusterCache.Budget());
+}
+
+/**
+* @brief Reads series of sequential clusters through clusters cache
+* @details Clusters found in the cache are copied from there, each contiguous range of missing clusters is read by one 
+* InternalReadClusters call and put into the cache. Repeated reads of the same INDX blocks (directory lookups by path, 
+* PathByMFTRecID) do not go to disk. Raw data is cached, USA fixups are applied by caller to its own copy.
+* @param lcnStart number (id) of first cluster to be read
+* @param lcnCnt Count of sequential clusters to be read
+* @param dataBuf Buffer where all clusters will be read. Should be at least size lcnCnt*VolumeClusterSize
+**/
+TErrorCode IRecordsLoader::ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    uint32_t clusterSize = FVolumeData.BytesPerCluster;
+    TCallTimer timer(FStats, TIOCall::ReadClusters, lcnCnt * clusterSize);
+
+    if (!FClusterCache.Enabled() || (clusterSize == 0))
+        return DeviceReadClusters(lcnStart, lcnCnt, dataBuf);
+
+    assert(FClusterCache.RecordSize() == clusterSize); // sized by InitCaches at Open
+
+    // large reads would evict the whole cache
+    if (lcnCnt > FClusterCache.Capacity() / 4)
+        return DeviceReadClusters(lcnStart, lcnCnt, dataBuf);
+
+    uint64_t i = 0;
+    while (i < lcnCnt)
     {
-        assert(checkValue == *sectorEnd);
-        if (checkValue != *sectorEnd)
+        if (FClusterCache.CopyRec(lcnStart + i, dataBuf + i * clusterSize))
         {
-            GET_LOGGER;
-            logger.Error("[FixupUSA1] Error: looks like data is corrupted in the sector");
-            return TErrorCode::CorruptedData; // looks like data is corrupted in this sector
+            i++;
+            continue;
         }
 
-        *sectorEnd = fixupArr[s]; // restore data
+        uint64_t missEnd = i + 1;
+        while ((missEnd < lcnCnt) && !FClusterCache.Contains(lcnStart + missEnd)) missEnd++;
 
-        sectorEnd += wordsPerSector;
-        s++;
+        CH_ERR(DeviceReadClusters(lcnStart + i, missEnd - i, dataBuf + i * clusterSize)); // InternalReadClusters writes error message to log file
+
+        CacheClusters(lcnStart + i, missEnd - i, dataBuf + i * clusterSize);
+        i = missEnd;
     }
 
     return TErrorCode::Success;
 }
 
-expected_uintptr IRecordsLoader::LoadMFTRecordCache(MFT_REF mftRecRef) // returns NULL if error occurred during loading MFT record
+// true when all clusters of the range are in FClusterCache, LRU order and counters are not changed
+bool IRecordsLoader::ClustersCached(uint64_t lcnStart, uint64_t lcnCnt)
 {
-    assert(IsOpened());
+    if (!FClusterCache.Enabled() || (FClusterCache.RecordSize() != FVolumeData.BytesPerCluster)) return false;
 
-    uint8_t** result = FMFTRecCache.GetValuePointer(mftRecRef.sId.low);
+    for (uint64_t i = 0; i < lcnCnt; i++)
+        if (!FClusterCache.Contains(lcnStart + i)) return false;
 
-    if (result == nullptr) // no value in cache, load MFT record from disk
-    {
-        uint8_t* mftRecBuf = DBG_NEW uint8_t[FVolumeData.BytesPerMFTRec];
-        TErrorCode res = LoadMFTRecord(mftRecRef, mftRecBuf);
-        if (res != TErrorCode::Success)
-            return std::unexpected(res); // error loading MFT record
+    return true;
+}
 
-        //we use mftRecRef.sId.low here because high part of mftRecRef.Id may change when MFT record is modified
-        FMFTRecCache.SetValue(mftRecRef.sId.low, mftRecBuf); // update cache
+// puts clusters into FClusterCache. used by ReadClusters and by loaders that read clusters bypassing it (asynchronous reads)
+void IRecordsLoader::CacheClusters(uint64_t lcnStart, uint64_t lcnCnt, const uint8_t* dataBuf)
+{
+    uint32_t clusterSize = FVolumeData.BytesPerCluster;
+    if (!FClusterCache.Enabled() || (clusterSize == 0)) return;
 
-        return mftRecBuf;
-    }
+    assert(FClusterCache.RecordSize() == clusterSize); // sized by InitCaches at Open
 
-    GET_LOGGER;
-    logger.Info("[LoadMFTRecordCache] Record is loaded from cache!");
+    if (lcnCnt > FClusterCache.Capacity() / 4) return;
 
-    return *result; // return MFT record from cache
+    for (uint64_t i = 0; i < lcnCnt; i++)
+        FClusterCache.AddRec(lcnStart + i, dataBuf + i * clusterSize);
 }
 
 void IRecordsLoader::Close()
@@ -124,6 +179,8 @@ void IRecordsLoader::Close()
     GET_LOGGER;
     logger.DebugFmt("Closing volume: {}", wtos(FVolumeData.Name));
 
+    StopIOTrace();
+
     // clears data about volume, clears caches
 
     //CloseHandle(FVolumeData.hVolume);
@@ -132,23 +189,85 @@ void IRecordsLoader::Close()
     //FVolumeData.hVolume = INVALID_HANDLE_VALUE;
     FVolumeData.Name.clear();
     FMFTRecCache.Clear();
+    FClusterCache.Clear();
+    FMFTBitmap.SetData(0u, false);
     FRecordsCount = 0;
     FMetaFilesCount = 0;
 }
 
+// reads $BITMAP attribute of $MFT (MFT record #0) into FMFTBitmap. 
+// when bitmap cannot be read FMFTBitmap stays empty and all MFT records are considered allocated.
+TErrorCode IRecordsLoader::ReadMFTBitmap(TMFTBaseReader& parser)
+{
+    if (!IsOpened()) return TErrorCode::IOError;
+
+    GET_LOGGER;
+    FMFTBitmap.SetData(0u, false);
+
+    uint8_t* mftRecBuf = (uint8_t*)alloca(FVolumeData.BytesPerMFTRec);
+    MFT_REF mftRef{ 0 };
+    CH_ERR(DeviceLoadMFTRecord(mftRef, mftRecBuf, true));
+
+    TAttrCollection coll;
+    CH_ERR(parser.FillAttrCollection((MFT_FILE_RECORD*)mftRecBuf, MakeAttrBitmask(ATTR_BITMAP), coll));
+
+    auto& abmp = coll.Get(ATTR_BITMAP);
+    if (abmp.Count() == 0)
+    {
+        logger.Warn("[ReadMFTBitmap] $MFT does not have BITMAP attribute, all MFT records are considered allocated.");
+        return TErrorCode::NotFound;
+    }
+
+    TErrorCode res = parser.ParseBitmap(abmp[0], FMFTBitmap);
+    if (res != TErrorCode::Success)
+    {
+        logger.Warn("[ReadMFTBitmap] Error reading $MFT BITMAP attribute, all MFT records are considered allocated.");
+        FMFTBitmap.SetData(0u, false);
+        return res;
+    }
+
+    logger.DebugFmt("[ReadMFTBitmap] $MFT BITMAP covers {} MFT records, MFT records count: {}", FMFTBitmap.BitsCount(), FRecordsCount);
+
+    return TErrorCode::Success;
+}
+
+MFTRecIndex IRecordsLoader::NextAllocatedRecord(MFTRecIndex mftRecID) const
+{
+    if (mftRecID >= FMFTBitmap.BitsCount()) return mftRecID;
+
+    int64_t next = FMFTBitmap.NextSetBit(mftRecID);
+    if (next == -1) next = (int64_t)FMFTBitmap.BitsCount(); // records beyond the bitmap are considered allocated
+
+    return (MFTRecIndex)std::min<uint64_t>((uint64_t)next, FRecordsCount);
+}
+
+MFTRecIndex IRecordsLoader::NextFreeRecord(MFTRecIndex mftRecID) const
+{
+    if (mftRecID >= FMFTBitmap.BitsCount()) return (MFTRecIndex)std::max<uint64_t>(mftRecID, FRecordsCount);
+
+    int64_t next = FMFTBitmap.NextClearBit(mftRecID);
+    if (next >= (int64_t)FMFTBitmap.BitsCount()) return (MFTRecIndex)std::max<uint64_t>(mftRecID, FRecordsCount); // records beyond the bitmap are considered allocated
+
+    return (MFTRecIndex)std::min<uint64_t>((uint64_t)next, FRecordsCount);
+}
+
 expected_uint32 IRecordsLoader::ReadMetaFilesCount(TMFTBaseReader& parser)
 {
     if (!IsOpened()) return std::unexpected(TErrorCode::IOError);
     assert(FRecordsCount > 0);
 
-    uint8_t* mftRecBuf = (uint8_t*)alloca(DEFAULT_BYTES_PER_MFT_REC);
+    uint8_t* mftRecBuf = (uint8_t*)alloca(FVolumeData.BytesPerMFTRec);
     MFT_FILE_RECORD* mftRec = (MFT_FILE_RECORD*)mftRecBuf;
     MFT_REF mftRef{ 0 };
     TErrorCode res;
 
     while (mftRef.sId.low < FRecordsCount)
     {
-        res = InternalLoadMFTRecord(mftRef, mftRecBuf, true); // function checks signature (should be 'FILE'), returns NotInUse error when signature <>'FILE'
+        // free records are bypassed without loading them
+        mftRef.sId.low = NextAllocatedRecord(mftRef.sId.low);
+        if (mftRef.sId.low >= FRecordsCount) break;
+
+        res = DeviceLoadMFTRecord(mftRef, mftRecBuf, true); // function checks signature (should be 'FILE'), returns NotInUse error when signature <>'FILE'
         if ((res == TErrorCode::MFTRecordNotInUse) || (mftRec->Flags & MFT_FLAG_IN_USE) == 0)
         {
             // MFT record does not contain 'FILE' signature (consider it as NotInUse)
@@ -163,22 +282,16 @@ expected_uint32 IRecordsLoader::ReadMetaFilesCount(TMFTBaseReader& parser)
         }
         else
         {
-            TAttrCollection coll;
-            res = parser.FillAttrCollection(mftRec, MakeAttrBitmask(ATTR_FILENAME), coll); // MFTRecordNotInUse is valid return value
-            assert(res == TErrorCode::Success);
-
-            auto& afn = coll.Get(ATTR_FILENAME);
+            // only the first name is needed, the rest of the record is not walked
+            TAttrRange<MakeAttrBitmask(ATTR_FILENAME)> fileNames(parser, mftRec);
+            auto attr = fileNames.First();
+            assert(fileNames.Result() == TErrorCode::Success);
 
             ATTR_FILE_NAME* fn{ nullptr };
             // sometimes there are 'system' MFT records without ATTR_FILENAME attribute (ids #12-#15)
-            if (afn.Count() > 0)
-            {
-                // some disk images contain system files like $TxfLogContainer0000000000000000001 which have two names (DOS and WIN), both names start from '$'
-                //ASSERT_EQ(1ul, afn.Count());
-                auto attr = afn[0];
-                assert(nullptr != attr);
+            // some disk images contain system files like $TxfLogContainer0000000000000000001 which have two names (DOS and WIN), both names start from '$'
+            if (attr != nullptr)
                 fn = (ATTR_FILE_NAME*)Add2Ptr(attr, attr->res.DataOffset);
-            }
 
             if ((fn != nullptr) && (fn->FileNameLen > 0) && (GetFName(fn)[0] != L'$'))
                 if ((fn->FileNameLen > 1) || GetFName(fn)[0] != L'.')
@@ -193,7 +306,163 @@ expected_uint32 IRecordsLoader::ReadMetaFilesCount(TMFTBaseReader& parser)
 
 TErrorCode IRecordsLoader::LoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData)
 {
-    return InternalLoadMFTRecord(mftRecRef, mftRecData, false);
+    // read must be recorded into I/O trace even when statistics are off, DeviceLoadMFTRecord returns early when both are off
+    if (!FStats.Enabled()) return DeviceLoadMFTRecord(mftRecRef, mftRecData, false);
+
+    auto start = TLoaderStats::Now();
+    TErrorCode res = DeviceLoadMFTRecord(mftRecRef, mftRecData, false);
+    FStats.AddCall(TIOCall::LoadMFTRecord, (res == TErrorCode::Success) ? FVolumeData.BytesPerMFTRec : 0, TLoaderStats::NanosecsSince(start));
+
+    return res;
+}
+
+expected_uintptr IRecordsLoader::LoadMFTRecordCache(MFT_REF mftRecRef)
+{
+    if (!FStats.Enabled()) return InternalLoadMFTRecordCache(mftRecRef);
+
+    auto start = TLoaderStats::Now();
+    auto result = InternalLoadMFTRecordCache(mftRecRef);
+    FStats.AddCall(TIOCall::LoadMFTRecordCache, result ? FVolumeData.BytesPerMFTRec : 0, TLoaderStats::NanosecsSince(start));
+
+    return result;
+}
+
+// one MFT record is one read, its offset on disk is taken from MFTRecVolumeOffset. reads are recorded into I/O trace before they are made
+TErrorCode IRecordsLoader::DeviceLoadMFTRecord(MFT_REF mftRecRef, uint8_t* mftRecData, bool internalCall)
+{
+    if (!FStats.Enabled() && (FIOTrace == nullptr)) return InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+
+    int64_t offset = (mftRecRef.sId.low < FRecordsCount) ? MFTRecVolumeOffset(mftRecRef.sId.low) : -1;
+    TraceRead((offset < 0) ? IO_TRACE_NO_OFFSET : (uint64_t)offset, FVolumeData.BytesPerMFTRec, TIOTag::MFTRecord);
+
+    if (!FStats.Enabled()) return InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+
+    auto start = TLoaderStats::Now();
+    TErrorCode res = InternalLoadMFTRecord(mftRecRef, mftRecData, internalCall);
+    FStats.AddRead(offset, FVolumeData.BytesPerMFTRec, TLoaderStats::NanosecsSince(start));
+
+    return res;
+}
+
+TErrorCode IRecordsLoader::DeviceReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+{
+    TraceRead(lcnStart * FVolumeData.BytesPerCluster, lcnCnt * FVolumeData.BytesPerCluster, FIOTag);
+
+    if (!FStats.Enabled()) return InternalReadClusters(lcnStart, lcnCnt, dataBuf);
+
+    auto start = TLoaderStats::Now();
+    TErrorCode res = InternalReadClusters(lcnStart, lcnCnt, dataBuf);
+    FStats.AddRead(lcnStart * FVolumeData.BytesPerCluster, lcnCnt * FVolumeData.BytesPerCluster, TLoaderStats::NanosecsSince(start));
+
+    return res;
+}
+
+void IRecordsLoader::StartIOTrace(const string_t& traceFileName)
+{
+    assert(IsOpened());
+
+    StopIOTrace();
+
+    IO_TRACE_HEADER header;
+    header.BytesPerCluster = FVolumeData.BytesPerCluster;
+    header.BytesPerMFTRec = FVolumeData.BytesPerMFTRec;
+    header.VolumeSize = (uint64_t)FVolumeData.TotalClusters.QuadPart * FVolumeData.BytesPerCluster;
+
+    FIOTrace = DBG_NEW TIOTraceWriter(traceFileName, header); // throws when file cannot be created
+}
+
+uint64_t IRecordsLoader::StopIOTrace()
+{
+    if (FIOTrace == nullptr) return 0;
+
+    uint64_t count = FIOTrace->Count();
+    delete FIOTrace; // writes remaining records
+    FIOTrace = nullptr;
+
+    return count;
+}
+
+LOADER_IO_STATS IRecordsLoader::GetIOStats()
+{
+    LOADER_IO_STATS stats;
+    FStats.Snapshot(stats);
+
+    stats.RecCacheHits = FMFTRecCache.Hits();
+    stats.RecCacheMisses = FMFTRecCache.Misses();
+    stats.ClusterCacheHits = FClusterCache.Hits();
+    stats.ClusterCacheMisses = FClusterCache.Misses();
+
+    return stats;
+}
+
+// generic implementation, loads MFT records one by one in requested order
+TErrorCode IRecordsLoader::LoadMFTRecords(std::span<const MFT_REF> mftRecRefs, LoadMFTRecordsPred pred)
+{
+    assert(IsOpened());
+
+    uint8_t* mftRecBuf = (uint8_t*)alloca(FVolumeData.BytesPerMFTRec);
+
+    for (uint32_t i = 0; i < mftRecRefs.size(); i++)
+    {
+        // records marked as free in $MFT bitmap are not loaded
+        bool load = (mftRecRefs[i].sId.low >= FRecordsCount) || IsRecordAllocated(mftRecRefs[i].sId.low);
+        TErrorCode res = load ? LoadMFTRecord(mftRecRefs[i], mftRecBuf) : TErrorCode::MFTRecordNotInUse;
+        res = pred(i, mftRecRefs[i], (res == TErrorCode::Success) ? mftRecBuf : nullptr, res);
+        if (res != TErrorCode::Success) return res;
+    }
+
+    return TErrorCode::Success;
+}
+
+// generic implementation, reads runs synchronously one by one in requested order
+TErrorCode IRecordsLoader::ReadClustersAsync(std::span<const DATA_RUN_ITEM> runs, ReadClustersPred pred, bool useCache)
+{
+    assert(IsOpened());
+
+    uint8_t* dataBuf = nullptr;
+    uint64_t dataBufSize = 0;
+    TErrorCode result = TErrorCode::Success;
+
+    for (uint32_t i = 0; i < runs.size(); i++)
+    {
+        uint64_t runBufSize = runs[i].len * FVolumeData.BytesPerCluster;
+        if (runBufSize > dataBufSize)
+        {
+            delete[] dataBuf;
+            dataBufSize = runBufSize;
+            dataBuf = DBG_NEW uint8_t[dataBufSize];
+        }
+
+        TErrorCode res = useCache ? ReadClusters(runs[i].lcn, runs[i].len, dataBuf) : DeviceReadClusters(runs[i].lcn, runs[i].len, dataBuf); // ReadClusters writes error message to log file
+        result = pred(i, (res == TErrorCode::Success) ? dataBuf : nullptr, res);
+        if (result != TErrorCode::Success) break;
+    }
+
+    delete[] dataBuf;
+
+    return result;
+}
+
+// generic implementation, loads MFT records one by one
+TErrorCode IRecordsLoader::ScanMFTRecords(ScanMFTRecordsPred pred, uint32_t chunkSize)
+{
+    UNREFERENCED_PARAMETER(chunkSize);
+    assert(IsOpened());
+
+    uint8_t* mftRecBuf = (uint8_t*)alloca(FVolumeData.BytesPerMFTRec);
+    MFT_REF mftRef{ 0 };
+
+    for (mftRef.sId.low = NextAllocatedRecord(0); mftRef.sId.low < FRecordsCount; mftRef.sId.low = NextAllocatedRecord(mftRef.sId.low + 1))
+    {
+        TErrorCode res = DeviceLoadMFTRecord(mftRef, mftRecBuf, true);
+        if (res == TErrorCode::MFTRecordNotInUse) continue; // no 'FILE' signature
+        if (res != TErrorCode::Success) return res;
+
+        res = pred((MFT_FILE_RECORD*)mftRecBuf, mftRef.sId.low);
+        if (res != TErrorCode::Success) return res;
+    }
+
+    return TErrorCode::Success;
 }
 
 
@@ -229,10 +498,22 @@ void TWinAPIRecordsLoader::InternalOpen(const string_t& vol)
         DWORD err = GetLastError();
         std::string errMsg = GetErrorMessageTextA(err, "DeviceIoControl");
         //logger.Error(errMsg);
+        CloseHandle(hVolume);
         throw std::system_error(std::error_code(err, std::system_category()), errMsg);
     }
 
-    assert(FVolumeData.BytesPerMFTRec == DEFAULT_BYTES_PER_MFT_REC); // always 1024 ??
+    // records come fixed up from FSCTL_GET_NTFS_FILE_RECORD, this checks record and sector sizes of the volume.
+    // called before hVolume is stored into FVolumeData, so the handle is closed here when sizes are not supported
+    try
+    {
+        SelectRecordKernels();
+    }
+    catch (...)
+    {
+        CloseHandle(hVolume);
+        throw;
+    }
+    InitCaches();
 
     FVolumeData.hVolume = hVolume;
     FVolumeData.Name = convert_string<wchar_t>(vol2.substr(4)); // remove \\.\ from \\.\C:
@@ -247,6 +528,7 @@ void TWinAPIRecordsLoader::Open(const string_t& vol)
     InternalOpen(vol);
 
     TMFTBaseReader parser(*this);
+    ReadMFTBitmap(parser); // on error bitmap is empty, nothing is skipped
     auto expct =  ReadMetaFilesCount(parser);
     assert(expct);
     FMetaFilesCount = expct.value();
@@ -334,7 +616,7 @@ TErrorCode TWinAPIRecordsLoader::InternalLoadMFTRecord(MFT_REF mftRecRef, uint8_
 * @param lcnCnt Count of sequential clusters to be read
 * @param dataBuf Buffer where all clusters will be read. Should be at least size lcnCnt*VolumeClusterSize
 **/
-TErrorCode TWinAPIRecordsLoader::ReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
+TErrorCode TWinAPIRecordsLoader::InternalReadClusters(uint64_t lcnStart, uint64_t lcnCnt, uint8_t* dataBuf)
 {
     assert(IsOpened());
 